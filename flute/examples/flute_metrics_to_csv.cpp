@@ -0,0 +1,52 @@
+// libflute - FLUTE/ALC library
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#include <fstream>
+#include <iostream>
+#include <string>
+
+#include "Metric/MetricsLogReader.h"
+
+/**
+ *  Convert a binary metrics log (written with Metrics::setBinaryLogFile) to CSV.
+ *
+ *  Usage: flute_metrics_to_csv <input.metric.bin> [output.csv]
+ *  The CSV is written to stdout if no output file is given.
+ *
+ * @return 0 on success, -1 on failure
+ */
+auto main(int argc, char **argv) -> int {
+    if (argc < 2 || argc > 3) {
+        std::cerr << "Usage: " << argv[0] << " <input.metric.bin> [output.csv]" << std::endl;
+        return -1;
+    }
+
+    try {
+        size_t count = 0;
+        if (argc == 3) {
+            std::ofstream out(argv[2]);
+            if (!out.is_open()) {
+                std::cerr << "Failed to open " << argv[2] << std::endl;
+                return -1;
+            }
+            count = LibFlute::Metric::MetricsLogReader::toCsv(argv[1], out);
+        } else {
+            count = LibFlute::Metric::MetricsLogReader::toCsv(argv[1], std::cout);
+        }
+        std::cerr << "Converted " << count << " samples" << std::endl;
+    } catch (const char *errorMessage) {
+        std::cerr << "Failed to convert " << argv[1] << ": " << errorMessage << std::endl;
+        return -1;
+    }
+    return 0;
+}
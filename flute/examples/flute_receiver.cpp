@@ -35,6 +35,8 @@
 #include <fcntl.h> 
 
 #include "Metric/Metrics.h"
+#include "Metric/MetricsExporter.h"
+#include "Metric/LifecycleTracer.h"
 #include "Object/File.h"
 #include "Component/Receiver.h"
 #include "Version.h"
@@ -67,6 +69,12 @@ static struct argp_option options[] = {  // NOLINT
      "critical, 6 = none. Default: 2.",
      0},
     {"video-ids", 'v', "IDS", 0, "Comma separated list of video ids to receive", 0},
+    {"metrics-endpoint", 'x', "ENDPOINT", 0, "Serve metrics in the Prometheus format on PORT, ADDRESS:PORT or unix:PATH. Disabled if empty (default: '')", 0},
+    {"binary-metrics", 'b', nullptr, 0, "Write metrics to a binary log (convert with flute_metrics_to_csv) instead of a text log", 0},
+    {"trace", 'c', "FILE", 0, "Trace the lifecycle of every file and write it to FILE in the Chrome trace format. Disabled if empty (default: '')", 0},
+    {"repair-connections", 'n', "COUNT", 0, "Maximum number of keep-alive connections used to retrieve lost packets (default: 4)", 0},
+    {"repair-batch-window", 'w', "MS", 0, "Collect the repair requests of all files for this long and send them as one request. Disabled if 0 (default: 10)", 0},
+    {"repair-deadline-grace", 'g', "MS", 0, "Stop repairing a file this long after its deadline. Disabled if 0 (default: 2000)", 0},
     {nullptr, 0, nullptr, 0, nullptr, 0}};
 
 /**
@@ -85,6 +93,12 @@ struct ft_arguments {
     std::string video_ids;
     char **files;
     std::string directory = "./";
+    bool binary_metrics = false;
+    std::string metrics_endpoint;
+    std::string trace_file;
+    size_t repair_connections = 4;
+    unsigned repair_batch_window = 10;
+    unsigned repair_deadline_grace = 2000;
 };
 
 /**
@@ -125,6 +139,24 @@ static auto parse_opt(int key, char *arg, struct argp_state *state) -> error_t {
         case 'v':
             arguments->video_ids = std::string(arg);
             break;
+        case 'b':
+            arguments->binary_metrics = true;
+            break;
+        case 'x':
+            arguments->metrics_endpoint = std::string(arg);
+            break;
+        case 'c':
+            arguments->trace_file = std::string(arg);
+            break;
+        case 'n':
+            arguments->repair_connections = static_cast<size_t>(strtoul(arg, nullptr, 10));
+            break;
+        case 'w':
+            arguments->repair_batch_window = static_cast<unsigned>(strtoul(arg, nullptr, 10));
+            break;
+        case 'g':
+            arguments->repair_deadline_grace = static_cast<unsigned>(strtoul(arg, nullptr, 10));
+            break;
         default:
             return ARGP_ERR_UNKNOWN;
     }
@@ -189,11 +221,30 @@ auto main(int argc, char **argv) -> int {
     spdlog::info("FLUTE receiver demo starting up");
 
     LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
-    metricsInstance.setLogFile("./proxy_multicast_" + arguments.directory + ".metric.log");
+    if (arguments.binary_metrics) {
+        metricsInstance.setBinaryLogFile("./proxy_multicast_" + arguments.directory + ".metric.bin");
+    } else {
+        metricsInstance.setLogFile("./proxy_multicast_" + arguments.directory + ".metric.log");
+    }
     auto multicast_files_received_gauge = metricsInstance.getOrCreateGauge("multicast_files_received");
     auto multicast_reception_time = metricsInstance.getOrCreateGauge("multicast_reception_time");
     auto multicast_reception_time_before_deadline = metricsInstance.getOrCreateGauge("multicast_reception_time_before_deadline");
     auto multicast_reception_time_after_deadline = metricsInstance.getOrCreateGauge("multicast_reception_time_after_deadline");
+    auto multicast_files_deadline_missed = metricsInstance.getOrCreateCounter("multicast_files_deadline_missed");
+
+    std::unique_ptr<LibFlute::Metric::MetricsExporter> metricsExporter;
+    if (!arguments.metrics_endpoint.empty()) {
+        try {
+            metricsExporter = LibFlute::Metric::MetricsExporter::fromEndpoint(arguments.metrics_endpoint);
+        } catch (std::exception &ex) {
+            spdlog::error("Failed to start the metrics exporter on {}: {}", arguments.metrics_endpoint, ex.what());
+        } catch (const char* errorMessage) {
+            spdlog::error("Failed to start the metrics exporter on {}: {}", arguments.metrics_endpoint, errorMessage);
+        }
+    }
+
+    LibFlute::Metric::LifecycleTracer& tracer = LibFlute::Metric::LifecycleTracer::getInstance();
+    tracer.setEnabled(!arguments.trace_file.empty());
 
     // Define a flag to control the loop.
     // If no retreival_url is set, then the flag is true
@@ -235,6 +286,13 @@ auto main(int argc, char **argv) -> int {
             receiver.set_video_ids_ptr(video_ids);
         }
 
+        // Limit the connections used for repair requests
+        LibFlute::ConnectionPool::Options pool_options;
+        pool_options.max_connections = std::max<size_t>(arguments.repair_connections, 1);
+        receiver.set_repair_pool_options(pool_options);
+        receiver.set_repair_batch_window(std::chrono::milliseconds(arguments.repair_batch_window));
+        receiver.set_repair_deadline_grace(std::chrono::milliseconds(arguments.repair_deadline_grace));
+
         // Configure IPSEC, if enabled
         if (arguments.enable_ipsec) {
             receiver.enable_ipsec(1, arguments.aes_key);
@@ -289,6 +347,7 @@ auto main(int argc, char **argv) -> int {
                 flock(fd, LOCK_UN);
                 // This also closes the underlying file descriptor
                 fclose(file_stream);
+                tracer.record(LibFlute::Metric::LifecycleTracer::Event::FileWritten, file->tsi(), file->meta().toi, file->length());
 
                 /*
                 // Print the first 40 bytes of the file in hex
@@ -308,6 +367,9 @@ auto main(int argc, char **argv) -> int {
 
                 multicast_reception_time_before_deadline->Set(static_cast<double>(file->time_before_deadline()));
                 multicast_reception_time_after_deadline->Set(static_cast<double>(file->time_after_deadline()));
+                if (file->time_after_deadline() > 0) {
+                    multicast_files_deadline_missed->Increment();
+                }
 
             });
 
@@ -364,9 +426,14 @@ auto main(int argc, char **argv) -> int {
         removeExpiredFilesThread = std::jthread([&]() {
             // Track the CPU usage of this thread
             metricsInstance.addThread(std::this_thread::get_id(), "removeExpiredFilesThread");
+            unsigned iterations = 0;
             while (!stopFlag) {
                 // Every 1 second, we remove files of which the reception started 60 seconds ago.
                 receiver.remove_expired_files(60);
+                // Every 10 seconds, we rewrite the trace so it is available even if we get killed.
+                if (tracer.enabled() && ++iterations % 10 == 0 && !tracer.writeChromeTrace(arguments.trace_file)) {
+                    spdlog::error("Failed to write the lifecycle trace to {}", arguments.trace_file);
+                }
                 std::this_thread::sleep_for(std::chrono::seconds(1));
             }
         });
@@ -424,5 +491,9 @@ exit:
         removeExpiredFilesThread.join();
     }
 
+    if (tracer.enabled() && !tracer.writeChromeTrace(arguments.trace_file)) {
+        spdlog::error("Failed to write the lifecycle trace to {}", arguments.trace_file);
+    }
+
     return 0;
 }
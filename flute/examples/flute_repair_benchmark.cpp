@@ -0,0 +1,185 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#include <boost/asio.hpp>
+
+#include "Component/RepairServer.h"
+#include "Packet/AlcPacket.h"
+#include "Recovery/ConnectionPool.h"
+#include "Recovery/RepairRequest.h"
+#include "spdlog/spdlog.h"
+
+/**
+ *  Load test for the RepairServer. A server is started on a generated file and every client connection keeps
+ *  a window of pipelined repair requests in flight until it has sent its share. Reports the throughput and
+ *  the latency (until the response headers arrived) percentiles.
+ *
+ *  Usage: flute_repair_benchmark [connections] [requests per connection] [loss %] [file size in bytes] [workers] [zlib]
+ *  Defaults: 32 connections, 200 requests, 5 %, 4 MB, 4 workers, uncompressed responses (0)
+ *
+ * @return 0 on success, -1 on failure
+ */
+auto main(int argc, char **argv) -> int {
+    size_t connections = argc > 1 ? std::stoul(argv[1]) : 32;
+    size_t requests_per_connection = argc > 2 ? std::stoul(argv[2]) : 200;
+    unsigned loss = argc > 3 ? std::stoul(argv[3]) : 5;
+    size_t file_size = argc > 4 ? std::stoull(argv[4]) : 4 * 1024 * 1024;
+    size_t workers = argc > 5 ? std::stoul(argv[5]) : 4;
+    auto encoding = argc > 6 && std::stoul(argv[6]) ? LibFlute::RepairResponse::Encoding::BinaryZlib
+                                                    : LibFlute::RepairResponse::Encoding::Binary;
+    constexpr unsigned short mtu = 1500;
+    constexpr size_t window = 8; // Requests in flight per connection
+
+    spdlog::set_level(spdlog::level::warn);
+
+    // Content to serve
+    auto directory = std::filesystem::temp_directory_path() / ("flute_repair_benchmark_" + std::to_string(getpid()));
+    std::filesystem::create_directories(directory);
+    std::mt19937 rng(42);
+    {
+        std::string data(file_size, '\0');
+        for (auto& c : data) {
+            c = static_cast<char>(rng());
+        }
+        std::ofstream(directory / "benchmark.bin", std::ios::binary).write(data.data(), data.size());
+    }
+
+    // A set of requests with random losses, symbols are sized like the Retriever does
+    size_t max_payload = mtu - 20 - 8 - 28 - LibFlute::AlcPacket::id_fields_length(16, UINT32_MAX) - 4;
+    size_t nof_symbols = (file_size + max_payload - 1) / max_payload;
+    size_t nof_blocks = (nof_symbols + 63) / 64;
+    std::vector<std::string> requests;
+    size_t requested_symbols = 0;
+    for (unsigned i = 0; i < 64; i++) {
+        LibFlute::RepairRequest request(1, 0, "benchmark.bin");
+        request.set_encoding(encoding);
+        for (uint32_t sbn = 0; sbn < nof_blocks; sbn++) {
+            std::vector<uint32_t> esis;
+            for (uint32_t esi = 0; esi < 64 && sbn * 64 + esi < nof_symbols; esi++) {
+                if (rng() % 100 < loss) {
+                    esis.push_back(esi);
+                }
+            }
+            if (!esis.empty()) {
+                request.add_missing(sbn, std::move(esis));
+            }
+        }
+        requested_symbols += request.symbol_count();
+        requests.push_back(request.to_compact());
+    }
+
+    LibFlute::RepairServer::Options options;
+    options.address = "127.0.0.1";
+    options.port = 0;
+    options.worker_threads = workers;
+    options.storage_root = directory.string();
+    options.max_queue_length = connections * window;
+    LibFlute::RepairServer server(options);
+    try {
+        server.start();
+    } catch (const std::exception& ex) {
+        std::cerr << "Failed to start the server: " << ex.what() << std::endl;
+        return -1;
+    }
+
+    boost::asio::io_service io;
+    LibFlute::ConnectionPool::Options pool_options;
+    pool_options.max_connections = 1;
+    pool_options.pipeline_depth = window;
+
+    std::vector<std::shared_ptr<LibFlute::ConnectionPool>> pools;
+    std::vector<size_t> submitted(connections, 0);
+    std::vector<size_t> latencies;
+    latencies.reserve(connections * requests_per_connection);
+    size_t succeeded = 0;
+    size_t failed = 0;
+    size_t bytes = 0;
+    size_t completed = 0;
+    size_t total = connections * requests_per_connection;
+
+    std::function<void(size_t)> submit = [&](size_t client) {
+        if (submitted[client] == requests_per_connection) {
+            return;
+        }
+        const auto& body = requests[(client + submitted[client]) % requests.size()];
+        submitted[client]++;
+        pools[client]->submit("/", body,
+            [&](const char* /*buffer*/, size_t bytes_recvd) {
+                succeeded++;
+                bytes += bytes_recvd;
+            },
+            [&, client](std::optional<LibFlute::ConnectionPool::Completion> completion) {
+                if (!completion) {
+                    failed++;
+                } else {
+                    latencies.push_back(completion->latency_us);
+                }
+                if (++completed == total) {
+                    // Do not wait for the idle connections to be reaped
+                    io.stop();
+                    return;
+                }
+                submit(client);
+            });
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    for (size_t client = 0; client < connections; client++) {
+        pools.push_back(std::make_shared<LibFlute::ConnectionPool>(io, "127.0.0.1", std::to_string(server.port()), pool_options));
+        for (size_t i = 0; i < window; i++) {
+            submit(client);
+        }
+    }
+    io.run();
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    for (auto& pool : pools) {
+        pool->shutdown();
+    }
+    server.stop();
+    std::filesystem::remove_all(directory);
+
+    std::sort(latencies.begin(), latencies.end());
+    auto percentile = [&latencies](double p) -> size_t {
+        if (latencies.empty()) {
+            return 0;
+        }
+        return latencies[std::min(latencies.size() - 1, static_cast<size_t>(std::ceil(p * latencies.size())) - 1)];
+    };
+
+    std::cout << "file " << file_size << " bytes, " << nof_symbols << " symbols, " << loss << " % loss, "
+              << requested_symbols / requests.size() << " symbols/request" << std::endl;
+    std::cout << connections << " connections x " << requests_per_connection << " requests, window " << window
+              << ", " << workers << " workers"
+              << (encoding == LibFlute::RepairResponse::Encoding::BinaryZlib ? ", zlib" : "") << std::endl;
+    std::cout << "requests\tok\tfailed\tseconds\treq/s\tMB/s\tp50 us\tp90 us\tp99 us\tmax us" << std::endl;
+    std::cout << total << "\t" << succeeded << "\t" << total - succeeded << "\t" << elapsed << "\t"
+              << total / elapsed << "\t" << bytes / elapsed / 1e6 << "\t"
+              << percentile(0.5) << "\t" << percentile(0.9) << "\t" << percentile(0.99) << "\t"
+              << (latencies.empty() ? 0 : latencies.back()) << std::endl;
+    return failed == 0 && succeeded == total ? 0 : -1;
+}
@@ -0,0 +1,188 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#include <argp.h>
+
+#include <boost/asio.hpp>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <string>
+
+#include "Component/RepairServer.h"
+#include "Metric/Metrics.h"
+#include "Metric/MetricsExporter.h"
+#include "Version.h"
+#include "spdlog/spdlog.h"
+
+#include "public/tracy/Tracy.hpp"
+
+static void print_version(FILE *stream, struct argp_state *state);
+void (*argp_program_version_hook)(FILE *, struct argp_state *) = print_version;
+const char *argp_program_bug_address = "Austrian Broadcasting Services <obeca@ors.at>";
+static char doc[] = "FLUTE/ALC unicast repair server, answers repair requests for the files in a directory";  // NOLINT
+
+static struct argp_option options[] = {  // NOLINT
+    {"address", 'a', "IP", 0, "Address to listen on (default: 0.0.0.0)", 0},
+    {"port", 'p', "PORT", 0, "Port to listen on (default: 8080)", 0},
+    {"directory", 'd', "DIRECTORY", 0, "Directory the content locations are relative to (default: ./)", 0},
+    {"mtu", 't', "BYTES", 0, "Path MTU to size ALC packets for (default: 1500)", 0},
+    {"io-threads", 'i', "COUNT", 0, "Threads that handle the connections (default: 2)", 0},
+    {"workers", 'w', "COUNT", 0, "Threads that encode the repair responses (default: 4)", 0},
+    {"repair-cache", 'c', "MB", 0, "Memory for encoded files, 0 = disabled (default: 256)", 0},
+    {"client-rate", 'r', "REQUESTS", 0, "Repair requests per second per client address, 0 = unlimited (default: 0)", 0},
+    {"client-burst", 'b', "REQUESTS", 0, "Repair requests a client may send at once (default: 50)", 0},
+    {"queue", 'q', "COUNT", 0, "Repair requests waiting for a worker before new ones are rejected (default: 4096)", 0},
+    {"deadline", 'e', "MS", 0, "Deadline of requests without an X-Deadline header, relative to their arrival (default: 1000)", 0},
+    {"metrics-endpoint", 'x', "ENDPOINT", 0, "Serve metrics in the Prometheus format on PORT, ADDRESS:PORT or unix:PATH. Disabled if empty (default: '')", 0},
+    {"log-level", 'l', "LEVEL", 0,
+     "Log verbosity: 0 = trace, 1 = debug, 2 = info, 3 = warn, 4 = error, 5 = "
+     "critical, 6 = none. Default: 2.",
+     0},
+    {nullptr, 0, nullptr, 0, nullptr, 0}};
+
+/**
+ * Holds all options passed on the command line
+ */
+struct ft_arguments {
+    LibFlute::RepairServer::Options server;
+    uint64_t repair_cache_mb = 256;
+    std::string metrics_endpoint;
+    unsigned log_level = 2; /**< log level */
+};
+
+/**
+ * Parses the command line options into the arguments struct.
+ */
+static auto parse_opt(int key, char *arg, struct argp_state *state) -> error_t {
+    auto arguments = static_cast<struct ft_arguments *>(state->input);
+    switch (key) {
+        case 'a':
+            arguments->server.address = arg;
+            break;
+        case 'p':
+            arguments->server.port = static_cast<unsigned short>(strtoul(arg, nullptr, 10));
+            break;
+        case 'd':
+            arguments->server.storage_root = arg;
+            break;
+        case 't':
+            arguments->server.mtu = static_cast<unsigned short>(strtoul(arg, nullptr, 10));
+            break;
+        case 'i':
+            arguments->server.io_threads = static_cast<size_t>(strtoul(arg, nullptr, 10));
+            break;
+        case 'w':
+            arguments->server.worker_threads = static_cast<size_t>(strtoul(arg, nullptr, 10));
+            break;
+        case 'c':
+            arguments->repair_cache_mb = static_cast<uint64_t>(strtoull(arg, nullptr, 10));
+            break;
+        case 'r':
+            arguments->server.client_rate = strtod(arg, nullptr);
+            break;
+        case 'b':
+            arguments->server.client_burst = strtod(arg, nullptr);
+            break;
+        case 'q':
+            arguments->server.max_queue_length = static_cast<size_t>(strtoul(arg, nullptr, 10));
+            break;
+        case 'e':
+            arguments->server.default_deadline = std::chrono::milliseconds(strtoull(arg, nullptr, 10));
+            break;
+        case 'x':
+            arguments->metrics_endpoint = std::string(arg);
+            break;
+        case 'l':
+            arguments->log_level = static_cast<unsigned>(strtoul(arg, nullptr, 10));
+            break;
+        default:
+            return ARGP_ERR_UNKNOWN;
+    }
+    return 0;
+}
+
+static struct argp argp = {options, parse_opt, nullptr, doc,
+                           nullptr, nullptr, nullptr};
+
+/**
+ * Print the program version in MAJOR.MINOR.PATCH format.
+ */
+void print_version(FILE *stream, struct argp_state * /*state*/) {
+    fprintf(stream, "%s.%s.%s\n", std::to_string(VERSION_MAJOR).c_str(),
+            std::to_string(VERSION_MINOR).c_str(),
+            std::to_string(VERSION_PATCH).c_str());
+}
+
+/**
+ *  Main entry point for the program.
+ *
+ * @param argc  Command line agument count
+ * @param argv  Command line arguments
+ * @return 0 on clean exit, -1 on failure
+ */
+auto main(int argc, char **argv) -> int {
+    ZoneScopedN("main");
+    struct ft_arguments arguments;
+    arguments.server.storage_root = ".";
+
+    // Parse the arguments
+    argp_parse(&argp, argc, argv, 0, nullptr, &arguments);
+    arguments.server.cache_bytes = arguments.repair_cache_mb * 1024 * 1024;
+
+    // Set up logging
+    spdlog::set_level(
+        static_cast<spdlog::level::level_enum>(arguments.log_level));
+    spdlog::set_pattern("[%H:%M:%S.%f][thr %t][%^%l%$] %v");
+
+    LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
+    metricsInstance.setLogFile("./repair_server.metric.log");
+
+    std::unique_ptr<LibFlute::Metric::MetricsExporter> metricsExporter;
+    if (!arguments.metrics_endpoint.empty()) {
+        try {
+            metricsExporter = LibFlute::Metric::MetricsExporter::fromEndpoint(arguments.metrics_endpoint);
+        } catch (std::exception &ex) {
+            spdlog::error("Failed to start the metrics exporter on {}: {}", arguments.metrics_endpoint, ex.what());
+        } catch (const char* errorMessage) {
+            spdlog::error("Failed to start the metrics exporter on {}: {}", arguments.metrics_endpoint, errorMessage);
+        }
+    }
+
+    try {
+        LibFlute::RepairServer server(arguments.server);
+        server.start();
+
+        // Serve until we are asked to stop
+        boost::asio::io_service io;
+        boost::asio::signal_set signals(io, SIGINT, SIGTERM);
+        signals.async_wait([](const boost::system::error_code& /*error*/, int signal) {
+            spdlog::info("Received signal {}, stopping", signal);
+        });
+        io.run();
+
+        server.stop();
+    } catch (std::exception &ex) {
+        spdlog::error("Exiting on unhandled exception: {}", ex.what());
+        return -1;
+    } catch (const char* errorMessage) {
+        spdlog::error("Exiting on unhandled error: {}", errorMessage);
+        return -1;
+    } catch (...) {
+        spdlog::error("Exiting on unhandled exception");
+        return -1;
+    }
+    return 0;
+}
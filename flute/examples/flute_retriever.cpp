@@ -24,11 +24,10 @@
 #include <iostream>
 #include <libconfig.h++>
 #include <string>
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/json_parser.hpp>
 
 #include "Component/Retriever.h"
 #include "Metric/Metrics.h"
+#include "Recovery/RepairRequest.h"
 #include "Version.h"
 #include "spdlog/async.h"
 #include "spdlog/sinks/syslog_sink.h"
@@ -64,9 +63,13 @@ using libconfig::ParseException;
 
 struct Data {
     std::string file;
-    uint64_t toi;
-    unsigned fec;
+    uint64_t toi = 0;
+    unsigned fec = 0;
     std::map<uint32_t,std::vector<uint32_t>> missing;
+    std::map<uint32_t,LibFlute::RepairRequest::Needed> needed;
+    uint64_t symbols = 0;
+    LibFlute::RepairResponse::Encoding encoding = LibFlute::RepairResponse::Encoding::Legacy;
+    LibFlute::ContentEncoding content_encoding = LibFlute::ContentEncoding::NONE;
 };
 
 /**
@@ -96,42 +99,41 @@ auto split(const std::string& str, char delimiter) -> std::vector<std::string> {
 }
 
 /**
- * Proof of concept parser for converting incoming string to the required data object.
- * A proper json library or another input format would be better.
+ * Parse an incoming repair request (JSON or compact) into the required data object.
+ * The request is only parsed once, the number of symbols comes along with it.
 */
-auto convert(const std::string& json_string) -> Data {
+auto convert(const char* request_string, size_t request_length) -> Data {
     Data data;
     try {
-        std::stringstream ss;
-        ss << json_string;
-
-        boost::property_tree::ptree pt;
-        boost::property_tree::read_json(ss, pt);
-
-        data.toi = std::stoi(pt.get<std::string>("toi"));
-        data.file = pt.get<std::string>("file");
-        data.fec = std::stoi(pt.get<std::string>("fec"));
-
-        // Iterate over all the blocks.
-        boost::property_tree::ptree missing_pt = pt.get_child("missing");
-        for (boost::property_tree::ptree::iterator block = missing_pt.begin(); block != missing_pt.end(); ++block) {
-            // Iterate over all the missing symbols of the current block.
-            std::vector<uint32_t> symbols;
-            for (boost::property_tree::ptree::iterator symbol = block->second.begin(); symbol != block->second.end(); ++symbol) {
-                symbols.push_back(std::stoi(symbol->second.data()));
-            }
-            data.missing[std::stoi(block->first)] = symbols;
-        }
-
+        auto request = LibFlute::RepairRequest::parse(request_string, request_length);
+
+        data.toi = request.toi();
+        data.file = request.content_location();
+        data.fec = request.fec();
+        data.missing = request.missing();
+        data.needed = request.needed();
+        data.symbols = request.symbol_count();
+        // Clients that understand the binary framing announce it, others get the legacy framing
+        data.encoding = request.encoding();
+        data.content_encoding = request.content_encoding();
     } catch (const std::exception& e) {
-        spdlog::error("Error parsing JSON: {}", e.what());
-        spdlog::error("String was {}", json_string);
+        spdlog::error("Error parsing repair request: {}", e.what());
+        spdlog::error("String was {}", std::string(request_string, request_length));
+    } catch (const char* errorMessage) {
+        spdlog::error("Error parsing repair request: {}", errorMessage);
     }
 
     return data;
 
 }
 
+auto convert(const char* request_string) -> Data {
+    return convert(request_string, strlen(request_string));
+}
+
+// Encoded files shared by all requests, 256 MiB unless set_cache_size is called
+std::shared_ptr<LibFlute::EncodedObjectCache> object_cache = std::make_shared<LibFlute::EncodedObjectCache>(256 * 1024 * 1024);
+
 extern "C" LIB_PUBLIC void setup(
     uint16_t log_level = 2) {
     // Set up logging
@@ -145,13 +147,31 @@ extern "C" LIB_PUBLIC void setup(
     auto alc_percentage_retrieved = metricsInstance.getOrCreateGauge("alc_percentage_retrieved");
 }
 
-extern "C" LIB_PUBLIC auto retrieve(const char *json_string, uint16_t mtu, char* result) -> size_t {
+/**
+ * Set the byte budget of the cache of encoded files, 0 disables it.
+ * Must be called before the first request, it drops everything that was cached.
+*/
+extern "C" LIB_PUBLIC void set_cache_size(uint64_t max_bytes) {
+    object_cache = std::make_shared<LibFlute::EncodedObjectCache>(max_bytes);
+}
+
+/**
+ * Build the repair response for a parsed request.
+ *
+ * @returns The response body, empty if the file does not exist or on error.
+*/
+auto retrieve_data(const Data& data, uint16_t mtu) -> std::string {
 
     try {
 
-        Data data = convert(json_string);
         spdlog::info("(TOI {}) Partial request received for {}",data.toi, data.file);
 
+        // Files on disk hold the content, the symbols of an encoded transport object can not be cut from them
+        if (data.content_encoding != LibFlute::ContentEncoding::NONE) {
+            spdlog::info("(TOI {}) Refusing to repair {}, it was sent with a content encoding", data.toi, data.file);
+            return "";
+        }
+
         std::string location = data.file;
 
         // Only handle files that exists.
@@ -172,7 +192,7 @@ extern "C" LIB_PUBLIC auto retrieve(const char *json_string, uint16_t mtu, char*
 
             if (directories.size() <= 1) {
                 spdlog::info("{} does not exists", location);
-                return 0;
+                return "";
             }
 
         
@@ -180,7 +200,7 @@ extern "C" LIB_PUBLIC auto retrieve(const char *json_string, uint16_t mtu, char*
             std::string second_directory = directories[1];
             if (second_directory.find('_') == std::string::npos) {
                 spdlog::info("{} does not exists", location);
-                return 0;
+                return "";
             }
 
             std::string second_directory_before_underscore = second_directory.substr(0, second_directory.find('_'));
@@ -198,48 +218,28 @@ extern "C" LIB_PUBLIC auto retrieve(const char *json_string, uint16_t mtu, char*
             // Check if the new location exists
             if (!file_exists(location)) {
                 spdlog::info("{} does not exists", location);
-                return 0;
+                return "";
             }
         }
 
         // Construct the retriever class.
         LibFlute::Retriever retriever(16, mtu, LibFlute::FecScheme(data.fec));
 
-        // Read the file contents into the buffers.
-        std::ifstream file(location, std::ios::binary | std::ios::ate);
-        std::streamsize size = file.tellg();
-        file.seekg(0, std::ios::beg);
-
-        // Allocate memory to read the file using new
-        char* buffer = nullptr;
-        try {
-            buffer = new char[size];
-        } catch (std::bad_alloc& e) {
-            spdlog::error("Memory allocation failed for file: {} with size: {}", location, size);
-            return 0;
-        }
-        //TracyAlloc(buffer, size);
-        if (!file.read(buffer, size)) {
-            spdlog::error("Failed to read file: {}", location);
-            delete[] buffer;
-            return 0;
-        }
-
-        auto retrieved = retriever.get_alcs(data.file, // We use the original filename here
+        // Files are read and encoded once, later requests for them are served from the cache
+        retriever.set_cache(object_cache);
+        auto retrieved = retriever.get_alcs_from_storage(location,
+                        data.file, // We use the original filename here
                         "application/octet-stream",
                         retriever.seconds_since_epoch() + 60,  // 1 minute from now
-                        buffer,
-                        (size_t)size,
                         data.toi,
-                        data.missing);
-
-        // Free the buffer
-        //TracyFree(buffer);
-        // free(buffer);
-        delete[] buffer;
-
-        memcpy(result, retrieved.c_str(), retrieved.size());
-        return retrieved.size();
+                        data.missing,
+                        data.encoding,
+                        data.needed);
+        // Requests are parsed with RepairRequest::parse, which understands the compact format and symbol counts
+        LibFlute::RepairResponse::announce(retrieved, LibFlute::RepairResponse::CompactRequests
+            | LibFlute::RepairResponse::SymbolCounts | LibFlute::RepairResponse::ContentEncodings);
+
+        return retrieved;
     } catch (const std::exception &ex) {
         spdlog::error("Exiting on unhandled exception: {}", ex.what());
     } catch (const char* errorMessage) {
@@ -249,7 +249,48 @@ extern "C" LIB_PUBLIC auto retrieve(const char *json_string, uint16_t mtu, char*
         spdlog::error("Exiting on unhandled exception");
     }
 
-    return 0;
+    return "";
+}
+
+extern "C" LIB_PUBLIC auto retrieve(const char *json_string, uint16_t mtu, char* result) -> size_t {
+    auto retrieved = retrieve_data(convert(json_string), mtu);
+    memcpy(result, retrieved.c_str(), retrieved.size());
+    return retrieved.size();
+}
+
+/**
+ * Parse a request once and build its response, without a separate length estimate.
+ *
+ * @param request This string holds a JSON or compact repair request.
+ * @param mtu The MTU of the ALC packets.
+ * @param result Set to a buffer holding the response, release it with free_result.
+ * @param symbols Set to the number of requested symbols, may be null.
+ * @returns The length of the response.
+*/
+extern "C" LIB_PUBLIC auto retrieve_request(const char *request, uint16_t mtu, char** result, uint64_t* symbols) -> size_t {
+    Data data = convert(request);
+    if (symbols) {
+        *symbols = data.symbols;
+    }
+    *result = nullptr;
+    auto retrieved = retrieve_data(data, mtu);
+    if (retrieved.empty()) {
+        return 0;
+    }
+    *result = static_cast<char*>(malloc(retrieved.size()));
+    if (!*result) {
+        spdlog::error("Memory allocation failed for a response of {} bytes", retrieved.size());
+        return 0;
+    }
+    memcpy(*result, retrieved.data(), retrieved.size());
+    return retrieved.size();
+}
+
+/**
+ * Release a buffer returned by retrieve_request.
+*/
+extern "C" LIB_PUBLIC void free_result(char* result) {
+    free(result);
 }
 
 /**
@@ -259,15 +300,7 @@ extern "C" LIB_PUBLIC auto retrieve(const char *json_string, uint16_t mtu, char*
  * @returns The number of symbols.
 */
 extern "C" LIB_PUBLIC auto symbol_count(const char *json_string) -> uint64_t {
-    Data data = convert(json_string);
-    auto symbols = 0;
-    for (auto& block : data.missing) {
-        for (const auto &symbol : block.second) {
-            ++symbols;
-        }
-
-    }
-    return symbols;
+    return convert(json_string).symbols;
 }
 
 
@@ -279,6 +312,6 @@ extern "C" LIB_PUBLIC auto symbol_count(const char *json_string) -> uint64_t {
  * @returns The estimated length.
 */
 extern "C" LIB_PUBLIC auto length(const char *json_string) -> uint64_t {
-     // Each symbol is wrapped in it's own ALC packet.
-    return symbol_count(json_string) * (2048 + strlen("ALC "));
+     // Each symbol is wrapped in it's own ALC packet, binary responses also start with a header.
+    return symbol_count(json_string) * (2048 + strlen("ALC ")) + LibFlute::RepairResponse::header_length;
 }
@@ -0,0 +1,98 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <string>
+
+#include "Component/Retriever.h"
+#include "Object/File.h"
+#include "Packet/AlcPacket.h"
+#include "spdlog/spdlog.h"
+
+/**
+ *  Measure how long the Retriever takes to select the missing symbols of a file and build the repair
+ *  response, for loss rates between 1 % and 50 %.
+ *
+ *  Usage: flute_retriever_benchmark [file size in bytes] [iterations] [fec scheme] [mtu]
+ *  Defaults: 16 MB, 50 iterations, Compact No Code (0), 1500
+ *
+ * @return 0 on success, -1 on failure
+ */
+auto main(int argc, char **argv) -> int {
+    size_t file_size = argc > 1 ? std::stoull(argv[1]) : 16 * 1024 * 1024;
+    unsigned iterations = argc > 2 ? std::stoul(argv[2]) : 50;
+    auto fec = LibFlute::FecScheme(argc > 3 ? std::stoul(argv[3]) : 0);
+    auto mtu = static_cast<unsigned short>(argc > 4 ? std::stoul(argv[4]) : 1500);
+
+    spdlog::set_level(spdlog::level::warn);
+
+    std::mt19937 rng(42);
+    std::string data(file_size, '\0');
+    for (auto& c : data) {
+        c = static_cast<char>(rng());
+    }
+
+    LibFlute::Retriever retriever(16, mtu, fec);
+    std::shared_ptr<LibFlute::FileBase> file;
+    try {
+        // Size the symbols like the Retriever does
+        uint32_t max_payload = mtu - 20 - 8 - 28 - LibFlute::AlcPacket::id_fields_length(16, UINT32_MAX) - 4;
+        uint32_t max_source_block_length = 64;
+        if (fec == LibFlute::FecScheme::Raptor) {
+            max_payload -= max_payload % 4;
+            max_source_block_length = 842;
+        }
+        file = std::make_shared<LibFlute::File>(1, LibFlute::FecOti{fec, 0, max_payload, max_source_block_length},
+            "benchmark", "application/octet-stream", 0, 0, data.data(), data.size(), false, false);
+    } catch (const char *errorMessage) {
+        std::cerr << "Failed to create the file: " << errorMessage << std::endl;
+        return -1;
+    }
+
+    size_t nof_symbols = 0;
+    for (const auto& block : file->source_blocks()) {
+        nof_symbols += block.second.symbols.size();
+    }
+    std::cout << "file " << file_size << " bytes, " << file->source_blocks().size() << " blocks, "
+              << nof_symbols << " symbols, " << iterations << " iterations" << std::endl;
+    std::cout << "loss %\tsymbols\tus/request\tresponse bytes\tMB/s" << std::endl;
+
+    for (unsigned loss : {1, 2, 5, 10, 20, 50}) {
+        std::map<uint32_t, std::vector<uint32_t>> missing;
+        size_t nof_missing = 0;
+        for (const auto& block : file->source_blocks()) {
+            for (const auto& symbol : block.second.symbols) {
+                if (rng() % 100 < loss) {
+                    missing[block.first].push_back(symbol.first);
+                    nof_missing++;
+                }
+            }
+        }
+
+        size_t response_size = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (unsigned i = 0; i < iterations; i++) {
+            response_size = retriever.get_alcs_from_file(file, missing, LibFlute::RepairResponse::Encoding::Binary).size();
+        }
+        auto elapsed = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+        double us_per_request = static_cast<double>(elapsed) / iterations;
+        std::cout << loss << "\t" << nof_missing << "\t" << us_per_request << "\t" << response_size << "\t"
+                  << (us_per_request > 0 ? response_size / us_per_request : 0) << std::endl;
+    }
+    return 0;
+}
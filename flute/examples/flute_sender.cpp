@@ -31,6 +31,7 @@
 
 #include "Component/Transmitter.h"
 #include "Metric/Metrics.h"
+#include "Metric/LifecycleTracer.h"
 #include "Version.h"
 #include "spdlog/async.h"
 #include "spdlog/sinks/syslog_sink.h"
@@ -79,6 +80,15 @@ static struct argp_option options[] = {  // NOLINT
     {"instance-id-start", 'i', "IID", 0, "The Instance Id assigned to the first file (default: 1)", 0},
     {"rate-limit", 'r', "KBPS", 0, "Transmit rate limit (kbps), 0 = use default, default: 1000 (1 Mbps)", 0},
     {"deadline", 'd', "MS", 0, "Time after epoch by which the files have to be received. Disabled if 0.(default: 0)", 0},
+    {"fdt-compression", 'z', "LEVEL", 0, "Send FDT instances gzip compressed at LEVEL (0-9). Disabled if -1 (default: -1)", 0},
+    {"fdt-compression-threshold", 'y', "BYTES", 0, "Size from which on FDT instances are compressed (default: 1024)", 0},
+    {"fdt-interval", 'n', "MS", 0, "Repeat the FDT at least every MS milliseconds while files are sent (default: 1000)", 0},
+    {"fdt-packets", 'g', "COUNT", 0, "Also repeat the FDT after COUNT data packets. Disabled if 0 (default: 0)", 0},
+    {"fdt-interleave", 'j', "COUNT", 0, "Data packets sent between two packets of an FDT repetition, 0 sends it at once (default: 0)", 0},
+    {"inband-fti", 'x', "SYMBOLS", 0, "Send EXT_FTI on every packet of a file that starts a run of SYMBOLS symbols, so receivers can start on it before its FDT entry. Disabled if 0 (default: 0)", 0},
+    {"sender-time", 's', "PACKETS", 0, "Send EXT_TIME with the sender's clock on every PACKETS-th packet of a file, and the time left until the deadline if one is set. Disabled if 0 (default: 0)", 0},
+    {"content-encoding", 'e', "LEVEL", 0, "Send files gzip encoded at LEVEL (0-9), files that do not get smaller are sent as they are. Disabled if -1 (default: -1)", 0},
+    {"trace", 'c', "FILE", 0, "Trace the lifecycle of every file and write it to FILE in the Chrome trace format when stopping. Disabled if empty (default: '')", 0},
     {"log-level", 'l', "LEVEL", 0,
      "Log verbosity: 0 = trace, 1 = debug, 2 = info, 3 = warn, 4 = error, 5 = "
      "critical, 6 = none. Default: 2.",
@@ -94,12 +104,19 @@ struct ft_arguments {
     const char *aes_key = {};
     unsigned short mcast_port = 40085;
     unsigned short mtu = 1500;
-    uint16_t toi_start = 1;
+    uint32_t toi_start = 1;
     uint32_t instance_id_start = 1;
     uint32_t rate_limit = 1000;
     uint64_t deadline = 0;
     unsigned log_level = 2; /**< log level */
     unsigned fec = 0; 
+    int fdt_compression_level = -1;
+    size_t fdt_compression_threshold = 1024;
+    int content_encoding_level = -1;
+    unsigned inband_fti_interval = 0;
+    unsigned sender_time_interval = 0;
+    LibFlute::Transmitter::FdtSchedule fdt_schedule;
+    std::string trace_file;
     char **files;
 };
 
@@ -130,7 +147,7 @@ static auto parse_opt(int key, char *arg, struct argp_state *state) -> error_t {
             arguments->mtu = static_cast<unsigned short>(strtoul(arg, nullptr, 10));
             break;
         case 'o':
-            arguments->toi_start = static_cast<uint16_t>(strtoul(arg, nullptr, 10));
+            arguments->toi_start = static_cast<uint32_t>(strtoul(arg, nullptr, 10));
             break;
         case 'i':
             arguments->instance_id_start = static_cast<uint32_t>(strtoul(arg, nullptr, 10));
@@ -144,6 +161,33 @@ static auto parse_opt(int key, char *arg, struct argp_state *state) -> error_t {
         case 'l':
             arguments->log_level = static_cast<unsigned>(strtoul(arg, nullptr, 10));
             break;
+        case 'c':
+            arguments->trace_file = std::string(arg);
+            break;
+        case 'z':
+            arguments->fdt_compression_level = static_cast<int>(strtol(arg, nullptr, 10));
+            break;
+        case 'y':
+            arguments->fdt_compression_threshold = static_cast<size_t>(strtoul(arg, nullptr, 10));
+            break;
+        case 'n':
+            arguments->fdt_schedule.repeat_interval = std::chrono::milliseconds(strtoul(arg, nullptr, 10));
+            break;
+        case 'g':
+            arguments->fdt_schedule.repeat_packets = static_cast<unsigned>(strtoul(arg, nullptr, 10));
+            break;
+        case 'j':
+            arguments->fdt_schedule.interleave = static_cast<unsigned>(strtoul(arg, nullptr, 10));
+            break;
+        case 'x':
+            arguments->inband_fti_interval = static_cast<unsigned>(strtoul(arg, nullptr, 10));
+            break;
+        case 's':
+            arguments->sender_time_interval = static_cast<unsigned>(strtoul(arg, nullptr, 10));
+            break;
+        case 'e':
+            arguments->content_encoding_level = static_cast<int>(strtol(arg, nullptr, 10));
+            break;
         case ARGP_KEY_NO_ARGS:
             //argp_usage(state);
             arguments->files = nullptr;
@@ -220,6 +264,8 @@ public:
         // Print the rate limit
         spdlog::info("Rate limit is {} kbps", arguments.rate_limit);  
 
+        LibFlute::Metric::LifecycleTracer::getInstance().setEnabled(!arguments.trace_file.empty());
+
         // Construct the transmitter class
         transmitter = std::make_unique<LibFlute::Transmitter>(
             arguments.mcast_target,
@@ -237,6 +283,21 @@ public:
             transmitter->enable_ipsec(1, arguments.aes_key);
         }
 
+        if (arguments.fdt_compression_level >= 0) {
+            transmitter->set_fdt_compression(LibFlute::ContentEncoding::GZIP, arguments.fdt_compression_level, arguments.fdt_compression_threshold);
+        }
+        transmitter->set_fdt_schedule(arguments.fdt_schedule);
+        transmitter->set_inband_fti(arguments.inband_fti_interval);
+        transmitter->set_sender_time(arguments.sender_time_interval, arguments.deadline > 0);
+        if (arguments.content_encoding_level >= 0) {
+            // All files are sent as application/octet-stream
+            LibFlute::Transmitter::ContentEncodingPolicy policy;
+            policy.encoding = LibFlute::ContentEncoding::GZIP;
+            policy.level = arguments.content_encoding_level;
+            policy.content_types = {"application/octet-stream"};
+            transmitter->set_content_encoding_policy(policy);
+        }
+
         // Register a completion callback
         transmitter->register_completion_callback(
             [this](uint32_t toi) {
@@ -352,6 +413,11 @@ public:
 
         auto next_instance_id = (transmitter->current_instance_id() + 1) & ((1 << 20) - 1);
         std::cout << "next_instance_id = " << next_instance_id << std::endl;
+
+        LibFlute::Metric::LifecycleTracer& tracer = LibFlute::Metric::LifecycleTracer::getInstance();
+        if (tracer.enabled() && !tracer.writeChromeTrace(arguments.trace_file)) {
+            spdlog::error("Failed to write the lifecycle trace to {}", arguments.trace_file);
+        }
     }
 
     auto send_file(std::string file_location, u_int64_t deadline) -> int{
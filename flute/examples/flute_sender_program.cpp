@@ -70,7 +70,7 @@ struct ft_arguments {
     const char *aes_key = {};
     unsigned short mcast_port = 40085;
     unsigned short mtu = 1500;
-    uint16_t toi_start = 1;
+    uint32_t toi_start = 1;
     uint32_t instance_id_start = 1;
     uint32_t rate_limit = 1000;
     uint64_t deadline = 0;
@@ -106,7 +106,7 @@ static auto parse_opt(int key, char *arg, struct argp_state *state) -> error_t {
             arguments->mtu = static_cast<unsigned short>(strtoul(arg, nullptr, 10));
             break;
         case 'o':
-            arguments->toi_start = static_cast<uint16_t>(strtoul(arg, nullptr, 10));
+            arguments->toi_start = static_cast<uint32_t>(strtoul(arg, nullptr, 10));
             break;
         case 'i':
             arguments->instance_id_start = static_cast<uint32_t>(strtoul(arg, nullptr, 10));
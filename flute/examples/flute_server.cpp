@@ -28,12 +28,13 @@
 #include <string>
 #include <thread>
 #include <atomic>
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/json_parser.hpp>
 
+#include "Component/RepairServer.h"
 #include "Component/Transmitter.h"
 #include "Component/Retriever.h"
 #include "Metric/Metrics.h"
+#include "Metric/MetricsExporter.h"
+#include "Recovery/RepairRequest.h"
 #include "Version.h"
 #include "spdlog/async.h"
 #include "spdlog/sinks/syslog_sink.h"
@@ -82,6 +83,9 @@ static struct argp_option options[] = {  // NOLINT
     {"instance-id-start", 'i', "IID", 0, "The Instance Id assigned to the first file (default: 1)", 0},
     {"rate-limit", 'r', "KBPS", 0, "Transmit rate limit (kbps), 0 = use default, default: 1000 (1 Mbps)", 0},
     {"deadline", 'd', "MS", 0, "Time after epoch by which the files have to be received. Disabled if 0.(default: 0)", 0},
+    {"metrics-endpoint", 'x', "ENDPOINT", 0, "Serve metrics in the Prometheus format on PORT, ADDRESS:PORT or unix:PATH. Disabled if empty (default: '')", 0},
+    {"repair-cache", 'c', "MB", 0, "Memory for encoded files that are served from storage to repair requests, 0 = disabled (default: 256)", 0},
+    {"repair-port", 'u', "PORT", 0, "Answer repair requests with the built-in HTTP server on PORT. Disabled if 0 (default: 0)", 0},
     {"log-level", 'l', "LEVEL", 0,
      "Log verbosity: 0 = trace, 1 = debug, 2 = info, 3 = warn, 4 = error, 5 = "
      "critical, 6 = none. Default: 2.",
@@ -97,12 +101,15 @@ struct ft_arguments {
     const char *aes_key = {};
     unsigned short mcast_port = 40085;
     unsigned short mtu = 1500;
-    uint16_t toi_start = 1;
+    uint32_t toi_start = 1;
     uint32_t instance_id_start = 1;
     uint32_t rate_limit = 1000;
     uint64_t deadline = 0;
     unsigned log_level = 2; /**< log level */
     unsigned fec = 0; 
+    std::string metrics_endpoint;
+    uint64_t repair_cache_mb = 256;
+    unsigned short repair_port = 0;
     char **files;
 };
 
@@ -133,7 +140,7 @@ static auto parse_opt(int key, char *arg, struct argp_state *state) -> error_t {
             arguments->mtu = static_cast<unsigned short>(strtoul(arg, nullptr, 10));
             break;
         case 'o':
-            arguments->toi_start = static_cast<uint16_t>(strtoul(arg, nullptr, 10));
+            arguments->toi_start = static_cast<uint32_t>(strtoul(arg, nullptr, 10));
             break;
         case 'i':
             arguments->instance_id_start = static_cast<uint32_t>(strtoul(arg, nullptr, 10));
@@ -144,6 +151,15 @@ static auto parse_opt(int key, char *arg, struct argp_state *state) -> error_t {
         case 'd':
             arguments->deadline = static_cast<uint64_t>(strtoul(arg, nullptr, 10));
             break;
+        case 'x':
+            arguments->metrics_endpoint = std::string(arg);
+            break;
+        case 'c':
+            arguments->repair_cache_mb = static_cast<uint64_t>(strtoull(arg, nullptr, 10));
+            break;
+        case 'u':
+            arguments->repair_port = static_cast<unsigned short>(strtoul(arg, nullptr, 10));
+            break;
         case 'l':
             arguments->log_level = static_cast<unsigned>(strtoul(arg, nullptr, 10));
             break;
@@ -188,49 +204,47 @@ auto file_exists(const std::string& name) -> bool {
 
 struct Data {
     std::string file;
-    uint64_t toi;
-    unsigned fec;
+    uint64_t toi = 0;
+    unsigned fec = 0;
     std::map<uint32_t,std::vector<uint32_t>> missing;
+    std::map<uint32_t,LibFlute::RepairRequest::Needed> needed;
+    uint64_t symbols = 0;
+    LibFlute::RepairResponse::Encoding encoding = LibFlute::RepairResponse::Encoding::Legacy;
 };
 
 /**
- * Proof of concept parser for converting incoming string to the required data object.
- * A proper json library or another input format would be better.
+ * Parse an incoming repair request (JSON or compact) into the required data object.
+ * The request is only parsed once, the number of symbols comes along with it.
 */
-auto convert(const std::string& json_string) -> Data {
+auto convert(const char* request_string, size_t request_length) -> Data {
     ZoneScopedN("convert");
     Data data;
     try {
-        std::stringstream ss;
-        ss << json_string;
-
-        boost::property_tree::ptree pt;
-        boost::property_tree::read_json(ss, pt);
-
-        data.toi = std::stoi(pt.get<std::string>("toi"));
-        data.file = pt.get<std::string>("file");
-        data.fec = std::stoi(pt.get<std::string>("fec"));
-
-        // Iterate over all the blocks.
-        boost::property_tree::ptree missing_pt = pt.get_child("missing");
-        for (boost::property_tree::ptree::iterator block = missing_pt.begin(); block != missing_pt.end(); ++block) {
-            // Iterate over all the missing symbols of the current block.
-            std::vector<uint32_t> symbols;
-            for (boost::property_tree::ptree::iterator symbol = block->second.begin(); symbol != block->second.end(); ++symbol) {
-                symbols.push_back(std::stoi(symbol->second.data()));
-            }
-            data.missing[std::stoi(block->first)] = symbols;
-        }
-
+        auto request = LibFlute::RepairRequest::parse(request_string, request_length);
+
+        data.toi = request.toi();
+        data.file = request.content_location();
+        data.fec = request.fec();
+        data.missing = request.missing();
+        data.needed = request.needed();
+        data.symbols = request.symbol_count();
+        // Clients that understand the binary framing announce it, others get the legacy framing
+        data.encoding = request.encoding();
     } catch (const std::exception& e) {
-        spdlog::error("Error parsing JSON: {}", e.what());
-        spdlog::error("String was {}", json_string);
+        spdlog::error("Error parsing repair request: {}", e.what());
+        spdlog::error("String was {}", std::string(request_string, request_length));
+    } catch (const char* errorMessage) {
+        spdlog::error("Error parsing repair request: {}", errorMessage);
     }
 
     return data;
 
 }
 
+auto convert(const char* request_string) -> Data {
+    return convert(request_string, strlen(request_string));
+}
+
 class FluteTransmissionManager {
 public:
     static auto getInstance() -> FluteTransmissionManager& {
@@ -268,6 +282,21 @@ public:
         // Print the rate limit
         spdlog::info("Rate limit is {} kbps", arguments.rate_limit);  
 
+        if (!arguments.metrics_endpoint.empty() && !metricsExporter) {
+            try {
+                metricsExporter = LibFlute::Metric::MetricsExporter::fromEndpoint(arguments.metrics_endpoint);
+            } catch (const std::exception &ex) {
+                spdlog::error("Failed to start the metrics exporter on {}: {}", arguments.metrics_endpoint, ex.what());
+            } catch (const char* errorMessage) {
+                spdlog::error("Failed to start the metrics exporter on {}: {}", arguments.metrics_endpoint, errorMessage);
+            }
+        }
+
+        object_cache = std::make_shared<LibFlute::EncodedObjectCache>(arguments.repair_cache_mb * 1024 * 1024);
+
+        // The repair server looks files up in the transmitter, stop it before the transmitter is replaced
+        repair_server.reset();
+
         // Construct the transmitter class
         transmitter = std::make_unique<LibFlute::Transmitter>(
             arguments.mcast_target,
@@ -280,6 +309,28 @@ public:
             arguments.toi_start,
             arguments.instance_id_start);
 
+        if (arguments.repair_port != 0) {
+            LibFlute::RepairServer::Options repair_options;
+            repair_options.port = arguments.repair_port;
+            repair_options.mtu = arguments.mtu;
+            repair_options.cache_bytes = 0; // Shared with retrieve()
+            repair_server = std::make_unique<LibFlute::RepairServer>(repair_options);
+            repair_server->set_cache(object_cache);
+            // Transmitter::get_file has its own lock, so lookups do not wait for the transmitter mutex
+            repair_server->set_file_lookup([this](uint64_t toi) { return transmitter->get_file(static_cast<uint32_t>(toi)); });
+            repair_server->set_fdt_lookup([this]() {
+                std::lock_guard<LockableBase(std::mutex)> fdt_lock(transmitter_mutex);
+                return transmitter->fdt_string();
+            });
+            repair_server->set_location_resolver([this](const std::string& location) { return get_real_location(location); });
+            try {
+                repair_server->start();
+            } catch (const std::exception &ex) {
+                spdlog::error("Failed to start the repair server on port {}: {}", arguments.repair_port, ex.what());
+                repair_server.reset();
+            }
+        }
+
         // Configure IPSEC ESP, if enabled
         if (arguments.enable_ipsec) {
             transmitter->enable_ipsec(1, arguments.aes_key);
@@ -367,7 +418,7 @@ public:
                 std::unique_lock<LockableBase(std::mutex)> remover_lock(transmitter_mutex);
                 auto removed_file_tois = transmitter->remove_expired_files();
                 // Iterate over this vector
-                for (auto &toi : removed_file_tois) {
+                for (uint32_t toi : removed_file_tois) {
                     for (auto &file : files) {
                         if (file.toi == toi) {
                             spdlog::debug("{} (TOI {}) has been removed", file.location, file.toi);
@@ -634,9 +685,13 @@ public:
     }
 
     auto retrieve(const char *json_string, uint16_t mtu, char* result) -> size_t {
-        try {
-            Data data = convert(json_string);
+        auto retrieved = retrieve(convert(json_string), mtu);
+        memcpy(result, retrieved.c_str(), retrieved.size());
+        return retrieved.size();
+    }
 
+    auto retrieve(const Data& data, uint16_t mtu) -> std::string {
+        try {
             spdlog::info("(TOI {}) Partial request received for {}", data.toi, data.file);
 
             // Get the real location
@@ -652,53 +707,29 @@ public:
             auto parsed_file = transmitter->get_file(data.toi);
             // If not nullptr, then
             if (parsed_file != nullptr) {
-                auto retrieved_from_memory = retriever.get_alcs_from_file(parsed_file, data.missing);
+                auto retrieved_from_memory = retriever.get_alcs_from_file(parsed_file, data.missing, data.encoding, data.needed);
 
                 // Unlock the mutex
                 remover_lock.unlock();
 
-                memcpy(result, retrieved_from_memory.c_str(), retrieved_from_memory.size());
-                return retrieved_from_memory.size();
+                return retrieved_from_memory;
             }
 
             // Unlock the mutex
             remover_lock.unlock();
 
-            // Read the file contents into the buffers.
-            std::ifstream file(real_location, std::ios::binary | std::ios::ate);
-            std::streamsize size = file.tellg();
-            file.seekg(0, std::ios::beg);
-
-            // Allocate memory to read the file using new
-            char* buffer = nullptr;
-            try {
-                buffer = new char[size];
-            } catch (std::bad_alloc& e) {
-                spdlog::error("Memory allocation failed for file: {} with size: {}", real_location, size);
-                return 0;
-            }
-            //TracyAlloc(buffer, size);
-            if (!file.read(buffer, size)) {
-                spdlog::error("Failed to read file: {}", real_location);
-                delete[] buffer;
-                return 0;
-            }
-
-            auto retrieved = retriever.get_alcs(data.file, // We use the original filename here
+            // Files that aged out of the transmitter are read and encoded once, later requests use the cache
+            retriever.set_cache(object_cache);
+            auto retrieved = retriever.get_alcs_from_storage(real_location,
+                            data.file, // We use the original filename here
                             "application/octet-stream",
                             retriever.seconds_since_epoch() + 60,  // 1 minute from now
-                            buffer,
-                            (size_t)size,
                             data.toi,
-                            data.missing);
-
-            // Free the buffer
-            //TracyFree(buffer);
-            // free(buffer);
-            delete[] buffer;
+                            data.missing,
+                            data.encoding,
+                            data.needed);
 
-            memcpy(result, retrieved.c_str(), retrieved.size());
-            return retrieved.size();
+            return retrieved;
 
         } catch (const std::exception &ex) {
             spdlog::error("Exiting on unhandled exception: {}", ex.what());
@@ -709,7 +740,7 @@ public:
             spdlog::error("Exiting on unhandled exception");
         }
 
-        return 0;
+        return "";
 
     }
 private:
@@ -725,8 +756,11 @@ private:
     std::vector<FsFile> files;
     std::chrono::time_point<std::chrono::system_clock> exact_start_time;
     LibFlute::Metric::Metrics& metricsInstance;
+    std::unique_ptr<LibFlute::Metric::MetricsExporter> metricsExporter;
+    std::shared_ptr<LibFlute::EncodedObjectCache> object_cache;
     boost::asio::io_service io;
     std::unique_ptr<LibFlute::Transmitter> transmitter;
+    std::unique_ptr<LibFlute::RepairServer> repair_server;
     std::atomic<bool> io_thread_running{false};  // Flag to track the running status of the thread
     // A mutex to prevent the transmitter from being accessed from multiple threads concurrently
     TracyLockable(std::mutex, transmitter_mutex);
@@ -805,15 +839,7 @@ extern "C" LIB_PUBLIC auto current_total_file_size() -> uint64_t {
  * @returns The number of symbols.
 */
 extern "C" LIB_PUBLIC auto symbol_count(const char *json_string) -> uint64_t {
-    Data data = convert(json_string);
-    auto symbols = 0;
-    for (auto& block : data.missing) {
-        for (const auto &symbol : block.second) {
-            ++symbols;
-        }
-
-    }
-    return symbols;
+    return convert(json_string).symbols;
 }
 
 /**
@@ -824,11 +850,47 @@ extern "C" LIB_PUBLIC auto symbol_count(const char *json_string) -> uint64_t {
  * @returns The estimated length.
 */
 extern "C" LIB_PUBLIC auto length(const char *json_string) -> uint64_t {
-     // Each symbol is wrapped in it's own ALC packet.
-    return symbol_count(json_string) * (2048 + strlen("ALC "));
+     // Each symbol is wrapped in it's own ALC packet, binary responses also start with a header.
+    return symbol_count(json_string) * (2048 + strlen("ALC ")) + LibFlute::RepairResponse::header_length;
 }
 
 extern "C" LIB_PUBLIC auto retrieve(const char *json_string, uint16_t mtu, char* result) -> size_t {
     FluteTransmissionManager& fluteTransmissionManager = FluteTransmissionManager::getInstance();
     return fluteTransmissionManager.retrieve(json_string, mtu, result);
-}
\ No newline at end of file
+}
+
+/**
+ * Parse a request once and build its response, without a separate length estimate.
+ *
+ * @param request This string holds a JSON or compact repair request.
+ * @param mtu The MTU of the ALC packets.
+ * @param result Set to a buffer holding the response, release it with free_result.
+ * @param symbols Set to the number of requested symbols, may be null.
+ * @returns The length of the response.
+*/
+extern "C" LIB_PUBLIC auto retrieve_request(const char *request, uint16_t mtu, char** result, uint64_t* symbols) -> size_t {
+    FluteTransmissionManager& fluteTransmissionManager = FluteTransmissionManager::getInstance();
+    Data data = convert(request);
+    if (symbols) {
+        *symbols = data.symbols;
+    }
+    *result = nullptr;
+    auto retrieved = fluteTransmissionManager.retrieve(data, mtu);
+    if (retrieved.empty()) {
+        return 0;
+    }
+    *result = static_cast<char*>(malloc(retrieved.size()));
+    if (!*result) {
+        spdlog::error("Memory allocation failed for a response of {} bytes", retrieved.size());
+        return 0;
+    }
+    memcpy(*result, retrieved.data(), retrieved.size());
+    return retrieved.size();
+}
+
+/**
+ * Release a buffer returned by retrieve_request.
+*/
+extern "C" LIB_PUBLIC void free_result(char* result) {
+    free(result);
+}
@@ -28,14 +28,13 @@
 #include <string>
 #include <thread>
 #include <atomic>
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/json_parser.hpp>
 
 #include "Component/Transmitter.h"
 #include "Component/Retriever.h"
 #include "Component/Receiver.h"
 #include "Metric/Metrics.h"
 #include "Metric/Gauge.h"
+#include "Recovery/RepairRequest.h"
 #include "Version.h"
 #include "spdlog/async.h"
 #include "spdlog/sinks/syslog_sink.h"
@@ -179,58 +178,48 @@ struct Data {
     uint64_t toi;
     unsigned fec;
     std::map<uint32_t,std::vector<uint32_t>> missing;
+    std::map<uint32_t,LibFlute::RepairRequest::Needed> needed;
+    uint64_t symbols;
     bool valid;
+    LibFlute::RepairResponse::Encoding encoding = LibFlute::RepairResponse::Encoding::Legacy;
+    LibFlute::ContentEncoding content_encoding = LibFlute::ContentEncoding::NONE;
 };
 
 /**
- * Proof of concept parser for converting incoming string to the required data object.
- * A proper json library or another input format would be better.
+ * Parse an incoming repair request (JSON or compact) into the required data object.
+ * The request is only parsed once, the number of symbols comes along with it.
 */
-auto convert(const std::string& json_string) -> Data {
+auto convert(const std::string& request_string) -> Data {
     ZoneScopedN("convert");
-    Data data{"", 0, 0, {}, false};
+    Data data{"", 0, 0, {}, {}, 0, false};
     try {
-        if (json_string.empty()) {
-            spdlog::error("Empty JSON string");
+        if (request_string.empty()) {
+            spdlog::error("Empty repair request");
             return data;
         }
 
-        std::stringstream ss;
-        ss << json_string;
+        auto request = LibFlute::RepairRequest::parse(request_string);
 
-        boost::property_tree::ptree pt;
-        boost::property_tree::read_json(ss, pt);
-
-        if (pt.find("toi") != pt.not_found()) {
-            data.toi = std::stoi(pt.get<std::string>("toi"));
-        }
-        if (pt.find("file") != pt.not_found()) {
-            data.file = pt.get<std::string>("file");
-        } else if (data.toi == 0) {
+        data.toi = request.toi();
+        data.file = request.content_location();
+        if (data.file.empty() && data.toi == 0) {
             data.file = "last.fdt";
         }
-        if (pt.find("fec") != pt.not_found()) {
-            data.fec = std::stoi(pt.get<std::string>("fec"));
-        }
-
-        // Iterate over all the blocks.
-        if (pt.find("missing") != pt.not_found()) {
-            boost::property_tree::ptree missing_pt = pt.get_child("missing");
-            for (boost::property_tree::ptree::iterator block = missing_pt.begin(); block != missing_pt.end(); ++block) {
-                // Iterate over all the missing symbols of the current block.
-                std::vector<uint32_t> symbols;
-                for (boost::property_tree::ptree::iterator symbol = block->second.begin(); symbol != block->second.end(); ++symbol) {
-                    symbols.push_back(std::stoi(symbol->second.data()));
-                }
-                data.missing[std::stoi(block->first)] = symbols;
-            }
-        }
+        data.fec = request.fec();
+        data.missing = request.missing();
+        data.needed = request.needed();
+        data.symbols = request.symbol_count();
+        // Clients that understand the binary framing announce it, others get the legacy framing
+        data.encoding = request.encoding();
+        data.content_encoding = request.content_encoding();
 
         data.valid = true;
 
     } catch (const std::exception& e) {
-        spdlog::error("Error parsing JSON: {}", e.what());
-        spdlog::error("String was {}", json_string);
+        spdlog::error("Error parsing repair request: {}", e.what());
+        spdlog::error("String was {}", request_string);
+    } catch (const char* errorMessage) {
+        spdlog::error("Error parsing repair request: {}", errorMessage);
     }
 
     return data;
@@ -340,7 +329,7 @@ public:
                 std::unique_lock<LockableBase(std::mutex)> remover_lock(transmitter_mutex);
                 auto removed_file_tois = transmitter->remove_expired_files();
                 // Iterate over this vector
-                for (auto &toi : removed_file_tois) {
+                for (uint32_t toi : removed_file_tois) {
                     for (auto &file : files) {
                         if (file.toi == toi) {
                             // free() the buffer here
@@ -730,11 +719,13 @@ public:
     }
 
     auto retrieve(const std::string& json_string, uint16_t mtu) -> std::string {
-        try {
-            Data data = convert(json_string);
+        return retrieve(convert(json_string), mtu);
+    }
 
+    auto retrieve(const Data& data, uint16_t mtu) -> std::string {
+        try {
             if (data.valid == false) {
-                spdlog::error("Invalid JSON string");
+                spdlog::error("Invalid repair request");
                 return {};
             }
 
@@ -743,7 +734,7 @@ public:
             // Lock the mutex
             std::unique_lock<LockableBase(std::mutex)> remover_lock(transmitter_mutex);
 
-            if (data.toi == 0 && data.missing.size() == 0) {
+            if (data.toi == 0 && data.missing.size() == 0 && data.needed.size() == 0) {
                 auto retrieved_from_memory = transmitter->fdt_string();
                 if (!retrieved_from_memory.empty()) {
                     // Unlock the mutex
@@ -762,7 +753,7 @@ public:
                 if (parsed_file != nullptr && parsed_file->fec_oti().encoding_id == retriever.get_fec_scheme()) {
                     spdlog::info("[RETRIEVE] Retrieving file {} from memory", parsed_file->meta().content_location);
                     // Retrieve the file from memory
-                    auto retrieved_from_memory = retriever.get_alcs_from_file(parsed_file, data.missing);
+                    auto retrieved_from_memory = retriever.get_alcs_from_file(parsed_file, data.missing, data.encoding, data.needed);
 
                     // Unlock the mutex
                     remover_lock.unlock();
@@ -771,6 +762,8 @@ public:
                         spdlog::error("[RETRIEVE] Failed to retrieve file {} from memory", parsed_file->meta().content_location);
                         return {};
                     }
+                    LibFlute::RepairResponse::announce(retrieved_from_memory, LibFlute::RepairResponse::CompactRequests
+                        | LibFlute::RepairResponse::SymbolCounts | LibFlute::RepairResponse::ContentEncodings);
 
                     return retrieved_from_memory;
                 }
@@ -779,6 +772,12 @@ public:
             // Unlock the mutex
             remover_lock.unlock();
 
+            // Files on disk hold the content, the symbols of an encoded transport object can not be cut from them
+            if (data.content_encoding != LibFlute::ContentEncoding::NONE) {
+                spdlog::info("[RETRIEVE] Refusing to repair {}, it was sent with a content encoding", data.file);
+                return {};
+            }
+
             // Get the real location
             std::string real_location = get_real_location(data.file);
 
@@ -801,7 +800,7 @@ public:
             TracyAlloc(buffer, size);
             file.read(buffer, size);
 
-            if (data.toi == 0 && data.missing.size() == 0) {
+            if (data.toi == 0 && data.missing.size() == 0 && data.needed.size() == 0) {
                 // Create a string copy of the buffer
                 std::string retrieved(buffer, size);
                 // Free the buffer
@@ -817,12 +816,17 @@ public:
                             buffer,
                             (size_t)size,
                             data.toi,
-                            data.missing);
+                            data.missing,
+                            data.encoding,
+                            data.needed);
 
             // Free the buffer
             TracyFree(buffer);
             free(buffer);
 
+            // Requests are parsed with RepairRequest::parse, which understands the compact format and symbol counts
+            LibFlute::RepairResponse::announce(retrieved, LibFlute::RepairResponse::CompactRequests
+                | LibFlute::RepairResponse::SymbolCounts | LibFlute::RepairResponse::ContentEncodings);
             return retrieved;
 
         } catch (const std::exception &ex) {
@@ -1239,6 +1243,25 @@ public:
         return _network_socket;
     }
 
+    // Replace a stage of the impairment pipeline, nullptr removes it
+    auto set_bandwidth_limit(std::shared_ptr<LibFlute::TokenBucket> bandwidth_limit) -> bool {
+        std::lock_guard<LockableBase(std::mutex)> lock(storage_mutex);
+        _bandwidth_limit = std::move(bandwidth_limit);
+        return apply_impairments();
+    }
+
+    auto set_burst_loss(std::shared_ptr<LibFlute::GilbertElliottLoss> burst_loss) -> bool {
+        std::lock_guard<LockableBase(std::mutex)> lock(storage_mutex);
+        _burst_loss = std::move(burst_loss);
+        return apply_impairments();
+    }
+
+    auto set_delay(std::shared_ptr<LibFlute::DelayImpairment> delay) -> bool {
+        std::lock_guard<LockableBase(std::mutex)> lock(storage_mutex);
+        _delay = std::move(delay);
+        return apply_impairments();
+    }
+
     void set_latest_bandwidth(unsigned long bandwidth) {
         ZoneScopedN("StorageManager::set_latest_bandwidth");
         // Lock the mutex
@@ -1259,8 +1282,29 @@ private:
     
     struct ft_arguments _arguments;
     std::shared_ptr<LibFlute::FakeNetworkSocket> _network_socket;
+    // The impairment pipeline: the bandwidth limit of the sender's link, then loss and delay on the way
+    std::shared_ptr<LibFlute::TokenBucket> _bandwidth_limit;
+    std::shared_ptr<LibFlute::GilbertElliottLoss> _burst_loss;
+    std::shared_ptr<LibFlute::DelayImpairment> _delay;
     unsigned long latest_bandwidth = 0;
 
+    // NOTE: the storage mutex should be locked in the parent function.
+    auto apply_impairments() -> bool {
+        if (!_network_socket) {
+            return false;
+        }
+        _network_socket->clear_impairments();
+        for (const std::shared_ptr<LibFlute::NetworkImpairment>& stage : {
+                std::shared_ptr<LibFlute::NetworkImpairment>(_bandwidth_limit),
+                std::shared_ptr<LibFlute::NetworkImpairment>(_burst_loss),
+                std::shared_ptr<LibFlute::NetworkImpairment>(_delay)}) {
+            if (stage) {
+                _network_socket->add_impairment(stage);
+            }
+        }
+        return true;
+    }
+
     StorageManager() {
         // Set up logging
         spdlog::set_pattern("[%H:%M:%S.%f][thr %t][%^%l%$] %v");
@@ -1370,6 +1414,72 @@ extern "C" LIB_PUBLIC auto set_rate_limit(uint32_t rate_limit) -> int {
     return fluteTransmissionManager.set_rate_limit(rate_limit);
 }
 
+/**
+ * Lose packets on the fake network in bursts (Gilbert-Elliott model), on top of the uniform loss rate
+ * @param p Probability to go from the good to the bad state, per packet
+ * @param r Probability to go back from the bad to the good state, per packet
+ * @param loss_good Loss probability in the good state
+ * @param loss_bad Loss probability in the bad state
+ * @param seed Seed of the random generator
+ * @return 0 on success, -1 if the network socket was not set up yet
+ */
+extern "C" LIB_PUBLIC auto set_burst_loss(double p, double r, double loss_good, double loss_bad, uint64_t seed) -> int {
+    StorageManager& storageManager = StorageManager::getInstance();
+    LibFlute::GilbertElliottLoss::Options options;
+    options.p = p;
+    options.r = r;
+    options.loss_good = loss_good;
+    options.loss_bad = loss_bad;
+    options.seed = seed;
+    return storageManager.set_burst_loss(std::make_shared<LibFlute::GilbertElliottLoss>(options)) ? 0 : -1;
+}
+
+/**
+ * Delay the packets on the fake network
+ * @param delay_us Fixed delay in microseconds
+ * @param jitter_us Uniformly distributed variation of the delay, in both directions
+ * @param reorder Whether packets may overtake each other when their delays differ
+ * @param seed Seed of the random generator
+ * @return 0 on success, -1 if the network socket was not set up yet
+ */
+extern "C" LIB_PUBLIC auto set_delay(uint32_t delay_us, uint32_t jitter_us, bool reorder, uint64_t seed) -> int {
+    StorageManager& storageManager = StorageManager::getInstance();
+    LibFlute::DelayImpairment::Options options;
+    options.delay = std::chrono::microseconds(delay_us);
+    options.jitter = std::chrono::microseconds(jitter_us);
+    options.reorder = reorder;
+    options.seed = seed;
+    return storageManager.set_delay(std::make_shared<LibFlute::DelayImpairment>(options)) ? 0 : -1;
+}
+
+/**
+ * Limit the bandwidth of the fake network with a token bucket
+ * @param rate_kbps Rate in kbps
+ * @param burst_bytes Bytes that may be sent at once before the rate applies
+ * @param queue_limit Packets that may wait for the link before new ones are dropped, 0 = unlimited
+ * @return 0 on success, -1 if the network socket was not set up yet
+ */
+extern "C" LIB_PUBLIC auto set_bandwidth_limit(uint32_t rate_kbps, uint32_t burst_bytes, uint32_t queue_limit) -> int {
+    StorageManager& storageManager = StorageManager::getInstance();
+    LibFlute::TokenBucket::Options options;
+    options.rate = rate_kbps;
+    options.burst = burst_bytes;
+    options.queue_limit = queue_limit;
+    return storageManager.set_bandwidth_limit(std::make_shared<LibFlute::TokenBucket>(options)) ? 0 : -1;
+}
+
+/**
+ * Remove the burst loss, delay and bandwidth limit of the fake network, the uniform loss rate stays
+ * @return 0 on success, -1 if the network socket was not set up yet
+ */
+extern "C" LIB_PUBLIC auto clear_impairments() -> int {
+    StorageManager& storageManager = StorageManager::getInstance();
+    auto cleared = storageManager.set_bandwidth_limit(nullptr);
+    cleared = storageManager.set_burst_loss(nullptr) && cleared;
+    cleared = storageManager.set_delay(nullptr) && cleared;
+    return cleared ? 0 : -1;
+}
+
 extern "C" LIB_PUBLIC auto current_total_file_size() -> uint64_t {
     FluteTransmissionManager& fluteTransmissionManager = FluteTransmissionManager::getInstance();
     return fluteTransmissionManager.current_total_file_size();
@@ -1383,16 +1493,7 @@ extern "C" LIB_PUBLIC auto current_total_file_size() -> uint64_t {
  * @returns The number of symbols.
 */
 extern "C" LIB_PUBLIC auto symbol_count(const char *json_c_string) -> uint64_t {
-    std::string json_string(json_c_string);
-    Data data = convert(json_string);
-    auto symbols = 0;
-    for (auto& block : data.missing) {
-        for (const auto &symbol : block.second) {
-            ++symbols;
-        }
-
-    }
-    return symbols;
+    return convert(json_c_string).symbols;
 }
 
 /**
@@ -1403,8 +1504,8 @@ extern "C" LIB_PUBLIC auto symbol_count(const char *json_c_string) -> uint64_t {
  * @returns The estimated length.
 */
 extern "C" LIB_PUBLIC auto length(const char *json_c_string) -> uint64_t {
-    // Each symbol is wrapped in it's own ALC packet.
-    return symbol_count(json_c_string) * (2048 + strlen("ALC "));
+    // Each symbol is wrapped in it's own ALC packet, binary responses also start with a header.
+    return symbol_count(json_c_string) * (2048 + strlen("ALC ")) + LibFlute::RepairResponse::header_length;
 }
 
 extern "C" LIB_PUBLIC auto retrieve(const char *json_c_string, char* result) -> size_t {
@@ -1419,6 +1520,43 @@ extern "C" LIB_PUBLIC auto retrieve(const char *json_c_string, char* result) ->
     return result_str.length();
 }
 
+/**
+ * Parse a request once and build its response, without a separate length estimate.
+ *
+ * @param request This string holds a JSON or compact repair request.
+ * @param result Set to a buffer holding the response, release it with free_result.
+ * @param symbols Set to the number of requested symbols, may be null.
+ * @returns The length of the response.
+*/
+extern "C" LIB_PUBLIC auto retrieve_request(const char *request, char** result, uint64_t* symbols) -> size_t {
+    FluteTransmissionManager& fluteTransmissionManager = FluteTransmissionManager::getInstance();
+    StorageManager& storageManager = StorageManager::getInstance();
+
+    Data data = convert(request);
+    if (symbols) {
+        *symbols = data.symbols;
+    }
+    *result = nullptr;
+    auto result_str = fluteTransmissionManager.retrieve(data, storageManager.get_arguments().mtu);
+    if (result_str.empty()) {
+        return 0;
+    }
+    *result = static_cast<char*>(malloc(result_str.length()));
+    if (!*result) {
+        spdlog::error("Memory allocation failed for a response of {} bytes", result_str.length());
+        return 0;
+    }
+    memcpy(*result, result_str.data(), result_str.length());
+    return result_str.length();
+}
+
+/**
+ * Release a buffer returned by retrieve_request.
+*/
+extern "C" LIB_PUBLIC void free_result(char* result) {
+    free(result);
+}
+
 extern "C" LIB_PUBLIC void setup(int argc, char **argv) {
     // Load the arguments
     StorageManager& storageManager = StorageManager::getInstance();
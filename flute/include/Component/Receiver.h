@@ -16,6 +16,7 @@
 //
 #pragma once
 #include "Packet/AlcPacket.h"
+#include "Packet/AlcParkingBuffer.h"
 #include "Object/FileBase.h"
 #include "Object/File.h"
 #include "Object/FileStream.h"
@@ -26,10 +27,12 @@
 #include "Utils/IpSec.h"
 #include "Metric/Metrics.h"
 #include "Utils/FakeNetworkSocket.h"
+#include <atomic>
 #include <iostream>
 #include <map>
 #include <mutex>
 #include <memory>
+#include <set>
 #include <string>
 #include <thread>
 #include <vector>
@@ -119,6 +122,67 @@ namespace LibFlute {
       */
      void register_emit_message_callback(emit_message_callback_t cb) { _emit_message_cb = cb; };
 
+     /**
+      *  Configure the pool of keep-alive connections used to fetch repair data.
+      *
+      *  @param options Connection limit, pipeline depth and timeouts of the pool
+      */
+      void set_repair_pool_options(const LibFlute::ConnectionPool::Options& options) { _fetcher.set_pool_options(options); };
+
+     /**
+      *  Send the repair requests of all files that are fetched within this window as one request, if the
+      *  server accepts that. 0 sends a request per file.
+      */
+      void set_repair_batch_window(std::chrono::milliseconds window) { _fetcher.set_batch_window(window); };
+
+     /**
+      *  Give up on repairing a file once it is this long past its deadline. 0 repairs files however late they are.
+      */
+      void set_repair_deadline_grace(std::chrono::milliseconds grace) { _fetcher.set_deadline_grace(grace); };
+
+     /**
+      *  Costs that decide between repair symbols and fetching source blocks or whole objects with a GET.
+      */
+      void set_repair_cost_model(const LibFlute::Fetcher::CostModel& cost_model) { _fetcher.set_cost_model(cost_model); };
+
+     /**
+      *  Moving average of the share of symbols lost in the session, sampled per file when it is repaired or
+      *  completes without repair.
+      */
+      double loss_estimate() const { return _loss_estimate.load(std::memory_order_relaxed); };
+
+     /**
+      *  Interarrival jitter of the packets that carry EXT_TIME in seconds (RFC 3550 6.4.1), 0 until two arrived.
+      *  The one-way delay and the jitter are recorded per packet in the histograms alc_one_way_delay_seconds and
+      *  alc_jitter_seconds, labelled with the TSI. The delay is only meaningful when the clocks of sender and
+      *  receiver are synchronised, the jitter does not depend on it. Negative delays (the receiver clock is
+      *  behind) are only counted, in alc_one_way_delay_negative.
+      */
+      double jitter() const { return _jitter.load(std::memory_order_relaxed); };
+
+     /**
+      *  Start receiving a file as soon as a packet of it carries EXT_FTI, instead of buffering its packets
+      *  until its FDT entry arrives. The file is handed on once the entry arrived and its MD5 matched.
+      *  Not used when receiving is limited to video ids, those are only known from the entry.
+      *
+      *  @param max_files Files received like this at the same time, 0 disables it
+      *  @param max_length Largest transfer length to allocate for such a file
+      */
+      void set_provisional_reception(size_t max_files, uint64_t max_length) {
+        const std::lock_guard<LockableBase(std::mutex)> lock(_files_mutex);
+        _max_provisional_files = max_files;
+        _max_provisional_length = max_length;
+      };
+
+     /**
+      *  Limit the packets that are kept for TOIs without an FDT entry yet. Expired backlogs are evicted once
+      *  a second.
+      */
+      void set_parking_limits(const AlcParkingBuffer::Limits& limits) {
+        const std::lock_guard<LockableBase(std::mutex)> lock(_files_mutex);
+        _unknown_alcs.set_limits(limits);
+      };
+
       void stop() { _running = false; }
 
       void resolve_fdt_for_buffered_alcs();
@@ -135,14 +199,26 @@ namespace LibFlute {
       void handle_alc_step_one(char* data, size_t len, bool buffer_if_unknown);
       void handle_alc_step_two(std::shared_ptr<AlcPacket> alc_ptr, bool buffer_if_unknown);
       void handle_alc_step_three(std::shared_ptr<AlcPacket> alc_ptr);
-      void handle_fdt_step_one();
+      LibFlute::FileDeliveryTable::Changes apply_fdt(uint32_t instance_id, const char* data, size_t length);
+      void handle_fdt_step_one(const std::vector<LibFlute::FileDeliveryTable::FileEntry>& added);
       void handle_fdt_step_two();
+      void handle_file_completion(std::shared_ptr<LibFlute::FileBase> file);
+      void handle_fetched_object(uint32_t toi, uint64_t offset, const char* data, size_t length);
+      void sample_loss(double loss);
+      void sample_sender_time(const SenderTime& sender_time, uint64_t received_at);
       void pop_toi_from_buffer_fronts(uint64_t toi);
       void await_file_spawn_threads();
       void spawn_file(const LibFlute::FileDeliveryTable::FileEntry& entry);
+      bool spawn_provisional_file(const std::shared_ptr<AlcPacket>& alc_ptr);
+      void evict_parked_alcs(const boost::system::error_code& error);
+      void publish_files();
+      std::shared_ptr<LibFlute::FileBase> find_file(uint64_t toi) const;
+      // Copy of the repaired packet being handled, declared before the fetcher so it outlives its IO thread
+      std::vector<char> _repair_packet_buffer;
       LibFlute::Fetcher _fetcher;
       boost::asio::ip::udp::socket _socket;
       boost::asio::ip::udp::endpoint _sender_endpoint;
+      boost::asio::steady_timer _parking_timer;
 
       std::shared_ptr<LibFlute::FakeNetworkSocket> _fake_network_socket = nullptr;
 
@@ -150,8 +226,18 @@ namespace LibFlute {
       char _data[max_length];
       uint64_t _tsi;
       std::unique_ptr<LibFlute::FileDeliveryTable> _fdt;
-      std::map<uint64_t, std::shared_ptr<LibFlute::FileBase>> _files;
+      typedef std::map<uint64_t, std::shared_ptr<LibFlute::FileBase>> file_map_t;
+      file_map_t _files;
+      // Copy of _files for the packet path and readers that must not wait for FDT handling. It is replaced, never
+      // changed, under the files mutex, so it is read without the mutex. A removed file stays alive until the
+      // last reader of an older copy lets go of it.
+      std::atomic<std::shared_ptr<const file_map_t>> _published_files{std::make_shared<const file_map_t>()};
       std::map<uint64_t, std::vector<uint64_t>> _stream_tois;
+      std::set<uint64_t> _provisional_tois;
+      size_t _max_provisional_files = 32;
+      uint64_t _max_provisional_length = 64 * 1024 * 1024;
+      // Provisional files that completed before their FDT entry, handed on after the FDT was handled
+      std::vector<std::shared_ptr<LibFlute::FileBase>> _adopted_files;
       mutable TracyLockable(std::mutex, _spawn_files_mutex);
       mutable TracyLockable(std::mutex, _files_mutex);
       mutable TracyLockable(std::mutex, _buffer_mutex);
@@ -161,10 +247,19 @@ namespace LibFlute {
       completion_callback_t _completion_cb = nullptr;
       emit_message_callback_t _emit_message_cb = nullptr;
 
-      boost::circular_buffer_space_optimized<std::shared_ptr<LibFlute::AlcPacket>> _unknown_alc_buffer;
+      // Packets of TOIs without an FDT entry yet, guarded by the files mutex
+      LibFlute::AlcParkingBuffer _unknown_alcs;
       boost::circular_buffer_space_optimized<std::shared_ptr<LibFlute::AlcPacket>> _alc_buffer;
 
       bool _running = true;
+      std::atomic<double> _loss_estimate{0};
+
+      // One-way delay of the packets with EXT_TIME, only touched from the receive path
+      std::shared_ptr<LibFlute::Metric::Histogram> _one_way_delay_histogram;
+      std::shared_ptr<LibFlute::Metric::Histogram> _jitter_histogram;
+      int64_t _last_transit = 0; // Receive minus sender time of the last one, in NTP format
+      bool _has_last_transit = false;
+      std::atomic<double> _jitter{0};
 
       std::vector<std::jthread> _file_spawn_threads;
       std::shared_ptr<std::vector<std::string>> _video_ids_ptr;
@@ -0,0 +1,197 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+#include <boost/asio.hpp>
+#include "Object/FileBase.h"
+#include "Recovery/EncodedObjectCache.h"
+#include "Recovery/RepairRequest.h"
+
+#include "public/tracy/Tracy.hpp"
+
+namespace LibFlute {
+  /**
+   *  HTTP/1.1 server for unicast repair, to embed in a transmitter or to run on its own.
+   *
+   *  - POST (any path): a repair request (see RepairRequest), answered with the missing ALC packets. The file
+   *    is taken from the live file table (set_file_lookup) when it is still there, and read from storage
+   *    (through an EncodedObjectCache) otherwise. A batch of requests for several files gets one response.
+   *  - GET /fdt: the current FDT (set_fdt_lookup, or last.fdt in the storage root).
+   *  - GET /time: the current UTC time.
+   *  - GET of any other path: the file from storage, streamed in chunks. A single byte range may be asked for.
+   *
+   *  Connections are kept alive and requests may be pipelined, responses are always sent in request order.
+   *  Socket IO runs on Options::io_threads threads, repair requests are encoded on Options::worker_threads
+   *  threads and picked earliest deadline first. The deadline is taken from the X-Deadline header (ms since
+   *  the epoch), the deadline of the live file, or now + Options::default_deadline. Requests are limited per
+   *  client address with a token bucket, clients over their rate get 429 and a full queue gives 503.
+   */
+  class RepairServer {
+    public:
+      struct Options {
+        std::string address = "0.0.0.0";
+        unsigned short port = 8080; // 0 picks a free port, see port()
+        size_t io_threads = 2;
+        size_t worker_threads = 4;
+        uint64_t tsi = 16;
+        unsigned short mtu = 1500; // Path MTU to size ALC packets for
+        std::string storage_root = "."; // Files are looked up relative to this directory
+        size_t cache_bytes = 256 * 1024 * 1024; // Budget of the cache of encoded files, 0 disables it
+        size_t max_request_size = 4 * 1024 * 1024; // Largest accepted request body
+        size_t max_pipeline_depth = 16; // Requests in progress per connection before reading stops
+        size_t max_queue_length = 4096; // Repair requests waiting for a worker before new ones are rejected
+        double client_rate = 0; // Repair requests per second per client address, 0 = unlimited
+        double client_burst = 50; // Requests a client may send at once before the rate applies
+        std::chrono::milliseconds default_deadline = std::chrono::milliseconds(1000);
+        std::chrono::milliseconds idle_timeout = std::chrono::milliseconds(30000);
+        size_t stream_chunk_size = 64 * 1024; // Chunk size when streaming files from storage
+      };
+
+     /**
+      *  Look up a file of the live file table by TOI, returns nullptr if it is not there (anymore).
+      *  Called from the IO threads to find the deadline of a request, so it should not block.
+      */
+      typedef std::function<std::shared_ptr<FileBase>(uint64_t toi)> file_lookup_t;
+
+     /**
+      *  Return the current FDT, empty if there is none. Called from the worker threads.
+      */
+      typedef std::function<std::string()> fdt_lookup_t;
+
+     /**
+      *  Map a content location to a path on disk.
+      */
+      typedef std::function<std::string(const std::string& content_location)> location_resolver_t;
+
+      RepairServer(const Options& options);
+      RepairServer();
+
+     /**
+      *  Stops the server.
+      */
+      virtual ~RepairServer();
+
+      void set_file_lookup(file_lookup_t lookup) { _file_lookup = std::move(lookup); };
+      void set_fdt_lookup(fdt_lookup_t lookup) { _fdt_lookup = std::move(lookup); };
+      void set_location_resolver(location_resolver_t resolver) { _location_resolver = std::move(resolver); };
+
+     /**
+      *  Share a cache of encoded files, instead of the one sized by Options::cache_bytes.
+      */
+      void set_cache(std::shared_ptr<EncodedObjectCache> cache) { _cache = std::move(cache); };
+
+     /**
+      *  Bind, listen and start the IO and worker threads. Throws if the address can not be bound.
+      */
+      void start();
+
+     /**
+      *  Close all connections and join the threads. Requests that were not answered yet are dropped.
+      */
+      void stop();
+
+     /**
+      *  Port the server listens on, useful when it was started on port 0.
+      */
+      unsigned short port() const { return _port; };
+
+     /**
+      *  Answer a repair request synchronously, as the workers do.
+      *
+      *  @param live_file The file from the live file table, read from storage if nullptr
+      *
+      *  @return The response body, empty if the file could not be found
+      */
+      std::string repair(const RepairRequest& request, std::shared_ptr<FileBase> live_file = nullptr);
+
+     /**
+      *  Answer a batch of repair requests with one response, in the encoding of the first request.
+      *
+      *  @param live_files The files from the live file table, by index in the batch (nullptr if not there)
+      *
+      *  @return The response body, empty if none of the files could be found
+      */
+      std::string repair(const std::vector<RepairRequest>& batch, const std::vector<std::shared_ptr<FileBase>>& live_files);
+
+     /**
+      *  Path on disk of a content location, through the location resolver if one is set.
+      *
+      *  @return Empty if the location is not allowed (it leaves the storage root)
+      */
+      std::string resolve(const std::string& content_location) const;
+
+    private:
+      class Session;
+
+      struct Job {
+        uint64_t deadline_ms;
+        uint64_t sequence; // Keeps jobs with the same deadline in arrival order
+        std::function<void()> run;
+
+        bool operator>(const Job& other) const {
+          return deadline_ms != other.deadline_ms ? deadline_ms > other.deadline_ms : sequence > other.sequence;
+        }
+      };
+
+      struct Bucket {
+        double tokens;
+        std::chrono::steady_clock::time_point updated;
+      };
+
+      std::string repair(const RepairRequest& request, std::shared_ptr<FileBase> live_file, RepairResponse::Encoding encoding);
+      void accept();
+      bool enqueue(uint64_t deadline_ms, std::function<void()> run);
+      void work();
+      bool allow(const std::string& client);
+
+      Options _options;
+      unsigned short _port = 0;
+      file_lookup_t _file_lookup;
+      fdt_lookup_t _fdt_lookup;
+      location_resolver_t _location_resolver;
+      std::shared_ptr<EncodedObjectCache> _cache;
+
+      boost::asio::io_service _io_service;
+      std::unique_ptr<boost::asio::io_service::work> _io_work;
+      boost::asio::ip::tcp::acceptor _acceptor;
+      std::vector<std::jthread> _io_threads;
+      std::atomic<bool> _running = false;
+
+      TracyLockable(std::mutex, _sessions_mutex);
+      std::set<std::shared_ptr<Session>> _sessions;
+
+      TracyLockable(std::mutex, _queue_mutex);
+      std::condition_variable_any _queue_cv;
+      std::priority_queue<Job, std::vector<Job>, std::greater<Job>> _queue;
+      uint64_t _job_sequence = 0;
+      bool _stop_workers = false;
+      std::vector<std::jthread> _workers;
+
+      TracyLockable(std::mutex, _buckets_mutex);
+      std::map<std::string, Bucket> _buckets;
+  };
+};
@@ -21,6 +21,9 @@
 #include "Object/FileBase.h"
 #include "Packet/AlcPacket.h"
 #include "Object/FileDeliveryTable.h"
+#include "Recovery/EncodedObjectCache.h"
+#include "Recovery/RepairRequest.h"
+#include "Recovery/RepairResponse.h"
 #include "Utils/flute_types.h"
 
 namespace LibFlute {
@@ -51,6 +54,8 @@ namespace LibFlute {
       *  @param expires Expiry timestamp (based on NTP epoch)
       *  @param data Pointer to the data buffer (managed by caller)
       *  @param length Length of the data buffer (in bytes)
+      *  @param encoding Framing of the response, see RepairResponse
+      *  @param needed Number of fresh repair symbols per source block, for FEC schemes that can create them
       *
       *  @return TOI of the file
       */
@@ -60,11 +65,46 @@ namespace LibFlute {
           char* data,
           size_t length,
           uint64_t toi,
-          std::map<uint32_t,std::vector<uint32_t>> search_map);
+          std::map<uint32_t,std::vector<uint32_t>> search_map,
+          RepairResponse::Encoding encoding = RepairResponse::Encoding::Legacy,
+          const std::map<uint32_t, RepairRequest::Needed>& needed = {});
 
+     /**
+      *  Return the requested symbols of a file.
+      *
+      *  @param search_map Missing ESIs per source block
+      *  @param encoding Framing of the response, see RepairResponse
+      *  @param needed Number of fresh repair symbols per source block, for FEC schemes that can create them
+      */
       std::string get_alcs_from_file(
           std::shared_ptr<FileBase> file,
-          std::map<uint32_t,std::vector<uint32_t>> search_map);
+          std::map<uint32_t,std::vector<uint32_t>> search_map,
+          RepairResponse::Encoding encoding = RepairResponse::Encoding::Legacy,
+          const std::map<uint32_t, RepairRequest::Needed>& needed = {});
+
+     /**
+      *  Read a file from storage and return the requested symbols. The encoded file is taken from the
+      *  cache (see set_cache) when possible, and added to it otherwise.
+      *
+      *  @param path Location of the file on disk
+      *  @param content_location URI of the file, as known to the receivers
+      *  @param toi TOI to put in the ALC packets
+      *
+      *  @return The response body, empty if the file could not be read
+      */
+      std::string get_alcs_from_storage(const std::string& path,
+          const std::string& content_location,
+          const std::string& content_type,
+          uint32_t expires,
+          uint64_t toi,
+          const std::map<uint32_t,std::vector<uint32_t>>& search_map,
+          RepairResponse::Encoding encoding = RepairResponse::Encoding::Legacy,
+          const std::map<uint32_t, RepairRequest::Needed>& needed = {});
+
+     /**
+      *  Share a cache of encoded files between retrievers. Without one every request encodes the file again.
+      */
+      void set_cache(std::shared_ptr<EncodedObjectCache> cache) { _cache = std::move(cache); };
 
      /**
       *  Convenience function to get the current timestamp for expiry calculation
@@ -79,6 +119,13 @@ namespace LibFlute {
       FecScheme get_fec_scheme() { return _fec_oti.encoding_id; }
 
     private:
+      std::string encode_symbols(
+          std::shared_ptr<FileBase> file,
+          uint64_t toi,
+          const std::map<uint32_t,std::vector<uint32_t>>& search_map,
+          RepairResponse::Encoding encoding,
+          const std::map<uint32_t, RepairRequest::Needed>& needed);
+
       uint64_t _tsi;
       uint16_t _mtu;
 
@@ -88,5 +135,7 @@ namespace LibFlute {
 
       uint32_t _max_payload;
       FecOti _fec_oti{};
+
+      std::shared_ptr<EncodedObjectCache> _cache;
   };
 };
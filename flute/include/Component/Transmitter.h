@@ -16,10 +16,13 @@
 #pragma once
 #include <boost/asio.hpp>
 #include <boost/bind/bind.hpp>
+#include <chrono>
 #include <queue>
+#include <set>
 #include <string>
 #include <map>
 #include <mutex>
+#include <vector>
 #include "Object/FileBase.h"
 #include "Object/File.h"
 #include "Object/FileStream.h"
@@ -27,6 +30,7 @@
 #include "Object/FileDeliveryTable.h"
 #include "Utils/flute_types.h"
 #include "Utils/FakeNetworkSocket.h"
+#include "Utils/AsyncFileWriter.h"
 
 #include "public/tracy/Tracy.hpp"
 
@@ -65,7 +69,7 @@ namespace LibFlute {
                    short port, uint64_t tsi, unsigned short mtu,
                    uint32_t rate_limit,
                    FecScheme fec_scheme,
-                   boost::asio::io_service& io_service, uint16_t toi, uint32_t instance_id);
+                   boost::asio::io_service& io_service, uint32_t toi, uint32_t instance_id);
 
      /**
       *  Default destructor.
@@ -91,9 +95,9 @@ namespace LibFlute {
       *  @param data Pointer to the data buffer (managed by caller)
       *  @param length Length of the data buffer (in bytes)
       *
-      *  @return TOI of the file
+      *  @return TOI of the file. TOIs are 32 bit, they wrap around to 1 and skip the TOIs of files still being sent.
       */
-      uint16_t send(
+      uint32_t send(
         const std::string& content_location,
         const std::string& content_type,
         uint32_t expires,
@@ -102,7 +106,7 @@ namespace LibFlute {
         size_t length);
 
         
-      uint16_t create_empty_file_for_stream(
+      uint32_t create_empty_file_for_stream(
         uint32_t stream_id, 
         const std::string& content_type,
         uint32_t expires,
@@ -148,7 +152,7 @@ namespace LibFlute {
           _remove_after_transmission = remove_after_transmission;
       }
 
-      std::vector<uint16_t> remove_expired_files();
+      std::vector<uint32_t> remove_expired_files();
 
       void set_fake_network_socket(std::shared_ptr<LibFlute::FakeNetworkSocket> fake_network_socket) {
           _fake_network_socket = fake_network_socket;
@@ -156,12 +160,79 @@ namespace LibFlute {
 
       std::string fdt_string();
 
+     /**
+      *  Send FDT instances compressed, signalled with EXT_CENC. Instances below the threshold size, or that would
+      *  not get smaller, are sent as they are.
+      *
+      *  @param encoding ZLIB, DEFLATE or GZIP, NONE sends all instances uncompressed (the default)
+      *  @param level zlib compression level, 0 (none) to 9 (best), -1 for the zlib default
+      *  @param threshold Size in bytes of the serialized FDT from which on it is compressed
+      */
+      void set_fdt_compression(ContentEncoding encoding, int level = -1, size_t threshold = 1024);
+
+     /**
+      *  Which files are sent with a content encoding. The receiver decodes them before handing them on.
+      */
+      struct ContentEncodingPolicy {
+        ContentEncoding encoding = ContentEncoding::NONE; // NONE sends all files as they are (the default)
+        int level = -1; // zlib compression level, -1 for the zlib default
+        size_t min_length = 1024; // Smaller files are sent as they are
+        // Content types (without parameters) to encode, entries ending in '/' match all subtypes
+        std::vector<std::string> content_types = {
+          "text/", "application/dash+xml", "application/json", "application/xml",
+          "application/vnd.apple.mpegurl", "application/x-mpegURL", "application/ttml+xml"};
+      };
+
+     /**
+      *  Encode the files passed to send() from now on according to the policy. Files that would not get
+      *  smaller are sent as they are. Streams are never encoded.
+      */
+      void set_content_encoding_policy(const ContentEncodingPolicy& policy);
+
+     /**
+      *  When the FDT is sent besides announcing new files. A file is never sent before an FDT instance that
+      *  lists it was sent, those announcements go out at once. Repetitions let receivers that join late find
+      *  the files in transmission, the more often they are sent the fewer packets a receiver has to buffer.
+      */
+      struct FdtSchedule {
+        std::chrono::milliseconds repeat_interval = std::chrono::milliseconds(1000); // Repeat the FDT at least this often while files are sent
+        unsigned repeat_packets = 0; // Also repeat it after this many data packets, 0 = only by time
+        unsigned interleave = 0; // Data packets sent between two packets of a repetition, 0 sends a repetition at once
+      };
+
+      void set_fdt_schedule(const FdtSchedule& schedule);
+
+     /**
+      *  Send EXT_FTI on the packets of files too, so receivers can start on a file before its FDT entry arrives.
+      *  It goes on the packets that carry a symbol whose ESI is a multiple of the interval, which includes the
+      *  first packet of every source block.
+      *
+      *  @param interval In symbols, 0 only sends EXT_FTI with the FDT (the default)
+      */
+      void set_inband_fti(unsigned interval) { _inband_fti_interval = interval; };
+
+     /**
+      *  Send EXT_TIME with the current time of the sender on a subset of the packets of files, so receivers can
+      *  measure the one-way delay and jitter. A packet that carries EXT_FTI has no room for it, the timestamp then
+      *  goes on the next packet. Packets of the FDT are not timestamped.
+      *
+      *  @param interval Timestamp every interval-th packet, 0 disables EXT_TIME (the default)
+      *  @param expected_residual_time Also send the time left until the deadline of the file (ERT), if it has one
+      */
+      void set_sender_time(unsigned interval, bool expected_residual_time = false) {
+        _sender_time_interval = interval;
+        _sender_time_ert = expected_residual_time;
+      };
+
     private:
+      bool should_encode(const std::string& content_type, size_t length) const;
+
       void send_fdt(bool should_lock);
       void send_next_packet();
       void fdt_send_tick();
 
       void file_transmitted(uint32_t toi, bool should_lock);
+      uint32_t allocate_toi();
 
       std::shared_ptr<LibFlute::FakeNetworkSocket> _fake_network_socket = nullptr;
 
@@ -177,11 +248,30 @@ namespace LibFlute {
       uint16_t _mtu;
 
       std::unique_ptr<LibFlute::FileDeliveryTable> _fdt;
+      // The FDT is only packetized again when its content changed, repetitions reuse its file and packets
+      std::shared_ptr<const std::string> _fdt_content;
+      std::shared_ptr<LibFlute::FileBase> _fdt_file;
+      std::map<uint64_t, std::shared_ptr<LibFlute::AlcPacket>> _fdt_packets;
+      LibFlute::AsyncFileWriter _fdt_writer{"last.fdt"};
       std::map<uint32_t, std::shared_ptr<LibFlute::FileBase>> _files;
       TracyLockable(std::mutex, _files_mutex);
 
-      unsigned _fdt_repeat_interval = 1; // Seconds
-      uint16_t _toi = 1;
+      FdtSchedule _fdt_schedule;
+      unsigned _fdt_repeat_interval = 1; // Seconds, the schedule's interval rounded up, for the expiry of the FDT
+      std::set<uint32_t> _unannounced_tois; // Files that were not listed in a completely queued FDT yet
+      std::set<uint32_t> _fdt_file_tois; // Files listed in the FDT that is being sent
+      bool _fdt_announces = false; // The FDT that is being sent announces new files, it is not interleaved
+      unsigned _data_packets_since_fdt = 0;
+      unsigned _data_packets_since_fdt_packet = 0;
+      unsigned _inband_fti_interval = 0;
+      unsigned _sender_time_interval = 0;
+      bool _sender_time_ert = false;
+      unsigned _packets_since_sender_time = 0;
+      ContentEncoding _fdt_encoding = ContentEncoding::NONE;
+      int _fdt_compression_level = -1;
+      size_t _fdt_compression_threshold = 1024;
+      ContentEncodingPolicy _content_encoding_policy;
+      uint32_t _toi = 1;
 
       uint32_t _max_payload;
       FecOti _fec_oti;
@@ -90,6 +90,18 @@ namespace LibFlute {
 
             virtual void discard_decoder(uint16_t block_id) = 0;
 
+            /**
+             * @brief Create repair symbols of a source block beyond the ones create_blocks() encoded, for schemes that can create any number of them
+             *
+             * @param buffer a pointer to the buffer containing the data of the file
+             * @param block_id the source block id
+             * @param first_id the id of the first symbol to create
+             * @param count the number of symbols to create
+             * @param out a buffer of count times the symbol size to write the symbols to
+             * @return false if the scheme can not create additional symbols
+             */
+            virtual bool create_repair_symbols(char * /*buffer*/, uint16_t /*block_id*/, uint32_t /*first_id*/, uint32_t /*count*/, char * /*out*/) { return false; }
+
             uint32_t nof_source_symbols = 0;
             uint32_t nof_source_blocks = 0;
             uint32_t large_source_block_length = 0;
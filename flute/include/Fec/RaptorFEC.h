@@ -49,6 +49,11 @@ namespace LibFlute {
 
         bool add_fdt_info(tinyxml2::XMLElement *file, LibFlute::FecOti global_fec_oti);
 
+        /**
+         * @brief Set up decoding from the FEC OTI of an EXT_FTI header extension, instead of from the FDT
+         */
+        bool parse_fti(const LibFlute::FecOti& fec_oti);
+
         void *allocate_file_buffer(int min_length);
 
         bool extract_file(std::map<uint16_t, LibFlute::SourceBlock> blocks);
@@ -59,8 +64,12 @@ namespace LibFlute {
 
         void discard_decoder(uint16_t block_id);
 
+        bool create_repair_symbols(char *buffer, uint16_t block_id, uint32_t first_id, uint32_t count, char *out);
+
         std::map<uint16_t, struct dec_context* > decoders; // map of source block number to decoders
 
+        std::map<uint16_t, struct enc_context* > encoders; // map of source block number to the encoders of repair symbols
+
         uint32_t nof_source_symbols = 0;
         uint32_t nof_source_blocks = 0;
         uint32_t large_source_block_length = 0;
@@ -0,0 +1,67 @@
+// Modified version of https://github.com/jupp0r/prometheus-cpp/blob/66e60b47c3bf5a2f81707a6c236214e788c58525/core/include/prometheus/counter.h
+
+#pragma once
+
+
+#include <memory>
+#include <mutex>
+#include <string>
+
+#include "Metric/MetricsSink.h"
+
+#include "public/tracy/Tracy.hpp"
+
+namespace LibFlute {
+namespace Metric {
+
+/// \brief A counter metric to represent a monotonically increasing value.
+///
+/// This class represents the metric type counter:
+/// https://prometheus.io/docs/concepts/metric_types/#counter
+///
+/// The value of the counter can only increase. Example of counters are:
+/// - the number of requests served
+/// - tasks completed
+/// - errors
+///
+/// Do not use a counter to expose a value that can decrease - instead use a
+/// Gauge.
+///
+/// The class is thread-safe. No concurrent call to any API of this type causes
+/// a data race.
+class Counter {
+ public:
+  static const char* metric_type;
+
+  /// \brief Create a counter that starts at 0.
+  Counter(const std::string&, const std::string&);
+
+  /// \brief Increment the counter by 1.
+  void Increment();
+
+  /// \brief Increment the counter by a given amount.
+  ///
+  /// The counter will not change if the given amount is negative.
+  void Increment(double);
+
+  /// \brief Get the current value of the counter.
+  double Value() const;
+
+  /// \brief Get the name of the counter.
+  const std::string& Name() const { return _name; }
+
+  /// \brief Log every change of the counter to the given sink.
+  void setSink(std::shared_ptr<MetricsSink> sink);
+
+ private:
+  double _value = 0.0;
+
+  std::string _name;
+  std::string _doc;
+  std::shared_ptr<MetricsSink> _sink;
+  uint32_t _sinkId = 0;
+  mutable TracyLockable(std::mutex, _mutex); // Mutex to protect the value
+};
+
+}  // namespace Metric
+}  // namespace LibFlute
@@ -3,9 +3,12 @@
 #pragma once
 
 
+#include <memory>
 #include <mutex>
 #include <string>
 
+#include "Metric/MetricsSink.h"
+
 #include "public/tracy/Tracy.hpp"
 
 namespace LibFlute {
@@ -51,17 +54,21 @@ class Gauge {
   /// \brief Get the current value of the gauge.
   double Value() const;
 
-  void setLogFile(const std::string& filename);
+  /// \brief Get the name of the gauge.
+  const std::string& Name() const { return _name; }
+
+  /// \brief Log every change of the gauge to the given sink.
+  void setSink(std::shared_ptr<MetricsSink> sink);
 
  private:
   void Change(double);
   double _value = 0.0;
-  void writeToLog();
 
   std::string _name;
   std::string _doc;
-  std::string _logFilename;
-  TracyLockable(std::mutex, _mutex); // Mutex to protect the value
+  std::shared_ptr<MetricsSink> _sink;
+  uint32_t _sinkId = 0;
+  mutable TracyLockable(std::mutex, _mutex); // Mutex to protect the value
 };
 
 }  // namespace Metric
@@ -0,0 +1,96 @@
+// Modified version of https://github.com/jupp0r/prometheus-cpp/blob/66e60b47c3bf5a2f81707a6c236214e788c58525/core/include/prometheus/histogram.h
+
+#pragma once
+
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "public/tracy/Tracy.hpp"
+
+namespace LibFlute {
+namespace Metric {
+
+/// \brief A histogram metric to represent aggregatable distributions of events.
+///
+/// This class represents the metric type histogram:
+/// https://prometheus.io/docs/concepts/metric_types/#histogram
+///
+/// A histogram tracks the number of observations and the sum of the observed
+/// values, allowing to calculate the average of the observed values.
+///
+/// At its core a histogram has a counter per bucket. The sum of observations
+/// also behaves like a counter as long as there are no negative observations.
+///
+/// The class is thread-safe. No concurrent call to any API of this type causes
+/// a data race.
+class Histogram {
+ public:
+  using BucketBoundaries = std::vector<double>;
+  using Labels = std::map<std::string, std::string>;
+
+  static const char* metric_type;
+
+  /// \brief A consistent copy of the histogram state.
+  ///
+  /// bucket_counts are cumulative, the last entry is the +Inf bucket and
+  /// equals count.
+  struct Snapshot {
+    BucketBoundaries bucket_boundaries;
+    std::vector<uint64_t> bucket_counts;
+    uint64_t count;
+    double sum;
+  };
+
+  /// \brief Create a histogram with manually chosen buckets.
+  ///
+  /// The BucketBoundaries are a list of monotonically increasing values
+  /// representing the bucket boundaries. Each consecutive pair of values is
+  /// interpreted as a half-open interval [b_n, b_n+1) which defines one bucket.
+  ///
+  /// There is no limitation on how the buckets are divided, i.e, equal size,
+  /// exponential etc..
+  ///
+  /// The bucket boundaries cannot be changed once the histogram is created.
+  Histogram(const std::string&, const std::string&, const BucketBoundaries&);
+
+  /// \brief Create a histogram that is one of a family with the same name,
+  /// told apart by its labels.
+  Histogram(const std::string&, const std::string&, const BucketBoundaries&, const Labels&);
+
+  /// \brief Observe the given amount.
+  ///
+  /// The given amount selects the 'observed' bucket. The observed bucket is
+  /// chosen for which the given amount falls into the half-open interval [b_n,
+  /// b_n+1). The counter of the observed bucket is incremented. Also the total
+  /// sum of all observations is incremented.
+  void Observe(double value);
+
+  /// \brief Get a copy of the current state of the histogram.
+  Snapshot Collect() const;
+
+  /// \brief Get the name of the histogram.
+  const std::string& Name() const { return _name; }
+
+  /// \brief Get the labels of the histogram.
+  const Labels& GetLabels() const { return _labels; }
+
+  /// \brief Exponentially growing buckets: start, start*factor, ... (count boundaries)
+  static BucketBoundaries ExponentialBuckets(double start, double factor, size_t count);
+
+ private:
+  std::string _name;
+  std::string _doc;
+  const Labels _labels;
+  const BucketBoundaries _bucket_boundaries;
+  std::vector<uint64_t> _bucket_counts;
+  uint64_t _count = 0;
+  double _sum = 0.0;
+  mutable TracyLockable(std::mutex, _mutex); // Mutex to protect the buckets
+};
+
+}  // namespace Metric
+}  // namespace LibFlute
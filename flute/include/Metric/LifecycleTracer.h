@@ -0,0 +1,140 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "public/tracy/Tracy.hpp"
+
+namespace LibFlute {
+namespace Metric {
+
+/// \brief Records the lifecycle of every file of a session, keyed by TSI and TOI.
+///
+/// Each thread appends events to its own fixed-size ring, so recording never
+/// allocates and never contends with other threads. When a ring is full the
+/// oldest events of that thread are overwritten. Timestamps come from a
+/// monotonic clock and are relative to the creation of the tracer.
+///
+/// The tracer is disabled by default, in that state record() is a single
+/// relaxed atomic load. The collected events can be exported in the Chrome
+/// trace-event format (chrome://tracing, Perfetto): every TSI becomes a
+/// process, every TOI a row within it.
+class LifecycleTracer {
+public:
+    enum class Event : uint8_t {
+        // Sender
+        FileEnqueued,
+        EncodingDone,
+        FdtAnnounced,
+        FirstPacketSent,
+        LastPacketSent,
+        // Receiver
+        FdtReceived,
+        FirstSymbolReceived,
+        RepairRequested,
+        RepairReceived,
+        BlockDecoded,
+        FileVerified,
+        CompletionCallback,
+        FileWritten,
+    };
+
+    /// \brief Get the tracer instance.
+    static LifecycleTracer& getInstance();
+
+    /// \brief Start or stop recording. Already recorded events are kept.
+    void setEnabled(bool enabled);
+
+    bool enabled() const { return _enabled.load(std::memory_order_relaxed); }
+
+    /// \brief Set the number of events kept per thread.
+    ///
+    /// Only applies to threads that record their first event afterwards.
+    void setCapacity(size_t capacity);
+
+    /// \brief Record an event for a file. Does nothing while disabled.
+    ///
+    /// \param event The lifecycle event
+    /// \param tsi TSI of the session
+    /// \param toi TOI of the file
+    /// \param value Event specific value (block number, symbol count, bytes, ...)
+    void record(Event event, uint64_t tsi, uint64_t toi, int64_t value = 0) {
+        if (!enabled()) {
+            return;
+        }
+        append(event, tsi, toi, value);
+    }
+
+    /// \brief Attach a readable label (e.g. the content location) to a file.
+    void setLabel(uint64_t tsi, uint64_t toi, const std::string& label);
+
+    /// \brief Serialize all recorded events as Chrome trace-event JSON.
+    ///
+    /// The events of threads that have exited are handed out once, their
+    /// rings are dropped by the export.
+    std::string exportChromeTrace();
+
+    /// \brief Write the Chrome trace-event JSON to a file.
+    ///
+    /// \return false if the file could not be written
+    bool writeChromeTrace(const std::string& filename);
+
+    /// \brief Drop all recorded events and labels.
+    void clear();
+
+    static const char* eventName(Event event);
+
+private:
+    LifecycleTracer();
+
+    LifecycleTracer(const LifecycleTracer&) = delete;
+    LifecycleTracer& operator=(const LifecycleTracer&) = delete;
+
+    struct Entry {
+        int64_t timestamp_ns;
+        uint64_t tsi;
+        uint64_t toi;
+        int64_t value;
+        Event event;
+    };
+
+    // The owning thread is the only writer, the mutex is only contended
+    // while an export or clear is running.
+    struct Ring {
+        explicit Ring(size_t capacity, uint32_t thread_id);
+
+        TracyLockable(std::mutex, mutex);
+        std::vector<Entry> entries;
+        size_t next = 0;
+        bool wrapped = false;
+        uint32_t thread_id;
+    };
+
+    void append(Event event, uint64_t tsi, uint64_t toi, int64_t value);
+    Ring& localRing();
+    // Drop the rings of exited threads, all but the newest keep_exited of them. Must hold _rings_mutex.
+    void pruneRings(size_t keep_exited);
+
+    std::atomic<bool> _enabled{false};
+    std::atomic<size_t> _capacity{4096};
+    const std::chrono::steady_clock::time_point _epoch;
+
+    // Rings are shared with the registry so events survive the thread that recorded them, until they are
+    // exported. Short-lived threads that are never exported keep at most this many rings around.
+    static constexpr size_t max_exited_rings = 64;
+    TracyLockable(std::mutex, _rings_mutex);
+    std::vector<std::shared_ptr<Ring>> _rings;
+
+    TracyLockable(std::mutex, _labels_mutex);
+    std::map<std::pair<uint64_t, uint64_t>, std::string> _labels;
+};
+
+}  // namespace Metric
+}  // namespace LibFlute
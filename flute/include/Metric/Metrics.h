@@ -1,8 +1,12 @@
 
 #pragma once
 
+#include "Metric/Counter.h"
 #include "Metric/Gauge.h"
+#include "Metric/Histogram.h"
+#include "Metric/MetricsSink.h"
 #include "Metric/ThreadedCPUUsage.h"
+#include <chrono>
 #include <unordered_map>
 #include <memory>
 #include <mutex>
@@ -21,10 +25,30 @@ public:
     static Metrics& getInstance();
 
     std::shared_ptr<Gauge> getOrCreateGauge(const std::string& name);
-    void setLogFile(const std::string& filename);
+    // Drop a gauge from the registry, existing references stay valid
+    void removeGauge(const std::string& name);
+    std::shared_ptr<Counter> getOrCreateCounter(const std::string& name);
+    // The buckets are only used when the histogram does not exist yet
+    std::shared_ptr<Histogram> getOrCreateHistogram(const std::string& name, const Histogram::BucketBoundaries& buckets);
+    // One histogram of the family with this name, per set of labels
+    std::shared_ptr<Histogram> getOrCreateHistogram(const std::string& name, const Histogram::Labels& labels, const Histogram::BucketBoundaries& buckets);
 
-    // Add a thread to be monitored for CPU usage
-    void addThread(std::jthread::id threadId, std::string threadName);
+    // Render all counters, gauges and histograms in the Prometheus text exposition format (version 0.0.4)
+    std::string serialize();
+
+    // Log all gauge changes to a text file ("timestamp;name;value" lines), restoring the last logged values first
+    void setLogFile(const std::string& filename,
+                    std::chrono::milliseconds flushInterval = std::chrono::milliseconds(250));
+
+    // Log all gauge changes to a compact binary file, see MetricsLogReader to convert it to CSV
+    void setBinaryLogFile(const std::string& filename,
+                          std::chrono::milliseconds flushInterval = std::chrono::milliseconds(250));
+
+    // Write all pending samples to the log file
+    void flush();
+
+    // Add a thread to be monitored for CPU usage, threads of a group share one set of gauges
+    void addThread(std::jthread::id threadId, std::string threadName, const std::string& group = "");
 
     // Remove a thread from the list of monitored threads
     void removeThread(std::jthread::id threadId);
@@ -34,10 +58,15 @@ private:
     Metrics(const Metrics&) = delete; // Delete copy constructor
     Metrics& operator=(const Metrics&) = delete; // Delete assignment operator
 
+    void setSink(std::shared_ptr<MetricsSink> sink);
+
     static Metrics* _instance;
     TracyLockable(std::mutex, _mutex); // Mutex to protect the value
     std::string _logFilename;
+    std::shared_ptr<MetricsSink> _sink; // Background writer for the log file
     std::unordered_map<std::string, std::shared_ptr<Gauge>> _gauges;
+    std::unordered_map<std::string, std::shared_ptr<Counter>> _counters;
+    std::unordered_map<std::string, std::shared_ptr<Histogram>> _histograms;
     std::unique_ptr<ThreadedCPUUsage> threadedCPUUsage; // Threaded CPU usage gauge
 };
 
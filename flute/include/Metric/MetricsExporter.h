@@ -0,0 +1,66 @@
+#pragma once
+#define BOOST_BIND_GLOBAL_PLACEHOLDERS
+
+#include <chrono>
+#include <memory>
+#include <string>
+#include <thread>
+
+#include <boost/asio.hpp>
+
+namespace LibFlute {
+namespace Metric {
+
+/// \brief Serves the Metrics registry in the Prometheus text format.
+///
+/// A minimal HTTP/1.1 listener that answers "GET /metrics" with the output of
+/// Metrics::serialize(). It runs its own io_service on a dedicated thread and
+/// all handlers are serialized on a strand, so a scrape never runs on (or
+/// blocks) the io_service of the data path.
+class MetricsExporter {
+public:
+    /// \brief Listen on a TCP port.
+    ///
+    /// \param port Port to listen on
+    /// \param address Address to bind to, loopback by default
+    MetricsExporter(unsigned short port, const std::string& address = "127.0.0.1");
+
+    /// \brief Listen on a Unix domain socket, an existing socket file is replaced.
+    ///
+    /// Throws if something other than a socket exists at the path.
+    explicit MetricsExporter(const std::string& unix_socket_path);
+
+    /// \brief Stop listening and join the exporter thread.
+    ~MetricsExporter();
+
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+
+    /// \brief Create an exporter from an endpoint string.
+    ///
+    /// Accepted forms: "PORT", "ADDRESS:PORT" and "unix:PATH".
+    /// Throws if the endpoint cannot be parsed.
+    static std::unique_ptr<MetricsExporter> fromEndpoint(const std::string& endpoint);
+
+private:
+    template <typename Acceptor>
+    void accept(Acceptor& acceptor);
+
+    template <typename Socket>
+    void serve(std::shared_ptr<Socket> socket);
+
+    void start();
+
+    /// Time a connection gets to send its request and read the response
+    static constexpr std::chrono::seconds request_timeout{5};
+
+    boost::asio::io_service _io_service;
+    boost::asio::io_service::strand _strand;
+    std::unique_ptr<boost::asio::ip::tcp::acceptor> _tcp_acceptor;
+    std::unique_ptr<boost::asio::local::stream_protocol::acceptor> _unix_acceptor;
+    std::string _unix_socket_path;
+    std::jthread _io_service_thread;
+};
+
+}  // namespace Metric
+}  // namespace LibFlute
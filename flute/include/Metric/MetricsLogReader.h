@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <unordered_map>
+
+namespace LibFlute {
+namespace Metric {
+
+/// \brief Reader for the binary log files written by MetricsSink.
+///
+/// Iterates over the samples of a log in file order, resolving metric ids to
+/// their names. Throws when the file does not start with a valid header.
+class MetricsLogReader {
+public:
+    struct Sample {
+        int64_t timestamp_us;
+        std::string name;
+        double value;
+    };
+
+    explicit MetricsLogReader(const std::string& filename);
+
+    /// \brief Read the next sample.
+    ///
+    /// \return false at the end of the file, or when the file is truncated
+    bool next(Sample& sample);
+
+    /// \brief Write a sample as "YYYY-mm-dd HH:MM:SS.mmm,name,value" (local time).
+    static void writeCsvLine(std::ostream& out, const Sample& sample);
+
+    /// \brief Convert a binary log file to CSV, including a header row.
+    ///
+    /// \return Number of samples written
+    static size_t toCsv(const std::string& filename, std::ostream& out);
+
+private:
+    std::ifstream _file;
+    std::unordered_map<uint32_t, std::string> _names;
+};
+
+}  // namespace Metric
+}  // namespace LibFlute
@@ -0,0 +1,122 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "public/tracy/Tracy.hpp"
+
+namespace LibFlute {
+namespace Metric {
+
+/// \brief Background writer for metric samples.
+///
+/// Gauges push timestamped samples into a bounded lock-free ring, a single
+/// writer thread drains the ring every flush interval and appends the whole
+/// batch to the log file with one write call. The file is opened once, so the
+/// cost of logging no longer scales with the update rate of the gauges.
+///
+/// Two output formats are supported:
+///  - Text: the legacy "YYYY-mm-dd HH:MM:SS,mmm;name;value" lines.
+///  - Binary: a compact append-only record stream (see MetricsLogReader to
+///    convert it to CSV).
+///
+/// Binary layout (host byte order):
+///   header  : "FLMETRIC" | u16 version | u16 reserved | u32 reserved
+///   name    : u8 type=1 | u32 id | u16 length | name bytes
+///   sample  : u8 type=2 | u32 id | i64 unix time (us) | f64 value
+/// Name records always precede the first sample that refers to them. Ids are
+/// only valid within the session that defined them, appending a new session
+/// to an existing file simply redefines them.
+class MetricsSink {
+public:
+    enum class Format { Text, Binary };
+
+    static constexpr char binary_magic[8] = {'F', 'L', 'M', 'E', 'T', 'R', 'I', 'C'};
+    static constexpr uint16_t binary_version = 1;
+    static constexpr uint8_t record_name = 1;
+    static constexpr uint8_t record_sample = 2;
+
+    /// \brief Open (or create) the log file and start the writer thread.
+    ///
+    /// \param filename Path of the log file, samples are appended
+    /// \param format Output format
+    /// \param flush_interval Time between two batched writes
+    /// \param capacity Number of samples the ring can hold, rounded up to a power of two
+    MetricsSink(const std::string& filename, Format format,
+                std::chrono::milliseconds flush_interval = std::chrono::milliseconds(250),
+                size_t capacity = 1 << 16);
+
+    /// \brief Drain the remaining samples and stop the writer thread.
+    ~MetricsSink();
+
+    MetricsSink(const MetricsSink&) = delete;
+    MetricsSink& operator=(const MetricsSink&) = delete;
+
+    /// \brief Assign an id to a metric name. Ids are handed out sequentially.
+    uint32_t registerMetric(const std::string& name);
+
+    /// \brief Queue a sample. Never blocks, the sample is dropped if the ring is full.
+    void record(uint32_t id, double value);
+
+    /// \brief Write everything that is queued right now, from the calling thread.
+    void flush();
+
+    /// \brief Number of samples dropped because the ring was full.
+    uint64_t dropped() const { return _dropped.load(std::memory_order_relaxed); }
+
+    const std::string& filename() const { return _filename; }
+
+private:
+    struct Sample {
+        int64_t timestamp_us;
+        uint32_t id;
+        double value;
+    };
+
+    // Bounded multi-producer ring, each cell carries a sequence number that
+    // tells producers and the consumer whose turn it is (Vyukov style).
+    struct Cell {
+        std::atomic<size_t> sequence;
+        Sample sample;
+    };
+
+    bool pop(Sample& sample);
+    void writerThread();
+    void writeBatch();
+    void appendNames(std::string& out);
+    void appendSample(std::string& out, const Sample& sample);
+    void writeAll(const std::string& out);
+
+    std::string _filename;
+    Format _format;
+    std::chrono::milliseconds _flush_interval;
+    int _fd = -1;
+
+    std::unique_ptr<Cell[]> _cells;
+    size_t _mask;
+    alignas(64) std::atomic<size_t> _enqueue_pos{0};
+    alignas(64) size_t _dequeue_pos = 0;
+    std::atomic<uint64_t> _dropped{0};
+
+    TracyLockable(std::mutex, _names_mutex); // Protects _names
+    std::vector<std::string> _names;
+    std::vector<std::string> _known_names; // Writer side copy of _names
+
+    TracyLockable(std::mutex, _write_mutex); // Serializes the writer thread and flush()
+    std::string _batch;
+
+    std::mutex _wake_mutex;
+    std::condition_variable _wake;
+    std::atomic<bool> _stop{false};
+    std::jthread _writer_thread;
+};
+
+}  // namespace Metric
+}  // namespace LibFlute
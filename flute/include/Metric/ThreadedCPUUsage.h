@@ -5,6 +5,7 @@
 
 #include <algorithm>
 #include <atomic>
+#include <chrono>
 #include <iostream>
 #include <math.h>
 #include <memory>
@@ -12,9 +13,13 @@
 #include <string>
 #include <iostream>
 #include <thread>
+#include <unordered_map>
 #include <vector>
+#include <pthread.h>
+#include <time.h>
 #include <sys/resource.h>
 #include <sys/syscall.h>
+#include <sys/types.h>
 #include <unistd.h>
 
 #include "public/tracy/Tracy.hpp"
@@ -22,28 +27,80 @@
 namespace LibFlute {
 namespace Metric {
 
+/**
+ * Samples the CPU usage of registered threads.
+ *
+ * Threads register themselves (addThread has to be called from the thread
+ * that is being registered) and are tracked by their thread id. Every sample
+ * interval the kernel accounting of each thread is read and exposed, per
+ * label, through the following gauges:
+ *  - cpu_usage_<label>: CPU time over the last interval, in % of one core
+ *  - cpu_user_time_<label> / cpu_system_time_<label>: total time in seconds
+ *  - cpu_voluntary_ctx_switches_<label> / cpu_involuntary_ctx_switches_<label>
+ *  - cpu_last_core_<label>: the CPU a thread of the label last ran on
+ * The label is the thread name, or the group of the thread. Threads that share
+ * a label are summed, the totals keep the time of the threads that exited.
+ * The gauges of a thread name are dropped once its last thread has exited,
+ * those of a group stay, so short-lived threads (e.g. one per file) that share
+ * a group cost a single set of gauges.
+ */
 class ThreadedCPUUsage {
 public:
     ThreadedCPUUsage();
 
     ~ThreadedCPUUsage();
 
-    // Add a thread to be monitored for CPU usage
-    void addThread(std::jthread::id threadId, std::string threadName);
+    // Add the calling thread to be monitored for CPU usage, under its name or under group if that is not empty
+    void addThread(std::jthread::id threadId, std::string threadName, const std::string& group = "");
 
     // Remove a thread from the list of monitored threads
     void removeThread(std::jthread::id threadId);
 
 private:
-    struct ThreadGauge {
-        std::shared_ptr<Gauge> gauge;
-        std::jthread::id threadId;
+    struct ThreadSample {
+        uint64_t cpuTimeNs = 0;
+        double userSeconds = 0;
+        double systemSeconds = 0;
+        int64_t voluntaryCtxSwitches = 0;
+        int64_t involuntaryCtxSwitches = 0;
+        int lastCore = -1;
     };
 
-    std::vector<ThreadGauge> threadGauges; // List of thread gauges
-    TracyLockable(std::mutex, threadGaugesMutex); // Mutex to protect access to threadGauges
+    struct ThreadState {
+        pid_t tid;
+        clockid_t cpuClock; // From pthread_getcpuclockid, fails once the thread has exited
+        std::string name;
+        std::string label;
+
+        std::chrono::steady_clock::time_point lastSample;
+        ThreadSample last; // The totals at the last sample
+    };
+
+    struct LabelGauges {
+        size_t threads = 0;
+        bool keep = false; // Group gauges stay when the label has no threads
+        ThreadSample exited; // Totals of the threads that exited
+
+        std::shared_ptr<Gauge> usage;
+        std::shared_ptr<Gauge> userTime;
+        std::shared_ptr<Gauge> systemTime;
+        std::shared_ptr<Gauge> voluntaryCtxSwitches;
+        std::shared_ptr<Gauge> involuntaryCtxSwitches;
+        std::shared_ptr<Gauge> lastCore;
+    };
+
+    // Read the accounting of a thread, returns false if the thread no longer exists
+    static bool sampleThread(const ThreadState& thread, ThreadSample& sample);
+    static void removeGauges(const std::string& label);
+    // Fold the totals of a thread into its label and drop it, must hold threadsMutex
+    void retireThread(std::unordered_map<std::jthread::id, ThreadState>::iterator it);
+
+    std::unordered_map<std::jthread::id, ThreadState> threads; // Monitored threads by thread id
+    std::unordered_map<std::string, LabelGauges> labels; // Gauges by label
+    TracyLockable(std::mutex, threadsMutex); // Mutex to protect access to threads and labels
     std::jthread cpuUsageThread; // Thread for measuring CPU usage
     std::atomic<bool> stopThread; // Atomic flag to signal thread termination
+    std::chrono::milliseconds sampleInterval{250};
 
     void measureCPUUsageThread();
 };
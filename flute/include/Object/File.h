@@ -78,6 +78,22 @@ namespace LibFlute {
       */
       void put_symbol(const EncodingSymbol& symbol);
 
+      /**
+      *  Write a byte range of the object that was fetched as a whole. FEC encoded files only take the whole object.
+      */
+      void put_range(uint64_t offset, const char* data, size_t length);
+
+      /**
+      *  Inflate the completed transport object into a buffer of the content length, which replaces it
+      */
+      void decode_content();
+
+      /**
+      *  Free the buffer the file was created from (without copy_data) with the file. It must have been allocated
+      *  with malloc.
+      */
+      void take_buffer_ownership() { _own_buffer = true; };
+
       /**
       *  Get the data buffer
       */
@@ -27,6 +27,7 @@
 #include "Object/FileDeliveryTable.h"
 #include "Packet/AlcPacket.h"
 #include "Packet/EncodingSymbol.h"
+#include "Recovery/RepairRequest.h"
 
 #include "public/tracy/Tracy.hpp"
 
@@ -39,6 +40,11 @@ namespace LibFlute {
         typedef std::function<void(LibFlute::FileBase&, std::shared_ptr<std::map<uint16_t, std::vector<uint16_t>>>)> missing_callback_t;
 
         typedef std::function<void(std::shared_ptr<LibFlute::AlcPacket>)> receiver_callback_t;   
+
+        /**
+        *  Called with the source block number when a block of a received file completes. The content lock is held.
+        */
+        typedef std::function<void(LibFlute::FileBase&, uint16_t)> block_callback_t;
         /**
         *  Create a file from an FDT entry (used for reception)
         *
@@ -105,19 +111,69 @@ namespace LibFlute {
         /**
         *  Set the FDT instance ID
         */
-        void set_fdt_instance_id( uint16_t id);
+        void set_fdt_instance_id( uint32_t id);
 
         /**
         *  Get the FDT instance ID
         */
-        uint16_t fdt_instance_id();
+        uint32_t fdt_instance_id();
+
+        /**
+        *  Set the TSI of the session this file belongs to (used to key lifecycle trace events)
+        */
+        void set_tsi(uint64_t tsi) { _tsi = tsi; }
+
+        uint64_t tsi() const { return _tsi; }
+
+        /**
+        *  Returns true only for the first call, used to trace the first symbol sent or received
+        */
+        bool is_first_symbol() { return !_first_symbol_seen.exchange(true, std::memory_order_relaxed); }
+
+        /**
+        *  Returns true only for the first call, so a completed file is handed on once when several threads complete it
+        */
+        bool claim_completion() { return !_completion_claimed.exchange(true); }
+
+        /**
+        *  Whether the file was started from the EXT_FTI of its packets and its FDT entry did not arrive yet.
+        *  Provisional files are not handed on when they complete, that waits for the entry.
+        */
+        bool provisional() const { return _provisional; }
+
+        void set_provisional(bool provisional) { _provisional = provisional; }
+
+        /**
+        *  Take over the FDT entry of a provisional file. A file that completed in the meantime is verified
+        *  against the MD5 of the entry, it is received again if it does not match.
+        *
+        *  @return false if the entry describes another transport object, the file can not be kept then
+        */
+        bool adopt_entry(const LibFlute::FileDeliveryTable::FileEntry& entry);
+
+        /**
+        *  Number of symbols the file was split into, 0 for streams. Can be read without the content lock.
+        */
+        uint32_t nof_symbols() const { return _nof_symbols; }
+
+        /**
+        *  Number of symbols received so far, including repair symbols. Can be read without the content lock.
+        */
+        uint32_t symbols_received() const { return _symbols_received.load(std::memory_order_relaxed); }
 
         void register_missing_callback(missing_callback_t cb);
 
         void register_receiver_callback(receiver_callback_t cb);
 
+        void register_block_callback(block_callback_t cb);
+
         std::map<uint16_t, LibFlute::SourceBlock> get_source_blocks();
 
+        /**
+        *  Access the source blocks without copying them. Hold the content buffer lock while using them.
+        */
+        const std::map<uint16_t, LibFlute::SourceBlock>& source_blocks() const { return _source_blocks; }
+
         void retrieve_missing_parts();
 
         void push_alc_to_receive_buffer(const std::shared_ptr<AlcPacket>& alc);
@@ -136,6 +192,11 @@ namespace LibFlute {
 
         uint64_t time_before_deadline();
 
+        /**
+        *  Time (in ms since the epoch) the file should be complete at, 0 if the FDT did not set one
+        */
+        uint64_t retrieval_deadline() const { return _retrieval_deadline; }
+
         virtual char* buffer() const;
 
         /**
@@ -147,6 +208,18 @@ namespace LibFlute {
         *  Write the data from an encoding symbol into the appropriate place in the buffer
         */
         virtual void put_symbol(const EncodingSymbol& symbol);
+
+        /**
+        *  Write a byte range of the object that was fetched as a whole (not as symbols), e.g. by HTTP. Symbols it
+        *  covers completely are completed as if they were received.
+        */
+        virtual void put_range(uint64_t offset, const char* data, size_t length);
+
+        /**
+        *  Replace the received transport object by the content it encodes (Content-Encoding), in place of its buffer.
+        *  Throws if it can not be decoded.
+        */
+        virtual void decode_content();
         
         /**
         *  Get the next encoding symbols that fit in max_size bytes
@@ -158,8 +231,33 @@ namespace LibFlute {
         */
         void mark_completed(const std::vector<EncodingSymbol>& symbols, bool success);
 
+        /**
+        *  Mark all symbols as not sent, so a completely transmitted file is transmitted again
+        */
+        void rewind();
+
+        /**
+        *  True when get_next_symbols has handed out all symbols, they may not have been sent yet
+        */
+        bool all_symbols_queued();
+
         const std::unique_lock<LockableBase(std::mutex)> get_content_buffer_lock();
 
+        /**
+        *  Repair symbols of a block beyond the ones that were encoded into it, for FEC schemes that can create
+        *  any number of them. They are created once and kept with the file, so every request gets the same
+        *  symbols. ESIs below the ones of the block are moved up. Hold the content buffer lock while using them.
+        *
+        *  @return Empty if the scheme can not create additional symbols
+        */
+        std::vector<EncodingSymbol> fresh_repair_symbols(uint16_t sbn, uint32_t first_esi, uint32_t count);
+
+        /**
+        *  For FEC schemes that can create any number of repair symbols: the number of symbols each incomplete
+        *  block still needs and the first ESI after the ones that were received. Hold the content buffer lock.
+        */
+        std::map<uint16_t, RepairRequest::Needed> symbols_needed();
+
     protected:
         // More than one semaphore seems to drastically slow down the time it takes to create the blocks of one file.
         // Even though, this allows to create the blocks of multiple files in parallel, it is not worth it.
@@ -175,19 +273,35 @@ namespace LibFlute {
         void emit_missing_symbols();
 
         std::map<uint16_t, LibFlute::SourceBlock> _source_blocks;
+        uint32_t _nof_symbols = 0;
+        std::atomic<uint32_t> _symbols_received{0};
+
+        // Extra symbols asked on top of the source block length, the decoder rarely needs more
+        static constexpr uint32_t _repair_symbol_overhead = 2;
+
+        // Fresh repair symbols per block, the ones following the symbols of the block (sender)
+        std::map<uint16_t, std::vector<char>> _repair_symbols;
+        // Fresh repair symbols received per block and the ESI after the last one (receiver)
+        std::map<uint16_t, uint32_t> _repair_symbols_received;
+        std::map<uint16_t, uint32_t> _next_repair_esi;
 
         bool _complete = false;
 
         LibFlute::FileDeliveryTable::FileEntry _meta;
         unsigned long _received_at = 0;
-        const uint64_t _retrieval_deadline;
+        std::atomic<uint64_t> _retrieval_deadline; // Only changes when a provisional file gets its FDT entry
 
-        uint16_t _fdt_instance_id = 0;
+        uint32_t _fdt_instance_id = 0;
+        uint64_t _tsi = 0;
+        std::atomic<bool> _first_symbol_seen{false};
+        std::atomic<bool> _completion_claimed{false};
+        std::atomic<bool> _provisional{false};
 
         std::string _purpose = "unknown";
 
         missing_callback_t _missing_cb = nullptr;
         receiver_callback_t _receiver_cb = nullptr;
+        block_callback_t _block_cb = nullptr;
 
         TracyLockable(std::mutex, _receive_buffer_mutex);
         TracyLockable(std::mutex, _content_buffer_mutex);
@@ -16,7 +16,10 @@
 #pragma once
 #include <stddef.h>
 #include <stdint.h>
+#include <memory>
 #include <string>
+#include <string_view>
+#include <unordered_map>
 #include <vector>
 #include "Utils/flute_types.h"
 #include "Fec/FecTransformer.h"
@@ -46,7 +49,7 @@ namespace LibFlute {
       *  @param buffer String containing the FDT XML
       *  @param len Length of the buffer
       */
-      FileDeliveryTable(uint32_t instance_id, char* buffer, size_t len);
+      FileDeliveryTable(uint32_t instance_id, const char* buffer, size_t len);
 
      /**
       *  Default destructor.
@@ -75,12 +78,47 @@ namespace LibFlute {
         uint64_t should_be_complete_at;
         FecOti fec_oti;
         LibFlute::FecTransformer *fec_transformer;
+        ContentEncoding content_encoding = ContentEncoding::NONE; // Encoding of the transport object (EXT_CENC)
       };
 
+     /**
+      *  The entries an FDT instance added to, changed in or removed from the table
+      */
+      struct Changes {
+        bool duplicate = false; // Same content as the previous instance, nothing was parsed
+        std::vector<FileEntry> added; // Includes entries that replace the one of a known TOI
+        std::vector<uint32_t> removed;
+      };
+
+     /**
+      *  Apply a newly received FDT instance to the table. The instance is only scanned for the TOIs it lists,
+      *  entries that are already in the table are only parsed again if their Content-Location, Content-MD5 or
+      *  length changed. Throws if the instance is malformed, the table is left as it was then. A File element
+      *  that can not be parsed is skipped, a known TOI stays in the table then.
+      *
+      *  @param instance_id FDT instance ID (from ALC headers)
+      *  @param buffer String containing the FDT XML
+      *  @param len Length of the buffer
+      *
+      *  @return The entries that are new or changed in this instance, and the TOIs it no longer lists
+      */
+      Changes update(uint32_t instance_id, const char* buffer, size_t len);
+
      /**
       *  Set the expiry value
       */
-      void set_expires(uint64_t exp) { _expires = exp; };
+      void set_expires(uint64_t exp) {
+        const std::lock_guard<LockableBase(std::mutex)> lock(_fdt_mutex);
+        if (exp != _expires) {
+          _expires = exp;
+          _serialized = nullptr;
+        }
+        };
+
+      uint64_t expires() const {
+        const std::lock_guard<LockableBase(std::mutex)> lock(_fdt_mutex);
+        return _expires;
+        };
 
      /**
       *  Add a file entry
@@ -95,26 +133,50 @@ namespace LibFlute {
      /**
       *  Serialize the FDT to an XML string
       */
-      std::string to_string() const;
+      std::string to_string() const { return *serialized(); };
+
+     /**
+      *  The FDT as an XML string. It is only serialized again after the table changed, until then the same
+      *  string is returned, so callers can tell by the pointer whether the FDT changed.
+      */
+      std::shared_ptr<const std::string> serialized() const;
+
+     /**
+      *  Get a copy of all current file entries, in TOI order
+      */
+      std::vector<FileEntry> file_entries() const;
 
      /**
-      *  Get all current file entries
+      *  Check if the table has an entry for a TOI
       */
-      std::vector<FileEntry> file_entries() { return _file_entries; };
+      bool contains(uint32_t toi) const {
+        const std::lock_guard<LockableBase(std::mutex)> lock(_fdt_mutex);
+        return _file_entries.find(toi) != _file_entries.end();
+        };
 
       std::size_t file_count() {
         const std::lock_guard<LockableBase(std::mutex)> lock(_fdt_mutex);
         return _file_entries.size();
         };
 
+     /**
+      *  Entry for a file that is only known from the EXT_FTI of its packets, until its own entry arrives.
+      *  Throws if the FEC OTI can not be used to receive the file.
+      */
+      static FileEntry provisional_entry(uint32_t toi, const FecOti& fec_oti, ContentEncoding content_encoding);
+
     private:
+      FileEntry parse_entry(tinyxml2::XMLElement* file, const FecOti& global_fec_oti) const;
+
       mutable TracyLockable(std::mutex, _fdt_mutex);
 
       uint32_t _instance_id;
 
-      std::vector<FileEntry> _file_entries;
+      std::unordered_map<uint32_t, FileEntry> _file_entries;
       FecOti _global_fec_oti;
 
-      uint64_t _expires;
+      uint64_t _expires = 0;
+      mutable std::shared_ptr<const std::string> _serialized;
+      size_t _content_hash = 0; // Hash of the last applied instance, to skip repetitions of it
   };
 };
@@ -35,16 +35,50 @@ namespace LibFlute {
       AlcPacket(char* data, size_t len);
 
      /**
-      *  Create an ALC packet from encoding symbols 
+      *  Create an ALC packet from encoding symbols. The TSI and TOI fields are as short as the values allow.
       *
-      *  @param tsi Transport Stream Identifier
+      *  @param tsi Transport Stream Identifier, up to 48 bits
       *  @param toi Transport Object Identifier
       *  @param fec_oti OTI values
       *  @param symbols Vector of encoding symbols
       *  @param max_size Maximum payload size
       *  @param fdt_instance_id FDT instance ID (only relevant for FDT with TOI=0)
+      *  @param content_encoding Encoding of the transport object, signalled in EXT_CENC if it is not NONE
+      *  @param with_fti Add EXT_FTI to a packet of a file, so receivers can start before the FDT entry arrives.
+      *                  Packets of the FDT always carry it.
+      *  @param sender_time Add EXT_TIME with this time, unless its timestamp is 0. The header only has room for it
+      *                     on packets of a file without EXT_FTI.
       */
-      AlcPacket(uint16_t tsi, uint16_t toi, FecOti fec_oti, const std::vector<EncodingSymbol>& symbols, size_t max_size, uint32_t fdt_instance_id);
+      AlcPacket(uint64_t tsi, uint64_t toi, FecOti fec_oti, const std::vector<EncodingSymbol>& symbols, size_t max_size, uint32_t fdt_instance_id,
+          ContentEncoding content_encoding = ContentEncoding::NONE, bool with_fti = false, const SenderTime& sender_time = SenderTime());
+
+     /**
+      *  Write an ALC packet from encoding symbols into a caller provided buffer, without allocating a packet.
+      *  The symbols must be consecutive symbols of the same source block.
+      *
+      *  @param buffer Buffer of at least max_length(tsi, toi, max_size) bytes
+      *
+      *  @return Length of the packet
+      */
+      static size_t serialize(char* buffer, uint64_t tsi, uint64_t toi, const FecOti& fec_oti, const std::vector<EncodingSymbol>& symbols, size_t max_size, uint32_t fdt_instance_id,
+          ContentEncoding content_encoding = ContentEncoding::NONE, bool with_fti = false, const SenderTime& sender_time = SenderTime());
+
+     /**
+      *  Upper bound for the length of a packet created from symbols with the given maximum payload size
+      */
+      static size_t max_length(uint64_t tsi, uint64_t toi, size_t max_size);
+
+     /**
+      *  Length in bytes of the TSI and TOI fields of a packet with these values
+      */
+      static size_t id_fields_length(uint64_t tsi, uint64_t toi);
+
+     /**
+      *  Read the TOI and the source block number of a packet without parsing or copying it
+      *
+      *  @return false if the header can not be read
+      */
+      static bool peek(const char* data, size_t len, uint64_t& toi, uint16_t& source_block_number);
 
      /**
       *  Default destructor.
@@ -92,6 +126,21 @@ namespace LibFlute {
       */
       ContentEncoding content_encoding() const { return _content_encoding; };
 
+     /**
+      *  Whether the packet carries EXT_FTI, so fec_oti() holds the transfer length and FEC parameters of the object
+      */
+      bool has_fti() const { return _has_fti; };
+
+     /**
+      *  Whether the packet carries EXT_TIME with the sender's current time, see sender_time()
+      */
+      bool has_sender_time() const { return _has_sender_time; };
+
+     /**
+      *  Get the sender time from EXT_TIME
+      */
+      const SenderTime& sender_time() const { return _sender_time; };
+
      /**
       *  Get a pointer to the payload data of the constructed packet
       */
@@ -118,6 +167,9 @@ namespace LibFlute {
 
       ContentEncoding _content_encoding = ContentEncoding::NONE;
       FecOti _fec_oti = {};
+      bool _has_fti = false;
+      SenderTime _sender_time = {};
+      bool _has_sender_time = false;
 
       char* _buffer = nullptr;
       size_t _len;
@@ -165,6 +217,22 @@ namespace LibFlute {
         EXT_CENC = 193
       };
 
+      // Use field of EXT_TIME, the time values it flags
+      enum TimeUse {
+        TIME_SCT_HIGH = 0x8000,
+        TIME_SCT_LOW  = 0x4000,
+        TIME_ERT      = 0x2000,
+        TIME_SLC      = 0x1000
+      };
+
+      static size_t tsi_field_length(uint8_t tsi_flag, uint8_t half_word_flag) { return 4UL * tsi_flag + 2UL * half_word_flag; };
+      static size_t toi_field_length(uint8_t toi_flag, uint8_t half_word_flag) { return 4UL * toi_flag + 2UL * half_word_flag; };
+      static void id_field_flags(uint64_t tsi, uint64_t toi, uint8_t& tsi_flag, uint8_t& toi_flag, uint8_t& half_word_flag);
+      static uint64_t read_id_field(const char* ptr, size_t length);
+      static void write_id_field(char* ptr, uint64_t value, size_t length);
+      static void write_fti(char* hdr_ptr, const FecOti& fec_oti);
+      static void write_time(char* hdr_ptr, const SenderTime& sender_time);
+
   };
 };
 
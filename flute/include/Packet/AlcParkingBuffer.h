@@ -0,0 +1,117 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include "Packet/AlcPacket.h"
+
+namespace LibFlute {
+  /**
+   *  Parks the ALC packets of TOIs that are not known yet (their FDT entry did not arrive) until a file claims
+   *  them. Packets are grouped per TOI, so claiming the backlog of a TOI does not look at the packets of others.
+   *
+   *  The payload bytes are limited per TOI and over all TOIs, as is the number of TOIs and the time a backlog
+   *  may wait. A packet over the limit of its TOI is dropped, going over the global budget or number of TOIs
+   *  evicts the backlogs that were parked first. Expired backlogs are only removed by evict_expired().
+   *
+   *  Not thread safe, the receiver guards it with its files mutex. The parked packets and bytes and the drops
+   *  per reason are recorded as metrics (alcs_buffer_size, alcs_parked_bytes, alcs_parked_dropped_*).
+   */
+  class AlcParkingBuffer {
+    public:
+      struct Limits {
+        size_t max_bytes = 48 * 1024 * 1024; // Payload bytes over all TOIs
+        size_t max_bytes_per_toi = 8 * 1024 * 1024;
+        size_t max_tois = 1024;
+        std::chrono::milliseconds max_age = std::chrono::milliseconds(5000); // Counted from the first packet of a TOI
+      };
+
+      enum class DropReason {
+        ToiLimit,  // The backlog of the TOI was full
+        Budget,    // Evicted to stay within the global byte budget
+        ToiCount,  // Evicted to make room for a new TOI
+        Expired,   // Not claimed within max_age
+        Discarded, // Discarded by the owner, e.g. because the file completed
+        Count
+      };
+
+      AlcParkingBuffer(const Limits& limits);
+      AlcParkingBuffer();
+
+      virtual ~AlcParkingBuffer() = default;
+
+     /**
+      *  Change the limits, they apply from the next park() or evict_expired() on.
+      */
+      void set_limits(const Limits& limits) { _limits = limits; };
+      const Limits& limits() const { return _limits; };
+
+     /**
+      *  Park a packet until its TOI is claimed.
+      *
+      *  @return false if the packet was dropped
+      */
+      bool park(std::shared_ptr<AlcPacket> alc_ptr);
+
+     /**
+      *  Take the backlog of a TOI, in the order it was parked. Empty if nothing was parked for it.
+      */
+      std::vector<std::shared_ptr<AlcPacket>> claim(uint64_t toi);
+
+     /**
+      *  Drop the backlog of a TOI.
+      *
+      *  @return The number of dropped packets
+      */
+      size_t discard(uint64_t toi);
+
+     /**
+      *  Drop the backlogs that waited longer than max_age.
+      *
+      *  @return The number of dropped packets
+      */
+      size_t evict_expired();
+
+      bool empty() const { return _packets == 0; };
+      size_t size() const { return _packets; };
+      size_t size_bytes() const { return _bytes; };
+      size_t nof_tois() const { return _backlogs.size(); };
+      uint64_t dropped(DropReason reason) const { return _dropped[static_cast<size_t>(reason)]; };
+
+    private:
+      struct Backlog {
+        std::vector<std::shared_ptr<AlcPacket>> packets;
+        size_t bytes = 0;
+        std::chrono::steady_clock::time_point parked_at;
+        std::list<uint64_t>::iterator order;
+      };
+
+      size_t drop(std::unordered_map<uint64_t, Backlog>::iterator backlog, DropReason reason);
+      void update_metrics();
+
+      Limits _limits;
+      std::unordered_map<uint64_t, Backlog> _backlogs;
+      std::list<uint64_t> _order; // TOIs by the time their first packet was parked, oldest first
+      size_t _packets = 0;
+      size_t _bytes = 0;
+      std::array<uint64_t, static_cast<size_t>(DropReason::Count)> _dropped{};
+  };
+};
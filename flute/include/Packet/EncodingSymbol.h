@@ -28,12 +28,12 @@ namespace LibFlute {
       /**
        *  Parse and construct all encoding symbols from a payload data buffer
        */
-      static std::vector<EncodingSymbol> from_payload(char* encoded_data, size_t data_len, const FecOti& fec_oti, ContentEncoding encoding);
+      static std::vector<EncodingSymbol> from_payload(char* encoded_data, size_t data_len, const FecOti& fec_oti);
 
       /**
        *  Write encoding symbols to a packet payload buffer
        */
-      static size_t to_payload(const std::vector<EncodingSymbol>&, char* encoded_data, size_t data_len, const FecOti& fec_oti, ContentEncoding encoding);
+      static size_t to_payload(const std::vector<EncodingSymbol>&, char* encoded_data, size_t data_len, const FecOti& fec_oti);
     
      /**
       *  Default constructor.
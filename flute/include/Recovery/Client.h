@@ -26,7 +26,7 @@ namespace LibFlute {
 class Client: public boost::enable_shared_from_this<Client>
 {
 public:
-  using ContentCallback = std::function<void(char * buffer, size_t bytes_recvd)>;
+  using ContentCallback = std::function<void(const char * buffer, size_t bytes_recvd)>;
   using CompletionCallback = std::function<void(size_t , size_t)>;
 
   Client(boost::asio::io_service& io_service, const std::string& server, const std::string& port,
@@ -0,0 +1,163 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#pragma once
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+#include <boost/asio.hpp>
+
+namespace LibFlute {
+  /**
+   *  Pool of persistent HTTP/1.1 connections to a single origin (host and port), used for unicast repair.
+   *
+   *  Requests are spread over at most Options::max_connections connections. Once a connection has
+   *  shown that the server keeps it open, up to Options::pipeline_depth requests are pipelined on it.
+   *  The endpoints of the origin are resolved once and cached, connections that stay idle for longer than
+   *  Options::idle_timeout are closed. A connection with requests in flight on which nothing arrives for
+   *  Options::response_timeout is closed as lost, its requests are retried on another one.
+   *
+   *  Responses without a Content-Length are read until the server closes the connection, so servers that
+   *  do not support keep-alive still work, they just do not benefit from the pool.
+   *
+   *  All state is owned by the io_service thread, submit() may be called from any thread.
+   */
+  class ConnectionPool : public std::enable_shared_from_this<ConnectionPool> {
+    public:
+     /**
+      *  Called once with the complete body of a successful (200 or 206) response. The buffer is only valid
+      *  during the call.
+      */
+      typedef std::function<void(const char* buffer, size_t bytes_recvd)> content_callback_t;
+
+      struct Completion {
+        size_t bytes_recvd_total; // Headers and body
+        size_t latency_us; // Until the response headers arrived
+      };
+
+     /**
+      *  Called once per request when its response was read, or with std::nullopt if the request failed.
+      */
+      typedef std::function<void(std::optional<Completion> completion)> completion_callback_t;
+
+      struct Options {
+        size_t max_connections = 4; // Concurrent connections to the origin
+        size_t pipeline_depth = 8; // Outstanding requests per connection
+        std::chrono::milliseconds idle_timeout = std::chrono::milliseconds(15000);
+        std::chrono::milliseconds resolve_ttl = std::chrono::milliseconds(60000); // How long resolved endpoints are reused
+        std::chrono::milliseconds response_timeout = std::chrono::milliseconds(10000); // Silence allowed while requests are in flight
+      };
+
+     /**
+      *  Create a pool, no connection is opened until the first request is submitted.
+      *
+      *  @param io_service Boost io_service that runs all socket operations (must outlive the pool)
+      *  @param host Host name or address of the origin
+      *  @param port Port of the origin
+      *  @param options Connection limit, pipeline depth and timeouts
+      */
+      ConnectionPool(boost::asio::io_service& io_service, const std::string& host, const std::string& port,
+          const Options& options);
+
+     /**
+      *  Create a pool with the default options.
+      */
+      ConnectionPool(boost::asio::io_service& io_service, const std::string& host, const std::string& port);
+
+      virtual ~ConnectionPool() = default;
+
+     /**
+      *  Queue a request. A GET is sent when the body is empty, a POST otherwise.
+      *
+      *  @param headers Extra header lines, each terminated by CRLF (e.g. a Range header)
+      */
+      void submit(const std::string& path, const std::string& body,
+          content_callback_t content_cb, completion_callback_t completion_cb, const std::string& headers = "");
+
+      void set_options(const Options& options);
+
+     /**
+      *  Close all connections and drop every queued request without calling its callbacks.
+      *  Must be called from the io_service thread, or after it has stopped.
+      */
+      void shutdown();
+
+    private:
+      struct Request {
+        std::string data; // Serialized request
+        content_callback_t content_cb;
+        completion_callback_t completion_cb;
+        std::chrono::steady_clock::time_point submitted_at;
+        unsigned attempts = 0; // Number of connections that were lost while the request was assigned to them
+        bool written = false;
+      };
+
+      struct Connection {
+        explicit Connection(boost::asio::io_service& io_service) : socket(io_service), deadline(io_service) {}
+
+        boost::asio::ip::tcp::socket socket;
+        boost::asio::steady_timer deadline;
+        boost::asio::streambuf response;
+        std::deque<std::shared_ptr<Request>> in_flight; // Requests assigned to this connection, in order
+        size_t nof_written = 0; // Number of requests of in_flight that have been (or are being) written
+        bool connecting = false;
+        bool connected = false;
+        bool writing = false;
+        bool keep_alive_confirmed = false; // The server answered without closing, pipelining is safe
+        bool closed = false;
+        bool deadline_running = false;
+        std::chrono::steady_clock::time_point last_used;
+        std::chrono::steady_clock::time_point last_progress; // Last time the connection got busy or bytes of a response arrived
+      };
+
+      std::string serialize(const std::string& path, const std::string& body, const std::string& headers) const;
+
+      void dispatch();
+      std::shared_ptr<Connection> pick_connection();
+      std::shared_ptr<Connection> open_connection();
+      void resolve();
+      void connect(const std::shared_ptr<Connection>& connection);
+      void write_next(const std::shared_ptr<Connection>& connection);
+      void read_headers(const std::shared_ptr<Connection>& connection);
+      void handle_headers(const std::shared_ptr<Connection>& connection, size_t header_length);
+      void finish_request(const std::shared_ptr<Connection>& connection, size_t body_length, size_t bytes_recvd_total,
+          size_t latency_us, bool deliver, bool close_after);
+      void fail_connection(const std::shared_ptr<Connection>& connection, const std::string& reason);
+      void close_connection(const std::shared_ptr<Connection>& connection, bool failed);
+      void schedule_deadline(const std::shared_ptr<Connection>& connection);
+      void schedule_reaper();
+      void reap_idle_connections();
+
+      boost::asio::io_service& _io_service;
+      std::string _host;
+      std::string _port;
+      Options _options;
+
+      boost::asio::ip::tcp::resolver _resolver;
+      std::vector<boost::asio::ip::tcp::endpoint> _endpoints;
+      std::chrono::steady_clock::time_point _resolved_at;
+      bool _resolving = false;
+
+      boost::asio::steady_timer _reaper;
+      bool _reaper_running = false;
+
+      std::deque<std::shared_ptr<Request>> _pending;
+      std::vector<std::shared_ptr<Connection>> _connections;
+  };
+};
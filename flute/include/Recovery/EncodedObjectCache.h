@@ -0,0 +1,114 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "Object/FileBase.h"
+#include "Utils/flute_types.h"
+
+#include "public/tracy/Tracy.hpp"
+
+namespace LibFlute {
+  /**
+   *  Cache of encoded objects (files split into source blocks, with their repair symbols when FEC is used)
+   *  for the repair servers, so a segment that many receivers miss is read and encoded once.
+   *
+   *  Entries are keyed by everything that changes the encoding: the location on disk, the FEC scheme, the
+   *  symbol length and the size and modification time of the file. The cache is split into shards, each with
+   *  its own lock, LRU list and an equal part of the byte budget. Concurrent misses for the same key are
+   *  single-flighted, only the first caller runs the loader and the others wait for its result.
+   *
+   *  Hits, misses, evictions and the cached bytes are recorded as metrics (object_cache_*).
+   */
+  class EncodedObjectCache {
+    public:
+      struct Key {
+        std::string location; // Path of the file on disk
+        FecScheme fec = FecScheme::CompactNoCode;
+        uint32_t symbol_length = 0; // Maximum payload the symbols are sized for
+        uint64_t size = 0;
+        int64_t mtime = 0; // Modification time in ns
+
+        bool operator==(const Key& other) const = default;
+      };
+
+     /**
+      *  Creates the object on a miss, may throw.
+      */
+      typedef std::function<std::shared_ptr<FileBase>()> loader_t;
+
+     /**
+      *  @param max_bytes Byte budget over all shards, 0 disables caching (loads are still single-flighted)
+      *  @param nof_shards Number of independently locked shards
+      */
+      EncodedObjectCache(size_t max_bytes, size_t nof_shards = 16);
+
+      virtual ~EncodedObjectCache() = default;
+
+     /**
+      *  Return the cached object for key, or load it. Exceptions thrown by the loader are passed on to
+      *  every caller that waited for it, nothing is cached in that case.
+      */
+      std::shared_ptr<FileBase> get_or_load(const Key& key, const loader_t& loader);
+
+     /**
+      *  Drop all entries, loads that are in progress are not affected.
+      */
+      void clear();
+
+      size_t size_bytes() const;
+      size_t max_bytes() const { return _max_bytes; };
+
+     /**
+      *  Number of bytes an object is charged for: its content and, when FEC is used, the repair symbols.
+      */
+      static size_t cost(FileBase& file);
+
+    private:
+      struct KeyHash {
+        size_t operator()(const Key& key) const;
+      };
+
+      struct Entry {
+        Key key;
+        std::shared_ptr<FileBase> file;
+        size_t bytes;
+      };
+
+      struct Shard {
+        TracyLockable(std::mutex, mutex);
+        std::list<Entry> lru; // Most recently used first
+        std::unordered_map<Key, std::list<Entry>::iterator, KeyHash> index;
+        std::unordered_map<Key, std::shared_future<std::shared_ptr<FileBase>>, KeyHash> loading;
+        size_t bytes = 0;
+      };
+
+      Shard& shard_for(const Key& key);
+      void insert(Shard& shard, const Key& key, const std::shared_ptr<FileBase>& file, size_t bytes);
+      void update_size_metric();
+
+      size_t _max_bytes;
+      size_t _shard_max_bytes;
+      std::vector<std::unique_ptr<Shard>> _shards;
+  };
+};
@@ -21,6 +21,10 @@
 #include <map>
 #include <thread>
 #include <atomic>
+#include <chrono>
+#include <mutex>
+#include <set>
+#include <vector>
 
 #include <boost/asio.hpp>
 #include <boost/property_tree/ptree.hpp>
@@ -28,10 +32,14 @@
 #include <boost/shared_ptr.hpp>
 
 #include <Recovery/Client.h>
+#include "Recovery/ConnectionPool.h"
+#include "Recovery/RepairRequest.h"
 #include "Utils/flute_types.h"
 
 #include "Utils/FakeNetworkSocket.h"
 
+#include "public/tracy/Tracy.hpp"
+
 namespace LibFlute {
   /**
    *  FLUTE receiver class. Construct an instance of this to receive files from a FLUTE/ALC session.
@@ -45,6 +53,34 @@ namespace LibFlute {
       *  @returns to the received file
       */
       typedef std::function<void(const char*, size_t)> callback_t;
+
+     /**
+      *  Called with a byte range of an object that was fetched over HTTP instead of as repair symbols.
+      */
+      typedef std::function<void(uint32_t toi, uint64_t offset, const char*, size_t)> object_callback_t;
+
+     /**
+      *  Where the source blocks of a file are in the object, to fetch the whole object or some of its blocks
+      *  with a plain GET instead of repair symbols.
+      */
+      struct ObjectLayout {
+        uint64_t length = 0; // Length of the object, 0 if it can not be fetched as a whole
+        uint32_t symbol_length = 0;
+        std::vector<uint64_t> block_offsets; // Offset of every source block by SBN, empty if the blocks are no byte ranges of it (FEC)
+      };
+
+     /**
+      *  Costs, in bytes, that decide between repair symbols and fetching blocks or the whole object.
+      *  A repair symbol costs its length, its packet overhead and its handling on both ends. A fetched byte
+      *  range costs its length. Every request costs the request overhead.
+      */
+      struct CostModel {
+        bool enabled = true; // Only ever fetch repair symbols if false
+        double request_overhead = 500; // HTTP headers and a round trip
+        double packet_overhead = 40; // ALC header and response framing of a repair symbol
+        double packet_cost = 600; // Encoding, parsing and handling a repair symbol, relative to moving its bytes
+        double symbol_request_cost = 4; // Listing a missing symbol in the request
+      };
  
       /**
        * Construct a new Fetcher instance.
@@ -55,7 +91,34 @@ namespace LibFlute {
 
       virtual ~Fetcher();
 
-      void fetch_alcs(const uint32_t toi, LibFlute::FecScheme fec, const std::string &content_location, std::shared_ptr<std::map<uint16_t, std::vector<uint16_t>>> missing_symbols);
+     /**
+      *  Request the missing symbols of a file from the repair server. Requests wait in a queue until the
+      *  connection pool has room for them and are sent earliest deadline first, a newer request for the same
+      *  file replaces a waiting one.
+      *
+      *  @param needed_symbols For fountain coded files, the number of symbols each block still needs. Once the
+      *                        server announced that it creates fresh repair symbols, these blocks ask for a
+      *                        number of symbols instead of listing the missing ones.
+      *  @param deadline Time (in ms since the epoch) the file should be complete at, 0 if it has none
+      *  @param layout If given and the cost model says so, the whole object or some of its blocks are fetched
+      *                with a GET of the content location instead, and handed to the object callback
+      *  @param content_encoding Content encoding the file was sent with. Encoded files are only repaired once the
+      *                          server announced that it honours the content encoding of requests.
+      */
+      void fetch_alcs(const uint32_t toi, LibFlute::FecScheme fec, const std::string &content_location, std::shared_ptr<std::map<uint16_t, std::vector<uint16_t>>> missing_symbols,
+          std::shared_ptr<std::map<uint16_t, LibFlute::RepairRequest::Needed>> needed_symbols = nullptr, uint64_t deadline = 0,
+          std::shared_ptr<const ObjectLayout> layout = nullptr, ContentEncoding content_encoding = ContentEncoding::NONE);
+
+     /**
+      *  A block of a file completed. It is dropped from the waiting request of the file, and its packets are
+      *  dropped from responses that are already on the way.
+      */
+      void block_completed(uint32_t toi, uint16_t sbn);
+
+     /**
+      *  A file completed, like block_completed for all of its blocks.
+      */
+      void file_completed(uint32_t toi);
 
       void fetch_fdt();
 
@@ -66,31 +129,126 @@ namespace LibFlute {
       */
       void register_alc_callback(callback_t cb) { _alc_cb = cb; };
       void register_fdt_callback(callback_t cb) { _fdt_cb = cb; };
+      void register_object_callback(object_callback_t cb) { _object_cb = cb; };
 
 
       void set_fake_network_socket(std::shared_ptr<LibFlute::FakeNetworkSocket> fake_network_socket) {
         _fake_network_socket = fake_network_socket;
       }
 
+      /**
+       * Set the TSI of the session, used to key lifecycle trace events.
+       */
+      void set_tsi(uint64_t tsi) { _tsi = tsi; }
+
+      /**
+       * Configure the connection pool used for repair requests (concurrency, pipelining, idle timeout).
+       */
+      void set_pool_options(const LibFlute::ConnectionPool::Options& options);
+
+      /**
+       * Collect the repair requests of all files for this long and send them as one request, once the server
+       * announced that it accepts batches. 0 sends a request per file.
+       */
+      void set_batch_window(std::chrono::milliseconds window) { _batch_window = window; }
+
+      /**
+       * Give up on repairing a file once it is this late, requests that are still waiting by then are dropped.
+       * 0 repairs files however late they are.
+       */
+      void set_deadline_grace(std::chrono::milliseconds grace) { _deadline_grace = grace; }
+
+      void set_cost_model(const CostModel& cost_model) { _cost_model = cost_model; }
+
     private:
-      void handle_ALC(char * buffer, size_t bytes_recvd);
+      void handle_ALC(const char * buffer, size_t bytes_recvd);
+
+      void handle_FDT(const char * buffer, size_t bytes_recvd);
+
+      void handle_fetch_completion(const std::vector<uint32_t>& tois, std::optional<LibFlute::ConnectionPool::Completion> completion);
+
+      struct Repair {
+        LibFlute::RepairRequest request;
+        uint64_t deadline; // ms since the epoch, UINT64_MAX if the file has none
+      };
+
+      struct Range {
+        uint64_t offset;
+        uint64_t length;
+      };
 
-      void handle_FDT(char * buffer, size_t bytes_recvd);
+      struct RangeRepair {
+        std::string path;
+        uint64_t object_length;
+        std::vector<Range> ranges;
+        uint64_t deadline;
+      };
+
+      std::vector<Range> plan(LibFlute::RepairRequest& request, const ObjectLayout& layout) const;
+      std::string object_path(const std::string& content_location) const;
+      void send_range(uint32_t toi, const std::string& path, uint64_t object_length, Range range);
+
+      void dispatch();
+      void send(std::vector<LibFlute::RepairRequest> batch);
+      void sent(const std::vector<uint32_t>& tois);
+      bool is_completed(const char * alc_data, size_t alc_length);
 
       std::string _url;
+      // The URL is parsed once, in the constructor
+      std::string _host;
+      std::string _port;
+      std::string _path;
       boost::asio::io_service _io_service;
       std::jthread _io_service_thread;
       std::atomic<bool> _stop_thread = false;
 
-      std::regex _url_regex;
-
       callback_t _alc_cb = nullptr;
       callback_t _fdt_cb = nullptr;
+      object_callback_t _object_cb = nullptr;
 
       std::shared_ptr<LibFlute::FakeNetworkSocket> _fake_network_socket = nullptr;
 
+      uint64_t _tsi = 0;
+
+      // Reused to inflate compressed repair responses
+      std::vector<char> _inflate_buffer;
+
+      // Set once the server announced that it accepts compact repair requests
+      std::atomic<bool> _compact_requests = false;
+
+      // Set once the server announced that it answers requests for a number of symbols
+      std::atomic<bool> _symbol_counts = false;
+
+      // Set once the server announced that it accepts batches of repair requests
+      std::atomic<bool> _batch_requests = false;
+
+      // Set once the server announced that it refuses requests for encoded files it can not serve
+      std::atomic<bool> _content_encodings = false;
+      std::chrono::milliseconds _batch_window = std::chrono::milliseconds(10);
+      std::chrono::milliseconds _deadline_grace = std::chrono::milliseconds(2000);
+      CostModel _cost_model;
+
+      TracyLockable(std::mutex, _repairs_mutex);
+      // Requests waiting to be sent, by TOI
+      std::map<uint32_t, Repair> _waiting;
+      // Byte ranges waiting to be fetched, by TOI
+      std::map<uint32_t, RangeRepair> _waiting_ranges;
+      // Requests on the wire per TOI, and the blocks and files that completed while they were
+      std::map<uint32_t, unsigned> _in_flight;
+      std::map<uint32_t, std::set<uint16_t>> _completed_blocks;
+      std::set<uint32_t> _completed_files;
+      std::atomic<bool> _drop_completed = false;
+      size_t _requests_in_flight = 0;
+      size_t _max_requests_in_flight = LibFlute::ConnectionPool::Options{}.max_connections * LibFlute::ConnectionPool::Options{}.pipeline_depth;
+      // Set while the batch window is open, the timer is only used from the IO thread
+      bool _window_open = false;
+      boost::asio::steady_timer _batch_timer{_io_service};
+
       LibFlute::Metric::Metrics& metricsInstance;
 
       std::vector<boost::shared_ptr<LibFlute::Client>> _activeClients;
+
+      // Persistent connections to the repair server, only used when not fetching from a fake network socket
+      std::shared_ptr<LibFlute::ConnectionPool> _pool;
   };
 };
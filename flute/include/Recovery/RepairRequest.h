@@ -0,0 +1,160 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#pragma once
+#include <cstdint>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/property_tree/ptree_fwd.hpp>
+#include "Recovery/RepairResponse.h"
+#include "Utils/flute_types.h"
+
+namespace LibFlute {
+  /**
+   *  Request for the missing symbols of one file.
+   *
+   *  Requests are either JSON ({"toi", "file", "fec", "missing": {sbn: [esi, ...]}, "needed": {sbn: {"count",
+   *  "from"}}, "framing", "compression", "content-encoding"}) or compact. The compact encoding is base64 text, so it can be passed around as a C string, of:
+   *
+   *    "FLRQ" | version (1) | flags (1) | toi | fec | location length | location | [content encoding] | number of blocks | blocks
+   *    block: sbn (delta to the previous block) | mode (1) | missing symbols
+   *
+   *  All numbers but the flags and mode bytes are LEB128 varints. The missing symbols of a block are
+   *  either runs (count, then for every run the gap since the end of the previous run and its length - 1)
+   *  or a bitmap (first esi, byte count, bytes with the least significant bit first), whichever is smaller.
+   *  A block that lost all its symbols therefore costs a couple of bytes, independent of its size.
+   *
+   *  For fountain codes (Raptor) a block can instead ask for a number of symbols it still needs (mode 2: count,
+   *  first esi). The server answers with repair symbols from the first esi on, but never below the symbols
+   *  that were multicast, so every receiver gets the same fresh symbols and responses can be shared.
+   *
+   *  Servers that understand compact requests say so in their binary responses (see RepairResponse), a
+   *  client only switches to compact requests after it has seen such a response. The same goes for asking
+   *  for a number of symbols.
+   *
+   *  Files that were sent with a content encoding carry it in their requests (the content encoding is only
+   *  present in compact requests when its flag is set): the symbols are cut from the encoded transport object,
+   *  not from the content. A server that only has the content must refuse such requests.
+   *
+   *  Requests for several files can be sent together as a batch: a JSON array of requests, or compact
+   *  requests on separate lines. The ALC packets of all files come back in one response, they are told
+   *  apart by their TOI. Clients only send batches to servers that announced them (see RepairResponse).
+   */
+  class RepairRequest {
+    public:
+      struct Needed {
+        uint32_t count = 0; // Number of symbols the block still needs
+        uint32_t first_esi = 0; // First ESI that was not received yet
+      };
+
+      RepairRequest() = default;
+
+     /**
+      *  @param toi TOI of the file
+      *  @param fec FEC scheme of the file
+      *  @param content_location Content location of the file
+      */
+      RepairRequest(uint64_t toi, unsigned fec, const std::string& content_location);
+
+     /**
+      *  Parse a JSON or compact request. Throws if the request is malformed or exceeds the limits.
+      */
+      static RepairRequest parse(const char* data, size_t length);
+
+      static RepairRequest parse(const std::string& request) { return parse(request.data(), request.size()); };
+
+     /**
+      *  Parse a batch of requests, a single request is a batch of one. Throws if any of the requests is
+      *  malformed or the batch exceeds the limits.
+      */
+      static std::vector<RepairRequest> parse_batch(const char* data, size_t length);
+
+      static std::vector<RepairRequest> parse_batch(const std::string& batch) { return parse_batch(batch.data(), batch.size()); };
+
+     /**
+      *  Serialize requests for several files as one batch, in the compact encoding.
+      */
+      static std::string to_batch(const std::vector<RepairRequest>& requests);
+
+     /**
+      *  Serialize as JSON, understood by every server.
+      */
+      std::string to_json() const;
+
+     /**
+      *  Serialize in the compact encoding.
+      */
+      std::string to_compact() const;
+
+      void add_missing(uint32_t sbn, std::vector<uint32_t> esis);
+
+     /**
+      *  Ask for any count symbols of a block, instead of a list of missing ones. Replaces the missing
+      *  symbols of the block, just like add_missing replaces the needed ones.
+      */
+      void add_needed(uint32_t sbn, uint32_t count, uint32_t first_esi = 0);
+
+     /**
+      *  Drop the missing or needed symbols of a block, e.g. when it completed before the request was sent.
+      */
+      void remove_block(uint32_t sbn);
+
+      uint64_t toi() const { return _toi; };
+      unsigned fec() const { return _fec; };
+      const std::string& content_location() const { return _content_location; };
+      const std::map<uint32_t, std::vector<uint32_t>>& missing() const { return _missing; };
+      const std::map<uint32_t, Needed>& needed() const { return _needed; };
+
+     /**
+      *  Total number of missing and needed symbols over all blocks.
+      */
+      size_t symbol_count() const { return _symbol_count; };
+
+     /**
+      *  Framing the client asked for its response.
+      */
+      RepairResponse::Encoding encoding() const { return _encoding; };
+      void set_encoding(RepairResponse::Encoding encoding) { _encoding = encoding; };
+
+     /**
+      *  Content encoding of the transport object the symbols belong to.
+      */
+      ContentEncoding content_encoding() const { return _content_encoding; };
+      void set_content_encoding(ContentEncoding content_encoding) { _content_encoding = content_encoding; };
+
+      static constexpr uint8_t version = 1;
+
+      // Limits that keep the cost of parsing a request bounded
+      static constexpr size_t max_symbols = 1 << 20;
+      static constexpr size_t max_symbols_per_block = 1 << 16;
+      static constexpr size_t max_content_location_length = 4096;
+      static constexpr size_t max_batch_size = 1024; // Requests in one batch, their symbols count towards max_symbols
+
+    private:
+      static RepairRequest parse_json(const char* data, size_t length);
+      static RepairRequest from_tree(const boost::property_tree::ptree& pt);
+      static RepairRequest parse_compact(const char* data, size_t length);
+
+      uint64_t _toi = 0;
+      unsigned _fec = 0;
+      std::string _content_location;
+      std::map<uint32_t, std::vector<uint32_t>> _missing;
+      std::map<uint32_t, Needed> _needed;
+      size_t _symbol_count = 0;
+      RepairResponse::Encoding _encoding = RepairResponse::Encoding::Legacy;
+      ContentEncoding _content_encoding = ContentEncoding::NONE;
+  };
+};
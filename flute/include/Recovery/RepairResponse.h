@@ -0,0 +1,163 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "Packet/AlcPacket.h"
+
+namespace LibFlute {
+  /**
+   *  Framing of the ALC packets in the body of a repair response.
+   *
+   *  Legacy responses are a sequence of "ALC " + packet + "\r\n\r\n", which breaks as soon as a packet
+   *  contains the delimiter. Binary responses start with a fixed header and length-prefix every packet
+   *  (all integers in network byte order):
+   *
+   *    "FLRB" | version (1) | flags (1) | reserved (2) | number of packets (4) | length of the frames (4)
+   *    frames: length (4) | ALC packet, repeated
+   *
+   *  When the zlib flag is set the frames are deflated and the header holds their inflated length. The other
+   *  flags announce what else the server understands: compact repair requests (see RepairRequest), requests
+   *  for a number of fresh symbols, batches of requests and the content encoding of requests (it refuses the
+   *  ones it can not serve). A Writer sets none of them, the server adds the ones it supports with announce().
+   *
+   *  A client asks for the binary framing by adding "framing" (the highest version it understands) and
+   *  optionally "compression": "zlib" to its repair request. Servers that do not know these fields keep
+   *  answering in the legacy framing, which is detected by the missing magic.
+   */
+  class RepairResponse {
+    public:
+      enum class Encoding {
+        Legacy,
+        Binary,
+        BinaryZlib, // Binary, deflated if that makes the response smaller
+      };
+
+      /**
+       *  Capabilities a server announces in the flags of its binary responses.
+       */
+      enum Capability : uint8_t {
+        CompactRequests = 0x02,
+        SymbolCounts = 0x04,
+        BatchRequests = 0x08,
+        ContentEncodings = 0x10,
+      };
+
+      static constexpr uint8_t version = 1;
+      static constexpr size_t header_length = 16;
+      static constexpr size_t frame_header_length = 4;
+
+     /**
+      *  Pick the encoding of a response from the "framing" and "compression" fields of the request.
+      */
+      static auto requested_encoding(unsigned framing, const std::string& compression) -> Encoding;
+
+     /**
+      *  Builds a response body in place: packets are serialized straight into the output buffer, which is
+      *  only copied again when it is deflated.
+      */
+      class Writer {
+        public:
+         /**
+          *  @param encoding Framing of the response
+          *  @param expected_bytes Total length of the packets that will be added, used to size the buffer
+          */
+          Writer(Encoding encoding, size_t expected_bytes = 0);
+
+         /**
+          *  Space for the next packet of at most max_length bytes, valid until the next call to the Writer.
+          */
+          auto reserve(size_t max_length) -> char*;
+
+         /**
+          *  Finish the packet written to the last reserved space.
+          */
+          auto commit(size_t length) -> void;
+
+         /**
+          *  Add a complete packet.
+          */
+          auto append(const char* data, size_t length) -> void;
+
+          auto count() const -> size_t { return _count; };
+
+         /**
+          *  Finish the header (and deflate the frames if requested) and return the body.
+          */
+          auto finish() -> std::string;
+
+        private:
+          Encoding _encoding;
+          std::string _out;
+          size_t _frame_start = 0;
+          size_t _count = 0;
+      };
+
+     /**
+      *  Serialize ALC packets into a response body.
+      */
+      static auto encode(const std::vector<std::shared_ptr<AlcPacket>>& packets, Encoding encoding) -> std::string;
+
+     /**
+      *  Check if a response body uses the binary framing.
+      */
+      static auto is_binary(const char* data, size_t length) -> bool;
+
+     /**
+      *  Check if the server that sent a response body accepts compact repair requests.
+      */
+      static auto accepts_compact_requests(const char* data, size_t length) -> bool;
+
+     /**
+      *  Check if the server that sent a response body answers requests for a number of symbols.
+      */
+      static auto accepts_symbol_counts(const char* data, size_t length) -> bool;
+
+     /**
+      *  Check if the server that sent a response body accepts batches of repair requests.
+      */
+      static auto accepts_batch_requests(const char* data, size_t length) -> bool;
+
+     /**
+      *  Check if the server that sent a response body honours the content encoding of repair requests.
+      */
+      static auto accepts_content_encodings(const char* data, size_t length) -> bool;
+
+     /**
+      *  Flag the capabilities of the server in a binary response body. Legacy bodies have no flags and are
+      *  left alone.
+      *
+      *  @param capabilities Bitwise or of Capability values
+      */
+      static auto announce(std::string& body, uint8_t capabilities) -> void;
+
+     /**
+      *  Call packet_cb for every ALC packet in a response body, in either framing.
+      *
+      *  @param data Response body
+      *  @param length Length of the response body
+      *  @param scratch Buffer that is reused to inflate compressed responses
+      *  @param packet_cb Called with a pointer into data (or scratch) and the length of the packet
+      *
+      *  @return false if the body is malformed or truncated
+      */
+      static auto for_each_packet(const char* data, size_t length, std::vector<char>& scratch,
+          const std::function<void(const char*, size_t)>& packet_cb) -> bool;
+  };
+};
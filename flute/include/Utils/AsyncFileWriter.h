@@ -0,0 +1,60 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#pragma once
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+#include "public/tracy/Tracy.hpp"
+
+namespace LibFlute {
+  /**
+   *  Writes a file from a background thread, off the path that produces its content. Only the latest content
+   *  is kept: when new content arrives before the previous one was written, the previous one is skipped.
+   *
+   *  The content is written to a temporary file next to the target and renamed over it, so readers never see
+   *  a partly written file.
+   */
+  class AsyncFileWriter {
+    public:
+     /**
+      *  @param path File to write
+      */
+      AsyncFileWriter(const std::string& path);
+
+     /**
+      *  Writes the pending content, if any, and stops the thread.
+      */
+      virtual ~AsyncFileWriter();
+
+     /**
+      *  Queue content to be written, replacing content that was not written yet. Does not block on IO.
+      */
+      void write(std::shared_ptr<const std::string> content);
+
+    private:
+      void run(std::stop_token stop);
+      void write_now(const std::string& content);
+
+      std::string _path;
+      TracyLockable(std::mutex, _mutex);
+      std::condition_variable_any _cv;
+      std::shared_ptr<const std::string> _pending;
+      std::jthread _thread;
+  };
+};
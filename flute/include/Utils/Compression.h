@@ -0,0 +1,56 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#pragma once
+#include <stddef.h>
+#include <string>
+#include "Utils/flute_types.h"
+
+namespace LibFlute::Compression {
+ /**
+  *  Compress data with a content encoding (RFC 6726 section 3.4.1, ZLIB, DEFLATE or GZIP). Throws on failure.
+  *
+  *  @param level zlib compression level, 0 (none) to 9 (best), -1 for the zlib default
+  */
+  std::string compress(const char* data, size_t length, ContentEncoding encoding, int level = -1);
+
+ /**
+  *  Compress data into a buffer allocated with malloc, which the caller has to free. Throws on failure.
+  *
+  *  @param compressed_length Set to the length of the compressed data
+  */
+  char* compress_to_buffer(const char* data, size_t length, ContentEncoding encoding, int level, size_t& compressed_length);
+
+ /**
+  *  Decompress data of a content encoding. Throws if the data is corrupt or inflates to more than max_length bytes.
+  */
+  std::string decompress(const char* data, size_t length, ContentEncoding encoding, size_t max_length);
+
+ /**
+  *  Decompress data of a content encoding into a buffer of its known inflated length. Throws if the data is corrupt
+  *  or does not inflate to exactly buffer_length bytes.
+  */
+  void decompress_to(const char* data, size_t length, ContentEncoding encoding, char* buffer, size_t buffer_length);
+
+ /**
+  *  Name of a content encoding in the Content-Encoding attribute of the FDT, empty for NONE
+  */
+  std::string encoding_name(ContentEncoding encoding);
+
+ /**
+  *  Content encoding of a Content-Encoding attribute, NONE if it is not known
+  */
+  ContentEncoding parse_encoding(const std::string& name);
+};
@@ -3,13 +3,17 @@
 #include <boost/asio.hpp> // Include necessary Boost.Asio headers
 #include <boost/circular_buffer.hpp>
 #include <functional> // Include necessary headers for std::function
+#include <map>
+#include <memory>
 #include <mutex>
 #include <atomic>
 #include <thread>
+#include <vector>
 
 
 #include "spdlog/spdlog.h"
 #include "Metric/Metrics.h"
+#include "Utils/NetworkImpairment.h"
 
 #include "public/tracy/Tracy.hpp"
 #include "public/common/TracySystem.hpp"
@@ -49,6 +53,13 @@ namespace LibFlute {
         // Set packet loss rate (0.0 - 1.0)
         void set_loss_rate(double loss_rate);
 
+        // Add a stage to the impairment pipeline, packets pass the stages in the order they were added.
+        // The uniform loss of set_loss_rate applies before the pipeline.
+        void add_impairment(std::shared_ptr<NetworkImpairment> impairment);
+
+        // Remove all stages of the impairment pipeline, packets that are held back still arrive
+        void clear_impairments();
+
         // Start background threads for processing
         void start_threads();
 
@@ -70,13 +81,18 @@ namespace LibFlute {
     private:
         // Circular buffers for sender, network, and receiver
         boost::circular_buffer_space_optimized<std::string> sender_to_network_buffer;
-        boost::circular_buffer_space_optimized<std::string> network_buffer;
+        // Packets in flight by the time they arrive, packets that arrive at the same time keep their order
+        std::multimap<NetworkImpairment::time_point_t, std::string> network_buffer;
+        size_t network_capacity;
         boost::circular_buffer_space_optimized<std::string> network_to_receiver_buffer;
 
         // Mutexes to ensure thread safety for accessing buffers
         TracyLockable(std::mutex, sender_to_network_mutex);
         TracyLockable(std::mutex, network_mutex);
         TracyLockable(std::mutex, network_to_receiver_mutex);
+        TracyLockable(std::mutex, impairments_mutex);
+
+        std::vector<std::shared_ptr<NetworkImpairment>> impairments;
 
         // Atomic variable to hold the loss rate
         std::atomic<double> loss_rate = 0.0; // Atomic for safe concurrent access
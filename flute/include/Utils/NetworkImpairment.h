@@ -0,0 +1,131 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <random>
+
+namespace LibFlute {
+  /**
+   *  A stage of the impairment pipeline of FakeNetworkSocket. Every packet passes the stages in the order they
+   *  were added, a stage may drop it or hold it back. Random stages draw from their own generator, seeded from
+   *  their options, so a run with the same seeds and packets is repeated exactly.
+   *
+   *  Stages are only called from the network thread of the socket.
+   */
+  class NetworkImpairment {
+    public:
+      typedef std::chrono::steady_clock::time_point time_point_t;
+
+      virtual ~NetworkImpairment() = default;
+
+     /**
+      *  Pass a packet through the stage.
+      *
+      *  @param size Packet size in bytes
+      *  @param release_at When the packet left the previous stage, moved to when it leaves this one
+      *
+      *  @return false if the packet is dropped
+      */
+      virtual bool process(size_t size, time_point_t& release_at) = 0;
+
+     /**
+      *  Name of the stage, the drops are counted in the counter network_dropped_<name>
+      */
+      virtual const char* name() const = 0;
+  };
+
+  /**
+   *  Burst loss with the Gilbert-Elliott model: a good and a bad state, each with its own loss probability.
+   *  The state changes before every packet. The mean loss rate is (p * loss_bad + r * loss_good) / (p + r),
+   *  a stay in the bad state lasts 1 / r packets on average.
+   */
+  class GilbertElliottLoss : public NetworkImpairment {
+    public:
+      struct Options {
+        double p = 0.01; // Probability to go from the good to the bad state
+        double r = 0.25; // Probability to go from the bad to the good state
+        double loss_good = 0.0;
+        double loss_bad = 1.0;
+        uint64_t seed = 1;
+      };
+
+      GilbertElliottLoss(const Options& options);
+
+      bool process(size_t size, time_point_t& release_at) override;
+      const char* name() const override { return "burst_loss"; };
+
+      bool bad() const { return _bad; };
+
+    private:
+      Options _options;
+      std::mt19937_64 _random;
+      std::uniform_real_distribution<double> _uniform{0.0, 1.0};
+      bool _bad = false;
+  };
+
+  /**
+   *  Fixed delay plus a uniformly distributed variation of up to jitter in both directions (never below 0).
+   *  Packets keep their order unless reordering is allowed, then a packet with a short delay overtakes the ones
+   *  before it that drew a longer one.
+   */
+  class DelayImpairment : public NetworkImpairment {
+    public:
+      struct Options {
+        std::chrono::microseconds delay = std::chrono::microseconds(0);
+        std::chrono::microseconds jitter = std::chrono::microseconds(0);
+        bool reorder = false;
+        uint64_t seed = 1;
+      };
+
+      DelayImpairment(const Options& options);
+
+      bool process(size_t size, time_point_t& release_at) override;
+      const char* name() const override { return "delay"; };
+
+    private:
+      Options _options;
+      std::mt19937_64 _random;
+      time_point_t _last_release = {};
+  };
+
+  /**
+   *  Bandwidth limit with a token bucket: packets leave at the rate once the burst is used up. The packets
+   *  waiting for tokens form a queue, a packet that finds it full is dropped (tail drop).
+   */
+  class TokenBucket : public NetworkImpairment {
+    public:
+      struct Options {
+        uint32_t rate = 10000; // kbps, 0 = unlimited
+        size_t burst = 15000; // Bucket size in bytes
+        size_t queue_limit = 100; // Packets waiting for tokens, 0 = unlimited
+      };
+
+      TokenBucket(const Options& options);
+
+      bool process(size_t size, time_point_t& release_at) override;
+      const char* name() const override { return "queue"; };
+
+    private:
+      Options _options;
+      double _tokens;
+      time_point_t _updated = {};
+      time_point_t _last_departure = {};
+      std::deque<time_point_t> _departures; // Of the packets in the queue
+  };
+};
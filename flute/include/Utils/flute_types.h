@@ -15,6 +15,7 @@
 //
 #pragma once
 
+#include <chrono>
 #include <cstdint>
 #include <map>
 
@@ -65,8 +66,39 @@ namespace LibFlute {
         uint64_t transfer_length;
         uint32_t encoding_symbol_length;
         uint32_t max_source_block_length;
+        // Scheme specific values of Raptor (RFC 5053), carried in EXT_FTI. 0 if they are not known.
+        uint16_t nof_source_blocks = 0;
+        uint8_t nof_sub_blocks = 0;
+        uint8_t symbol_alignment = 0;
     };
 
+    /**
+    *  Whether TOI a was handed out after TOI b. TOIs are 32 bit and wrap around, so they are compared with serial
+    *  number arithmetic (RFC 1982): a is after b if it is less than half the TOI space ahead of it.
+    */
+    inline bool toi_after(uint32_t a, uint32_t b) {
+        return a != b && static_cast<int32_t>(a - b) > 0;
+    }
+
+    /**
+    *  Sender time of an ALC packet, carried in EXT_TIME (RFC 5651 5.2.2)
+    */
+    struct SenderTime {
+        uint64_t ntp_timestamp = 0; // SCT-High and SCT-Low: the sender's clock in NTP format (32.32 fixed point seconds)
+        bool has_expected_residual_time = false;
+        uint32_t expected_residual_time = 0; // ERT: milliseconds until the transmission of the object ends
+    };
+
+    /**
+    *  Convert a wall clock time to the NTP timestamp format (seconds since 1900 in 32.32 fixed point)
+    */
+    inline uint64_t ntp_timestamp(std::chrono::system_clock::time_point time) {
+        auto since_epoch = std::chrono::duration_cast<std::chrono::nanoseconds>(time.time_since_epoch()).count();
+        uint64_t seconds = since_epoch / 1000000000 + 2208988800ULL; // The NTP epoch is 70 years before the Unix epoch
+        uint64_t fraction = (static_cast<uint64_t>(since_epoch % 1000000000) << 32) / 1000000000;
+        return seconds << 32 | fraction;
+    }
+
     struct SourceBlock {
         uint16_t id = 0; // The id of the source block
         bool complete = false;
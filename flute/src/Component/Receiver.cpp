@@ -15,9 +15,19 @@
 //
 #include "Component/Receiver.h"
 #include "Utils/base64.h"
+#include "Utils/Compression.h"
+#include "Metric/LifecycleTracer.h"
 
 #include "public/tracy/Tracy.hpp"
 
+namespace {
+    // 0.5 ms up to ~8 s
+    const LibFlute::Metric::Histogram::BucketBoundaries one_way_delay_buckets =
+        LibFlute::Metric::Histogram::ExponentialBuckets(0.0005, 2.0, 15);
+    // 0.1 ms up to ~1.6 s
+    const LibFlute::Metric::Histogram::BucketBoundaries jitter_buckets =
+        LibFlute::Metric::Histogram::ExponentialBuckets(0.0001, 2.0, 15);
+}
 // #include <iomanip>    // For std::setw and std::setfill
 // #include <sstream>    // For std::stringstream
 
@@ -26,16 +36,10 @@ LibFlute::Receiver::Receiver(const std::string &iface, const std::string &addres
                              short port, uint64_t tsi,
                              boost::asio::io_service &io_service,
                              std::shared_ptr<LibFlute::FakeNetworkSocket> fake_network_socket)
-    : _socket(io_service), _tsi(tsi), _mcast_address(address), _fetcher(retreival_url), _fake_network_socket(fake_network_socket)
+    : _socket(io_service), _parking_timer(io_service), _tsi(tsi), _mcast_address(address), _fetcher(retreival_url), _fake_network_socket(fake_network_socket)
 {
   ZoneScopedN("Receiver::Receiver");
 
-  // The bigger the buffer, the more symbols we can buffer and the larger the file is that we can handle,
-  // but the more memory we use
-  // Knowing that max_length is 2048, the max memory usage should still be quite small (~64 MBytes)
-  // Actuall max length is 1452, so max memory usage is even smaller
-  _unknown_alc_buffer.set_capacity(32768);
-
   // The bigger the buffer, the more symbols we can buffer and the larger the file is that we can handle,
   // but the more memory we use
   // Knowing that max_length is 2048, the max memory usage should still be quite small (~64 MBytes)
@@ -58,6 +62,13 @@ LibFlute::Receiver::Receiver(const std::string &iface, const std::string &addres
   if (_fake_network_socket) {
       _fetcher.set_fake_network_socket(_fake_network_socket);
   }
+  _fetcher.set_tsi(_tsi);
+
+  // Labelled with the TSI, so the sessions of one process can be told apart
+  LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
+  LibFlute::Metric::Histogram::Labels session_labels{{"tsi", std::to_string(_tsi)}};
+  _one_way_delay_histogram = metricsInstance.getOrCreateHistogram("alc_one_way_delay_seconds", session_labels, one_way_delay_buckets);
+  _jitter_histogram = metricsInstance.getOrCreateHistogram("alc_jitter_seconds", session_labels, jitter_buckets);
 
   _fetcher.register_alc_callback(
       [&](const char *alc_data, size_t alc_length)
@@ -68,9 +79,12 @@ LibFlute::Receiver::Receiver(const std::string &iface, const std::string &addres
 
         FrameMarkStart("Receiver::fetcher_alc_callback");
 
-        // Make a non const c string.
-        char *data = (char *)malloc(alc_length + 1);
-        //TracyAlloc(data, alc_length + 1);
+        // Make a non const copy. The callback only runs on the fetcher IO thread and the packet is
+        // handled synchronously, so the same buffer is reused for every repaired packet.
+        if (_repair_packet_buffer.size() < alc_length + 1) {
+          _repair_packet_buffer.resize(alc_length + 1);
+        }
+        char *data = _repair_packet_buffer.data();
         memcpy(data, alc_data, alc_length);
 
         try {
@@ -92,12 +106,6 @@ LibFlute::Receiver::Receiver(const std::string &iface, const std::string &addres
           spdlog::warn("[RECEIVE] Failed to decode ALC/FLUTE packet: unknown error");
         }
 
-        // Free the non const c string.
-        if (data) {
-          //TracyFree(data);
-          free(data);
-        }
-
         FrameMarkEnd("Receiver::fetcher_alc_callback");
       });
 
@@ -109,22 +117,16 @@ LibFlute::Receiver::Receiver(const std::string &iface, const std::string &addres
         return;
       }
 
-      // Make a non const c string.
-      char *data = (char *)malloc(fdt_length + 1);
-      //TracyAlloc(data, fdt_length + 1);
-      memcpy(data, fdt_data, fdt_length);
-
       // Prevent other files and fdts from being handled while we are parsing the FDT
       std::unique_lock<LockableBase(std::mutex)> lock(_files_mutex);
 
+      LibFlute::FileDeliveryTable::Changes changes;
       try {
         // Set an artificial instance id for the FDT
         // In case that we already have an FDT, then we use the instance id of that FDT
         // This allows future FDTs to be handled correctly
         uint32_t instance_id = _fdt ? _fdt->instance_id() : 0;
-        // Make the FDT with a unique pointer. If there is already an FDT, then it will be replaced.
-        _fdt = std::make_unique<LibFlute::FileDeliveryTable>(
-            instance_id, data, fdt_length);
+        changes = apply_fdt(instance_id, fdt_data, fdt_length);
       } catch (std::exception &ex) {
         spdlog::warn("[RECEIVE] Failed to parse FDT: {}", ex.what());
         lock.unlock();
@@ -140,37 +142,58 @@ LibFlute::Receiver::Receiver(const std::string &iface, const std::string &addres
         return;
       }
 
-      // Free the non const c string.
-      if (data) {
-        //TracyFree(data);
-        free(data);
-      }
-
-      // Final check if the FDT is resolved
-      if (!_fdt)
-      {
-        spdlog::warn("[RECEIVE] Cannot resolve FDT for buffered ALCs: no FDT available");
-        lock.unlock();
-        return;
-      }
-
       // The files lock is still needed when we handle the FDT
-      handle_fdt_step_one();
+      handle_fdt_step_one(changes.added);
       lock.unlock();
       // The second step in handling the FDT is not time critical, so we can do it outside of the files lock
       handle_fdt_step_two();
     });
 
+  _fetcher.register_object_callback(
+    [&](uint32_t toi, uint64_t offset, const char *data, size_t length) {
+      handle_fetched_object(toi, offset, data, length);
+    });
+
     // Handle an empty reception, this will start the reception loop
     handle_receive_from(boost::system::error_code(), 0);
+
+    evict_parked_alcs(boost::system::error_code());
 }
 
 LibFlute::Receiver::~Receiver()
 {
   spdlog::debug("[RECEIVE] Destroying Receiver");
+  _parking_timer.cancel();
   _socket.close();
 }
 
+auto LibFlute::Receiver::publish_files() -> void
+{
+  // NOTE: files lock should be locked in the parent function.
+  ZoneScopedN("Receiver::publish_files");
+  _published_files.store(std::make_shared<const file_map_t>(_files), std::memory_order_release);
+}
+
+auto LibFlute::Receiver::find_file(uint64_t toi) const -> std::shared_ptr<LibFlute::FileBase>
+{
+  auto published_files = _published_files.load(std::memory_order_acquire);
+  auto file = published_files->find(toi);
+  return file == published_files->end() ? nullptr : file->second;
+}
+
+auto LibFlute::Receiver::evict_parked_alcs(const boost::system::error_code& error) -> void
+{
+  if (error == boost::asio::error::operation_aborted || !_running) {
+    return;
+  }
+  std::unique_lock<LockableBase(std::mutex)> files_lock(_files_mutex);
+  _unknown_alcs.evict_expired();
+  files_lock.unlock();
+
+  _parking_timer.expires_after(std::chrono::seconds(1));
+  _parking_timer.async_wait(boost::bind(&Receiver::evict_parked_alcs, this, boost::asio::placeholders::error));
+}
+
 auto LibFlute::Receiver::enable_ipsec(uint32_t spi, const std::string &key) -> void
 {
   LibFlute::IpSec::enable_esp(spi, _mcast_address, LibFlute::IpSec::Direction::In, key);
@@ -236,6 +259,7 @@ auto LibFlute::Receiver::handle_receive_from(const boost::system::error_code &er
 auto LibFlute::Receiver::handle_alc_step_one(char* data, size_t bytes_recvd, bool buffer_if_unknown) -> void
 {
   ZoneScopedN("Receiver::handle_alc_step_one");
+  auto received_at = ntp_timestamp(std::chrono::system_clock::now());
   try
   {
     LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
@@ -252,6 +276,10 @@ auto LibFlute::Receiver::handle_alc_step_one(char* data, size_t bytes_recvd, boo
       return;
     }
 
+    if (alc_ptr->has_sender_time()) {
+      sample_sender_time(alc_ptr->sender_time(), received_at);
+    }
+
     // The ALC packet is valid, so we can continue handling it
     handle_alc_step_two(alc_ptr, buffer_if_unknown && alc_ptr->toi() != 0);
   }
@@ -377,6 +405,17 @@ auto LibFlute::Receiver::handle_alc_step_three(std::shared_ptr<AlcPacket> alc_pt
     return;
   }
 
+  // Packets of files that are known are handed on without the files mutex, which FDT handling may hold for a while
+  if (alc_ptr->toi() != 0)
+  {
+    auto file = find_file(alc_ptr->toi());
+    if (file)
+    {
+      file->push_alc_to_receive_buffer(alc_ptr);
+      return;
+    }
+  }
+
   LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
 
   std::unique_lock<LockableBase(std::mutex)> files_lock(_files_mutex);
@@ -388,43 +427,42 @@ auto LibFlute::Receiver::handle_alc_step_three(std::shared_ptr<AlcPacket> alc_pt
 
     // spdlog::info("[RECEIVE] ALC:\n{}", std::string(alc_ptr->data(), alc_ptr->size()));
 
-    // Add FDT to files, but only if the instance id within the ALC is different from the FDT which we are currently using and there is no FDT currently within files
-    // This prevents handling re-transmitted FDTs. We only want to handle the FDT once.
+    // Only handle an FDT instance once, but keep collecting the packets of an instance that spans several.
     // Example, the FDT with instance id 1 is send 3 times, but we only receive the second and third transmission,
     // then we only want to handle the second transmission.
-    if ((!_fdt || _fdt->instance_id() != alc_ptr->fdt_instance_id()) && _files.find(alc_ptr->toi()) == _files.end())
+    auto fdt_file = _files.find(alc_ptr->toi());
+    if (_fdt && _fdt->instance_id() == alc_ptr->fdt_instance_id())
     {
-      FileDeliveryTable::FileEntry fe{0, 0, "", static_cast<uint32_t>(alc_ptr->fec_oti().transfer_length), "", "", 0, 0, alc_ptr->fec_oti(), 0};
-      // We use File for the FDT, because this has the most complete implementation of the FileBase interface
-      std::shared_ptr<LibFlute::FileBase> file = std::make_shared<LibFlute::File>(fe);
-      _files.emplace(alc_ptr->toi(), file);
-    } else {
       spdlog::debug("[RECEIVE] Discarding packet: already handled FDT with instance id {}", alc_ptr->fdt_instance_id());
       files_lock.unlock();
       return;
     }
+    else if (fdt_file == _files.end() || fdt_file->second->fdt_instance_id() != alc_ptr->fdt_instance_id())
+    {
+      // A newer instance replaces one that is still incomplete, the sender does not finish sending outdated instances
+      FileDeliveryTable::FileEntry fe{0, 0, "", static_cast<uint32_t>(alc_ptr->fec_oti().transfer_length), "", "", 0, 0, alc_ptr->fec_oti(), 0, alc_ptr->content_encoding()};
+      // We use File for the FDT, because this has the most complete implementation of the FileBase interface
+      std::shared_ptr<LibFlute::FileBase> file = std::make_shared<LibFlute::File>(fe);
+      file->set_fdt_instance_id(alc_ptr->fdt_instance_id());
+      _files.insert_or_assign(alc_ptr->toi(), file);
+      publish_files();
+    }
   /*} else {
     spdlog::info("[RECEIVE] ALC for TOI {}", alc_ptr->toi());
     spdlog::info("[RECEIVE] ALC:\n{}", std::string(alc_ptr->data(), alc_ptr->size()));
   */}
 
   // Check if the ALC does not belong to a file that we know
-  if (_files.find(alc_ptr->toi()) == _files.end() )
+  if (_files.find(alc_ptr->toi()) == _files.end() && !(alc_ptr->toi() != 0 && spawn_provisional_file(alc_ptr)))
   {
     // The file is not known, so we discard or buffer the ALC (if the ALC does not belong to an FDT)
 
     if (alc_ptr->may_buffer_if_unknown && alc_ptr->toi() != 0)
     {
-      // Push the ALC to the buffer, we will handle it once we receive a new FDT
-      // This buffer is circular, if it is full, then the oldest ALC will be removed first
-      _unknown_alc_buffer.push_back(alc_ptr);
-
-      // Log the buffer size
-      auto alcs_buffer_size = metricsInstance.getOrCreateGauge("alcs_buffer_size");
-      alcs_buffer_size->Set(_unknown_alc_buffer.size());
-      auto alcs_buffered = metricsInstance.getOrCreateGauge("alcs_buffered");
-      alcs_buffered->Increment();
-      spdlog::trace("[RECEIVE] Added discared packet to temp buffer with TOI {}", alc_ptr->toi());
+      // Park the ALC with the others of its TOI, the file claims them when it is spawned
+      if (_unknown_alcs.park(alc_ptr)) {
+        spdlog::trace("[RECEIVE] Parked packet with unknown TOI {}", alc_ptr->toi());
+      }
     } else {
       // End of the line, we don't know the file and we don't want to buffer it, so we discard it
       auto alcs_ignored = metricsInstance.getOrCreateGauge("alcs_ignored");
@@ -483,8 +521,7 @@ auto LibFlute::Receiver::handle_alc_step_four(std::shared_ptr<LibFlute::FileBase
   auto encoding_symbols = LibFlute::EncodingSymbol::from_payload(
       alc_ptr->data(), // Payload
       alc_ptr->size(), // Size of the payload
-      file->fec_oti(),
-      alc_ptr->content_encoding());
+      file->fec_oti());
   
   auto symbols_received = metricsInstance.getOrCreateGauge("symbols_received");
   symbols_received->Increment(encoding_symbols.size());
@@ -495,6 +532,11 @@ auto LibFlute::Receiver::handle_alc_step_four(std::shared_ptr<LibFlute::FileBase
     return;
   }
 
+  auto& tracer = LibFlute::Metric::LifecycleTracer::getInstance();
+  if (alc_ptr->toi() != 0 && tracer.enabled() && file->is_first_symbol()) {
+    tracer.record(LibFlute::Metric::LifecycleTracer::Event::FirstSymbolReceived, _tsi, alc_ptr->toi(), encoding_symbols.size());
+  }
+
   // Do the (possibly) time consuming part of handling the ALC
   // Add the symbols to the file
   for (const auto &symbol : encoding_symbols)
@@ -532,6 +574,11 @@ auto LibFlute::Receiver::handle_alc_step_four(std::shared_ptr<LibFlute::FileBase
     return;
   }
 
+  if (alc_ptr->toi() != 0) {
+    handle_file_completion(file);
+    return;
+  }
+
   spdlog::debug("[RECEIVE] File with TOI {} completed", alc_ptr->toi());
 
   // The file is complete, we will do some operations on the files map or on _fdt, so we need to lock it
@@ -540,43 +587,67 @@ auto LibFlute::Receiver::handle_alc_step_four(std::shared_ptr<LibFlute::FileBase
   //spdlog::debug("[RECEIVE] Lock acquired for file with TOI {}", alc_ptr->toi());
 
 
-  // Check if the ALC belongs to an FDT
-  if (alc_ptr->toi() == 0)
-  {
-    auto fdt_received = metricsInstance.getOrCreateGauge("fdt_received");
-    fdt_received->Increment();
+  // From here on the completed file is an FDT
+  auto fdt_received = metricsInstance.getOrCreateGauge("fdt_received");
+  fdt_received->Increment();
 
-    try {
-      // Cast file from FileBase to File
-      // auto f = std::dynamic_pointer_cast<LibFlute::File>(file);
-      // Parse the completed FDT
-      _fdt = std::make_unique<LibFlute::FileDeliveryTable>(
-          alc_ptr->fdt_instance_id(), file->buffer(), file->length());
-    } catch (const char *errorMessage) {
-      _fdt = nullptr;
-      _files.erase(alc_ptr->toi());
-      files_lock.unlock();
-      spdlog::warn("[RECEIVE] Failed to parse FDT: {}", errorMessage);
-      return;
-    } catch (...)
-    {
-      _fdt = nullptr;
-      _files.erase(alc_ptr->toi());
-      files_lock.unlock();
-      spdlog::warn("[RECEIVE] Failed to parse FDT: unknown error");
-      return;
+  LibFlute::FileDeliveryTable::Changes changes;
+  try {
+    // Apply the completed FDT, the table keeps what earlier instances listed
+    if (file->meta().content_encoding != ContentEncoding::NONE) {
+      constexpr size_t max_fdt_length = 16 * 1024 * 1024; // Bound on the inflated size, against decompression bombs
+      auto fdt = Compression::decompress(file->buffer(), file->length(), file->meta().content_encoding, max_fdt_length);
+      metricsInstance.getOrCreateCounter("fdt_compressed")->Increment();
+      changes = apply_fdt(alc_ptr->fdt_instance_id(), fdt.data(), fdt.length());
+    } else {
+      changes = apply_fdt(alc_ptr->fdt_instance_id(), file->buffer(), file->length());
     }
-
+  } catch (const char *errorMessage) {
     _files.erase(alc_ptr->toi());
-
-    // The files lock is still needed when we handle the FDT
-    handle_fdt_step_one();
+    publish_files();
+    files_lock.unlock();
+    spdlog::warn("[RECEIVE] Failed to parse FDT: {}", errorMessage);
+    return;
+  } catch (...)
+  {
+    _files.erase(alc_ptr->toi());
+    publish_files();
     files_lock.unlock();
-    // The second step in handling the FDT is not time critical, so we can do it outside of the files lock
-    handle_fdt_step_two();
+    spdlog::warn("[RECEIVE] Failed to parse FDT: unknown error");
+    return;
+  }
+
+  _files.erase(alc_ptr->toi());
+
+  // The files lock is still needed when we handle the FDT, it publishes the files when it is done
+  handle_fdt_step_one(changes.added);
+  files_lock.unlock();
+  // The second step in handling the FDT is not time critical, so we can do it outside of the files lock
+  handle_fdt_step_two();
+}
 
+auto LibFlute::Receiver::handle_file_completion(std::shared_ptr<LibFlute::FileBase> file) -> void
+{
+  ZoneScopedN("Receiver::handle_file_completion");
+  // Without its FDT entry the file can not be verified nor named, it is handed on when the entry arrives
+  if (file->provisional()) {
+    spdlog::debug("[RECEIVE] File with TOI {} completed before its FDT entry", file->meta().toi);
+    return;
+  }
+  // Both the receive thread and the fetcher can complete a file, only the first one hands it on
+  if (!file->claim_completion()) {
     return;
   }
+  auto toi = file->meta().toi;
+  spdlog::debug("[RECEIVE] File with TOI {} completed", toi);
+  // Repairs of the file that are still waiting or on the way are of no use anymore
+  _fetcher.file_completed(toi);
+
+  // Files that were repaired were sampled when their missing symbols were asked for
+  bool repaired = file->retrieval_deadline() != 0 && file->meta().should_be_complete_at == 0;
+  if (!repaired && file->nof_symbols() > 0) {
+    sample_loss(std::max(0.0, 1.0 - static_cast<double>(file->symbols_received()) / file->nof_symbols()));
+  }
 
   // From this point on, we are only handling files, not FDTs
 
@@ -615,13 +686,25 @@ auto LibFlute::Receiver::handle_alc_step_four(std::shared_ptr<LibFlute::FileBase
     }
   }
   */
-  
-  // We can unlock the files map now.
-  files_lock.unlock();
+
+  // Files sent with a content encoding are handed on decoded
+  bool decoded = true;
+  if (file->meta().content_encoding != ContentEncoding::NONE) {
+    LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
+    try {
+      file->decode_content();
+      metricsInstance.getOrCreateCounter("files_decoded")->Increment();
+    } catch (const char *errorMessage) {
+      decoded = false;
+      metricsInstance.getOrCreateCounter("files_decode_failed")->Increment();
+      spdlog::warn("[RECEIVE] Failed to decode TOI {}: {}", toi, errorMessage);
+    }
+  }
 
   // We only call the completion callback for files that are not part of a stream
-  if (_completion_cb && file->meta().stream_id == 0) {
+  if (_completion_cb && file->meta().stream_id == 0 && decoded) {
     // Call the completion callback
+    LibFlute::Metric::LifecycleTracer::getInstance().record(LibFlute::Metric::LifecycleTracer::Event::CompletionCallback, _tsi, toi);
     _completion_cb(file);
   }
 
@@ -646,23 +729,157 @@ auto LibFlute::Receiver::handle_alc_step_four(std::shared_ptr<LibFlute::FileBase
   // The file will be removed from the list of files when the file is expired.
 
   // Quickly check if there are any buffered ALCs that belong to the completed file, we can remove them to prevent unnecessary handling.
-  pop_toi_from_buffer_fronts(alc_ptr->toi());
+  pop_toi_from_buffer_fronts(toi);
 
   // TODO: remove toi from any stream inside _stream_tois
 }
 
-auto LibFlute::Receiver::handle_fdt_step_one() -> void
+auto LibFlute::Receiver::handle_fetched_object(uint32_t toi, uint64_t offset, const char* data, size_t length) -> void
+{
+  ZoneScopedN("Receiver::handle_fetched_object");
+  auto file = find_file(toi);
+  if (!file) {
+    return;
+  }
+
+  if (file->complete()) {
+    return;
+  }
+  try {
+    file->put_range(offset, data, length);
+  } catch (const char *errorMessage) {
+    spdlog::warn("[RECEIVE] Failed to put fetched range of TOI {}: {}", toi, errorMessage);
+    return;
+  }
+  if (file->complete()) {
+    handle_file_completion(file);
+  }
+}
+
+auto LibFlute::Receiver::sample_loss(double loss) -> void
+{
+  // Exponential moving average, recent files weigh in the most
+  constexpr double alpha = 0.1;
+  auto estimate = _loss_estimate.load(std::memory_order_relaxed);
+  while (!_loss_estimate.compare_exchange_weak(estimate, estimate + alpha * (std::min(loss, 1.0) - estimate), std::memory_order_relaxed)) {
+  }
+  LibFlute::Metric::Metrics::getInstance().getOrCreateGauge("reception_loss_estimate")->Set(_loss_estimate.load(std::memory_order_relaxed));
+}
+
+auto LibFlute::Receiver::sample_sender_time(const SenderTime& sender_time, uint64_t received_at) -> void
+{
+  // NTP timestamps are 32.32 fixed point, the difference is taken modulo 2^64 so it survives the NTP era rollover
+  auto transit = static_cast<int64_t>(received_at - sender_time.ntp_timestamp);
+  auto delay = static_cast<double>(transit) / 4294967296.0;
+  if (delay >= 0) {
+    _one_way_delay_histogram->Observe(delay);
+  } else {
+    // The receiver clock is behind the sender clock, this is no delay that can be recorded
+    LibFlute::Metric::Metrics::getInstance().getOrCreateCounter("alc_one_way_delay_negative")->Increment();
+  }
+
+  // RFC 3550 6.4.1: J += (|D| - J) / 16, with D the difference in transit time of consecutive packets
+  if (_has_last_transit) {
+    auto difference = std::abs(static_cast<double>(transit - _last_transit)) / 4294967296.0;
+    auto jitter = _jitter.load(std::memory_order_relaxed);
+    jitter += (difference - jitter) / 16.0;
+    _jitter.store(jitter, std::memory_order_relaxed);
+    _jitter_histogram->Observe(jitter);
+  }
+  _last_transit = transit;
+  _has_last_transit = true;
+
+  spdlog::trace("[RECEIVE] One-way delay {} s, jitter {} s, expected residual time {} ms", delay, _jitter.load(std::memory_order_relaxed),
+      sender_time.has_expected_residual_time ? static_cast<int64_t>(sender_time.expected_residual_time) : -1);
+}
+
+auto LibFlute::Receiver::apply_fdt(uint32_t instance_id, const char* data, size_t length) -> LibFlute::FileDeliveryTable::Changes
+{
+  // NOTE: files lock should be locked in the parent function.
+  ZoneScopedN("Receiver::apply_fdt");
+  LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
+
+  LibFlute::FileDeliveryTable::Changes changes;
+  if (_fdt) {
+    changes = _fdt->update(instance_id, data, length);
+  } else {
+    // Only keep the table once an instance could be parsed
+    auto fdt = std::make_unique<LibFlute::FileDeliveryTable>(instance_id, FecOti{});
+    changes = fdt->update(instance_id, data, length);
+    _fdt = std::move(fdt);
+  }
+
+  if (changes.duplicate) {
+    metricsInstance.getOrCreateCounter("fdt_duplicates")->Increment();
+    spdlog::debug("[RECEIVE] FDT with instance ID {} has the same content as the previous one", instance_id);
+  } else {
+    metricsInstance.getOrCreateCounter("fdt_entries_added")->Increment(changes.added.size());
+    metricsInstance.getOrCreateCounter("fdt_entries_removed")->Increment(changes.removed.size());
+    spdlog::debug("[RECEIVE] FDT with instance ID {} added {} and removed {} entries", instance_id, changes.added.size(), changes.removed.size());
+  }
+  return changes;
+}
+
+auto LibFlute::Receiver::handle_fdt_step_one(const std::vector<LibFlute::FileDeliveryTable::FileEntry>& added) -> void
 {
   ZoneScopedN("Receiver::handle_fdt_step_one");
 
   const std::lock_guard<LockableBase(std::mutex)> lock(_spawn_files_mutex);
 
-  // Automatically receive all files in the FDT
-  for (const auto &file_entry : _fdt->file_entries())
+  // Automatically receive the files that are new in the FDT
+  for (const auto &file_entry : added)
   {
+    // Files that were started from the EXT_FTI of their packets are kept if the entry matches them
+    auto existing = _files.find(file_entry.toi);
+    if (existing != _files.end() && existing->second->provisional())
+    {
+      auto file = existing->second;
+      _provisional_tois.erase(file_entry.toi);
+      LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
+      if (file->adopt_entry(file_entry)) {
+        metricsInstance.getOrCreateCounter("files_provisional_adopted")->Increment();
+        LibFlute::Metric::LifecycleTracer::getInstance().setLabel(_tsi, file_entry.toi, file_entry.content_location);
+        // The file keeps its own FEC transformer
+        delete file_entry.fec_transformer;
+        if (file->complete()) {
+          _adopted_files.push_back(file);
+        }
+        continue;
+      }
+      spdlog::debug("[RECEIVE] FDT entry for TOI {} does not match the packets it was started from, starting over", file_entry.toi);
+      metricsInstance.getOrCreateCounter("files_provisional_replaced")->Increment();
+      // The file owns the FEC transformer it was started with, its thread must be gone before that is freed
+      file->stop_receive_thread(true);
+      if (file->meta().fec_transformer) {
+        delete file->meta().fec_transformer;
+        file->meta().fec_transformer = 0;
+      }
+      _files.erase(existing);
+    }
+    else if (existing != _files.end() && (existing->second->complete()
+                                          || existing->second->meta().content_location != file_entry.content_location
+                                          || existing->second->meta().content_md5 != file_entry.content_md5
+                                          || existing->second->meta().content_length != file_entry.content_length
+                                          || existing->second->meta().fec_oti.transfer_length != file_entry.fec_oti.transfer_length))
+    {
+      // The sender wrapped around its TOIs or changed the entry, the file we still hold under this TOI is an older one
+      spdlog::debug("[RECEIVE] TOI {} is reused for {}, dropping {}", file_entry.toi, file_entry.content_location, existing->second->meta().content_location);
+      LibFlute::Metric::Metrics::getInstance().getOrCreateCounter("files_toi_reused")->Increment();
+      existing->second->stop_receive_thread(true);
+      if (existing->second->meta().fec_transformer) {
+        delete existing->second->meta().fec_transformer;
+        existing->second->meta().fec_transformer = 0;
+      }
+      if (_removal_cb) {
+        _removal_cb(existing->second);
+      }
+      _files.erase(existing);
+    }
+
     // Check if the file is already in the list of files, if not then add it
     if (_files.find(file_entry.toi) == _files.end())
     {
+      LibFlute::Metric::LifecycleTracer::getInstance().record(LibFlute::Metric::LifecycleTracer::Event::FdtReceived, _tsi, file_entry.toi, _fdt->instance_id());
       /*
       // Create a shared pointer copy of the file entry
       auto file_entry_shared_ptr = std::make_shared<LibFlute::FileDeliveryTable::FileEntry>(file_entry);
@@ -689,6 +906,9 @@ auto LibFlute::Receiver::handle_fdt_step_one() -> void
       } 
     }
   }
+
+  // One copy for all the changes of this FDT
+  publish_files();
 }
 
 auto LibFlute::Receiver::spawn_file(const LibFlute::FileDeliveryTable::FileEntry &file_entry) -> void
@@ -707,6 +927,8 @@ auto LibFlute::Receiver::spawn_file(const LibFlute::FileDeliveryTable::FileEntry
   } else {
     file = std::make_shared<LibFlute::File>(file_entry);
   }
+  file->set_tsi(_tsi);
+  LibFlute::Metric::LifecycleTracer::getInstance().setLabel(_tsi, file_entry.toi, file_entry.content_location);
 
   // Add a callback that tries to fix a file that misses some parts.
   file->register_missing_callback(
@@ -784,8 +1006,7 @@ auto LibFlute::Receiver::spawn_file(const LibFlute::FileDeliveryTable::FileEntry
         auto buffered_symbols = EncodingSymbol::from_payload(
           it_alc->get()->data(), // Payload
           it_alc->get()->size(), // Size of the payload
-          incomplete_file.meta().fec_oti,
-          it_alc->get()->content_encoding());
+          incomplete_file.meta().fec_oti);
 
         // Check if the ALC contains any encoding symbols
         if (buffered_symbols.empty())
@@ -863,15 +1084,57 @@ auto LibFlute::Receiver::spawn_file(const LibFlute::FileDeliveryTable::FileEntry
         spdlog::debug("[RECEIVE] Found {} missing symbols in file received ALCs buffer. Buffer size is: {}", missing_symbols_found_in_buffer, buffered_symbols.size());
       }
 
-      _fetcher.fetch_alcs(incomplete_file.meta().toi, encoding_id, incomplete_file.meta().content_location, missing_symbols);
+      size_t nof_missing_symbols = 0;
+      for (const auto& block : *missing_symbols) {
+        nof_missing_symbols += block.second.size();
+      }
+      if (incomplete_file.nof_symbols() > 0) {
+        sample_loss(static_cast<double>(nof_missing_symbols) / incomplete_file.nof_symbols());
+      }
+      LibFlute::Metric::LifecycleTracer::getInstance().record(LibFlute::Metric::LifecycleTracer::Event::RepairRequested, _tsi, incomplete_file.meta().toi, nof_missing_symbols);
+
+      // Fountain coded blocks can be completed by any symbols, not just the missing ones
+      std::shared_ptr<std::map<uint16_t, LibFlute::RepairRequest::Needed>> needed_symbols = nullptr;
+      if (encoding_id == FecScheme::Raptor) {
+        needed_symbols = std::make_shared<std::map<uint16_t, LibFlute::RepairRequest::Needed>>(incomplete_file.symbols_needed());
+      }
+
+      // Where the object and its source blocks are, in case fetching them as a whole is cheaper. The content lock
+      // is held while this callback runs, so the source blocks can be read.
+      std::shared_ptr<LibFlute::Fetcher::ObjectLayout> layout = nullptr;
+      // Servers hold the content rather than the encoded transport object, so encoded files only take symbols
+      if (incomplete_file.meta().stream_id == 0 && incomplete_file.buffer() != nullptr
+          && incomplete_file.meta().content_encoding == ContentEncoding::NONE) {
+        layout = std::make_shared<LibFlute::Fetcher::ObjectLayout>();
+        layout->length = incomplete_file.meta().fec_oti.transfer_length;
+        layout->symbol_length = incomplete_file.meta().fec_oti.encoding_symbol_length;
+        if (!incomplete_file.meta().fec_transformer) {
+          for (const auto& [sbn, block] : incomplete_file.source_blocks()) {
+            if (block.symbols.empty()) {
+              break;
+            }
+            layout->block_offsets.push_back(block.symbols.begin()->second.data - incomplete_file.buffer());
+          }
+        }
+      }
+
+      _fetcher.fetch_alcs(incomplete_file.meta().toi, encoding_id, incomplete_file.meta().content_location, missing_symbols, needed_symbols,
+          incomplete_file.retrieval_deadline(), layout, incomplete_file.meta().content_encoding);
+    });
+
+  file->register_block_callback(
+    [&](LibFlute::FileBase& f, uint16_t sbn) { // NOLINT
+      _fetcher.block_completed(f.meta().toi, sbn);
     });
 
   file->register_receiver_callback(
     [&](std::shared_ptr<AlcPacket> a) { // NOLINT
       // The shared pointer looses a count here in the compiler, let's retrieve it to solve the issue
-      std::unique_lock<LockableBase(std::mutex)> files_lock2(_files_mutex);
-      auto file_shared_ptr = _files[a->toi()];
-      files_lock2.unlock();
+      auto file_shared_ptr = find_file(a->toi());
+      if (!file_shared_ptr) {
+        // Removed from the table in the meantime
+        return;
+      }
       handle_alc_step_four(file_shared_ptr, a);
     });
 
@@ -892,10 +1155,10 @@ auto LibFlute::Receiver::spawn_file(const LibFlute::FileDeliveryTable::FileEntry
     _stream_tois[file_entry.stream_id].push_back(file_entry.toi);
 
     // Search for the previous tois in _stream_tois map, which holds the TOIs of the previous files in the stream at the value, the key is the stream id
-    // The previous TOI is the greatest value that is at least 1 smaller than the current TOI
+    // The previous TOI is the latest one that was handed out before the current TOI, TOIs may have wrapped around
     uint64_t previous_toi = 0;
     for (const auto &toi : _stream_tois[file_entry.stream_id]) {
-      if (toi < file_entry.toi && toi > previous_toi) {
+      if (toi_after(file_entry.toi, toi) && (previous_toi == 0 || toi_after(toi, previous_toi))) {
         previous_toi = toi;
       }
     }
@@ -943,12 +1206,54 @@ auto LibFlute::Receiver::spawn_file(const LibFlute::FileDeliveryTable::FileEntry
   // Lock the files map, so we can add the file
   //const std::lock_guard<LockableBase(std::mutex)> files_lock(_files_mutex);
   _files.emplace(file_entry.toi, file);
+
+  // Hand over the packets that arrived before the file was known
+  auto parked_alcs = _unknown_alcs.claim(file_entry.toi);
+  if (!parked_alcs.empty()) {
+    spdlog::trace("[RECEIVE] Handing {} parked packets to TOI {}", parked_alcs.size(), file_entry.toi);
+    if (may_receive) {
+      for (auto &alc_ptr : parked_alcs) {
+        file->push_alc_to_receive_buffer(alc_ptr);
+      }
+    }
+  }
+}
+
+auto LibFlute::Receiver::spawn_provisional_file(const std::shared_ptr<AlcPacket>& alc_ptr) -> bool
+{
+  // NOTE: files lock should be locked in the parent function.
+  ZoneScopedN("Receiver::spawn_provisional_file");
+  if (!alc_ptr->has_fti() || _provisional_tois.size() >= _max_provisional_files ||
+      alc_ptr->fec_oti().transfer_length > _max_provisional_length ||
+      (_video_ids_ptr && !_video_ids_ptr->empty())) {
+    return false;
+  }
+  // A file that completed and was removed from the FDT already is not started again
+  if (_fdt && _fdt->contains(alc_ptr->toi())) {
+    return false;
+  }
+
+  try {
+    spawn_file(LibFlute::FileDeliveryTable::provisional_entry(alc_ptr->toi(), alc_ptr->fec_oti(), alc_ptr->content_encoding()));
+  } catch (const char *errorMessage) {
+    spdlog::debug("[RECEIVE] Not starting TOI {} before its FDT entry: {}", alc_ptr->toi(), errorMessage);
+    return false;
+  }
+  auto file = _files.find(alc_ptr->toi());
+  if (file == _files.end()) {
+    return false;
+  }
+  file->second->set_provisional(true);
+  _provisional_tois.insert(alc_ptr->toi());
+  publish_files();
+  LibFlute::Metric::Metrics::getInstance().getOrCreateCounter("files_provisional")->Increment();
+  spdlog::debug("[RECEIVE] Started TOI {} from EXT_FTI, {} bytes", alc_ptr->toi(), alc_ptr->fec_oti().transfer_length);
+  return true;
 }
 
 auto LibFlute::Receiver::handle_fdt_step_two() -> void
 {
   ZoneScopedN("Receiver::handle_fdt_step_two");
-  LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
   std::unique_lock<LockableBase(std::mutex)> spawn_files_lock(_spawn_files_mutex);
   if (!_file_spawn_threads.empty()) {
     spdlog::debug("[RECEIVE] Waiting for {} file spawn threads to finish", _file_spawn_threads.size());
@@ -963,33 +1268,18 @@ auto LibFlute::Receiver::handle_fdt_step_two() -> void
     // Clear all the files from the _file_spawn_threads vector
     _file_spawn_threads.clear();
   }
+  auto adopted_files = std::move(_adopted_files);
+  _adopted_files.clear();
   spawn_files_lock.unlock();
 
-  // Now that we have parsed an FDT, we can try to handle buffered ALCs
-  // The unknown buffer uses the files mutex, not the buffer mutex
-  // We need to lock it, so it is thread safe
-  const std::lock_guard<LockableBase(std::mutex)> file_lock(_files_mutex);
-  if (!_unknown_alc_buffer.empty()) {
-    spdlog::trace("[RECEIVE] Re-handling ALCs that were previously unknown");
-  }
-  while (!_unknown_alc_buffer.empty())
-  {
-    auto f_alc = _unknown_alc_buffer.front();
-    // Remove the ALC from the unknown buffer
-    _unknown_alc_buffer.pop_front();
-    // Check if f_alc does not belong to an FDT
-    // This should not happen, but we check it anyway to be sure
-    // Otherwise we might cause a deadlock!
-    if (f_alc->toi() != 0)
-    {
-      // Second parameter: We just handle them now and discard them if they are still unknown. We don't want to buffer them again, because we will probably never receive the FDT for them.
-      handle_alc_step_two(f_alc, false);
+  for (auto &file : adopted_files) {
+    if (file->complete()) {
+      handle_file_completion(file);
     }
   }
 
-  // Log the buffer size
-  auto alcs_buffer_size = metricsInstance.getOrCreateGauge("alcs_buffer_size");
-  alcs_buffer_size->Set(_unknown_alc_buffer.size());
+  // Packets that arrived before the FDT were already claimed by spawn_file, the others stay parked until
+  // their own FDT entry arrives or they expire
 
   spdlog::debug("[RECEIVE] FDT handling finished");
 }
@@ -1015,23 +1305,10 @@ auto LibFlute::Receiver::pop_toi_from_buffer_fronts(uint64_t toi) -> void {
     ++ignored_counter;
   }
 
-  // We do the same for the unknown buffer, although this should not be necessary
-  // The unknown buffer uses the files mutex, not the buffer mutex
-  // We need to lock it, so it is thread safe
+  // We do the same for the parked packets, although this should not be necessary
+  // The parking buffer uses the files mutex, not the buffer mutex
   std::unique_lock<LockableBase(std::mutex)> file_lock(_files_mutex);
-  while (!_unknown_alc_buffer.empty())
-  {
-    // Get the first ALC from the buffer
-    auto f_alc = _unknown_alc_buffer.front();
-    if (f_alc->toi() != toi)
-    {
-      // The ALC does not belong to the completed file, so we can stop
-      break;
-    }
-    // Remove the ALC from the unknown buffer
-    _unknown_alc_buffer.pop_front();
-    ++ignored_counter;
-  }
+  ignored_counter += _unknown_alcs.discard(toi);
   if (ignored_counter > 0) {
     spdlog::debug("[RECEIVE] Removed {} buffered ALCs for TOI {}", ignored_counter, toi);
   } else {
@@ -1046,7 +1323,7 @@ auto LibFlute::Receiver::resolve_fdt_for_buffered_alcs() -> void
   // We need to lock it, so it is thread safe
   std::unique_lock<LockableBase(std::mutex)> file_lock(_files_mutex);
   // Check if there are any buffered ALCs
-  if (_unknown_alc_buffer.empty())
+  if (_unknown_alcs.empty())
   {
     // No buffered ALCs, so we don't need to resolve the FDT
     file_lock.unlock();
@@ -1060,9 +1337,10 @@ auto LibFlute::Receiver::resolve_fdt_for_buffered_alcs() -> void
 
 auto LibFlute::Receiver::file_list() -> std::vector<std::shared_ptr<LibFlute::FileBase>>
 {
-  const std::lock_guard<LockableBase(std::mutex)> files_lock(_files_mutex);
+  // Read from the published table, so listing the files does not wait for FDT handling
+  auto published_files = _published_files.load(std::memory_order_acquire);
   std::vector<std::shared_ptr<LibFlute::FileBase>> files;
-  for (auto &f : _files)
+  for (auto &f : *published_files)
   {
     files.push_back(f.second);
   }
@@ -1081,17 +1359,20 @@ auto LibFlute::Receiver::remove_expired_files(unsigned max_age) -> void
     auto age = time(nullptr) - it->second->received_at();
     if (it->second->meta().content_location != "bootstrap.multipart" && age > max_age)
     {
+      // Packets may still be handed to the file from the published table, stop its thread before its FEC transformer goes
+      it->second.get()->stop_receive_thread(true);
+
       if (it->second.get()->meta().fec_transformer){
         delete it->second.get()->meta().fec_transformer;
         it->second.get()->meta().fec_transformer = 0;
       }
 
-      it->second.get()->stop_receive_thread(true);
-
-      if (_removal_cb) {
+      // Provisional files were never announced to the application
+      if (_removal_cb && !it->second->provisional()) {
         _removal_cb(it->second);
       }
 
+      _provisional_tois.erase(it->first);
       it = _files.erase(it);
     }
     else
@@ -1099,6 +1380,7 @@ auto LibFlute::Receiver::remove_expired_files(unsigned max_age) -> void
       ++it;
     }
   }
+  publish_files();
 }
 
 auto LibFlute::Receiver::remove_file_with_content_location(const std::string &cl) -> void
@@ -1109,17 +1391,20 @@ auto LibFlute::Receiver::remove_file_with_content_location(const std::string &cl
   {
     if (it->second->meta().content_location == cl)
     {
+      // Packets may still be handed to the file from the published table, stop its thread before its FEC transformer goes
+      it->second.get()->stop_receive_thread(true);
+
       if (it->second.get()->meta().fec_transformer){
         delete it->second.get()->meta().fec_transformer;
         it->second.get()->meta().fec_transformer = 0;
       }
 
-      it->second.get()->stop_receive_thread(true);
-
-      if (_removal_cb) {
+      // Provisional files were never announced to the application
+      if (_removal_cb && !it->second->provisional()) {
         _removal_cb(it->second);
       }
 
+      _provisional_tois.erase(it->first);
       it = _files.erase(it);
     }
     else
@@ -1127,4 +1412,5 @@ auto LibFlute::Receiver::remove_file_with_content_location(const std::string &cl
       ++it;
     }
   }
+  publish_files();
 }
@@ -0,0 +1,840 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#include "Component/RepairServer.h"
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <ctime>
+#include <fstream>
+#include <regex>
+#include <sstream>
+
+#include "Component/Retriever.h"
+#include "Metric/Metrics.h"
+#include "spdlog/spdlog.h"
+
+#include "public/common/TracySystem.hpp"
+
+namespace {
+    // Longest request line and headers we accept
+    constexpr size_t max_header_length = 64 * 1024;
+
+    // 0.1 ms up to ~1.6 s
+    const LibFlute::Metric::Histogram::BucketBoundaries latency_buckets =
+        LibFlute::Metric::Histogram::ExponentialBuckets(0.0001, 2.0, 15);
+
+    struct Request {
+        std::string method;
+        std::string path;
+        std::string body;
+        size_t content_length = 0;
+        uint64_t deadline_ms = 0; // From the X-Deadline header, 0 if absent
+        std::string range; // Range header of a GET
+        bool keep_alive = true;
+    };
+
+    struct Response {
+        unsigned status = 200;
+        std::string content_type = "application/octet-stream";
+        std::string body;
+        std::shared_ptr<std::ifstream> file; // Streamed after the body
+        uint64_t file_remaining = 0;
+        std::string extra_headers;
+        bool close = false;
+    };
+
+    auto now_ms() -> uint64_t {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    auto reason(unsigned status) -> const char* {
+        switch (status) {
+            case 200: return "OK";
+            case 206: return "Partial Content";
+            case 400: return "Bad Request";
+            case 403: return "Forbidden";
+            case 404: return "Not Found";
+            case 405: return "Method Not Allowed";
+            case 413: return "Payload Too Large";
+            case 416: return "Range Not Satisfiable";
+            case 429: return "Too Many Requests";
+            case 503: return "Service Unavailable";
+            default: return "Internal Server Error";
+        }
+    }
+
+    auto error_response(unsigned status) -> Response {
+        Response response;
+        response.status = status;
+        response.content_type = "text/plain";
+        response.body = reason(status);
+        if (status == 429 || status == 503) {
+            response.extra_headers = "Retry-After: 1\r\n";
+        }
+        return response;
+    }
+
+    auto trim(const std::string& value) -> std::string {
+        auto start = value.find_first_not_of(" \t\r\n");
+        if (start == std::string::npos) {
+            return {};
+        }
+        auto end = value.find_last_not_of(" \t\r\n");
+        return value.substr(start, end - start + 1);
+    }
+
+    auto lower(std::string value) -> std::string {
+        std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+        return value;
+    }
+
+    /**
+     *  Parse the request line and the headers we care about, returns false if the request is malformed.
+     */
+    auto parse_head(const std::string& head, Request& request) -> bool {
+        std::istringstream stream(head);
+        std::string line;
+        if (!std::getline(stream, line)) {
+            return false;
+        }
+        std::istringstream request_line(line);
+        std::string version;
+        request_line >> request.method >> request.path >> version;
+        version = trim(version);
+        if (request.method.empty() || request.path.empty() || version.compare(0, 5, "HTTP/") != 0) {
+            return false;
+        }
+        // HTTP/1.0 closes the connection unless asked otherwise
+        request.keep_alive = version != "HTTP/1.0";
+
+        while (std::getline(stream, line)) {
+            auto colon = line.find(':');
+            if (colon == std::string::npos) {
+                continue;
+            }
+            auto name = lower(trim(line.substr(0, colon)));
+            auto value = trim(line.substr(colon + 1));
+            try {
+                if (name == "content-length") {
+                    request.content_length = std::stoull(value);
+                } else if (name == "x-deadline") {
+                    request.deadline_ms = std::stoull(value);
+                } else if (name == "range") {
+                    request.range = value;
+                } else if (name == "connection") {
+                    auto connection = lower(value);
+                    if (connection == "close") {
+                        request.keep_alive = false;
+                    } else if (connection == "keep-alive") {
+                        request.keep_alive = true;
+                    }
+                }
+            } catch (const std::exception&) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    auto utc_time() -> std::string {
+        auto now = std::chrono::system_clock::now();
+        auto seconds = std::chrono::system_clock::to_time_t(now);
+        auto millis = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()).count() % 1000;
+        std::tm tm{};
+        gmtime_r(&seconds, &tm);
+        char buffer[32];
+        auto length = std::strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm);
+        snprintf(buffer + length, sizeof(buffer) - length, ".%03dZ", static_cast<int>(millis));
+        return buffer;
+    }
+}
+
+/**
+ *  One client connection. All members are only touched on the strand, complete() may be called from any thread.
+ */
+class LibFlute::RepairServer::Session : public std::enable_shared_from_this<Session> {
+  public:
+    Session(RepairServer& server)
+      : socket(server._io_service)
+      , _server(server)
+      , _strand(server._io_service)
+      , _idle_timer(server._io_service)
+      , _buffer(max_header_length + server._options.max_request_size)
+    {}
+
+    void start() {
+        boost::system::error_code error;
+        auto endpoint = socket.remote_endpoint(error);
+        _client = error ? "" : endpoint.address().to_string();
+        _strand.dispatch([self = shared_from_this()]() { self->read_headers(); });
+    }
+
+    void close_now() {
+        if (_closed) {
+            return;
+        }
+        _closed = true;
+        boost::system::error_code ignored;
+        socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+        socket.close(ignored);
+        _idle_timer.cancel(ignored);
+        _ready.clear();
+
+        const std::lock_guard<LockableBase(std::mutex)> lock(_server._sessions_mutex);
+        _server._sessions.erase(shared_from_this());
+    }
+
+    void complete(uint64_t sequence, Response response) {
+        _strand.dispatch([self = shared_from_this(), sequence, response = std::move(response)]() mutable {
+            if (self->_closed) {
+                return;
+            }
+            self->_ready.emplace(sequence, std::move(response));
+            self->write_next();
+        });
+    }
+
+    boost::asio::ip::tcp::socket socket;
+
+  private:
+    void read_headers() {
+        if (_closed || _reading || _stop_reading) {
+            return;
+        }
+        _reading = true;
+        arm_idle_timer();
+        boost::asio::async_read_until(socket, _buffer, "\r\n\r\n",
+            _strand.wrap([self = shared_from_this()](const boost::system::error_code& error, size_t header_length) {
+                self->handle_headers(error, header_length);
+            }));
+    }
+
+    void handle_headers(const boost::system::error_code& error, size_t header_length) {
+        if (error) {
+            if (error == boost::asio::error::not_found) {
+                // The headers do not fit the buffer
+                _reading = false;
+                _stop_reading = true;
+                respond_now(error_response(413), true);
+                return;
+            }
+            if (error != boost::asio::error::eof && error != boost::asio::error::operation_aborted) {
+                spdlog::debug("[REPAIR] Reading from {} failed: {}", _client, error.message());
+            }
+            close_now();
+            return;
+        }
+
+        auto request = std::make_shared<Request>();
+        std::string head(boost::asio::buffers_begin(_buffer.data()),
+                         boost::asio::buffers_begin(_buffer.data()) + header_length);
+        _buffer.consume(header_length);
+        if (!parse_head(head, *request)) {
+            _reading = false;
+            _stop_reading = true;
+            respond_now(error_response(400), true);
+            return;
+        }
+        if (request->content_length > _server._options.max_request_size) {
+            _reading = false;
+            _stop_reading = true;
+            respond_now(error_response(413), true);
+            return;
+        }
+
+        if (_buffer.size() >= request->content_length) {
+            take_body(*request);
+            handle_request(request);
+            return;
+        }
+        boost::asio::async_read(socket, _buffer, boost::asio::transfer_exactly(request->content_length - _buffer.size()),
+            _strand.wrap([self = shared_from_this(), request](const boost::system::error_code& error, size_t /*bytes*/) {
+                if (error) {
+                    self->close_now();
+                    return;
+                }
+                self->take_body(*request);
+                self->handle_request(request);
+            }));
+    }
+
+    void take_body(Request& request) {
+        request.body.assign(boost::asio::buffers_begin(_buffer.data()),
+                            boost::asio::buffers_begin(_buffer.data()) + request.content_length);
+        _buffer.consume(request.content_length);
+    }
+
+    void handle_request(const std::shared_ptr<Request>& request) {
+        ZoneScopedN("RepairServer::Session::handle_request");
+        _reading = false;
+        auto sequence = _next_sequence++;
+        _outstanding++;
+        if (!request->keep_alive) {
+            _stop_reading = true;
+        }
+        LibFlute::Metric::Metrics::getInstance().getOrCreateCounter("repair_server_requests")->Increment();
+
+        auto self = shared_from_this();
+        bool close = !request->keep_alive;
+        if (request->method == "POST") {
+            handle_repair(sequence, *request);
+        } else if (request->method != "GET") {
+            finish(sequence, error_response(405), close);
+        } else {
+            auto path = request->path.substr(0, request->path.find('?'));
+            if (path == "/fdt") {
+                // The FDT lookup may block, so it goes to the workers, ahead of everything else
+                if (!_server.enqueue(0, [self, sequence, close]() { self->finish(sequence, self->fdt(), close); })) {
+                    finish(sequence, error_response(503), close);
+                }
+            } else if (path == "/time") {
+                Response response;
+                response.content_type = "text/plain";
+                response.body = utc_time();
+                finish(sequence, std::move(response), close);
+            } else {
+                finish(sequence, open(path, request->range), close);
+            }
+        }
+
+        // Keep reading pipelined requests while the responses are being prepared
+        if (_outstanding < _server._options.max_pipeline_depth) {
+            read_headers();
+        }
+    }
+
+    void handle_repair(uint64_t sequence, const Request& request) {
+        bool close = !request.keep_alive;
+        if (!_server.allow(_client)) {
+            LibFlute::Metric::Metrics::getInstance().getOrCreateCounter("repair_server_rate_limited")->Increment();
+            finish(sequence, error_response(429), close);
+            return;
+        }
+
+        // A batch holds the requests of several files, which are answered together
+        auto batch = std::make_shared<std::vector<RepairRequest>>();
+        auto live_files = std::make_shared<std::vector<std::shared_ptr<FileBase>>>();
+        try {
+            *batch = RepairRequest::parse_batch(request.body);
+            for (const auto& repair_request : *batch) {
+                live_files->push_back(_server._file_lookup ? _server._file_lookup(repair_request.toi()) : nullptr);
+            }
+        } catch (const char* errorMessage) {
+            spdlog::debug("[REPAIR] Invalid repair request from {}: {}", _client, errorMessage);
+            finish(sequence, error_response(400), close);
+            return;
+        } catch (const std::exception& ex) {
+            spdlog::debug("[REPAIR] Invalid repair request from {}: {}", _client, ex.what());
+            finish(sequence, error_response(400), close);
+            return;
+        }
+
+        uint64_t deadline_ms = request.deadline_ms;
+        if (deadline_ms == 0) {
+            for (const auto& live_file : *live_files) {
+                if (live_file && live_file->meta().should_be_complete_at != 0
+                    && (deadline_ms == 0 || live_file->meta().should_be_complete_at < deadline_ms)) {
+                    deadline_ms = live_file->meta().should_be_complete_at;
+                }
+            }
+        }
+        if (deadline_ms == 0) {
+            deadline_ms = now_ms() + _server._options.default_deadline.count();
+        }
+
+        auto received_at = std::chrono::steady_clock::now();
+        auto job = [self = shared_from_this(), sequence, close, batch, live_files, received_at]() {
+            Response response;
+            try {
+                response.body = self->_server.repair(*batch, *live_files);
+                if (response.body.empty()) {
+                    response = error_response(404);
+                }
+            } catch (const char* errorMessage) {
+                spdlog::warn("[REPAIR] Failed to answer the repair request for {} ({} files): {}", batch->front().content_location(), batch->size(), errorMessage);
+                response = error_response(500);
+            } catch (const std::exception& ex) {
+                spdlog::warn("[REPAIR] Failed to answer the repair request for {} ({} files): {}", batch->front().content_location(), batch->size(), ex.what());
+                response = error_response(500);
+            }
+            auto latency = std::chrono::duration<double>(std::chrono::steady_clock::now() - received_at).count();
+            LibFlute::Metric::Metrics::getInstance().getOrCreateHistogram("repair_server_latency_seconds", latency_buckets)->Observe(latency);
+            self->finish(sequence, std::move(response), close);
+        };
+        if (!_server.enqueue(deadline_ms, std::move(job))) {
+            LibFlute::Metric::Metrics::getInstance().getOrCreateCounter("repair_server_rejected")->Increment();
+            finish(sequence, error_response(503), close);
+        }
+    }
+
+    auto fdt() -> Response {
+        Response response;
+        response.content_type = "application/fdt+xml";
+        if (_server._fdt_lookup) {
+            response.body = _server._fdt_lookup();
+        } else {
+            std::ifstream file(_server._options.storage_root + "/last.fdt", std::ios::binary);
+            response.body.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+        }
+        if (response.body.empty()) {
+            return error_response(404);
+        }
+        // Same delimiter as the repair responses, the fetcher strips it
+        response.body += "\r\n\r\n";
+        return response;
+    }
+
+    auto open(const std::string& path, const std::string& range) -> Response {
+        auto location = _server.resolve(path);
+        if (location.empty()) {
+            return error_response(403);
+        }
+        auto file = std::make_shared<std::ifstream>(location, std::ios::binary | std::ios::ate);
+        if (!file->is_open()) {
+            return error_response(404);
+        }
+        auto length = file->tellg();
+        if (length < 0) {
+            return error_response(404);
+        }
+        Response response;
+        response.file = file;
+        response.file_remaining = static_cast<uint64_t>(length);
+
+        // A single byte range (bytes=first-last, bytes=first- or bytes=-suffix), other ranges get the whole file
+        uint64_t first = 0;
+        uint64_t last = response.file_remaining - 1;
+        std::smatch match;
+        if (std::regex_match(range, match, std::regex(R"(bytes=(\d*)-(\d*))")) && (match[1].length() > 0 || match[2].length() > 0)) {
+            try {
+                if (match[1].length() == 0) {
+                    auto suffix = std::stoull(match[2].str());
+                    first = suffix < response.file_remaining ? response.file_remaining - suffix : 0;
+                } else {
+                    first = std::stoull(match[1].str());
+                    if (match[2].length() > 0) {
+                        last = std::min(last, static_cast<uint64_t>(std::stoull(match[2].str())));
+                    }
+                }
+            } catch (const std::exception&) {
+                return error_response(400);
+            }
+            if (response.file_remaining == 0 || first > last) {
+                auto error = error_response(416);
+                error.extra_headers = "Content-Range: bytes */" + std::to_string(response.file_remaining) + "\r\n";
+                return error;
+            }
+            response.status = 206;
+            response.extra_headers = "Content-Range: bytes " + std::to_string(first) + "-" + std::to_string(last) + "/"
+                                   + std::to_string(response.file_remaining) + "\r\n";
+            response.file_remaining = last - first + 1;
+        }
+        file->seekg(static_cast<std::streamoff>(first));
+        return response;
+    }
+
+    void finish(uint64_t sequence, Response response, bool close) {
+        response.close = response.close || close;
+        complete(sequence, std::move(response));
+    }
+
+    // Answer a request that could not be parsed, the connection is closed afterwards
+    void respond_now(Response response, bool close) {
+        auto sequence = _next_sequence++;
+        _outstanding++;
+        finish(sequence, std::move(response), close);
+    }
+
+    void write_next() {
+        if (_writing || _closed) {
+            return;
+        }
+        auto ready = _ready.find(_next_write);
+        if (ready == _ready.end()) {
+            return;
+        }
+        _writing = true;
+        auto& response = ready->second;
+
+        std::ostringstream head;
+        head << "HTTP/1.1 " << response.status << " " << reason(response.status) << "\r\n"
+             << "Content-Type: " << response.content_type << "\r\n"
+             << "Content-Length: " << response.body.size() + response.file_remaining << "\r\n"
+             << "Connection: " << (response.close ? "close" : "keep-alive") << "\r\n"
+             << response.extra_headers << "\r\n";
+        _head = head.str();
+
+        // The body is written from the response itself, without copying it behind the headers
+        std::array<boost::asio::const_buffer, 2> buffers{boost::asio::buffer(_head), boost::asio::buffer(response.body)};
+        boost::asio::async_write(socket, buffers,
+            _strand.wrap([self = shared_from_this()](const boost::system::error_code& error, size_t bytes) {
+                self->handle_written(error, bytes);
+            }));
+    }
+
+    void handle_written(const boost::system::error_code& error, size_t bytes) {
+        if (error) {
+            close_now();
+            return;
+        }
+        LibFlute::Metric::Metrics::getInstance().getOrCreateCounter("repair_server_bytes")->Increment(static_cast<double>(bytes));
+        auto ready = _ready.find(_next_write);
+        if (ready == _ready.end()) {
+            return;
+        }
+        auto& response = ready->second;
+
+        if (response.file && response.file_remaining > 0) {
+            // Stream the next chunk of the file
+            _chunk.resize(std::min<uint64_t>(_server._options.stream_chunk_size, response.file_remaining));
+            response.file->read(_chunk.data(), static_cast<std::streamsize>(_chunk.size()));
+            if (response.file->gcount() != static_cast<std::streamsize>(_chunk.size())) {
+                // The file shrunk, the promised length can not be delivered anymore
+                spdlog::warn("[REPAIR] Short read while streaming a file to {}", _client);
+                close_now();
+                return;
+            }
+            response.file_remaining -= _chunk.size();
+            boost::asio::async_write(socket, boost::asio::buffer(_chunk),
+                _strand.wrap([self = shared_from_this()](const boost::system::error_code& error, size_t bytes) {
+                    self->handle_written(error, bytes);
+                }));
+            return;
+        }
+
+        bool close = response.close;
+        _ready.erase(ready);
+        _next_write++;
+        _outstanding--;
+        _writing = false;
+        if (close) {
+            close_now();
+            return;
+        }
+        if (_outstanding < _server._options.max_pipeline_depth) {
+            read_headers();
+        }
+        write_next();
+    }
+
+    void arm_idle_timer() {
+        _idle_timer.expires_from_now(_server._options.idle_timeout);
+        _idle_timer.async_wait(_strand.wrap([self = shared_from_this()](const boost::system::error_code& error) {
+            if (error || self->_closed) {
+                return;
+            }
+            if (self->_outstanding > 0) {
+                // Still working on requests, the connection is not idle
+                self->arm_idle_timer();
+                return;
+            }
+            spdlog::debug("[REPAIR] Closing idle connection from {}", self->_client);
+            self->close_now();
+        }));
+    }
+
+    RepairServer& _server;
+    boost::asio::io_service::strand _strand;
+    boost::asio::steady_timer _idle_timer;
+    boost::asio::streambuf _buffer;
+    std::string _client;
+
+    uint64_t _next_sequence = 0; // Sequence number of the next request read
+    uint64_t _next_write = 0; // Sequence number of the next response to write
+    size_t _outstanding = 0; // Requests read but not answered yet
+    std::map<uint64_t, Response> _ready; // Responses waiting for their turn
+    std::string _head;
+    std::vector<char> _chunk;
+
+    bool _reading = false;
+    bool _writing = false;
+    bool _stop_reading = false; // The client asked to close after the last request, or sent garbage
+    bool _closed = false;
+};
+
+LibFlute::RepairServer::RepairServer(const Options& options)
+  : _options(options)
+  , _acceptor(_io_service)
+{
+    if (_options.cache_bytes > 0) {
+        _cache = std::make_shared<EncodedObjectCache>(_options.cache_bytes);
+    }
+}
+
+LibFlute::RepairServer::RepairServer()
+  : RepairServer(Options())
+{
+}
+
+LibFlute::RepairServer::~RepairServer()
+{
+    stop();
+}
+
+auto LibFlute::RepairServer::start() -> void
+{
+    if (_running) {
+        return;
+    }
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(_options.address), _options.port);
+    _acceptor.open(endpoint.protocol());
+    _acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+    _acceptor.bind(endpoint);
+    _acceptor.listen();
+    _port = _acceptor.local_endpoint().port();
+
+    _running = true;
+    _stop_workers = false;
+    _io_service.reset();
+    _io_work = std::make_unique<boost::asio::io_service::work>(_io_service);
+    accept();
+
+    // Create the metrics before the threads that use them
+    LibFlute::Metric::Metrics::getInstance();
+    // Every thread gets its own name, the port tells the threads of several servers apart
+    for (size_t i = 0; i < std::max<size_t>(_options.worker_threads, 1); i++) {
+        _workers.emplace_back([this, name = "Repair worker " + std::to_string(i) + " (port " + std::to_string(_port) + ")"]() {
+            tracy::SetThreadName(name.c_str());
+            LibFlute::Metric::Metrics::getInstance().addThread(std::this_thread::get_id(), name);
+            work();
+        });
+    }
+    for (size_t i = 0; i < std::max<size_t>(_options.io_threads, 1); i++) {
+        _io_threads.emplace_back([this, name = "Repair server " + std::to_string(i) + " (port " + std::to_string(_port) + ")"]() {
+            tracy::SetThreadName(name.c_str());
+            LibFlute::Metric::Metrics::getInstance().addThread(std::this_thread::get_id(), name);
+            _io_service.run();
+        });
+    }
+    spdlog::info("[REPAIR] Serving repair requests on http://{}:{}", _options.address, _port);
+}
+
+auto LibFlute::RepairServer::stop() -> void
+{
+    if (!_running.exchange(false)) {
+        return;
+    }
+    _io_work.reset();
+    _io_service.stop();
+    for (auto& thread : _io_threads) {
+        thread.join();
+    }
+    _io_threads.clear();
+
+    {
+        std::unique_lock<LockableBase(std::mutex)> lock(_queue_mutex);
+        _stop_workers = true;
+    }
+    _queue_cv.notify_all();
+    for (auto& worker : _workers) {
+        worker.join();
+    }
+    _workers.clear();
+
+    // No thread runs handlers anymore, so the sockets can be closed directly
+    boost::system::error_code ignored;
+    _acceptor.close(ignored);
+    std::set<std::shared_ptr<Session>> sessions;
+    {
+        const std::lock_guard<LockableBase(std::mutex)> lock(_sessions_mutex);
+        sessions.swap(_sessions);
+    }
+    for (const auto& session : sessions) {
+        session->socket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+        session->socket.close(ignored);
+    }
+    {
+        std::unique_lock<LockableBase(std::mutex)> lock(_queue_mutex);
+        _queue = decltype(_queue)();
+    }
+    spdlog::info("[REPAIR] Repair server stopped");
+}
+
+auto LibFlute::RepairServer::accept() -> void
+{
+    auto session = std::make_shared<Session>(*this);
+    _acceptor.async_accept(session->socket, [this, session](const boost::system::error_code& error) {
+        if (error) {
+            if (error == boost::asio::error::operation_aborted) {
+                return;
+            }
+            spdlog::warn("[REPAIR] Failed to accept a connection: {}", error.message());
+        } else {
+            boost::system::error_code ignored;
+            session->socket.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+            {
+                const std::lock_guard<LockableBase(std::mutex)> lock(_sessions_mutex);
+                _sessions.insert(session);
+            }
+            session->start();
+        }
+        accept();
+    });
+}
+
+auto LibFlute::RepairServer::enqueue(uint64_t deadline_ms, std::function<void()> run) -> bool
+{
+    {
+        std::unique_lock<LockableBase(std::mutex)> lock(_queue_mutex);
+        if (_stop_workers || _queue.size() >= _options.max_queue_length) {
+            return false;
+        }
+        _queue.push(Job{deadline_ms, _job_sequence++, std::move(run)});
+        LibFlute::Metric::Metrics::getInstance().getOrCreateGauge("repair_server_queue_length")->Set(static_cast<double>(_queue.size()));
+    }
+    _queue_cv.notify_one();
+    return true;
+}
+
+auto LibFlute::RepairServer::work() -> void
+{
+    while (true) {
+        std::function<void()> run;
+        {
+            std::unique_lock<LockableBase(std::mutex)> lock(_queue_mutex);
+            _queue_cv.wait(lock, [this]() { return _stop_workers || !_queue.empty(); });
+            if (_stop_workers) {
+                return;
+            }
+            // Earliest deadline first
+            run = std::move(const_cast<Job&>(_queue.top()).run);
+            _queue.pop();
+            LibFlute::Metric::Metrics::getInstance().getOrCreateGauge("repair_server_queue_length")->Set(static_cast<double>(_queue.size()));
+        }
+        run();
+    }
+}
+
+auto LibFlute::RepairServer::allow(const std::string& client) -> bool
+{
+    if (_options.client_rate <= 0) {
+        return true;
+    }
+    auto now = std::chrono::steady_clock::now();
+    auto refill = [this, now](Bucket& bucket) {
+        double elapsed = std::chrono::duration<double>(now - bucket.updated).count();
+        bucket.tokens = std::min(_options.client_burst, bucket.tokens + elapsed * _options.client_rate);
+        bucket.updated = now;
+    };
+
+    const std::lock_guard<LockableBase(std::mutex)> lock(_buckets_mutex);
+    auto [bucket, inserted] = _buckets.try_emplace(client, Bucket{_options.client_burst, now});
+    if (!inserted) {
+        refill(bucket->second);
+    }
+    if (bucket->second.tokens < 1) {
+        return false;
+    }
+    bucket->second.tokens -= 1;
+
+    // Forget clients with a full bucket, they are indistinguishable from new ones
+    if (_buckets.size() > 4096) {
+        for (auto it = _buckets.begin(); it != _buckets.end(); ) {
+            refill(it->second);
+            it = it->second.tokens >= _options.client_burst ? _buckets.erase(it) : std::next(it);
+        }
+    }
+    return true;
+}
+
+auto LibFlute::RepairServer::resolve(const std::string& content_location) const -> std::string
+{
+    if (_location_resolver) {
+        return _location_resolver(content_location);
+    }
+    auto location = content_location;
+    location.erase(0, location.find_first_not_of('/'));
+    // Do not leave the storage root
+    if (location.empty() || location == ".." || location.compare(0, 3, "../") == 0
+        || location.find("/../") != std::string::npos
+        || (location.size() >= 3 && location.compare(location.size() - 3, 3, "/..") == 0)) {
+        return {};
+    }
+    return _options.storage_root + "/" + location;
+}
+
+auto LibFlute::RepairServer::repair(const RepairRequest& request, std::shared_ptr<FileBase> live_file) -> std::string
+{
+    return repair(request, std::move(live_file), request.encoding());
+}
+
+auto LibFlute::RepairServer::repair(const std::vector<RepairRequest>& batch,
+                                    const std::vector<std::shared_ptr<FileBase>>& live_files) -> std::string
+{
+    ZoneScopedN("RepairServer::repair_batch");
+    if (batch.empty()) {
+        return {};
+    }
+    auto live_file = [&live_files](size_t i) { return i < live_files.size() ? live_files[i] : nullptr; };
+
+    std::string body;
+    if (batch.size() == 1) {
+        body = repair(batch.front(), live_file(0));
+    } else {
+        // The packets of every file go into one response, the client tells them apart by their TOI
+        RepairResponse::Writer writer(batch.front().encoding());
+        std::vector<char> scratch;
+        for (size_t i = 0; i < batch.size(); i++) {
+            auto file_body = repair(batch[i], live_file(i), RepairResponse::Encoding::Binary);
+            RepairResponse::for_each_packet(file_body.data(), file_body.size(), scratch,
+                [&writer](const char* packet, size_t length) { writer.append(packet, length); });
+        }
+        if (writer.count() == 0) {
+            return {};
+        }
+        body = writer.finish();
+    }
+    RepairResponse::announce(body,
+        RepairResponse::CompactRequests | RepairResponse::SymbolCounts | RepairResponse::BatchRequests
+        | RepairResponse::ContentEncodings);
+    return body;
+}
+
+auto LibFlute::RepairServer::repair(const RepairRequest& request, std::shared_ptr<FileBase> live_file,
+                                    RepairResponse::Encoding encoding) -> std::string
+{
+    ZoneScopedN("RepairServer::repair");
+    spdlog::debug("[REPAIR] (TOI {}) Repair request for {} symbols of {}", request.toi(), request.symbol_count(), request.content_location());
+    Retriever retriever(_options.tsi, _options.mtu, FecScheme(request.fec()));
+    if (live_file && (request.content_encoding() == ContentEncoding::NONE
+                      || request.content_encoding() == live_file->meta().content_encoding)) {
+        return retriever.get_alcs_from_file(live_file, request.missing(), encoding, request.needed());
+    }
+
+    // Stored files hold the content, the symbols of an encoded transport object can not be cut from it
+    if (request.content_encoding() != ContentEncoding::NONE) {
+        spdlog::debug("[REPAIR] (TOI {}) Refusing to repair {}, it was sent with a content encoding", request.toi(), request.content_location());
+        LibFlute::Metric::Metrics::getInstance().getOrCreateCounter("repair_server_encoded_refused")->Increment();
+        return {};
+    }
+
+    auto path = resolve(request.content_location());
+    if (path.empty()) {
+        return {};
+    }
+    // Files that aged out of the transmitter are read and encoded once, later requests use the cache
+    retriever.set_cache(_cache);
+    return retriever.get_alcs_from_storage(path,
+        request.content_location(),
+        "application/octet-stream",
+        retriever.seconds_since_epoch() + 60, // 1 minute from now
+        request.toi(),
+        request.missing(),
+        encoding,
+        request.needed());
+}
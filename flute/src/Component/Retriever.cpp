@@ -15,12 +15,15 @@
 //
 #include "Component/Retriever.h"
 
+#include <algorithm>
 #include <chrono>
 #include <cstdio>
 #include <cstring>
+#include <fstream>
 #include <iostream>
 #include <string>
 #include <sstream>
+#include <sys/stat.h>
 
 #include "Object/File.h"
 #include "spdlog/spdlog.h"
@@ -35,7 +38,8 @@ LibFlute::Retriever::Retriever(uint64_t tsi, unsigned short mtu, FecScheme fec_s
     _max_payload = mtu -
                    20 -  // IPv4 header // TODO: fix IPv6 support (look at Transmitter.cpp)
                    8 -   // UDP header
-                   32 -  // ALC Header with EXT_FDT and EXT_FTI
+                   28 -  // ALC Header with EXT_FDT and EXT_FTI, without the TSI and TOI
+                   AlcPacket::id_fields_length(tsi, UINT32_MAX) - // TSI and the longest TOI a transmitter hands out (change this in Transmitter.cpp as well)
                    4;    // SBN and ESI for compact no-code or raptor FEC
     uint32_t max_source_block_length = 64; // Change this in Transmitter.cpp as well
 
@@ -71,7 +75,9 @@ auto LibFlute::Retriever::get_alcs(
     char *data,
     size_t length,
     uint64_t toi,
-    std::map<uint32_t,std::vector<uint32_t>> search_map) -> std::string {
+    std::map<uint32_t,std::vector<uint32_t>> search_map,
+    RepairResponse::Encoding encoding,
+    const std::map<uint32_t, RepairRequest::Needed>& needed) -> std::string {
     ZoneScopedN("Retriever::get_alcs");
 
     std::shared_ptr<LibFlute::FileBase> file;
@@ -93,73 +99,180 @@ auto LibFlute::Retriever::get_alcs(
         return "";
     }
 
-    return get_alcs_from_file(file, search_map);
+    return get_alcs_from_file(file, search_map, encoding, needed);
+}
+
+auto LibFlute::Retriever::get_alcs_from_storage(
+    const std::string &path,
+    const std::string &content_location,
+    const std::string &content_type,
+    uint32_t expires,
+    uint64_t toi,
+    const std::map<uint32_t,std::vector<uint32_t>>& search_map,
+    RepairResponse::Encoding encoding,
+    const std::map<uint32_t, RepairRequest::Needed>& needed) -> std::string {
+    ZoneScopedN("Retriever::get_alcs_from_storage");
+
+    struct stat file_stat;
+    if (stat(path.c_str(), &file_stat) != 0 || file_stat.st_size <= 0) {
+        spdlog::error("[RETRIEVE] File {} not found", path);
+        return "";
+    }
+
+    auto load = [&]() -> std::shared_ptr<LibFlute::FileBase> {
+        ZoneScopedN("Retriever::load");
+        std::ifstream input(path, std::ios::binary);
+        std::vector<char> buffer(file_stat.st_size);
+        if (!input.read(buffer.data(), buffer.size())) {
+            throw "Failed to read file";
+        }
+        return std::make_shared<LibFlute::File>(
+            toi,
+            _fec_oti,
+            content_location,
+            content_type,
+            expires,
+            0, // Can be ignored, only used by the sender
+            buffer.data(),
+            buffer.size(),
+            true, // The file can outlive this request in the cache
+            false // Do not calculate the hash, we don't need it
+            );
+    };
+
+    std::shared_ptr<LibFlute::FileBase> file;
+    try {
+        if (_cache) {
+            EncodedObjectCache::Key key{
+                path,
+                _fec_oti.encoding_id,
+                _fec_oti.encoding_symbol_length,
+                static_cast<uint64_t>(file_stat.st_size),
+                static_cast<int64_t>(file_stat.st_mtim.tv_sec) * 1000000000 + file_stat.st_mtim.tv_nsec};
+            file = _cache->get_or_load(key, load);
+        } else {
+            file = load();
+        }
+    } catch (const char *e) {
+        spdlog::error("[RETRIEVE] Failed to create File object for file {} : {}", path, e);
+        return "";
+    } catch (const std::exception &e) {
+        spdlog::error("[RETRIEVE] Failed to create File object for file {} : {}", path, e.what());
+        return "";
+    }
+
+    // A cached file may have been created for another TOI
+    return encode_symbols(file, toi, search_map, encoding, needed);
 }
 
 auto LibFlute::Retriever::get_alcs_from_file(
     std::shared_ptr<LibFlute::FileBase> file,
-    std::map<uint32_t,std::vector<uint32_t>> search_map) -> std::string {
-    
-    std::stringstream string_stream;
-
-    // Counter, for total amount of symbols
-    uint32_t total_symbol_amount = 0;
+    std::map<uint32_t,std::vector<uint32_t>> search_map,
+    RepairResponse::Encoding encoding,
+    const std::map<uint32_t, RepairRequest::Needed>& needed) -> std::string {
+    auto toi = file->meta().toi;
+    return encode_symbols(std::move(file), toi, search_map, encoding, needed);
+}
 
-    std::vector<LibFlute::EncodingSymbol> encoding_symbols;
+auto LibFlute::Retriever::encode_symbols(
+    std::shared_ptr<LibFlute::FileBase> file,
+    uint64_t toi,
+    const std::map<uint32_t,std::vector<uint32_t>>& search_map,
+    RepairResponse::Encoding encoding,
+    const std::map<uint32_t, RepairRequest::Needed>& needed) -> std::string {
+    ZoneScopedN("Retriever::encode_symbols");
 
     auto content_lock = file->get_content_buffer_lock();
+    const auto& source_blocks = file->source_blocks();
+    const auto& fec_oti = file->fec_oti();
+    auto fdt_instance_id = file->fdt_instance_id();
 
-    for (auto& block : file->get_source_blocks()) {
-        // Increment total_symbol_amount
+    // Counter, for total amount of symbols
+    size_t total_symbol_amount = 0;
+    for (const auto& block : source_blocks) {
         total_symbol_amount += block.second.symbols.size();
-        if (search_map.find(block.first) != search_map.end()) {
-            auto searched_symbols = search_map[block.first];
-            for (const auto &symbol : block.second.symbols) {
-                if (std::find(searched_symbols.begin(), searched_symbols.end(), symbol.first) != searched_symbols.end()) {
-
-                    //spdlog::trace("[RETRIEVE] Retreiving TOI {} SBN {} ID {}", file->meta().toi, block.first, symbol.first);
-
-                    // Some safety checks to make sure the symbol is valid
-                    if (symbol.second.data != nullptr && symbol.second.length > 0 && symbol.second.has_content) {
-                        // Encode the symbol and place it in the encoding_symbols vector
-                        encoding_symbols.emplace_back(
-                            symbol.first,
-                            block.first,
-                            symbol.second.data,
-                            symbol.second.length,
-                            file->fec_oti().encoding_id);
-                    }
-                }
-            }
-        }
+    }
+    size_t requested_symbol_amount = 0;
+    for (const auto& block : search_map) {
+        requested_symbol_amount += block.second.size();
+    }
+    size_t needed_symbol_amount = 0;
+    for (const auto& block : needed) {
+        needed_symbol_amount += block.second.count;
     }
 
-    uint32_t total_symbols_selected = encoding_symbols.size();
+    size_t max_symbols_per_alc = fec_oti.encoding_symbol_length > 0 ? _max_payload / fec_oti.encoding_symbol_length : 0;
+    size_t max_packet_length = AlcPacket::max_length(_tsi, toi, _max_payload);
 
-    int max_symbols_per_alc = std::floor((float)(_max_payload) / (float)file->fec_oti().encoding_symbol_length);
+    // Every symbol ends up in at most one packet, size the response for that
+    RepairResponse::Writer response(encoding,
+        (std::min(requested_symbol_amount, total_symbol_amount) + std::min(needed_symbol_amount, total_symbol_amount))
+        * (max_packet_length + RepairResponse::frame_header_length));
 
-    while(!encoding_symbols.empty()) {
-        std::vector<LibFlute::EncodingSymbol> selected_symbols;
-        if (encoding_symbols.size() > max_symbols_per_alc) {
-            selected_symbols = std::vector<LibFlute::EncodingSymbol>(encoding_symbols.begin(), encoding_symbols.begin() + max_symbols_per_alc);
-        } else {
-            selected_symbols = encoding_symbols;
+    // Symbols of one packet, consecutive symbols of the same block
+    std::vector<LibFlute::EncodingSymbol> packet_symbols;
+    packet_symbols.reserve(max_symbols_per_alc);
+    auto flush = [&]() {
+        if (packet_symbols.empty()) {
+            return;
         }
+        //spdlog::trace("[RETRIEVE] Creating ALC packet with {} symbols for block {} starting at symbol {}", packet_symbols.size(), packet_symbols[0].source_block_number(), packet_symbols[0].id());
+        char* packet = response.reserve(max_packet_length);
+        response.commit(AlcPacket::serialize(packet, _tsi, toi, fec_oti, packet_symbols, _max_payload, fdt_instance_id));
+        packet_symbols.clear();
+    };
 
-        if (selected_symbols.empty()) {
-            break;
-        }
+    size_t total_symbols_selected = 0;
+    // Requested symbols of the current block, indexed by ESI
+    std::vector<bool> requested;
 
-        spdlog::trace("[RETRIEVE] Creating ALC packet with {} symbols for block {} starting at symbol {}", selected_symbols.size(), selected_symbols[0].source_block_number(), selected_symbols[0].id());
+    if (max_symbols_per_alc == 0) {
+        spdlog::error("[RETRIEVE] Symbols of {} bytes do not fit in a payload of {} bytes", fec_oti.encoding_symbol_length, _max_payload);
+    } else {
+        for (const auto& [sbn, esis] : search_map) {
+            auto block = source_blocks.find(sbn);
+            if (block == source_blocks.end() || block->second.symbols.empty() || esis.empty()) {
+                continue;
+            }
+            const auto& symbols = block->second.symbols;
+
+            requested.assign(symbols.rbegin()->first + 1, false);
+            for (auto esi : esis) {
+                if (esi < requested.size()) {
+                    requested[esi] = true;
+                }
+            }
 
-        auto packet = std::make_shared<AlcPacket>(_tsi, file->meta().toi, file->fec_oti(), selected_symbols, _max_payload, file->fdt_instance_id());
-        
-        string_stream << "ALC ";
-        const char* packet_data = packet->data();
-        string_stream.write(packet_data, packet->size());
-        string_stream << "\r\n\r\n";
+            for (const auto& [esi, symbol] : symbols) {
+                // Some safety checks to make sure the symbol is valid
+                if (!requested[esi] || symbol.data == nullptr || symbol.length == 0 || !symbol.has_content) {
+                    flush();
+                    continue;
+                }
+                if (packet_symbols.size() >= max_symbols_per_alc
+                    || (!packet_symbols.empty() && packet_symbols.back().id() + 1 != esi)) {
+                    flush();
+                }
+                packet_symbols.emplace_back(esi, sbn, symbol.data, symbol.length, fec_oti.encoding_id);
+                total_symbols_selected++;
+            }
+            flush();
+        }
 
-        encoding_symbols.erase(encoding_symbols.begin(), encoding_symbols.begin() + selected_symbols.size());
+        // Fresh repair symbols have consecutive ESIs, so they fill whole packets
+        for (const auto& [sbn, block_needed] : needed) {
+            if (sbn > UINT16_MAX) {
+                continue;
+            }
+            for (auto& symbol : file->fresh_repair_symbols(sbn, block_needed.first_esi, block_needed.count)) {
+                if (packet_symbols.size() >= max_symbols_per_alc) {
+                    flush();
+                }
+                packet_symbols.push_back(std::move(symbol));
+                total_symbols_selected++;
+            }
+            flush();
+        }
     }
 
     content_lock.unlock();
@@ -172,7 +285,5 @@ auto LibFlute::Retriever::get_alcs_from_file(
 
     spdlog::debug("[RETRIEVE] ALC percentage retrieved: {}", percentage);
 
-
-    return string_stream.str();
+    return response.finish();
 }
-
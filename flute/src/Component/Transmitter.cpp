@@ -27,9 +27,11 @@
 #include <unistd.h>
 #include <fcntl.h> 
 
+#include "Utils/Compression.h"
 #include "Utils/IpSec.h"
 #include "spdlog/spdlog.h"
 #include "Metric/Metrics.h"
+#include "Metric/LifecycleTracer.h"
 
 #include "public/tracy/Tracy.hpp"
 
@@ -38,7 +40,7 @@
 
 LibFlute::Transmitter::Transmitter(const std::string &address,
                                    short port, uint64_t tsi, unsigned short mtu, uint32_t rate_limit, FecScheme fec_scheme,
-                                   boost::asio::io_service &io_service, uint16_t toi, uint32_t instance_id)
+                                   boost::asio::io_service &io_service, uint32_t toi, uint32_t instance_id)
     : _endpoint(boost::asio::ip::address::from_string(address), port),
       _socket(io_service, boost::asio::ip::udp::v4()),
       _fdt_timer(io_service),
@@ -52,7 +54,8 @@ LibFlute::Transmitter::Transmitter(const std::string &address,
     _max_payload = mtu
                    - ( _endpoint.address().is_v6() ? 40 : 20) // IP header
                    - 8   // UDP header
-                   - 32  // ALC Header with EXT_FDT and EXT_FTI
+                   - 28  // ALC Header with EXT_FDT and EXT_FTI, without the TSI and TOI
+                   - AlcPacket::id_fields_length(tsi, UINT32_MAX) // TSI and the longest TOI that is handed out (change this in Retriever.cpp as well)
                    - 4;    // SBN and ESI for compact no-code or raptor FEC
     uint32_t max_source_block_length = 64; // Change this in Retriever.cpp as well
 
@@ -87,7 +90,7 @@ LibFlute::Transmitter::Transmitter(const std::string &address,
     _fec_oti = FecOti{fec_scheme, 0, _max_payload, max_source_block_length};
     _fdt = std::make_unique<FileDeliveryTable>(instance_id, _fec_oti);
 
-    _fdt_timer.expires_from_now(boost::posix_time::seconds(_fdt_repeat_interval));
+    _fdt_timer.expires_from_now(boost::posix_time::milliseconds(_fdt_schedule.repeat_interval.count()));
     _fdt_timer.async_wait(boost::bind(&Transmitter::fdt_send_tick, this));
 
     send_next_packet();
@@ -108,6 +111,43 @@ auto LibFlute::Transmitter::enable_ipsec(uint32_t spi, const std::string &key) -
     LibFlute::IpSec::enable_esp(spi, _mcast_address, LibFlute::IpSec::Direction::Out, key);
 }
 
+auto LibFlute::Transmitter::set_fdt_compression(ContentEncoding encoding, int level, size_t threshold) -> void {
+    const std::lock_guard<LockableBase(std::mutex)> lock(_files_mutex);
+    _fdt_encoding = encoding;
+    _fdt_compression_level = level;
+    _fdt_compression_threshold = threshold;
+    // Packetize the FDT again on the next repetition
+    _fdt_content = nullptr;
+}
+
+auto LibFlute::Transmitter::set_fdt_schedule(const FdtSchedule& schedule) -> void {
+    const std::lock_guard<LockableBase(std::mutex)> lock(_files_mutex);
+    _fdt_schedule = schedule;
+    if (_fdt_schedule.repeat_interval.count() <= 0) {
+        _fdt_schedule.repeat_interval = std::chrono::milliseconds(1000);
+    }
+    _fdt_repeat_interval = (_fdt_schedule.repeat_interval.count() + 999) / 1000;
+}
+
+auto LibFlute::Transmitter::set_content_encoding_policy(const ContentEncodingPolicy& policy) -> void {
+    const std::lock_guard<LockableBase(std::mutex)> lock(_files_mutex);
+    _content_encoding_policy = policy;
+}
+
+auto LibFlute::Transmitter::should_encode(const std::string& content_type, size_t length) const -> bool {
+    if (_content_encoding_policy.encoding == ContentEncoding::NONE || length < _content_encoding_policy.min_length) {
+        return false;
+    }
+    auto type = content_type.substr(0, content_type.find(';'));
+    type.erase(type.find_last_not_of(' ') + 1);
+    for (const auto& pattern : _content_encoding_policy.content_types) {
+        if ((!pattern.empty() && pattern.back() == '/') ? type.starts_with(pattern) : type == pattern) {
+            return true;
+        }
+    }
+    return false;
+}
+
 auto LibFlute::Transmitter::seconds_since_epoch() -> uint64_t {
     ZoneScopedN("Transmitter::seconds_since_epoch");
     return std::chrono::duration_cast<std::chrono::seconds>(
@@ -125,117 +165,88 @@ auto LibFlute::Transmitter::send_fdt(bool should_lock) -> void {
         .count();
         return;
     }
-    _fdt->set_expires(seconds_since_epoch() + _fdt_repeat_interval * 2);
+    // The expiry is only moved on when it comes close, so an FDT without new entries keeps its content
+    auto now = seconds_since_epoch();
+    if (_fdt->expires() < now + _fdt_repeat_interval * 2) {
+        _fdt->set_expires(now + _fdt_repeat_interval * 4);
+    }
     LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
     auto multicast_fdt_sent_gauge = metricsInstance.getOrCreateGauge("multicast_fdt_sent");
     multicast_fdt_sent_gauge->Increment();
-    auto fdt = _fdt->to_string();
-    auto fdt_fec_oti = _fec_oti; // Copy the FEC OTI and modify it to send the FDT in "plaintext" (no FEC = compact no-code FEC)
-    fdt_fec_oti.encoding_id = FecScheme::CompactNoCode;
-    fdt_fec_oti.encoding_symbol_length = _mtu
-        - ( _endpoint.address().is_v6() ? 40 : 20) // IP header
-        - 8   // UDP header
-        - 32  // ALC Header with EXT_FDT and EXT_FTI
-        - 4;    // SBN and ESI for compact no-code or raptor FEC
-    fdt_fec_oti.max_source_block_length = 64;
-    // We use File instead of FileStream because this is the most complete implementation of the FileBase interface
-    auto file = std::make_shared<File>(
-        0,
-        fdt_fec_oti,
-        "",
-        "",
-        seconds_since_epoch() + _fdt_repeat_interval * 2,
-        0, // No deadline mechanism for the FDT itself yet
-        (char *)fdt.c_str(),
-        fdt.length(),
-        true,
-        false); // Do not calculate the hash, the receiver does not need it
-    file->set_fdt_instance_id(_fdt->instance_id());
-    if (should_lock) {
-        // spdlog::info("[TRANSMIT] Acquiring lock: send_fdt");
-        std::unique_lock<LockableBase(std::mutex)> lock2(_files_mutex);
-        _files.insert_or_assign(0, file);
-        // Save last time that the FDT was sent
-        _last_fdt_sent = std::chrono::duration_cast<std::chrono::milliseconds>(
-                std::chrono::system_clock::now().time_since_epoch())
-            .count();
-
-        // Write FDT string to file
-        std::string file_location = "last.fdt";
-        // Open the file as a file descriptor
-        int fd = open(file_location.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-        if (fd < 0) {
-            spdlog::error("Failed to open FDT file for writing: {}", file_location);
-            lock2.unlock();
-            return;
-        }
-        // Lock the file, so no other process can read or write to it
-        bool is_locked = flock(fd, LOCK_EX | LOCK_NB) == 0; // Non-blocking lock
-        if (!is_locked) {
-            spdlog::error("[TRANSMIT] Failed to lock FDT file {} for writing", file_location);
-            close(fd);
-            lock2.unlock();
-            return;
-        }
-
-        // Get a filestream from the file descriptor
-        FILE * file_stream = fdopen(fd, "wb");
-        // Check if the filestream is valid
-        if (!file_stream) {
-            spdlog::error("Failed to open FDT file stream for writing: {}", file_location);
-            close(fd);
-            lock2.unlock();
-            return;
-        }
-        // Write the buffer to the file in storage.
-        fwrite(fdt.c_str(), 1, fdt.length(), file_stream);
-        // Flush the filestream to write the data to the file
-        fflush(file_stream);
-        // Unlock the file
-        flock(fd, LOCK_UN);
-        // This also closes the underlying file descriptor
-        fclose(file_stream);
-        lock2.unlock();
-    } else {
-        _files.insert_or_assign(0, file); // TODO: This is possibly not safe, this might screw us when this is called within the iterator loop (over _files)
-        // Save last time that the FDT was sent
-        _last_fdt_sent = std::chrono::duration_cast<std::chrono::milliseconds>(
-               std::chrono::system_clock::now().time_since_epoch())
-        .count();
+    auto fdt = _fdt->serialized();
 
-        // Write FDT string to file
-        std::string file_location = "last.fdt";
-        // Open the file as a file descriptor
-        int fd = open(file_location.c_str(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
-        if (fd < 0) {
-            spdlog::error("Failed to open FDT file for writing: {}", file_location);
-            return;
-        }
-        // Lock the file, so no other process can read or write to it
-        bool is_locked = flock(fd, LOCK_EX | LOCK_NB) == 0; // Non-blocking lock
-        if (!is_locked) {
-            spdlog::error("[TRANSMIT] Failed to lock FDT file {} for writing", file_location);
-            close(fd);
-            return;
+    std::unique_lock<LockableBase(std::mutex)> lock(_files_mutex, std::defer_lock);
+    if (should_lock) {
+        lock.lock();
+    }
+    if (fdt != _fdt_content) {
+        // Large FDTs are compressed, which also cuts the number of packets a late joiner has to catch
+        auto payload = fdt;
+        auto encoding = ContentEncoding::NONE;
+        if (_fdt_encoding != ContentEncoding::NONE && fdt->length() >= _fdt_compression_threshold) {
+            try {
+                auto compressed = Compression::compress(fdt->data(), fdt->length(), _fdt_encoding, _fdt_compression_level);
+                if (compressed.length() < fdt->length()) {
+                    payload = std::make_shared<const std::string>(std::move(compressed));
+                    encoding = _fdt_encoding;
+                }
+            } catch (const char* errorMessage) {
+                spdlog::warn("[TRANSMIT] Sending the FDT uncompressed: {}", errorMessage);
+            }
         }
-
-        // Get a filestream from the file descriptor
-        FILE * file_stream = fdopen(fd, "wb");
-        // Check if the filestream is valid
-        if (!file_stream) {
-            spdlog::error("Failed to open FDT file stream for writing: {}", file_location);
-            close(fd);
-            return;
+        spdlog::debug("[TRANSMIT] FDT with instance ID {} is {} bytes, {} bytes sent", _fdt->instance_id(), fdt->length(), payload->length());
+        metricsInstance.getOrCreateGauge("multicast_fdt_bytes")->Set(payload->length());
+
+        auto fdt_fec_oti = _fec_oti; // Copy the FEC OTI and modify it to send the FDT in "plaintext" (no FEC = compact no-code FEC)
+        fdt_fec_oti.encoding_id = FecScheme::CompactNoCode;
+        fdt_fec_oti.encoding_symbol_length = _mtu
+            - ( _endpoint.address().is_v6() ? 40 : 20) // IP header
+            - 8   // UDP header
+            - 28  // ALC Header with EXT_FDT and EXT_FTI, without the TSI and TOI
+            - AlcPacket::id_fields_length(_tsi, 0)
+            - (encoding != ContentEncoding::NONE ? 4 : 0) // EXT_CENC
+            - 4;    // SBN and ESI for compact no-code or raptor FEC
+        fdt_fec_oti.max_source_block_length = 64;
+        // We use File instead of FileStream because this is the most complete implementation of the FileBase interface
+        auto file = std::make_shared<File>(
+            0,
+            fdt_fec_oti,
+            "",
+            "",
+            now + _fdt_repeat_interval * 2,
+            0, // No deadline mechanism for the FDT itself yet
+            const_cast<char *>(payload->data()),
+            payload->length(),
+            true,
+            false); // Do not calculate the hash, the receiver does not need it
+        file->set_fdt_instance_id(_fdt->instance_id());
+        file->meta().content_encoding = encoding;
+        _fdt_file = file;
+        // Repetitions of an instance are not traced, they would push the rarer events out of the trace rings
+        auto& tracer = LibFlute::Metric::LifecycleTracer::getInstance();
+        _fdt_file_tois.clear();
+        for (const auto& entry : _fdt->file_entries()) {
+            _fdt_file_tois.insert(entry.toi);
+            if (tracer.enabled()) {
+                tracer.record(LibFlute::Metric::LifecycleTracer::Event::FdtAnnounced, _tsi, entry.toi, _fdt->instance_id());
+            }
         }
-        // Write the buffer to the file in storage.
-        fwrite(fdt.c_str(), 1, fdt.length(), file_stream);
-        // Flush the filestream to write the data to the file
-        fflush(file_stream);
-        // Unlock the file
-        flock(fd, LOCK_UN);
-        // This also closes the underlying file descriptor
-        fclose(file_stream);
+        _fdt_content = fdt;
+        _fdt_packets.clear();
+        metricsInstance.getOrCreateCounter("multicast_fdt_serialized")->Increment();
+
+        // Keep the FDT on disk for the repair server, without blocking the send path
+        _fdt_writer.write(fdt);
+    } else if (_fdt_file->complete()) {
+        // An FDT that is still being sent is not started over
+        _fdt_file->rewind();
+        _fdt_file->meta().expires = now + _fdt_repeat_interval * 2;
     }
+    _files.insert_or_assign(0, _fdt_file); // TODO: This is possibly not safe when called without the lock, within the iterator loop (over _files)
+    // Save last time that the FDT was sent
+    _last_fdt_sent = std::chrono::duration_cast<std::chrono::milliseconds>(
+           std::chrono::system_clock::now().time_since_epoch())
+    .count();
 }
 
 auto LibFlute::Transmitter::send(
@@ -244,64 +255,81 @@ auto LibFlute::Transmitter::send(
     uint32_t expires,
     uint64_t deadline,
     char *data,
-    size_t length) -> uint16_t {
+    size_t length) -> uint32_t {
     ZoneScopedN("Transmitter::send");
     ZoneText(content_location.c_str(), content_location.length());
     // spdlog::info("[TRANSMIT] Acquiring lock: send");
     std::unique_lock<LockableBase(std::mutex)> lock(_files_mutex);
-    auto toi = _toi;
-    _toi++;
-    if (_toi == 0)
-        _toi = 1;  // clamp to >= 1 in case it wraps around
+    auto toi = allocate_toi();
+    auto encoding = should_encode(content_type, length) ? _content_encoding_policy.encoding : ContentEncoding::NONE;
+    auto level = _content_encoding_policy.level;
     lock.unlock();
 
+    auto& tracer = LibFlute::Metric::LifecycleTracer::getInstance();
+    tracer.setLabel(_tsi, toi, content_location);
+    tracer.record(LibFlute::Metric::LifecycleTracer::Event::FileEnqueued, _tsi, toi, length);
+
     std::shared_ptr<FileBase> file;
-    try {
-        file = std::make_shared<File>(
-            toi,
-            _fec_oti,
-            content_location,
-            content_type,
-            expires,
-            deadline,
-            data,
-            length,
-            false, // Do not copy the data, we don't need it,
-            true // Calculate the hash, the receiver will need it
-            );
-    } catch (const char *e) {
-        spdlog::error("[TRANSMIT] Failed to create File object for file {} : {}", content_location, e);
-        return -1;
+    if (encoding != ContentEncoding::NONE) {
+        // Send the encoded content as the transport object, the hash is calculated over it
+        size_t encoded_length = 0;
+        char* encoded = nullptr;
+        try {
+            encoded = Compression::compress_to_buffer(data, length, encoding, level, encoded_length);
+        } catch (const char *e) {
+            spdlog::warn("[TRANSMIT] Failed to encode file {}, sending it as it is: {}", content_location, e);
+        }
+        if (encoded != nullptr && encoded_length >= length) {
+            free(encoded);
+            encoded = nullptr;
+        }
+        if (encoded != nullptr) {
+            try {
+                auto encoded_file = std::make_shared<File>(
+                    toi, _fec_oti, content_location, content_type, expires, deadline,
+                    encoded, encoded_length, false, true);
+                encoded_file->take_buffer_ownership();
+                encoded_file->meta().content_encoding = encoding;
+                encoded_file->meta().content_length = length;
+                file = encoded_file;
+            } catch (const char *e) {
+                free(encoded);
+                spdlog::error("[TRANSMIT] Failed to create File object for file {} : {}", content_location, e);
+                return -1;
+            }
+            spdlog::debug("[TRANSMIT] Encoded TOI {} from {} to {} bytes", toi, length, encoded_length);
+            LibFlute::Metric::Metrics::getInstance().getOrCreateCounter("files_encoded")->Increment();
+        }
     }
+    if (!file) {
+        try {
+            file = std::make_shared<File>(
+                toi,
+                _fec_oti,
+                content_location,
+                content_type,
+                expires,
+                deadline,
+                data,
+                length,
+                false, // Do not copy the data, we don't need it,
+                true // Calculate the hash, the receiver will need it
+                );
+        } catch (const char *e) {
+            spdlog::error("[TRANSMIT] Failed to create File object for file {} : {}", content_location, e);
+            return -1;
+        }
+    }
+    file->set_tsi(_tsi);
+    tracer.record(LibFlute::Metric::LifecycleTracer::Event::EncodingDone, _tsi, toi);
 
     // spdlog::info("[TRANSMIT] Acquiring lock: send2");
     std::lock_guard<LockableBase(std::mutex)> lock2(_files_mutex);
     // spdlog::info("[TRANSMIT] Lock acquired");
 
     _fdt->add(file->meta());
-    // We should send the FDT if there are no files in transmission, or if the file we are adding is the first file
-    auto should_send_fdt = _files.size() == 0;
-    if (!should_send_fdt) {
-        // If there are no uncompleted files, we should send the FDT
-        should_send_fdt = true;
-        for (auto &file_m : _files) {
-            if (file_m.first != 0 && !file_m.second->complete()) {
-                should_send_fdt = false;
-                break;
-            }
-        };
-    }
-
-    if (should_send_fdt) {
-        // There are currently no files in transmission, so we need to send the FDT with the new file
-        send_fdt(false);
-    } else {
-        // We don't need to send the FDT because when the next file transmission is done, we will automatically an FDT
-        // That FDT will contain the old file info as well as the new file info
-        // By not sending the FDT now, we avoid sending the FDT too often
-        spdlog::debug("[TRANSMIT] Not sending FDT, already {} files in transmission", _files.size());
-    }
-
+    // The FDT that announces the file is sent before its first packet, see send_next_packet
+    _unannounced_tois.insert(toi);
     _files.insert({toi, file});
 
     // spdlog::info("[TRANSMIT] Lock released");
@@ -315,7 +343,7 @@ auto LibFlute::Transmitter::create_empty_file_for_stream(
     uint32_t expires,
     uint64_t deadline,
     uint32_t max_source_block_length,
-    uint32_t file_length) -> uint16_t {
+    uint32_t file_length) -> uint32_t {
     ZoneScopedN("Transmitter::create_empty_file_for_stream");
 
     // Check that stream_id is at least one
@@ -339,10 +367,7 @@ auto LibFlute::Transmitter::create_empty_file_for_stream(
 
     // spdlog::info("[TRANSMIT] Acquiring lock: create_empty_file_for_stream");
     std::unique_lock<LockableBase(std::mutex)> lock(_files_mutex);
-    auto toi = _toi;
-    _toi++;
-    if (_toi == 0)
-        _toi = 1;  // clamp to >= 1 in case it wraps around
+    auto toi = allocate_toi();
     lock.unlock();
 
     // Create a copy of _fec_oti and modify it to use the given max_source_block_length
@@ -365,6 +390,7 @@ auto LibFlute::Transmitter::create_empty_file_for_stream(
             );
             // Set the stream id
             file->meta().stream_id = stream_id;
+            file->set_tsi(_tsi);
     } catch (const char *e) {
         spdlog::error("[TRANSMIT] Failed to create FileStream object for stream {} : {}", stream_id, e);
         return -1;
@@ -388,6 +414,7 @@ auto LibFlute::Transmitter::create_empty_file_for_stream(
         };
     }
     should_send_fdt = true;
+    _unannounced_tois.insert(toi);
 
     if (should_send_fdt) {
         // There are currently no files in transmission, so we need to send the FDT with the new file
@@ -409,7 +436,9 @@ auto LibFlute::Transmitter::fdt_send_tick() -> void {
     auto time_now = std::chrono::duration_cast<std::chrono::milliseconds>(
                std::chrono::system_clock::now().time_since_epoch())
         .count();
-    auto repeat_interval_ms = _fdt_repeat_interval * 1000;
+    std::unique_lock<LockableBase(std::mutex)> schedule_lock(_files_mutex);
+    uint64_t repeat_interval_ms = _fdt_schedule.repeat_interval.count();
+    schedule_lock.unlock();
     auto time_since_last_fdt_sent = time_now - _last_fdt_sent;
 
     // Only send the FDT if the repeat interval has passed since the last FDT was sent
@@ -432,11 +461,20 @@ auto LibFlute::Transmitter::fdt_send_tick() -> void {
     }
 
     // Substract the time since last FDT sent from the repeat interval
-    auto ms = repeat_interval_ms > time_since_last_fdt_sent ? repeat_interval_ms - time_since_last_fdt_sent : 100;
+    auto ms = repeat_interval_ms > time_since_last_fdt_sent ? repeat_interval_ms - time_since_last_fdt_sent : repeat_interval_ms;
     _fdt_timer.expires_from_now(boost::posix_time::milliseconds(ms));
     _fdt_timer.async_wait(boost::bind(&Transmitter::fdt_send_tick, this));
 }
 
+auto LibFlute::Transmitter::allocate_toi() -> uint32_t {
+    // NOTE: files lock should be locked in the parent function.
+    // After a wrap around the TOIs of files that are still being sent are skipped, TOI 0 is the FDT
+    while (_toi == 0 || _files.find(_toi) != _files.end()) {
+        _toi++;
+    }
+    return _toi++;
+}
+
 auto LibFlute::Transmitter::file_transmitted(uint32_t toi, bool should_lock) -> void {
     ZoneScopedN("Transmitter::file_transmitted");
     if (toi == 0) {
@@ -456,12 +494,14 @@ auto LibFlute::Transmitter::file_transmitted(uint32_t toi, bool should_lock) ->
             _files.erase(toi);
         }
         _fdt->remove(toi);
+        _unannounced_tois.erase(toi);
         lock.unlock();
     } else {
         if (_remove_after_transmission) {
             _files.erase(toi);
         }
         _fdt->remove(toi);
+        _unannounced_tois.erase(toi);
     }
 
     // Call the completion callback.
@@ -491,9 +531,9 @@ std::shared_ptr<LibFlute::FileBase> LibFlute::Transmitter::get_file(uint32_t toi
     return nullptr;
 }
 
-std::vector<uint16_t> LibFlute::Transmitter::remove_expired_files() {
+std::vector<uint32_t> LibFlute::Transmitter::remove_expired_files() {
     ZoneScopedN("Transmitter::remove_expired_files");
-    std::vector<uint16_t> expired_tois;
+    std::vector<uint32_t> expired_tois;
     uint64_t now = seconds_since_epoch();
 
     // spdlog::info("[TRANSMIT] Acquiring lock: remove_expired_files");
@@ -511,6 +551,7 @@ std::vector<uint16_t> LibFlute::Transmitter::remove_expired_files() {
             if (it->second->meta().expires > 0 && now > it->second->meta().expires) {
                 expired_tois.push_back(it->first);
                 _fdt->remove(it->first);
+                _unannounced_tois.erase(it->first);
                 it = _files.erase(it);
             } else {
                 ++it;
@@ -528,6 +569,7 @@ auto LibFlute::Transmitter::send_next_packet() -> void {
     FrameMarkNamed("Transmitter::send_next_packet");
     ZoneScopedN("Transmitter::send_next_packet");
     uint32_t bytes_queued = 0;
+    bool fdt_held_back = false;
 
     // spdlog::info("[TRANSMIT] Acquiring lock: send_next_packet");
     std::lock_guard<LockableBase(std::mutex)> lock(_files_mutex);
@@ -563,6 +605,26 @@ auto LibFlute::Transmitter::send_next_packet() -> void {
                 continue;
             }
 
+            if (file->meta().toi == 0) {
+                // Repetitions are interleaved with the data, announcements go out at once
+                if (!_fdt_announces && _fdt_schedule.interleave > 0 && _data_packets_since_fdt_packet < _fdt_schedule.interleave) {
+                    fdt_held_back = true;
+                    ++it;
+                    continue;
+                }
+            } else if (_unannounced_tois.contains(file->meta().toi)) {
+                // A file is only sent after an FDT instance that lists it
+                if (!_fdt_file || _fdt_file->complete() || !_fdt_file_tois.contains(file->meta().toi)) {
+                    send_fdt(false);
+                }
+                if (_fdt_file && _fdt_file_tois.contains(file->meta().toi)) {
+                    _fdt_announces = true;
+                    file = _fdt_file;
+                } else {
+                    _unannounced_tois.erase(file->meta().toi);
+                }
+            }
+
             auto symbols = file->get_next_symbols(_max_payload);
 
             // Check if there are any symbols to send
@@ -581,9 +643,54 @@ auto LibFlute::Transmitter::send_next_packet() -> void {
                 spdlog::trace("[TRANSMIT] Sending TOI {} SBN {} ID {}, size {}", file->meta().toi, symbol.source_block_number(), symbol.id(), symbol.len());
             }
             */
-            auto packet = std::make_shared<AlcPacket>(_tsi, file->meta().toi, file->fec_oti(), symbols, _max_payload, file->fdt_instance_id());
+            std::shared_ptr<AlcPacket> packet;
+            if (file == _fdt_file) {
+                // Repetitions of an unchanged FDT are split into the same packets, they are encoded once
+                auto key = (static_cast<uint64_t>(symbols.front().source_block_number()) << 32) | symbols.front().id();
+                auto& cached = _fdt_packets[key];
+                if (!cached) {
+                    cached = std::make_shared<AlcPacket>(_tsi, file->meta().toi, file->fec_oti(), symbols, _max_payload, file->fdt_instance_id(), file->meta().content_encoding);
+                }
+                packet = cached;
+            } else {
+                auto with_fti = false;
+                if (_inband_fti_interval > 0) {
+                    auto offset = symbols.front().id() % _inband_fti_interval;
+                    with_fti = offset == 0 || offset + symbols.size() > _inband_fti_interval;
+                }
+                SenderTime sender_time;
+                if (_sender_time_interval > 0 && ++_packets_since_sender_time >= _sender_time_interval && !with_fti) {
+                    _packets_since_sender_time = 0;
+                    sender_time.ntp_timestamp = ntp_timestamp(std::chrono::system_clock::now());
+                    if (_sender_time_ert && file->meta().should_be_complete_at > now) {
+                        sender_time.has_expected_residual_time = true;
+                        sender_time.expected_residual_time = std::min<uint64_t>(file->meta().should_be_complete_at - now, UINT32_MAX);
+                    }
+                }
+                packet = std::make_shared<AlcPacket>(_tsi, file->meta().toi, file->fec_oti(), symbols, _max_payload, file->fdt_instance_id(), file->meta().content_encoding, with_fti, sender_time);
+            }
             bytes_queued += packet->size();
 
+            if (file == _fdt_file) {
+                _data_packets_since_fdt_packet = 0;
+                if (file->all_symbols_queued()) {
+                    // The files in this instance are announced once its last packet is queued before their data
+                    for (auto announced : _fdt_file_tois) {
+                        _unannounced_tois.erase(announced);
+                    }
+                    _fdt_announces = false;
+                    _data_packets_since_fdt = 0;
+                }
+            } else {
+                _data_packets_since_fdt_packet++;
+                _data_packets_since_fdt++;
+                if (_fdt_schedule.repeat_packets > 0 && _data_packets_since_fdt >= _fdt_schedule.repeat_packets
+                    && _fdt_file && _fdt_file->complete()) {
+                    send_fdt(false);
+                    _data_packets_since_fdt = 0;
+                }
+            }
+
             boost::asio::ip::multicast::hops mopt;
             _socket.get_option(mopt);
             spdlog::trace("[TRANSMIT] Queued ALC packet of {} bytes, containing {} symbols with TTL is {}, for TOI {}", packet->size(), symbols.size(), mopt.value(), file->meta().toi);
@@ -662,6 +769,16 @@ auto LibFlute::Transmitter::send_next_packet() -> void {
                     file->mark_completed(symbols, true);
                     auto trigger_completion_cb = file->complete();
 
+                    auto& tracer = LibFlute::Metric::LifecycleTracer::getInstance();
+                    if (toi != 0 && tracer.enabled()) {
+                        if (file->is_first_symbol()) {
+                            tracer.record(LibFlute::Metric::LifecycleTracer::Event::FirstPacketSent, _tsi, toi, packet->size());
+                        }
+                        if (trigger_completion_cb) {
+                            tracer.record(LibFlute::Metric::LifecycleTracer::Event::LastPacketSent, _tsi, toi, packet->size());
+                        }
+                    }
+
                     LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
                     metricsInstance.getOrCreateGauge("multicast_symbols_sent")->Increment(symbols.size());
                     metricsInstance.getOrCreateGauge("multicast_packets_sent")->Increment();
@@ -679,6 +796,11 @@ auto LibFlute::Transmitter::send_next_packet() -> void {
         }
     }
     // Capture the start time before calling async_send_to
+
+    if (!bytes_queued && fdt_held_back) {
+        // There is no data to interleave the FDT with, send it on the next tick
+        _data_packets_since_fdt_packet = _fdt_schedule.interleave;
+    }
     
     if (!bytes_queued) {
         // [IDLab] Stop the transmitter if only the FDT remains in the list of files
@@ -722,6 +844,7 @@ auto LibFlute::Transmitter::clear_files() -> void {
         for (auto it = _files.begin(); it != _files.end(); ) {
             if (it->first != 0) { // All files except the FDT
                 _fdt->remove(it->first); // Remove from FDT
+                _unannounced_tois.erase(it->first);
                 it = _files.erase(it); // Remove from files
             } else {
                 ++it;
@@ -60,6 +60,9 @@ LibFlute::RaptorFEC::~RaptorFEC() {
   for(auto iter = decoders.begin(); iter != decoders.end(); iter++){
     free_decoder_context(iter->second);
   }
+  for(auto iter = encoders.begin(); iter != encoders.end(); iter++){
+    free_encoder_context(iter->second);
+  }
 }
 
 void LibFlute::RaptorFEC::set_max_source_block_length(uint32_t max_source_block_length) {
@@ -248,6 +251,35 @@ LibFlute::SourceBlock LibFlute::RaptorFEC::create_block(char *buffer, int *bytes
 }
 
 
+bool LibFlute::RaptorFEC::create_repair_symbols(char *buffer, uint16_t block_id, uint32_t first_id, uint32_t count, char *out) {
+    ZoneScopedN("RaptorFEC::create_repair_symbols");
+    if (block_id >= Z) {
+        return false;
+    }
+    // Same context as create_block, so the symbols continue the sequence that was multicast. It is kept for
+    // later requests for the block, setting up the precode is the expensive part.
+    auto encoder = encoders.find(block_id);
+    if (encoder == encoders.end()) {
+        int nsymbs = get_source_block_length(block_id);
+        int blocksize = (block_id < Z - 1) ? K*T : F - K*T*(Z-1);
+        struct enc_context *encoder_ctx = create_encoder_context((unsigned char *)buffer + block_id*K*T, nsymbs, T, blocksize, block_id);
+        if (!encoder_ctx) {
+            spdlog::error("[ENCODER] Error creating encoder context");
+            return false;
+        }
+        encoder = encoders.emplace(block_id, encoder_ctx).first;
+    }
+    // An LT packet only depends on its index (the encoder seeds its generator with it), so the encoder starts
+    // at the first requested symbol instead of encoding all the ones before it
+    encoder->second->count = first_id;
+    for (uint32_t symbol_id = first_id; symbol_id < first_id + count; symbol_id++) {
+        struct LT_packet *lt_packet = encode_LT_packet(encoder->second);
+        memcpy(out + (symbol_id - first_id)*T, lt_packet->syms, T);
+        free_LT_packet(lt_packet);
+    }
+    return true;
+}
+
 std::map<uint16_t, LibFlute::SourceBlock> LibFlute::RaptorFEC::create_blocks(char *buffer, int *bytes_read) {
   if(!bytes_read) {
     throw std::invalid_argument("bytes_read pointer shouldn't be null");
@@ -352,6 +384,32 @@ bool LibFlute::RaptorFEC::parse_fdt_info(tinyxml2::XMLElement *file, LibFlute::F
   return true;
 }
 
+bool LibFlute::RaptorFEC::parse_fti(const LibFlute::FecOti& fec_oti) {
+  is_encoder = false;
+
+  F = fec_oti.transfer_length;
+  T = fec_oti.encoding_symbol_length;
+  Z = fec_oti.nof_source_blocks;
+  N = fec_oti.nof_sub_blocks;
+  Al = fec_oti.symbol_alignment;
+  if (T == 0 || Z == 0 || Al == 0 || T % Al) {
+    throw "Invalid FEC OTI for Raptor in EXT_FTI";
+  }
+  set_max_source_block_length(fec_oti.max_source_block_length);
+
+  // Same as in parse_fdt_info()
+  nof_source_symbols = ceil((double)F / (double)T);
+  K = (nof_source_symbols > _max_source_block_length) ? _max_source_block_length : nof_source_symbols;
+  Kt = ceil((double)F/(double)T); // total symbols
+
+  nof_source_blocks = Z;
+  small_source_block_length = (Z * K - nof_source_symbols) * T;
+  nof_large_source_blocks = 0;
+  large_source_block_length = 0;
+
+  return true;
+}
+
 bool LibFlute::RaptorFEC::add_fdt_info(tinyxml2::XMLElement *file, LibFlute::FecOti global_fec_oti) {
   if (global_fec_oti.encoding_id != FecScheme::Raptor) {
     file->SetAttribute("FEC-OTI-FEC-Encoding-ID", (unsigned) FecScheme::Raptor);
@@ -0,0 +1,38 @@
+// Modified version of https://github.com/jupp0r/prometheus-cpp/blob/66e60b47c3bf5a2f81707a6c236214e788c58525/core/src/counter.cc
+
+#include "Metric/Counter.h"
+
+#include "public/tracy/Tracy.hpp"
+
+const char* LibFlute::Metric::Counter::metric_type = "counter"; // Initialize the static const member
+
+LibFlute::Metric::Counter::Counter(const std::string& name, const std::string& documentation):
+  _name{name}, _doc{documentation} {
+  }
+
+void LibFlute::Metric::Counter::Increment() { Increment(1.0); }
+
+void LibFlute::Metric::Counter::Increment(const double value) {
+  if (value < 0.0) {
+    return;
+  }
+  std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
+  _value += value;
+  TracyPlot(_name.c_str(), _value);
+  if (_sink) {
+    _sink->record(_sinkId, _value);
+  }
+}
+
+double LibFlute::Metric::Counter::Value() const {
+  std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
+  return _value;
+}
+
+void LibFlute::Metric::Counter::setSink(std::shared_ptr<MetricsSink> sink) {
+  std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
+  _sink = sink;
+  if (_sink) {
+    _sinkId = _sink->registerMetric(_name);
+  }
+}
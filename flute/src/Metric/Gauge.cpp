@@ -2,12 +2,8 @@
 
 #include "Metric/Gauge.h"
 
-#include <fstream>
 #include <chrono>
 #include <ctime>
-#include <iostream>
-#include <iomanip>
-#include "spdlog/spdlog.h"
 
 #include "public/tracy/Tracy.hpp"
 
@@ -29,15 +25,18 @@ void LibFlute::Metric::Gauge::Set(const double value) {
   std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
   _value = value;
   TracyPlot(_name.c_str(), _value);
-  LibFlute::Metric::Gauge::writeToLog();
+  if (_sink) {
+    _sink->record(_sinkId, _value);
+  }
   }
 
 void LibFlute::Metric::Gauge::Change(const double value) {
   std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
   _value += value;
   TracyPlot(_name.c_str(), _value);
-  LibFlute::Metric::Gauge::writeToLog();
-
+  if (_sink) {
+    _sink->record(_sinkId, _value);
+  }
 }
 
 void LibFlute::Metric::Gauge::SetToCurrentTime() {
@@ -45,33 +44,15 @@ void LibFlute::Metric::Gauge::SetToCurrentTime() {
   Set(static_cast<double>(time));
 }
 
-double LibFlute::Metric::Gauge::Value() const { return _value; }
-
-void LibFlute::Metric::Gauge::setLogFile(const std::string& filename) {
-    _logFilename = filename;
+double LibFlute::Metric::Gauge::Value() const {
+  std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
+  return _value;
 }
 
-void LibFlute::Metric::Gauge::writeToLog() {
-    if (_logFilename.empty()) {
-      return;
-    }
-    std::ofstream logfile(_logFilename, std::ios::app);
-    if (logfile.is_open()) {
-        auto now = std::chrono::system_clock::now();
-        std::time_t time = std::chrono::system_clock::to_time_t(now);
-        auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(now.time_since_epoch()) % 1000;
-        char timeBuffer[24];
-        std::strftime(timeBuffer, sizeof(timeBuffer), "%Y-%m-%d %H:%M:%S", std::localtime(&time));
-        logfile << timeBuffer << "," << std::setfill('0') << std::setw(3) << ms.count() << ";" << _name << ";" << LibFlute::Metric::Gauge::Value() << "\n";
-        logfile.close();
-    } else {
-        // File couldn't be opened for append, try creating it
-        std::ofstream newFile(_logFilename);
-        if (newFile.is_open()) {
-            newFile.close();
-            LibFlute::Metric::Gauge::writeToLog();
-        } else {
-            spdlog::error("Error opening or creating log file: {}", _logFilename);
-        }
-    }
-}
\ No newline at end of file
+void LibFlute::Metric::Gauge::setSink(std::shared_ptr<MetricsSink> sink) {
+  std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
+  _sink = sink;
+  if (_sink) {
+    _sinkId = _sink->registerMetric(_name);
+  }
+}
@@ -0,0 +1,64 @@
+// Modified version of https://github.com/jupp0r/prometheus-cpp/blob/66e60b47c3bf5a2f81707a6c236214e788c58525/core/src/histogram.cc
+
+#include "Metric/Histogram.h"
+
+#include <algorithm>
+#include <iterator>
+
+#include "public/tracy/Tracy.hpp"
+
+const char* LibFlute::Metric::Histogram::metric_type = "histogram"; // Initialize the static const member
+
+LibFlute::Metric::Histogram::Histogram(const std::string& name, const std::string& documentation,
+                                       const BucketBoundaries& buckets):
+  Histogram(name, documentation, buckets, Labels()) {}
+
+LibFlute::Metric::Histogram::Histogram(const std::string& name, const std::string& documentation,
+                                       const BucketBoundaries& buckets, const Labels& labels):
+  _name{name}, _doc{documentation}, _labels{labels}, _bucket_boundaries{buckets},
+  _bucket_counts(buckets.size() + 1, 0) {
+    if (!std::is_sorted(std::begin(_bucket_boundaries), std::end(_bucket_boundaries))) {
+      throw "Bucket boundaries must be in increasing order";
+    }
+  }
+
+void LibFlute::Metric::Histogram::Observe(const double value) {
+  const auto bucket_index = static_cast<size_t>(std::distance(
+      _bucket_boundaries.begin(),
+      std::lower_bound(_bucket_boundaries.begin(), _bucket_boundaries.end(), value)));
+
+  std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
+  _sum += value;
+  _count++;
+  _bucket_counts[bucket_index]++;
+}
+
+LibFlute::Metric::Histogram::Snapshot LibFlute::Metric::Histogram::Collect() const {
+  Snapshot snapshot;
+  snapshot.bucket_boundaries = _bucket_boundaries;
+  {
+    std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
+    snapshot.bucket_counts = _bucket_counts;
+    snapshot.count = _count;
+    snapshot.sum = _sum;
+  }
+  // Exposition uses cumulative bucket counts
+  uint64_t cumulative = 0;
+  for (auto& bucket_count : snapshot.bucket_counts) {
+    cumulative += bucket_count;
+    bucket_count = cumulative;
+  }
+  return snapshot;
+}
+
+LibFlute::Metric::Histogram::BucketBoundaries LibFlute::Metric::Histogram::ExponentialBuckets(
+    double start, double factor, size_t count) {
+  BucketBoundaries buckets;
+  buckets.reserve(count);
+  double boundary = start;
+  for (size_t i = 0; i < count; i++) {
+    buckets.push_back(boundary);
+    boundary *= factor;
+  }
+  return buckets;
+}
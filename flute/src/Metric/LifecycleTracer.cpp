@@ -0,0 +1,232 @@
+#include "Metric/LifecycleTracer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <set>
+#include <sstream>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+namespace {
+    struct ExportedEntry {
+        int64_t timestamp_ns;
+        uint64_t tsi;
+        uint64_t toi;
+        int64_t value;
+        LibFlute::Metric::LifecycleTracer::Event event;
+        uint32_t thread_id;
+    };
+
+    void appendEscaped(std::ostringstream& out, const std::string& text) {
+        for (char c : text) {
+            switch (c) {
+                case '"': out << "\\\""; break;
+                case '\\': out << "\\\\"; break;
+                case '\n': out << "\\n"; break;
+                case '\r': out << "\\r"; break;
+                case '\t': out << "\\t"; break;
+                default:
+                    if (static_cast<unsigned char>(c) < 0x20) {
+                        out << "\\u" << std::hex << std::setw(4) << std::setfill('0') << static_cast<int>(c) << std::dec;
+                    } else {
+                        out << c;
+                    }
+            }
+        }
+    }
+
+    void appendTimestamp(std::ostringstream& out, int64_t timestamp_ns) {
+        // Chrome trace timestamps are in microseconds
+        out << (timestamp_ns / 1000) << "." << std::setw(3) << std::setfill('0') << (timestamp_ns % 1000);
+    }
+}
+
+LibFlute::Metric::LifecycleTracer::Ring::Ring(size_t capacity, uint32_t thread_id):
+  entries(std::max<size_t>(capacity, 1)), thread_id{thread_id} {}
+
+LibFlute::Metric::LifecycleTracer::LifecycleTracer(): _epoch{std::chrono::steady_clock::now()} {}
+
+LibFlute::Metric::LifecycleTracer& LibFlute::Metric::LifecycleTracer::getInstance() {
+    static LifecycleTracer instance;
+    return instance;
+}
+
+void LibFlute::Metric::LifecycleTracer::setEnabled(bool enabled) {
+    _enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void LibFlute::Metric::LifecycleTracer::setCapacity(size_t capacity) {
+    _capacity.store(capacity, std::memory_order_relaxed);
+}
+
+LibFlute::Metric::LifecycleTracer::Ring& LibFlute::Metric::LifecycleTracer::localRing() {
+    thread_local std::shared_ptr<Ring> ring;
+    if (!ring) {
+        ring = std::make_shared<Ring>(_capacity.load(std::memory_order_relaxed), static_cast<uint32_t>(syscall(SYS_gettid)));
+        std::lock_guard<LockableBase(std::mutex)> lock(_rings_mutex);
+        pruneRings(max_exited_rings);
+        _rings.push_back(ring);
+    }
+    return *ring;
+}
+
+void LibFlute::Metric::LifecycleTracer::pruneRings(size_t keep_exited) {
+    // Rings that are only referenced here belong to threads that have exited, the newest are at the back
+    size_t exited = 0;
+    for (auto it = _rings.rbegin(); it != _rings.rend(); ++it) {
+        if (it->use_count() == 1 && ++exited > keep_exited) {
+            it->reset();
+        }
+    }
+    _rings.erase(std::remove(_rings.begin(), _rings.end(), nullptr), _rings.end());
+}
+
+void LibFlute::Metric::LifecycleTracer::append(Event event, uint64_t tsi, uint64_t toi, int64_t value) {
+    auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - _epoch).count();
+    Ring& ring = localRing();
+    std::lock_guard<LockableBase(std::mutex)> lock(ring.mutex);
+    ring.entries[ring.next] = Entry{timestamp, tsi, toi, value, event};
+    if (++ring.next == ring.entries.size()) {
+        ring.next = 0;
+        ring.wrapped = true;
+    }
+}
+
+void LibFlute::Metric::LifecycleTracer::setLabel(uint64_t tsi, uint64_t toi, const std::string& label) {
+    if (!enabled()) {
+        return;
+    }
+    std::lock_guard<LockableBase(std::mutex)> lock(_labels_mutex);
+    _labels[{tsi, toi}] = label;
+}
+
+void LibFlute::Metric::LifecycleTracer::clear() {
+    std::lock_guard<LockableBase(std::mutex)> lock(_rings_mutex);
+    pruneRings(0);
+    for (const auto& ring : _rings) {
+        std::lock_guard<LockableBase(std::mutex)> ring_lock(ring->mutex);
+        ring->next = 0;
+        ring->wrapped = false;
+    }
+
+    std::lock_guard<LockableBase(std::mutex)> labels_lock(_labels_mutex);
+    _labels.clear();
+}
+
+std::string LibFlute::Metric::LifecycleTracer::exportChromeTrace() {
+    ZoneScopedN("LifecycleTracer::exportChromeTrace");
+    std::vector<ExportedEntry> events;
+    {
+        std::lock_guard<LockableBase(std::mutex)> lock(_rings_mutex);
+        for (const auto& ring : _rings) {
+            std::lock_guard<LockableBase(std::mutex)> ring_lock(ring->mutex);
+            size_t count = ring->wrapped ? ring->entries.size() : ring->next;
+            size_t first = ring->wrapped ? ring->next : 0;
+            for (size_t i = 0; i < count; i++) {
+                const auto& entry = ring->entries[(first + i) % ring->entries.size()];
+                events.push_back({entry.timestamp_ns, entry.tsi, entry.toi, entry.value, entry.event, ring->thread_id});
+            }
+        }
+        pruneRings(0);
+    }
+    std::stable_sort(events.begin(), events.end(), [](const auto& a, const auto& b) { return a.timestamp_ns < b.timestamp_ns; });
+
+    std::map<std::pair<uint64_t, uint64_t>, std::string> labels;
+    {
+        std::lock_guard<LockableBase(std::mutex)> lock(_labels_mutex);
+        labels = _labels;
+    }
+
+    // First and last event of every file, used for the span that covers its whole lifecycle
+    std::map<std::pair<uint64_t, uint64_t>, std::pair<int64_t, int64_t>> spans;
+    std::set<uint64_t> sessions;
+    for (const auto& event : events) {
+        auto key = std::make_pair(event.tsi, event.toi);
+        auto span = spans.find(key);
+        if (span == spans.end()) {
+            spans.emplace(key, std::make_pair(event.timestamp_ns, event.timestamp_ns));
+        } else {
+            span->second.second = event.timestamp_ns;
+        }
+        sessions.insert(event.tsi);
+    }
+
+    std::ostringstream out;
+    out << "{\"traceEvents\":[";
+    bool first = true;
+    auto separator = [&]() {
+        if (!first) {
+            out << ",";
+        }
+        first = false;
+        out << "\n";
+    };
+
+    for (auto tsi : sessions) {
+        separator();
+        out << "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":" << tsi << ",\"args\":{\"name\":\"TSI " << tsi << "\"}}";
+    }
+
+    for (const auto& [key, span] : spans) {
+        auto label = labels.find(key);
+        std::ostringstream name;
+        name << "TOI " << key.second;
+        if (label != labels.end()) {
+            name << " " << label->second;
+        }
+
+        separator();
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":" << key.first << ",\"tid\":" << key.second << ",\"args\":{\"name\":\"";
+        appendEscaped(out, name.str());
+        out << "\"}}";
+
+        separator();
+        out << "{\"name\":\"";
+        appendEscaped(out, name.str());
+        out << "\",\"cat\":\"file\",\"ph\":\"X\",\"pid\":" << key.first << ",\"tid\":" << key.second << ",\"ts\":";
+        appendTimestamp(out, span.first);
+        out << ",\"dur\":";
+        appendTimestamp(out, span.second - span.first);
+        out << "}";
+    }
+
+    for (const auto& event : events) {
+        separator();
+        out << "{\"name\":\"" << eventName(event.event) << "\",\"cat\":\"flute\",\"ph\":\"i\",\"s\":\"t\",\"pid\":" << event.tsi
+            << ",\"tid\":" << event.toi << ",\"ts\":";
+        appendTimestamp(out, event.timestamp_ns);
+        out << ",\"args\":{\"value\":" << event.value << ",\"thread\":" << event.thread_id << "}}";
+    }
+
+    out << "\n],\"displayTimeUnit\":\"ms\"}\n";
+    return out.str();
+}
+
+bool LibFlute::Metric::LifecycleTracer::writeChromeTrace(const std::string& filename) {
+    std::ofstream file(filename, std::ios::out | std::ios::trunc);
+    if (!file.is_open()) {
+        return false;
+    }
+    file << exportChromeTrace();
+    return file.good();
+}
+
+const char* LibFlute::Metric::LifecycleTracer::eventName(Event event) {
+    switch (event) {
+        case Event::FileEnqueued: return "file_enqueued";
+        case Event::EncodingDone: return "encoding_done";
+        case Event::FdtAnnounced: return "fdt_announced";
+        case Event::FirstPacketSent: return "first_packet_sent";
+        case Event::LastPacketSent: return "last_packet_sent";
+        case Event::FdtReceived: return "fdt_received";
+        case Event::FirstSymbolReceived: return "first_symbol_received";
+        case Event::RepairRequested: return "repair_requested";
+        case Event::RepairReceived: return "repair_received";
+        case Event::BlockDecoded: return "block_decoded";
+        case Event::FileVerified: return "file_verified";
+        case Event::CompletionCallback: return "completion_callback";
+        case Event::FileWritten: return "file_written";
+    }
+    return "unknown";
+}
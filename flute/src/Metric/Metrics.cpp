@@ -1,6 +1,11 @@
 #include "Metric/Metrics.h"
 #include "Metric/Gauge.h"
 #include "Metric/ThreadedCPUUsage.h"
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <iomanip>
 #include <memory>
 #include <fstream>
 #include <sstream>
@@ -19,12 +24,14 @@ LibFlute::Metric::Metrics::Metrics(): threadedCPUUsage(std::make_unique<Threaded
 LibFlute::Metric::Metrics& LibFlute::Metric::Metrics::getInstance() {
     if (_instance == nullptr) {
         _instance = new LibFlute::Metric::Metrics();
+        // The instance is never destroyed, make sure the last samples still reach the log
+        std::atexit([] { _instance->flush(); });
     }
     return *_instance;
 }
 
-void LibFlute::Metric::Metrics::addThread(std::jthread::id threadId, std::string threadName) {
-    threadedCPUUsage->addThread(threadId, threadName);
+void LibFlute::Metric::Metrics::addThread(std::jthread::id threadId, std::string threadName, const std::string& group) {
+    threadedCPUUsage->addThread(threadId, threadName, group);
 }
 
 void LibFlute::Metric::Metrics::removeThread(std::jthread::id threadId) {
@@ -38,19 +45,199 @@ std::shared_ptr<LibFlute::Metric::Gauge> LibFlute::Metric::Metrics::getOrCreateG
         return it->second; // Return existing gauge
     } else {
         auto newGauge = std::make_shared<Gauge>(name, "");
-        if (!_logFilename.empty()) {
-            newGauge->setLogFile(_logFilename); // Set log filename if available
+        if (_sink) {
+            newGauge->setSink(_sink); // Log changes if a log file is set
         }
         _gauges[name] = newGauge;
         return newGauge; // Return newly created gauge
     }
 }
 
-void LibFlute::Metric::Metrics::setLogFile(const std::string& filename) {
+void LibFlute::Metric::Metrics::removeGauge(const std::string& name) {
+    std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
+    _gauges.erase(name);
+}
+
+std::shared_ptr<LibFlute::Metric::Counter> LibFlute::Metric::Metrics::getOrCreateCounter(const std::string& name) {
+    std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
+    auto it = _counters.find(name);
+    if (it != _counters.end()) {
+        return it->second; // Return existing counter
+    }
+    auto newCounter = std::make_shared<Counter>(name, "");
+    if (_sink) {
+        newCounter->setSink(_sink); // Log changes if a log file is set
+    }
+    _counters[name] = newCounter;
+    return newCounter;
+}
+
+std::shared_ptr<LibFlute::Metric::Histogram> LibFlute::Metric::Metrics::getOrCreateHistogram(const std::string& name, const Histogram::BucketBoundaries& buckets) {
+    return getOrCreateHistogram(name, Histogram::Labels(), buckets);
+}
+
+std::shared_ptr<LibFlute::Metric::Histogram> LibFlute::Metric::Metrics::getOrCreateHistogram(const std::string& name, const Histogram::Labels& labels, const Histogram::BucketBoundaries& buckets) {
+    // The registry is keyed by the name followed by the labels
+    std::string key = name;
+    for (const auto& [label, value] : labels) {
+        key += "\n" + label + "=" + value;
+    }
+    std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
+    auto it = _histograms.find(key);
+    if (it != _histograms.end()) {
+        return it->second; // Return existing histogram
+    }
+    auto newHistogram = std::make_shared<Histogram>(name, "", buckets, labels);
+    _histograms[key] = newHistogram;
+    return newHistogram;
+}
+
+namespace {
+    // Metric names may only contain [a-zA-Z0-9_:] and may not start with a digit
+    std::string sanitizeMetricName(const std::string& name) {
+        std::string sanitized;
+        sanitized.reserve(name.size() + 1);
+        if (name.empty() || std::isdigit(static_cast<unsigned char>(name[0]))) {
+            sanitized.push_back('_');
+        }
+        for (char c : name) {
+            sanitized.push_back(std::isalnum(static_cast<unsigned char>(c)) || c == ':' ? c : '_');
+        }
+        return sanitized;
+    }
+
+    // Label values escape backslashes, double quotes and line feeds
+    std::string labelPairs(const LibFlute::Metric::Histogram::Labels& labels) {
+        std::string pairs;
+        for (const auto& [label, value] : labels) {
+            pairs += sanitizeMetricName(label) + "=\"";
+            for (char c : value) {
+                if (c == '\\' || c == '"') {
+                    pairs.push_back('\\');
+                    pairs.push_back(c);
+                } else if (c == '\n') {
+                    pairs += "\\n";
+                } else {
+                    pairs.push_back(c);
+                }
+            }
+            pairs += "\",";
+        }
+        return pairs;
+    }
+
+    void writeValue(std::ostringstream& out, double value) {
+        if (std::isnan(value)) {
+            out << "NaN";
+        } else if (std::isinf(value)) {
+            out << (value < 0 ? "-Inf" : "+Inf");
+        } else {
+            out << value;
+        }
+    }
+}
+
+std::string LibFlute::Metric::Metrics::serialize() {
+    ZoneScopedN("Metrics::serialize");
+    // Only copy the registry under the lock, the values are read afterwards
+    std::vector<std::shared_ptr<Counter>> counters;
+    std::vector<std::shared_ptr<Gauge>> gauges;
+    std::vector<std::shared_ptr<Histogram>> histograms;
+    {
+        std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
+        for (const auto& [name, counter] : _counters) counters.push_back(counter);
+        for (const auto& [name, gauge] : _gauges) gauges.push_back(gauge);
+        for (const auto& [name, histogram] : _histograms) histograms.push_back(histogram);
+    }
+    auto byName = [](const auto& a, const auto& b) { return a->Name() < b->Name(); };
+    std::sort(counters.begin(), counters.end(), byName);
+    std::sort(gauges.begin(), gauges.end(), byName);
+    // The histograms of a family are listed together, under one TYPE line
+    std::sort(histograms.begin(), histograms.end(), [](const auto& a, const auto& b) {
+        return a->Name() != b->Name() ? a->Name() < b->Name() : a->GetLabels() < b->GetLabels();
+    });
+
+    std::ostringstream out;
+    out << std::setprecision(15);
+    for (const auto& counter : counters) {
+        auto name = sanitizeMetricName(counter->Name());
+        out << "# TYPE " << name << " " << Counter::metric_type << "\n" << name << " ";
+        writeValue(out, counter->Value());
+        out << "\n";
+    }
+    for (const auto& gauge : gauges) {
+        auto name = sanitizeMetricName(gauge->Name());
+        out << "# TYPE " << name << " " << Gauge::metric_type << "\n" << name << " ";
+        writeValue(out, gauge->Value());
+        out << "\n";
+    }
+    std::string family;
+    for (const auto& histogram : histograms) {
+        auto name = sanitizeMetricName(histogram->Name());
+        auto snapshot = histogram->Collect();
+        if (name != family) {
+            out << "# TYPE " << name << " " << Histogram::metric_type << "\n";
+            family = name;
+        }
+        auto labels = labelPairs(histogram->GetLabels());
+        for (size_t i = 0; i < snapshot.bucket_counts.size(); i++) {
+            out << name << "_bucket{" << labels << "le=\"";
+            if (i < snapshot.bucket_boundaries.size()) {
+                writeValue(out, snapshot.bucket_boundaries[i]);
+            } else {
+                out << "+Inf";
+            }
+            out << "\"} " << snapshot.bucket_counts[i] << "\n";
+        }
+        if (!labels.empty()) {
+            labels.pop_back(); // The trailing comma
+            labels = "{" + labels + "}";
+        }
+        out << name << "_sum" << labels << " ";
+        writeValue(out, snapshot.sum);
+        out << "\n" << name << "_count" << labels << " " << snapshot.count << "\n";
+    }
+    return out.str();
+}
+
+void LibFlute::Metric::Metrics::setSink(std::shared_ptr<MetricsSink> sink) {
+    std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
+    _sink = sink;
+    for (auto& [name, gauge] : _gauges) {
+        gauge->setSink(_sink);
+    }
+    for (auto& [name, counter] : _counters) {
+        counter->setSink(_sink);
+    }
+}
+
+void LibFlute::Metric::Metrics::flush() {
+    std::shared_ptr<MetricsSink> sink;
+    {
+        std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
+        sink = _sink;
+    }
+    if (sink) {
+        sink->flush();
+    }
+}
+
+void LibFlute::Metric::Metrics::setBinaryLogFile(const std::string& filename, std::chrono::milliseconds flushInterval) {
+    _logFilename = filename;
+    if (_logFilename.empty()) {
+      setSink(nullptr);
+      return;
+    }
+    setSink(std::make_shared<MetricsSink>(_logFilename, MetricsSink::Format::Binary, flushInterval));
+}
+
+void LibFlute::Metric::Metrics::setLogFile(const std::string& filename, std::chrono::milliseconds flushInterval) {
     _logFilename = filename;
     if (_logFilename.empty()) {
+      setSink(nullptr);
       return;
     }
+    setSink(std::make_shared<MetricsSink>(_logFilename, MetricsSink::Format::Text, flushInterval));
 
     // Load the file, iterate over each line, create a map of gauge names and their values
     std::ifstream file(_logFilename);
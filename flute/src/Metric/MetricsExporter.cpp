@@ -0,0 +1,162 @@
+#include "Metric/MetricsExporter.h"
+#include "Metric/Metrics.h"
+
+#include <istream>
+#include <sstream>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "spdlog/spdlog.h"
+
+#include "public/tracy/Tracy.hpp"
+#include "public/common/TracySystem.hpp"
+
+namespace {
+    // Only a socket left behind by an earlier exporter is removed, never a file that happens to be at the path
+    auto remove_stale_socket(const std::string& path) -> bool {
+        struct stat info;
+        if (lstat(path.c_str(), &info) != 0) {
+            return true;
+        }
+        if (!S_ISSOCK(info.st_mode)) {
+            return false;
+        }
+        unlink(path.c_str());
+        return true;
+    }
+}
+
+LibFlute::Metric::MetricsExporter::MetricsExporter(unsigned short port, const std::string& address)
+    : _strand(_io_service)
+{
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(address), port);
+    _tcp_acceptor = std::make_unique<boost::asio::ip::tcp::acceptor>(_io_service, endpoint);
+    accept(*_tcp_acceptor);
+    start();
+    spdlog::info("[METRICS] Exporting metrics on http://{}:{}/metrics", address, port);
+}
+
+LibFlute::Metric::MetricsExporter::MetricsExporter(const std::string& unix_socket_path)
+    : _strand(_io_service)
+    , _unix_socket_path(unix_socket_path)
+{
+    if (!remove_stale_socket(_unix_socket_path)) {
+        spdlog::error("[METRICS] {} exists and is not a socket", _unix_socket_path);
+        throw "Metrics socket path exists and is not a socket";
+    }
+    boost::asio::local::stream_protocol::endpoint endpoint(_unix_socket_path);
+    _unix_acceptor = std::make_unique<boost::asio::local::stream_protocol::acceptor>(_io_service, endpoint);
+    accept(*_unix_acceptor);
+    start();
+    spdlog::info("[METRICS] Exporting metrics on unix socket {}", _unix_socket_path);
+}
+
+LibFlute::Metric::MetricsExporter::~MetricsExporter() {
+    _io_service.stop();
+    if (_io_service_thread.joinable()) {
+        _io_service_thread.join();
+    }
+    if (!_unix_socket_path.empty()) {
+        remove_stale_socket(_unix_socket_path);
+    }
+}
+
+auto LibFlute::Metric::MetricsExporter::fromEndpoint(const std::string& endpoint) -> std::unique_ptr<MetricsExporter> {
+    const std::string unix_prefix = "unix:";
+    if (endpoint.compare(0, unix_prefix.size(), unix_prefix) == 0) {
+        return std::make_unique<MetricsExporter>(endpoint.substr(unix_prefix.size()));
+    }
+
+    std::string address = "127.0.0.1";
+    std::string port = endpoint;
+    auto colon = endpoint.rfind(':');
+    if (colon != std::string::npos) {
+        address = endpoint.substr(0, colon);
+        port = endpoint.substr(colon + 1);
+    }
+    if (port.empty() || port.find_first_not_of("0123456789") != std::string::npos) {
+        throw "Invalid metrics endpoint";
+    }
+    return std::make_unique<MetricsExporter>(static_cast<unsigned short>(std::stoul(port)), address);
+}
+
+void LibFlute::Metric::MetricsExporter::start() {
+    _io_service_thread = std::jthread([this]() {
+        tracy::SetThreadName("Metrics exporter");
+        Metrics::getInstance().addThread(std::this_thread::get_id(), "Metrics exporter");
+        _io_service.run();
+    });
+}
+
+template <typename Acceptor>
+void LibFlute::Metric::MetricsExporter::accept(Acceptor& acceptor) {
+    auto socket = std::make_shared<typename Acceptor::protocol_type::socket>(_io_service);
+    acceptor.async_accept(*socket, _strand.wrap([this, &acceptor, socket](const boost::system::error_code& error) {
+        if (error) {
+            if (error != boost::asio::error::operation_aborted) {
+                spdlog::warn("[METRICS] Failed to accept a connection: {}", error.message());
+                accept(acceptor);
+            }
+            return;
+        }
+        serve(socket);
+        accept(acceptor);
+    }));
+}
+
+template <typename Socket>
+void LibFlute::Metric::MetricsExporter::serve(std::shared_ptr<Socket> socket) {
+    auto request = std::make_shared<boost::asio::streambuf>();
+
+    // A client that does not finish its request and read the response in time is disconnected, so idle
+    // connections do not pile up
+    auto deadline = std::make_shared<boost::asio::steady_timer>(_io_service);
+    deadline->expires_after(request_timeout);
+    deadline->async_wait(_strand.wrap([socket](const boost::system::error_code& error) {
+        if (error) {
+            return;
+        }
+        spdlog::debug("[METRICS] Closing an idle connection");
+        boost::system::error_code ignored;
+        socket->close(ignored);
+    }));
+
+    boost::asio::async_read_until(*socket, *request, "\r\n\r\n",
+        _strand.wrap([this, socket, request, deadline](const boost::system::error_code& error, size_t /*bytes_transferred*/) {
+            if (error) {
+                deadline->cancel();
+                return;
+            }
+            ZoneScopedN("MetricsExporter::serve");
+            std::istream request_stream(request.get());
+            std::string method;
+            std::string path;
+            request_stream >> method >> path;
+
+            std::string status = "200 OK";
+            std::string body;
+            if (method != "GET") {
+                status = "405 Method Not Allowed";
+            } else if (path != "/metrics" && path != "/") {
+                status = "404 Not Found";
+            } else {
+                body = Metrics::getInstance().serialize();
+            }
+
+            std::ostringstream response_stream;
+            response_stream << "HTTP/1.1 " << status << "\r\n"
+                            << "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                            << "Content-Length: " << body.size() << "\r\n"
+                            << "Connection: close\r\n\r\n"
+                            << body;
+            auto response = std::make_shared<std::string>(response_stream.str());
+            boost::asio::async_write(*socket, boost::asio::buffer(*response),
+                _strand.wrap([socket, response, deadline](const boost::system::error_code& /*error*/, size_t /*bytes_transferred*/) {
+                    deadline->cancel();
+                    boost::system::error_code ignored;
+                    socket->shutdown(Socket::shutdown_both, ignored);
+                    socket->close(ignored);
+                }));
+        }));
+}
@@ -0,0 +1,80 @@
+#include "Metric/MetricsLogReader.h"
+#include "Metric/MetricsSink.h"
+
+#include <cstring>
+#include <ctime>
+#include <iomanip>
+
+LibFlute::Metric::MetricsLogReader::MetricsLogReader(const std::string& filename):
+  _file(filename, std::ios::binary) {
+    if (!_file.is_open()) {
+        throw "Failed to open metrics log";
+    }
+    char magic[sizeof(MetricsSink::binary_magic)];
+    uint16_t version = 0;
+    char reserved[6];
+    _file.read(magic, sizeof(magic));
+    _file.read(reinterpret_cast<char*>(&version), sizeof(version));
+    _file.read(reserved, sizeof(reserved));
+    if (!_file || memcmp(magic, MetricsSink::binary_magic, sizeof(magic)) != 0) {
+        throw "Invalid metrics log header";
+    }
+    if (version != MetricsSink::binary_version) {
+        throw "Unsupported metrics log version";
+    }
+}
+
+bool LibFlute::Metric::MetricsLogReader::next(Sample& sample) {
+    char type;
+    while (_file.read(&type, 1)) {
+        uint32_t id;
+        if (!_file.read(reinterpret_cast<char*>(&id), sizeof(id))) {
+            return false;
+        }
+        if (type == static_cast<char>(MetricsSink::record_name)) {
+            uint16_t length;
+            if (!_file.read(reinterpret_cast<char*>(&length), sizeof(length))) {
+                return false;
+            }
+            std::string name(length, '\0');
+            if (!_file.read(name.data(), length)) {
+                return false;
+            }
+            _names[id] = name;
+        } else if (type == static_cast<char>(MetricsSink::record_sample)) {
+            if (!_file.read(reinterpret_cast<char*>(&sample.timestamp_us), sizeof(sample.timestamp_us)) ||
+                !_file.read(reinterpret_cast<char*>(&sample.value), sizeof(sample.value))) {
+                return false;
+            }
+            auto it = _names.find(id);
+            sample.name = it != _names.end() ? it->second : std::to_string(id);
+            return true;
+        } else {
+            throw "Unknown record type in metrics log";
+        }
+    }
+    return false;
+}
+
+void LibFlute::Metric::MetricsLogReader::writeCsvLine(std::ostream& out, const Sample& sample) {
+    std::time_t time = static_cast<std::time_t>(sample.timestamp_us / 1000000);
+    auto ms = (sample.timestamp_us / 1000) % 1000;
+    struct tm local;
+    localtime_r(&time, &local);
+    char timeBuffer[24];
+    std::strftime(timeBuffer, sizeof(timeBuffer), "%Y-%m-%d %H:%M:%S", &local);
+    out << timeBuffer << "." << std::setfill('0') << std::setw(3) << ms << std::setfill(' ')
+        << "," << sample.name << "," << std::setprecision(15) << sample.value << "\n";
+}
+
+size_t LibFlute::Metric::MetricsLogReader::toCsv(const std::string& filename, std::ostream& out) {
+    MetricsLogReader reader(filename);
+    Sample sample;
+    size_t count = 0;
+    out << "timestamp,name,value\n";
+    while (reader.next(sample)) {
+        writeCsvLine(out, sample);
+        count++;
+    }
+    return count;
+}
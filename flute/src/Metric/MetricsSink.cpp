@@ -0,0 +1,199 @@
+#include "Metric/MetricsSink.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iomanip>
+#include <sstream>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "spdlog/spdlog.h"
+
+#include "public/tracy/Tracy.hpp"
+#include "public/common/TracySystem.hpp"
+
+LibFlute::Metric::MetricsSink::MetricsSink(const std::string& filename, Format format,
+                                           std::chrono::milliseconds flush_interval, size_t capacity):
+  _filename{filename}, _format{format}, _flush_interval{flush_interval} {
+    size_t size = 2;
+    while (size < capacity) {
+        size <<= 1;
+    }
+    _cells = std::make_unique<Cell[]>(size);
+    for (size_t i = 0; i < size; i++) {
+        _cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    _mask = size - 1;
+
+    _fd = open(_filename.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (_fd < 0) {
+        spdlog::error("Error opening or creating log file: {} ({})", _filename, strerror(errno));
+    } else if (_format == Format::Binary) {
+        struct stat st;
+        if (fstat(_fd, &st) == 0 && st.st_size == 0) {
+            std::string header(binary_magic, sizeof(binary_magic));
+            header.append(reinterpret_cast<const char*>(&binary_version), sizeof(binary_version));
+            header.append(6, '\0');
+            writeAll(header);
+        }
+    }
+
+    _writer_thread = std::jthread(&MetricsSink::writerThread, this);
+}
+
+LibFlute::Metric::MetricsSink::~MetricsSink() {
+    {
+        std::lock_guard<std::mutex> lock(_wake_mutex);
+        _stop.store(true, std::memory_order_relaxed);
+    }
+    _wake.notify_all();
+    if (_writer_thread.joinable()) {
+        _writer_thread.join();
+    }
+    flush();
+    if (_fd >= 0) {
+        close(_fd);
+    }
+}
+
+uint32_t LibFlute::Metric::MetricsSink::registerMetric(const std::string& name) {
+    std::lock_guard<LockableBase(std::mutex)> lock(_names_mutex);
+    _names.push_back(name);
+    return static_cast<uint32_t>(_names.size() - 1);
+}
+
+void LibFlute::Metric::MetricsSink::record(uint32_t id, double value) {
+    auto now = std::chrono::system_clock::now();
+    Sample sample{std::chrono::duration_cast<std::chrono::microseconds>(now.time_since_epoch()).count(), id, value};
+
+    size_t pos = _enqueue_pos.load(std::memory_order_relaxed);
+    for (;;) {
+        Cell& cell = _cells[pos & _mask];
+        size_t seq = cell.sequence.load(std::memory_order_acquire);
+        auto diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+        if (diff == 0) {
+            if (_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                cell.sample = sample;
+                cell.sequence.store(pos + 1, std::memory_order_release);
+                return;
+            }
+        } else if (diff < 0) {
+            // Ring is full, the writer is behind
+            _dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            pos = _enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+}
+
+bool LibFlute::Metric::MetricsSink::pop(Sample& sample) {
+    Cell& cell = _cells[_dequeue_pos & _mask];
+    size_t seq = cell.sequence.load(std::memory_order_acquire);
+    if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(_dequeue_pos + 1) < 0) {
+        return false;
+    }
+    sample = cell.sample;
+    cell.sequence.store(_dequeue_pos + _mask + 1, std::memory_order_release);
+    _dequeue_pos++;
+    return true;
+}
+
+void LibFlute::Metric::MetricsSink::flush() {
+    std::lock_guard<LockableBase(std::mutex)> lock(_write_mutex);
+    writeBatch();
+}
+
+void LibFlute::Metric::MetricsSink::writerThread() {
+    tracy::SetThreadName("Metrics sink writer");
+    while (!_stop.load(std::memory_order_relaxed)) {
+        {
+            std::unique_lock<std::mutex> lock(_wake_mutex);
+            _wake.wait_for(lock, _flush_interval, [this] { return _stop.load(std::memory_order_relaxed); });
+        }
+        flush();
+    }
+}
+
+// Called with _write_mutex held
+void LibFlute::Metric::MetricsSink::writeBatch() {
+    ZoneScopedN("MetricsSink::writeBatch");
+    _batch.clear();
+    appendNames(_batch);
+
+    Sample sample;
+    while (pop(sample)) {
+        if (sample.id >= _known_names.size()) {
+            // Registered after the names were collected for this batch
+            appendNames(_batch);
+        }
+        appendSample(_batch, sample);
+    }
+    if (!_batch.empty()) {
+        writeAll(_batch);
+    }
+}
+
+void LibFlute::Metric::MetricsSink::appendNames(std::string& out) {
+    std::lock_guard<LockableBase(std::mutex)> lock(_names_mutex);
+    // A sample can only reference an id that was registered before it was
+    // recorded, so emitting every new name first keeps the file self-describing.
+    for (size_t id = _known_names.size(); id < _names.size(); id++) {
+        _known_names.push_back(_names[id]);
+        if (_format != Format::Binary) {
+            continue;
+        }
+        const auto& name = _names[id];
+        auto length = static_cast<uint16_t>(std::min<size_t>(name.size(), UINT16_MAX));
+        out.push_back(static_cast<char>(record_name));
+        auto record_id = static_cast<uint32_t>(id);
+        out.append(reinterpret_cast<const char*>(&record_id), sizeof(record_id));
+        out.append(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.append(name.data(), length);
+    }
+}
+
+void LibFlute::Metric::MetricsSink::appendSample(std::string& out, const Sample& sample) {
+    if (_format == Format::Binary) {
+        out.push_back(static_cast<char>(record_sample));
+        out.append(reinterpret_cast<const char*>(&sample.id), sizeof(sample.id));
+        out.append(reinterpret_cast<const char*>(&sample.timestamp_us), sizeof(sample.timestamp_us));
+        out.append(reinterpret_cast<const char*>(&sample.value), sizeof(sample.value));
+        return;
+    }
+
+    if (sample.id >= _known_names.size()) {
+        return;
+    }
+    std::time_t time = static_cast<std::time_t>(sample.timestamp_us / 1000000);
+    auto ms = (sample.timestamp_us / 1000) % 1000;
+    struct tm local;
+    localtime_r(&time, &local);
+    char timeBuffer[24];
+    std::strftime(timeBuffer, sizeof(timeBuffer), "%Y-%m-%d %H:%M:%S", &local);
+    std::ostringstream line;
+    line << timeBuffer << "," << std::setfill('0') << std::setw(3) << ms << ";" << _known_names[sample.id] << ";" << sample.value << "\n";
+    out += line.str();
+}
+
+void LibFlute::Metric::MetricsSink::writeAll(const std::string& out) {
+    if (_fd < 0) {
+        return;
+    }
+    const char* data = out.data();
+    size_t remaining = out.size();
+    while (remaining > 0) {
+        ssize_t written = write(_fd, data, remaining);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            spdlog::error("Error writing to log file: {} ({})", _filename, strerror(errno));
+            return;
+        }
+        data += written;
+        remaining -= static_cast<size_t>(written);
+    }
+}
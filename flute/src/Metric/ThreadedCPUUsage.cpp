@@ -1,5 +1,6 @@
 #include "Metric/ThreadedCPUUsage.h"
 
+#include <fstream>
 #include "spdlog/spdlog.h"
 #include "public/common/TracySystem.hpp"
 
@@ -22,77 +23,219 @@ ThreadedCPUUsage::~ThreadedCPUUsage() {
     }
 }
 
-// Add a thread to be monitored for CPU usage
-void ThreadedCPUUsage::addThread(std::jthread::id threadId, std::string threadName) {
+// Add the calling thread to be monitored for CPU usage
+void ThreadedCPUUsage::addThread(std::jthread::id threadId, std::string threadName, const std::string& group) {
     ZoneScopedN("ThreadedCPUUsage::addThread");
+    if (threadId != std::this_thread::get_id()) {
+        // The kernel thread id and CPU clock can only be resolved from the thread itself
+        spdlog::warn("ThreadedCPUUsage: {} has to register itself, not monitoring it", threadName);
+        return;
+    }
     tracy::SetThreadName(threadName.c_str());
 
-    /*
-    std::lock_guard<LockableBase(std::mutex)> lock(threadGaugesMutex);
-    // Check if the thread is already being monitored
-    for (auto& threadGauge : threadGauges) {
-        if (threadGauge.threadId == threadId) {
-            // Remove the existing gauge for this thread
-            threadGauges.erase(std::remove_if(threadGauges.begin(), threadGauges.end(),
-                                              [threadId](const ThreadGauge& threadGauge) {
-                                                  return threadGauge.threadId == threadId;
-                                              }),
-                               threadGauges.end());
-        }
+    ThreadState thread;
+    thread.tid = static_cast<pid_t>(syscall(SYS_gettid));
+    if (pthread_getcpuclockid(pthread_self(), &thread.cpuClock) != 0) {
+        spdlog::warn("ThreadedCPUUsage: No CPU clock for {}, not monitoring it", threadName);
+        return;
+    }
+    thread.name = threadName;
+    thread.label = group.empty() ? threadName : group;
+    thread.lastSample = std::chrono::steady_clock::now();
+    try {
+        sampleThread(thread, thread.last);
+    } catch (...) {
+        // Counted from zero, the thread has only just started
+    }
+
+    std::lock_guard<LockableBase(std::mutex)> lock(threadsMutex);
+    // Replace the existing entry if the thread registers again (e.g. under a new name)
+    auto existing = threads.find(threadId);
+    if (existing != threads.end()) {
+        retireThread(existing);
     }
 
-    auto newGauge = Metrics::getInstance().getOrCreateGauge("cpu_usage_" + threadName);
-    threadGauges.push_back({newGauge, threadId});
-    */
+    auto& gauges = labels[thread.label];
+    if (!gauges.usage) {
+        auto& metricsInstance = Metrics::getInstance();
+        gauges.usage = metricsInstance.getOrCreateGauge("cpu_usage_" + thread.label);
+        gauges.userTime = metricsInstance.getOrCreateGauge("cpu_user_time_" + thread.label);
+        gauges.systemTime = metricsInstance.getOrCreateGauge("cpu_system_time_" + thread.label);
+        gauges.voluntaryCtxSwitches = metricsInstance.getOrCreateGauge("cpu_voluntary_ctx_switches_" + thread.label);
+        gauges.involuntaryCtxSwitches = metricsInstance.getOrCreateGauge("cpu_involuntary_ctx_switches_" + thread.label);
+        gauges.lastCore = metricsInstance.getOrCreateGauge("cpu_last_core_" + thread.label);
+    }
+    gauges.keep = gauges.keep || !group.empty();
+    gauges.threads++;
+    threads.insert_or_assign(threadId, std::move(thread));
 }
 
 // Remove a thread from the list of monitored threads
 void ThreadedCPUUsage::removeThread(std::jthread::id threadId) {
     ZoneScopedN("ThreadedCPUUsage::removeThread");
-    std::lock_guard<LockableBase(std::mutex)> lock(threadGaugesMutex);
-    // Remove the thread gauge from the list of thread gauges using c++17
-    threadGauges.erase(std::remove_if(threadGauges.begin(), threadGauges.end(),
-                                      [threadId](const ThreadGauge& threadGauge) {
-                                          return threadGauge.threadId == threadId;
-                                      }),
-                       threadGauges.end());
+    std::lock_guard<LockableBase(std::mutex)> lock(threadsMutex);
+    auto it = threads.find(threadId);
+    if (it != threads.end()) {
+        // Count the time since the last sample if the thread still runs, e.g. when it removes itself
+        ThreadSample sample;
+        try {
+            if (sampleThread(it->second, sample)) {
+                it->second.last = sample;
+            }
+        } catch (...) {
+            // Keep the totals of the last sample
+        }
+        retireThread(it);
+    }
+}
+
+void ThreadedCPUUsage::retireThread(std::unordered_map<std::jthread::id, ThreadState>::iterator it) {
+    auto label = labels.find(it->second.label);
+    if (label != labels.end()) {
+        auto& gauges = label->second;
+        const auto& last = it->second.last;
+        gauges.exited.userSeconds += last.userSeconds;
+        gauges.exited.systemSeconds += last.systemSeconds;
+        gauges.exited.voluntaryCtxSwitches += last.voluntaryCtxSwitches;
+        gauges.exited.involuntaryCtxSwitches += last.involuntaryCtxSwitches;
+        if (--gauges.threads == 0 && !gauges.keep) {
+            removeGauges(label->first);
+            labels.erase(label);
+        }
+    }
+    threads.erase(it);
+}
+
+void ThreadedCPUUsage::removeGauges(const std::string& label) {
+    auto& metricsInstance = Metrics::getInstance();
+    metricsInstance.removeGauge("cpu_usage_" + label);
+    metricsInstance.removeGauge("cpu_user_time_" + label);
+    metricsInstance.removeGauge("cpu_system_time_" + label);
+    metricsInstance.removeGauge("cpu_voluntary_ctx_switches_" + label);
+    metricsInstance.removeGauge("cpu_involuntary_ctx_switches_" + label);
+    metricsInstance.removeGauge("cpu_last_core_" + label);
+}
+
+bool ThreadedCPUUsage::sampleThread(const ThreadState& thread, ThreadSample& sample) {
+    struct timespec ts;
+    if (clock_gettime(thread.cpuClock, &ts) != 0) {
+        return false; // The thread has exited
+    }
+    sample.cpuTimeNs = static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + static_cast<uint64_t>(ts.tv_nsec);
+
+    const std::string taskPath = "/proc/self/task/" + std::to_string(thread.tid);
+
+    // Field 2 (comm) may contain spaces, the remaining fields start after the last ')'
+    std::ifstream statFile(taskPath + "/stat");
+    std::string stat;
+    if (!std::getline(statFile, stat)) {
+        return false;
+    }
+    auto commEnd = stat.rfind(')');
+    if (commEnd != std::string::npos) {
+        std::istringstream fields(stat.substr(commEnd + 2));
+        std::vector<std::string> values;
+        std::string value;
+        while (fields >> value) {
+            values.push_back(value);
+        }
+        // values[0] is field 3 (state): utime is field 14, stime 15 and processor 39
+        static const double ticksPerSecond = static_cast<double>(sysconf(_SC_CLK_TCK));
+        if (values.size() > 36) {
+            sample.userSeconds = std::stod(values[11]) / ticksPerSecond;
+            sample.systemSeconds = std::stod(values[12]) / ticksPerSecond;
+            sample.lastCore = std::stoi(values[36]);
+        }
+    }
+
+    std::ifstream statusFile(taskPath + "/status");
+    std::string line;
+    while (std::getline(statusFile, line)) {
+        if (line.rfind("voluntary_ctxt_switches:", 0) == 0) {
+            sample.voluntaryCtxSwitches = std::stoll(line.substr(line.find(':') + 1));
+        } else if (line.rfind("nonvoluntary_ctxt_switches:", 0) == 0) {
+            sample.involuntaryCtxSwitches = std::stoll(line.substr(line.find(':') + 1));
+        }
+    }
+    return true;
 }
 
 void ThreadedCPUUsage::measureCPUUsageThread() {
     tracy::SetThreadName("CPU Usage Thread");
     ZoneScopedN("ThreadedCPUUsage::measureCPUUsageThread");
     while (!stopThread.load(std::memory_order_relaxed)) {
-        std::unique_lock<LockableBase(std::mutex)> lock(threadGaugesMutex);
+        std::unique_lock<LockableBase(std::mutex)> lock(threadsMutex);
+
+        // Sum the threads of every label, starting from the ones that exited
+        struct LabelSample {
+            double usage = 0;
+            ThreadSample totals;
+        };
+        std::unordered_map<std::string, LabelSample> samples;
+        for (const auto& [label, gauges] : labels) {
+            samples[label].totals = gauges.exited;
+        }
 
         // Measure CPU usage for each thread
-        for (auto& threadGauge : threadGauges) {
+        auto now = std::chrono::steady_clock::now();
+        for (auto it = threads.begin(); it != threads.end();) {
+            auto& thread = it->second;
+            ThreadSample sample;
+            bool alive = false;
             try {
-                //pthread_t pthreadId = pthread_self();
-                //pid_t tid = syscall(SYS_gettid);
-
-                struct rusage usage;
-                int result = getrusage(RUSAGE_THREAD, &usage);
-
-                double cpuUsage = (result == 0) ? (static_cast<double>(usage.ru_utime.tv_sec) +
-                                                   static_cast<double>(usage.ru_utime.tv_usec) / 1000000.0)
-                                                 : 0.0;
-
-                // convert cpuTime to percentage of total CPU time
-                cpuUsage = cpuUsage / sysconf(_SC_CLK_TCK);
-                // Round to 2 decimal places
-                cpuUsage = std::round(cpuUsage * 100) / 100;
-
-                // Update the gauge with the measured CPU usage
-                threadGauge.gauge->Set(cpuUsage);
+                alive = sampleThread(thread, sample);
             } catch (...) {
-                // Handle exceptions, e.g., if the thread no longer exists
-                threadGauge.gauge->Set(-1.0); // Set to -1.0 to indicate an error.
+                // Malformed /proc entry, the thread is most likely exiting
+                alive = false;
             }
+            if (!alive) {
+                spdlog::debug("ThreadedCPUUsage: {} has exited", thread.name);
+                // Its last totals are counted with the label from now on
+                auto& totals = samples[thread.label].totals;
+                totals.userSeconds += thread.last.userSeconds;
+                totals.systemSeconds += thread.last.systemSeconds;
+                totals.voluntaryCtxSwitches += thread.last.voluntaryCtxSwitches;
+                totals.involuntaryCtxSwitches += thread.last.involuntaryCtxSwitches;
+                auto label = thread.label;
+                retireThread(it++);
+                if (labels.find(label) == labels.end()) {
+                    samples.erase(label);
+                }
+                continue;
+            }
+
+            auto& labelSample = samples[thread.label];
+            auto wallNs = std::chrono::duration_cast<std::chrono::nanoseconds>(now - thread.lastSample).count();
+            if (wallNs > 0 && sample.cpuTimeNs >= thread.last.cpuTimeNs) {
+                labelSample.usage += static_cast<double>(sample.cpuTimeNs - thread.last.cpuTimeNs) * 100.0 / static_cast<double>(wallNs);
+            }
+            labelSample.totals.userSeconds += sample.userSeconds;
+            labelSample.totals.systemSeconds += sample.systemSeconds;
+            labelSample.totals.voluntaryCtxSwitches += sample.voluntaryCtxSwitches;
+            labelSample.totals.involuntaryCtxSwitches += sample.involuntaryCtxSwitches;
+            if (sample.lastCore >= 0) {
+                labelSample.totals.lastCore = sample.lastCore;
+            }
+            thread.last = sample;
+            thread.lastSample = now;
+            ++it;
         }
 
+        for (const auto& [label, labelSample] : samples) {
+            auto& gauges = labels.at(label);
+            // Round to 2 decimal places
+            gauges.usage->Set(std::round(labelSample.usage * 100) / 100);
+            gauges.userTime->Set(labelSample.totals.userSeconds);
+            gauges.systemTime->Set(labelSample.totals.systemSeconds);
+            gauges.voluntaryCtxSwitches->Set(static_cast<double>(labelSample.totals.voluntaryCtxSwitches));
+            gauges.involuntaryCtxSwitches->Set(static_cast<double>(labelSample.totals.involuntaryCtxSwitches));
+            if (labelSample.totals.lastCore >= 0) {
+                gauges.lastCore->Set(static_cast<double>(labelSample.totals.lastCore));
+            }
+        }
 
         lock.unlock();
-        std::this_thread::sleep_for(std::chrono::milliseconds(250)); // Adjust sleep interval as needed
+        std::this_thread::sleep_for(sampleInterval);
     }
 }
 
@@ -25,8 +25,10 @@
 #include "openssl/md5.h"
 #include "openssl/evp.h"
 #include "Utils/base64.h"
+#include "Utils/Compression.h"
 #include "spdlog/spdlog.h"
 #include "Metric/Metrics.h"
+#include "Metric/LifecycleTracer.h"
 
 #include "public/tracy/Tracy.hpp"
 
@@ -145,6 +147,43 @@ auto LibFlute::File::put_symbol( const LibFlute::EncodingSymbol& symbol ) -> voi
 	  return;
   }
 
+  if (symbol.id() >= source_block.symbols.size() && _meta.fec_transformer) {
+    // A fresh repair symbol from the repair server, beyond the ones that were multicast. It only feeds the decoder.
+    const std::lock_guard<LockableBase(std::mutex)> bufferLock(_content_buffer_mutex);
+    std::vector<char> data(_meta.fec_oti.encoding_symbol_length);
+    LibFlute::SourceBlock::Symbol repair_symbol{ .id = static_cast<uint16_t>(symbol.id()), .data = data.data(), .length = data.size(), .complete = true};
+    symbol.decode_to(repair_symbol.data, repair_symbol.length);
+
+    _process_symbol_semaphore.acquire();
+    try
+    {
+      _meta.fec_transformer->process_symbol(source_block, repair_symbol, symbol.id());
+    }
+    catch(...)
+    {
+      _process_symbol_semaphore.release();
+      throw "Exception while processing the symbol with the FEC transformer";
+    }
+    _process_symbol_semaphore.release();
+
+    auto& next_esi = _next_repair_esi[symbol.source_block_number()];
+    if (symbol.id() >= next_esi) {
+      next_esi = symbol.id() + 1;
+      _repair_symbols_received[symbol.source_block_number()]++;
+      _symbols_received.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    check_source_block_completion(source_block);
+    if (source_block.complete) {
+      LibFlute::Metric::LifecycleTracer::getInstance().record(LibFlute::Metric::LifecycleTracer::Event::BlockDecoded, _tsi, _meta.toi, symbol.source_block_number());
+      if (_block_cb) {
+        _block_cb(*this, symbol.source_block_number());
+      }
+    }
+    check_file_completion();
+    return;
+  }
+
   if (symbol.id() > source_block.symbols.size()) {
     throw "Encoding Symbol ID too high";
   }
@@ -167,6 +206,7 @@ auto LibFlute::File::put_symbol( const LibFlute::EncodingSymbol& symbol ) -> voi
 
     symbol.decode_to(target_symbol.data, target_symbol.length);
     target_symbol.complete = true;
+    _symbols_received.fetch_add(1, std::memory_order_relaxed);
     if (_meta.fec_transformer) {
       auto error_occured = false;
       _process_symbol_semaphore.acquire();
@@ -189,7 +229,14 @@ auto LibFlute::File::put_symbol( const LibFlute::EncodingSymbol& symbol ) -> voi
     }
 
     if (target_symbol.complete) {
+      auto block_was_complete = source_block.complete;
       check_source_block_completion(source_block);
+      if (!block_was_complete && source_block.complete) {
+        LibFlute::Metric::LifecycleTracer::getInstance().record(LibFlute::Metric::LifecycleTracer::Event::BlockDecoded, _tsi, _meta.toi, symbol.source_block_number());
+        if (_block_cb) {
+          _block_cb(*this, symbol.source_block_number());
+        }
+      }
       check_file_completion();
     }
   }
@@ -204,6 +251,82 @@ auto LibFlute::File::put_symbol( const LibFlute::EncodingSymbol& symbol ) -> voi
 
 }
 
+auto LibFlute::File::put_range(uint64_t offset, const char* data, size_t length) -> void
+{
+  ZoneScopedN("File::put_range");
+  if (_complete || _buffer == nullptr) {
+    return;
+  }
+  if (offset + length > _meta.fec_oti.transfer_length) {
+    throw "Range exceeds the file";
+  }
+
+  if (_meta.fec_transformer) {
+    // The symbols of FEC encoded files are not ranges of the object, so only the whole object can be taken
+    if (offset != 0 || length != _meta.fec_oti.transfer_length) {
+      throw "Only whole objects can be put into FEC encoded files";
+    }
+    const std::lock_guard<LockableBase(std::mutex)> bufferLock(_content_buffer_mutex);
+    memcpy(_buffer, data, length);
+    for (auto& [sbn, block] : _source_blocks) {
+      if (block.complete) {
+        continue;
+      }
+      for (auto& symbol : block.symbols) {
+        symbol.second.complete = true;
+      }
+      block.complete = true;
+      LibFlute::Metric::LifecycleTracer::getInstance().record(LibFlute::Metric::LifecycleTracer::Event::BlockDecoded, _tsi, _meta.toi, sbn);
+      if (_block_cb) {
+        _block_cb(*this, sbn);
+      }
+    }
+    // There is nothing left to decode
+    check_file_completion(true, false);
+    return;
+  }
+
+  // Without FEC every symbol is a range of the buffer, the ones that are covered are handled as if they were received
+  for (const auto& [sbn, block] : _source_blocks) {
+    for (const auto& [esi, symbol] : block.symbols) {
+      uint64_t symbol_offset = symbol.data - _buffer;
+      if (symbol_offset < offset || symbol_offset + symbol.length > offset + length) {
+        continue;
+      }
+      put_symbol(LibFlute::EncodingSymbol(esi, sbn, const_cast<char*>(data) + (symbol_offset - offset), symbol.length, _meta.fec_oti.encoding_id));
+      if (_complete) {
+        return;
+      }
+    }
+  }
+}
+
+auto LibFlute::File::decode_content() -> void
+{
+  ZoneScopedN("File::decode_content");
+  const std::lock_guard<LockableBase(std::mutex)> bufferLock(_content_buffer_mutex);
+  if (_meta.content_encoding == ContentEncoding::NONE || _buffer == nullptr) {
+    return;
+  }
+  auto content = (char*) malloc(std::max<size_t>(_meta.content_length, 1));
+  if (content == nullptr) {
+    throw "Failed to allocate file buffer";
+  }
+  try {
+    Compression::decompress_to(_buffer, length(), _meta.content_encoding, content, _meta.content_length);
+  } catch (...) {
+    free(content);
+    throw;
+  }
+  spdlog::debug("[{}] Decoded TOI {} from {} to {} bytes", _purpose, _meta.toi, length(), _meta.content_length);
+  free_buffer();
+  _buffer = content;
+  _own_buffer = true;
+  // From here on the file holds the content itself
+  _meta.fec_oti.transfer_length = _meta.content_length;
+  _meta.content_encoding = ContentEncoding::NONE;
+}
+
 auto LibFlute::File::check_file_completion(bool check_hash, bool extract_data) -> void
 {
   // NOTE: content lock should be locked in the parent function.
@@ -270,6 +393,11 @@ auto LibFlute::File::check_file_completion(bool check_hash, bool extract_data) -
 
   }
 
+  // The transmitter also completes its files through here, only the receiver verifies anything
+  if (_purpose == "RECEIVE") {
+    LibFlute::Metric::LifecycleTracer::getInstance().record(LibFlute::Metric::LifecycleTracer::Event::FileVerified, _tsi, _meta.toi, _complete ? 1 : 0);
+  }
+
   auto endTime = std::chrono::time_point_cast<std::chrono::microseconds>(std::chrono::high_resolution_clock::now());
   auto elapsedTime = std::chrono::duration_cast<std::chrono::microseconds>(endTime - startTime).count();
   double elapsedTimeMilliseconds = static_cast<double>(elapsedTime) / 1000.0; // us to ms
@@ -342,6 +470,9 @@ auto LibFlute::File::create_blocks() -> void
       throw "FEC Transformer failed to create source blocks";
     }
     _create_blocks_semaphore.release();
+    for (const auto& block : _source_blocks) {
+      _nof_symbols += block.second.symbols.size();
+    }
     return;
   }
   auto buffer_ptr = _buffer;
@@ -379,6 +510,7 @@ auto LibFlute::File::create_blocks() -> void
       if (remaining_size <= 0) break;
     }
     block.length = total_buffer_size;
+    _nof_symbols += block.symbols.size();
     _source_blocks[block_id++] = block;
   }
 }
@@ -56,6 +56,10 @@ LibFlute::FileBase::FileBase(uint32_t toi,
                     _meta.fec_oti.encoding_symbol_length = r->T;
                     spdlog::debug("[{}] Raptor FEC Scheme 1, T = {}, K = {}, MSBL = {}", _purpose, r->T, r->K, _meta.fec_oti.max_source_block_length);
                     _meta.fec_oti.max_source_block_length = r->K; // The maximum source block length is the number of source symbols times the symbol length, for this file
+                    // For EXT_FTI
+                    _meta.fec_oti.nof_source_blocks = r->Z;
+                    _meta.fec_oti.nof_sub_blocks = r->N;
+                    _meta.fec_oti.symbol_alignment = r->Al;
                     _meta.fec_transformer = r; 
                 } catch (...) {
                     // Failed to create RaptorFEC object, fall back to CompactNoCode
@@ -114,11 +118,37 @@ auto LibFlute::FileBase::mark_complete() -> void {
     _complete = true;
 }
 
-auto LibFlute::FileBase::set_fdt_instance_id( uint16_t id) -> void {
+auto LibFlute::FileBase::adopt_entry(const LibFlute::FileDeliveryTable::FileEntry& entry) -> bool {
+    ZoneScopedN("FileBase::adopt_entry");
+    const std::lock_guard<LockableBase(std::mutex)> bufferLock(_content_buffer_mutex);
+    if (entry.stream_id != 0 ||
+        entry.fec_oti.encoding_id != _meta.fec_oti.encoding_id ||
+        entry.fec_oti.transfer_length != _meta.fec_oti.transfer_length ||
+        entry.fec_oti.encoding_symbol_length != _meta.fec_oti.encoding_symbol_length ||
+        entry.fec_oti.max_source_block_length != _meta.fec_oti.max_source_block_length ||
+        entry.content_encoding != _meta.content_encoding) {
+        return false;
+    }
+    _meta.content_location = entry.content_location;
+    _meta.content_length = entry.content_length;
+    _meta.content_md5 = entry.content_md5;
+    _meta.content_type = entry.content_type;
+    _meta.expires = entry.expires;
+    _meta.should_be_complete_at = entry.should_be_complete_at;
+    _retrieval_deadline = entry.should_be_complete_at;
+    if (_complete) {
+        // It completed without a hash to check against
+        check_file_completion(true, false);
+    }
+    _provisional = false;
+    return true;
+}
+
+auto LibFlute::FileBase::set_fdt_instance_id( uint32_t id) -> void {
     _fdt_instance_id = id;
 }
 
-auto LibFlute::FileBase::fdt_instance_id() -> uint16_t {
+auto LibFlute::FileBase::fdt_instance_id() -> uint32_t {
     return _fdt_instance_id;
 }
 
@@ -130,6 +160,10 @@ auto LibFlute::FileBase::register_receiver_callback(receiver_callback_t cb) -> v
     _receiver_cb = cb;
 }
 
+auto LibFlute::FileBase::register_block_callback(block_callback_t cb) -> void {
+    _block_cb = cb;
+}
+
 auto LibFlute::FileBase::get_source_blocks() -> std::map<uint16_t, LibFlute::SourceBlock> {
     return _source_blocks;
 }
@@ -152,8 +186,9 @@ auto LibFlute::FileBase::push_alc_to_receive_buffer(const std::shared_ptr<AlcPac
         // spdlog::debug("[{}] Ignoring reception of filebase {}", _purpose, _meta.content_location);
         return;
     }
-    // Check if the thread is running, if not, then return
-    if (!_receive_thread.joinable()) {
+    // Check if the thread is running, if not, then return. The receiver hands packets on without holding its
+    // files mutex, so this checks the atomic flag rather than the thread that may be joined concurrently.
+    if (_stop_receive_thread) {
         return;
     }
     std::lock_guard<LockableBase(std::mutex)> bufferLock(_receive_buffer_mutex);
@@ -209,17 +244,19 @@ auto LibFlute::FileBase::process_receive_buffer() -> void {
 
 auto LibFlute::FileBase::start_receive_thread() -> void {
     ZoneScopedN("FileBase::start_receive_thread");
+    // Clear the stop flag before the thread exists, packets are accepted from here on
+    _stop_receive_thread = false;
     // Start the processing thread
     _receive_thread = std::jthread([&]() {
         LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
-        // content_location is used as a unique identifier for the file
-        metricsInstance.addThread(std::this_thread::get_id(), "Receive thread for " + _meta.content_location + " (TOI " + std::to_string(_meta.toi) + ")");
-        // Set stop flag to false
-        _stop_receive_thread = false;
+        // There is a thread per file, their CPU usage is summed under one label
+        metricsInstance.addThread(std::this_thread::get_id(), "Receive thread for " + _meta.content_location + " (TOI " + std::to_string(_meta.toi) + ")",
+                                  "receive_threads");
 
         while (!_stop_receive_thread) {
             process_receive_buffer();
         }
+        metricsInstance.removeThread(std::this_thread::get_id());
 
         spdlog::debug("[{}] Stopped receive thread for TOI {}", _purpose, _meta.toi);
     });
@@ -257,8 +294,7 @@ auto LibFlute::FileBase::get_buffered_symbols(std::vector<EncodingSymbol>& symbo
         auto encoding_symbols = LibFlute::EncodingSymbol::from_payload(
             alc->data(), // Payload
             alc->size(), // Size of the payload
-            fec_oti(),
-            alc->content_encoding());
+            fec_oti());
 
         for(const auto& symbol : encoding_symbols) {
             symbols.push_back(symbol);
@@ -314,6 +350,14 @@ auto LibFlute::FileBase::put_symbol(const EncodingSymbol& symbol) -> void {
     throw "Not implemented, should be implemented in derived class";
 }
 
+auto LibFlute::FileBase::put_range(uint64_t /*offset*/, const char* /*data*/, size_t /*length*/) -> void {
+    throw "Not implemented, should be implemented in derived class";
+}
+
+auto LibFlute::FileBase::decode_content() -> void {
+    throw "Not implemented, should be implemented in derived class";
+}
+
 auto LibFlute::FileBase::check_source_block_completion( LibFlute::SourceBlock& block ) -> void
 {
   // NOTE: content lock should be locked in the parent function.
@@ -400,10 +444,107 @@ auto LibFlute::FileBase::mark_completed(const std::vector<EncodingSymbol>& symbo
     }
 }
 
+auto LibFlute::FileBase::rewind() -> void
+{
+    ZoneScopedN("FileBase::rewind");
+    const std::lock_guard<LockableBase(std::mutex)> bufferLock(_content_buffer_mutex);
+    for (auto& block : _source_blocks) {
+        for (auto& symbol : block.second.symbols) {
+            symbol.second.complete = false;
+            symbol.second.queued = false;
+        }
+        block.second.complete = false;
+    }
+    _complete = false;
+}
+
+auto LibFlute::FileBase::all_symbols_queued() -> bool
+{
+    ZoneScopedN("FileBase::all_symbols_queued");
+    const std::lock_guard<LockableBase(std::mutex)> bufferLock(_content_buffer_mutex);
+    for (const auto& block : _source_blocks) {
+        if (block.second.complete) {
+            continue;
+        }
+        for (const auto& symbol : block.second.symbols) {
+            if (!symbol.second.complete && !symbol.second.queued) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
 auto LibFlute::FileBase::get_content_buffer_lock() -> const std::unique_lock<LockableBase(std::mutex)> {
     return std::unique_lock<LockableBase(std::mutex)>(_content_buffer_mutex);
 }
 
+auto LibFlute::FileBase::fresh_repair_symbols(uint16_t sbn, uint32_t first_esi, uint32_t count) -> std::vector<EncodingSymbol>
+{
+  // NOTE: content lock should be locked in the parent function.
+  ZoneScopedN("FileBase::fresh_repair_symbols");
+  std::vector<EncodingSymbol> symbols;
+  auto block = _source_blocks.find(sbn);
+  uint32_t symbol_length = _meta.fec_oti.encoding_symbol_length;
+  if (!_meta.fec_transformer || block == _source_blocks.end() || count == 0 || symbol_length == 0) {
+    return symbols;
+  }
+  char* data = buffer();
+  if (data == nullptr) {
+    return symbols;
+  }
+
+  // ESIs have 16 bits, and a block never needs more fresh symbols than it had symbols in the first place
+  uint32_t nof_symbols = block->second.symbols.size();
+  uint32_t limit = std::min<uint32_t>(2 * nof_symbols, 0x10000);
+  first_esi = std::max(first_esi, nof_symbols);
+  if (first_esi >= limit) {
+    return symbols;
+  }
+  uint32_t end = first_esi + std::min(count, limit - first_esi);
+
+  auto& stored = _repair_symbols[sbn];
+  uint32_t nof_stored = stored.size() / symbol_length;
+  if (end > nof_symbols + nof_stored) {
+    uint32_t nof_new = end - nof_symbols - nof_stored;
+    stored.resize(static_cast<size_t>(nof_stored + nof_new) * symbol_length);
+    if (!_meta.fec_transformer->create_repair_symbols(data, sbn, nof_symbols + nof_stored, nof_new, stored.data() + static_cast<size_t>(nof_stored) * symbol_length)) {
+      stored.resize(static_cast<size_t>(nof_stored) * symbol_length);
+      return symbols;
+    }
+  }
+
+  symbols.reserve(end - first_esi);
+  for (uint32_t esi = first_esi; esi < end; esi++) {
+    symbols.emplace_back(esi, sbn, stored.data() + static_cast<size_t>(esi - nof_symbols) * symbol_length, symbol_length, _meta.fec_oti.encoding_id);
+  }
+  return symbols;
+}
+
+auto LibFlute::FileBase::symbols_needed() -> std::map<uint16_t, RepairRequest::Needed>
+{
+  // NOTE: content lock should be locked in the parent function.
+  std::map<uint16_t, RepairRequest::Needed> needed;
+  if (!_meta.fec_transformer) {
+    return needed;
+  }
+  for (const auto& [sbn, block] : _source_blocks) {
+    if (block.complete) {
+      continue;
+    }
+    uint32_t received = std::count_if(block.symbols.begin(), block.symbols.end(), [](const auto& symbol){ return symbol.second.complete; });
+    auto fresh = _repair_symbols_received.find(sbn);
+    received += fresh != _repair_symbols_received.end() ? fresh->second : 0;
+
+    uint32_t wanted = _meta.fec_transformer->get_source_block_length(sbn) + _repair_symbol_overhead;
+    auto next = _next_repair_esi.find(sbn);
+    needed[sbn] = RepairRequest::Needed{
+      // The decoder did not finish with enough symbols, ask for a couple more
+      received < wanted ? wanted - received : _repair_symbol_overhead,
+      std::max<uint32_t>(block.symbols.size(), next != _next_repair_esi.end() ? next->second : 0)};
+  }
+  return needed;
+}
 
 auto LibFlute::FileBase::emit_missing_symbols() -> void
 {
@@ -15,14 +15,96 @@
 //
 #include "Object/FileDeliveryTable.h"
 #include "tinyxml2.h" 
+#include <algorithm>
+#include <cctype>
+#include <charconv>
+#include <cstring>
 #include <iostream>
+#include <optional>
 #include <string>
 #include "spdlog/spdlog.h"
+#include "Utils/Compression.h"
 
 #ifdef RAPTOR_ENABLED
 #include "Fec/RaptorFEC.h"
 #endif
 
+namespace {
+  // Start of an element ("<name" followed by a space, '>' or '/') at or after pos
+  auto element_start(std::string_view xml, std::string_view name, size_t pos) -> size_t {
+    while ((pos = xml.find(name, pos)) != std::string_view::npos) {
+      auto after = pos + name.size();
+      if (pos > 0 && xml[pos - 1] == '<' && after < xml.size() &&
+          (std::isspace(static_cast<unsigned char>(xml[after])) || xml[after] == '>' || xml[after] == '/')) {
+        return pos - 1;
+      }
+      pos = after;
+    }
+    return std::string_view::npos;
+  }
+
+  // Position of the '>' that closes the tag starting at pos, skipping quoted attribute values
+  auto tag_end(std::string_view xml, size_t pos) -> size_t {
+    char quote = 0;
+    for (; pos < xml.size(); pos++) {
+      if (quote) {
+        quote = xml[pos] == quote ? 0 : quote;
+      } else if (xml[pos] == '"' || xml[pos] == '\'') {
+        quote = xml[pos];
+      } else if (xml[pos] == '>') {
+        return pos;
+      }
+    }
+    return std::string_view::npos;
+  }
+
+  // Raw value of an attribute in a start tag
+  auto attribute(std::string_view tag, std::string_view name) -> std::optional<std::string_view> {
+    for (auto pos = tag.find(name); pos != std::string_view::npos; pos = tag.find(name, pos + name.size())) {
+      if (pos == 0 || !std::isspace(static_cast<unsigned char>(tag[pos - 1]))) {
+        continue;
+      }
+      auto value = tag.find_first_not_of(" \t\r\n", pos + name.size());
+      if (value == std::string_view::npos || tag[value] != '=') {
+        continue;
+      }
+      value = tag.find_first_not_of(" \t\r\n", value + 1);
+      if (value == std::string_view::npos || (tag[value] != '"' && tag[value] != '\'')) {
+        return std::nullopt;
+      }
+      auto end = tag.find(tag[value], value + 1);
+      if (end == std::string_view::npos) {
+        return std::nullopt;
+      }
+      return tag.substr(value + 1, end - value - 1);
+    }
+    return std::nullopt;
+  }
+
+  auto to_number(std::string_view value) -> uint64_t {
+    uint64_t number = 0;
+    std::from_chars(value.data(), value.data() + value.size(), number);
+    return number;
+  }
+
+  // An entry describes a different object if its location, hash or length changed
+  auto same_object(const LibFlute::FileDeliveryTable::FileEntry& a, const LibFlute::FileDeliveryTable::FileEntry& b) -> bool {
+    return a.content_location == b.content_location && a.content_md5 == b.content_md5
+        && a.content_length == b.content_length && a.fec_oti.transfer_length == b.fec_oti.transfer_length;
+  }
+
+  // Quick check of the raw attributes of a File start tag against a known entry. Escaped attribute values
+  // do not match, the element is parsed in full then.
+  auto same_object(std::string_view tag, const LibFlute::FileDeliveryTable::FileEntry& entry) -> bool {
+    auto content_length = to_number(attribute(tag, "Content-Length").value_or("0"));
+    auto transfer_length = attribute(tag, "Transfer-Length");
+    return attribute(tag, "Content-Location") == std::string_view(entry.content_location)
+        && attribute(tag, "Content-MD5").value_or("") == entry.content_md5
+        && content_length == entry.content_length
+        && (transfer_length ? to_number(*transfer_length) : content_length) == entry.fec_oti.transfer_length;
+  }
+}
+
 
 LibFlute::FileDeliveryTable::FileDeliveryTable(uint32_t instance_id, FecOti fec_oti)
   : _instance_id( instance_id )
@@ -32,169 +114,323 @@ LibFlute::FileDeliveryTable::FileDeliveryTable(uint32_t instance_id, FecOti fec_
 LibFlute::FileDeliveryTable::~FileDeliveryTable() {
 }
 
-LibFlute::FileDeliveryTable::FileDeliveryTable(uint32_t instance_id, char* buffer, size_t len) 
+LibFlute::FileDeliveryTable::FileDeliveryTable(uint32_t instance_id, const char* buffer, size_t len)
   : _instance_id( instance_id )
 {
-  tinyxml2::XMLDocument doc(true, tinyxml2::COLLAPSE_WHITESPACE);
-  doc.Parse(buffer, len);
-  auto fdt_instance = doc.FirstChildElement("FDT-Instance");
-  if (fdt_instance == nullptr) {
-    spdlog::info("[RECEIVE] ERROR: {}", buffer);
+  update(instance_id, buffer, len);
+}
+
+auto LibFlute::FileDeliveryTable::update(uint32_t instance_id, const char* buffer, size_t len) -> Changes
+{
+  ZoneScopedN("FileDeliveryTable::update");
+  Changes changes;
+  std::string_view xml(buffer, len);
+
+  // FDTs are repeated far more often than they change
+  auto content_hash = std::hash<std::string_view>{}(xml);
+  {
+    const std::lock_guard<LockableBase(std::mutex)> lock(_fdt_mutex);
+    if (content_hash == _content_hash && !_file_entries.empty()) {
+      _instance_id = instance_id;
+      changes.duplicate = true;
+      return changes;
+    }
+  }
+
+  auto instance_start = element_start(xml, "FDT-Instance", 0);
+  auto instance_end = instance_start == std::string_view::npos ? std::string_view::npos : tag_end(xml, instance_start);
+  if (instance_end == std::string_view::npos) {
+    spdlog::info("[RECEIVE] ERROR: {}", xml);
     throw "Missing FDT-Instance element";
   }
-  _expires = std::stoull(fdt_instance->Attribute("Expires"));
+  auto instance_tag = xml.substr(instance_start, instance_end - instance_start);
+  auto expires = attribute(instance_tag, "Expires");
+  if (!expires) {
+    throw "Missing Expires attribute on FDT-Instance element";
+  }
 
   spdlog::debug("[RECEIVE] Received new FDT with instance ID {}", instance_id);
   // spdlog::debug("[RECEIVE] FDT content:\n{}", std::string(buffer, len));
 
-  _global_fec_oti.encoding_id = FecScheme::CompactNoCode;
-  auto val = fdt_instance->Attribute("FEC-OTI-FEC-Encoding-ID");
-  if (val != nullptr) {
-    _global_fec_oti.encoding_id = static_cast<FecScheme>(strtoul(val, nullptr, 0));
+  FecOti global_fec_oti{};
+  global_fec_oti.encoding_id = FecScheme::CompactNoCode;
+  if (auto val = attribute(instance_tag, "FEC-OTI-FEC-Encoding-ID")) {
+    global_fec_oti.encoding_id = static_cast<FecScheme>(to_number(*val));
   }
-
-  _global_fec_oti.max_source_block_length = 0;
-  val = fdt_instance->Attribute("FEC-OTI-Maximum-Source-Block-Length");
-  if (val != nullptr) {
-    _global_fec_oti.max_source_block_length = strtoul(val, nullptr, 0);
+  if (auto val = attribute(instance_tag, "FEC-OTI-Maximum-Source-Block-Length")) {
+    global_fec_oti.max_source_block_length = to_number(*val);
   }
-
-  _global_fec_oti.encoding_symbol_length = 0;
-  val = fdt_instance->Attribute("FEC-OTI-Encoding-Symbol-Length");
-  if (val != nullptr) {
-    _global_fec_oti.encoding_symbol_length = strtoul(val, nullptr, 0);
+  if (auto val = attribute(instance_tag, "FEC-OTI-Encoding-Symbol-Length")) {
+    global_fec_oti.encoding_symbol_length = to_number(*val);
   }
 
-  for (auto file = fdt_instance->FirstChildElement("File"); 
-      file != nullptr; file = file->NextSiblingElement("File")) {
-    try {
-      // required attributes
-      auto toi_str = file->Attribute("TOI");
-      if (toi_str == nullptr) {
-        throw "Missing TOI attribute on File element";
+  // Only the TOI of every File element is read, elements that are new to the table are parsed in full
+  const std::lock_guard<LockableBase(std::mutex)> lock(_fdt_mutex);
+  std::vector<uint32_t> listed;
+  listed.reserve(_file_entries.size());
+  tinyxml2::XMLDocument doc(true, tinyxml2::COLLAPSE_WHITESPACE);
+  for (auto pos = element_start(xml, "File", instance_end), end = pos; pos != std::string_view::npos; pos = element_start(xml, "File", end)) {
+    end = tag_end(xml, pos);
+    if (end == std::string_view::npos) {
+      throw "Unterminated File element in FDT";
+    }
+    auto tag = xml.substr(pos, end - pos);
+    auto toi_str = attribute(tag, "TOI");
+    auto known = toi_str ? _file_entries.find(to_number(*toi_str)) : _file_entries.end();
+    if (known != _file_entries.end()) {
+      // Known entries stay listed, even if the element turns out to be malformed
+      listed.push_back(known->first);
+      if (same_object(tag, known->second)) {
+        continue;
       }
-      uint32_t toi = strtoull(toi_str, nullptr, 0);
+    }
 
-      auto content_location = file->Attribute("Content-Location");
-      if (content_location == nullptr) {
-        throw "Missing Content-Location attribute on File element";
+    // An empty element ends with its start tag, others at their end tag
+    if (xml[end - 1] != '/') {
+      auto close = xml.find("</File>", end);
+      if (close == std::string_view::npos) {
+        throw "Unterminated File element in FDT";
       }
-
-      uint32_t content_length = 0;
-      val = file->Attribute("Content-Length");
-      if (val != nullptr) {
-        content_length = strtoull(val, nullptr, 0);
+      end = close + 6;
+    }
+    try {
+      doc.Clear();
+      doc.Parse(xml.data() + pos, end + 1 - pos);
+      auto file = doc.FirstChildElement("File");
+      if (file == nullptr) {
+        throw "Malformed File element";
+      }
+      auto entry = parse_entry(file, global_fec_oti);
+      if (known != _file_entries.end()) {
+        if (entry.toi == known->first && same_object(entry, known->second)) {
+          delete entry.fec_transformer;
+          continue;
+        }
+        spdlog::debug("[RECEIVE] FDT entry for TOI {} changed from {} to {}", known->first, known->second.content_location, entry.content_location);
       }
+      changes.added.push_back(entry);
+    } catch (std::exception &ex) {
+      spdlog::warn("[RECEIVE] Failed to parse FDT file entry: {}", ex.what());
+    } catch (const char *errorMessage) {
+      spdlog::warn("[RECEIVE] Failed to parse FDT file entry: {}", errorMessage);
+    } catch (...)
+    {
+      spdlog::warn("[RECEIVE] Failed to parse FDT file entry: unknown error");
+    }
+  }
 
-      uint32_t transfer_length = 0;
-      val = file->Attribute("Transfer-Length");
-      if (val != nullptr) {
-        transfer_length = strtoull(val, nullptr, 0);
+  // Entries that are not listed anymore, only looked for when the counts do not add up
+  if (listed.size() != _file_entries.size()) {
+    std::sort(listed.begin(), listed.end());
+    for (auto it = _file_entries.begin(); it != _file_entries.end();) {
+      if (!std::binary_search(listed.begin(), listed.end(), it->first)) {
+        changes.removed.push_back(it->first);
+        it = _file_entries.erase(it);
       } else {
-        transfer_length = content_length;
+        ++it;
       }
+    }
+  }
+  for (const auto& entry : changes.added) {
+    _file_entries.insert_or_assign(entry.toi, entry);
+  }
+  _serialized = nullptr;
+  _instance_id = instance_id;
+  _global_fec_oti = global_fec_oti;
+  _expires = to_number(*expires);
+  _content_hash = content_hash;
+  return changes;
+}
 
-      auto content_md5 = file->Attribute("Content-MD5");
-      if (!content_md5) {
-        content_md5 = "";
-      }
+auto LibFlute::FileDeliveryTable::parse_entry(tinyxml2::XMLElement* file, const FecOti& global_fec_oti) const -> FileEntry
+{
+  // required attributes
+  const char* val = nullptr;
+  auto toi_str = file->Attribute("TOI");
+  if (toi_str == nullptr) {
+    throw "Missing TOI attribute on File element";
+  }
+  uint32_t toi = strtoull(toi_str, nullptr, 0);
 
-      auto content_type = file->Attribute("Content-Type");
-      if (!content_type) {
-        content_type = "";
-      }
+  auto content_location = file->Attribute("Content-Location");
+  if (content_location == nullptr) {
+    throw "Missing Content-Location attribute on File element";
+  }
 
-      auto encoding_id = _global_fec_oti.encoding_id;
-      val = file->Attribute("FEC-OTI-FEC-Encoding-ID");
-      if (val != nullptr) {
-        encoding_id = static_cast<FecScheme>(strtoul(val, nullptr, 0));
-      }
+  uint32_t content_length = 0;
+  val = file->Attribute("Content-Length");
+  if (val != nullptr) {
+    content_length = strtoull(val, nullptr, 0);
+  }
 
-      auto max_source_block_length = _global_fec_oti.max_source_block_length;
-      val = file->Attribute("FEC-OTI-Maximum-Source-Block-Length");
-      if (val != nullptr) {
-        max_source_block_length = strtoul(val, nullptr, 0);
-      }
+  uint32_t transfer_length = 0;
+  val = file->Attribute("Transfer-Length");
+  if (val != nullptr) {
+    transfer_length = strtoull(val, nullptr, 0);
+  } else {
+    transfer_length = content_length;
+  }
 
-      auto encoding_symbol_length = _global_fec_oti.encoding_symbol_length;
-      val = file->Attribute("FEC-OTI-Encoding-Symbol-Length");
-      if (val != nullptr) {
-        encoding_symbol_length = strtoul(val, nullptr, 0);
-      }
+  auto content_md5 = file->Attribute("Content-MD5");
+  if (!content_md5) {
+    content_md5 = "";
+  }
+
+  auto content_type = file->Attribute("Content-Type");
+  if (!content_type) {
+    content_type = "";
+  }
+
+  auto content_encoding = ContentEncoding::NONE;
+  val = file->Attribute("Content-Encoding");
+  if (val != nullptr) {
+    content_encoding = Compression::parse_encoding(val);
+    if (content_encoding == ContentEncoding::NONE && strcmp(val, "null") != 0) {
+      spdlog::warn("Unsupported Content-Encoding {} for TOI {}, the content is passed on as it is", val, toi);
+    }
+  }
+
+  auto encoding_id = global_fec_oti.encoding_id;
+  val = file->Attribute("FEC-OTI-FEC-Encoding-ID");
+  if (val != nullptr) {
+    encoding_id = static_cast<FecScheme>(strtoul(val, nullptr, 0));
+  }
+
+  auto max_source_block_length = global_fec_oti.max_source_block_length;
+  val = file->Attribute("FEC-OTI-Maximum-Source-Block-Length");
+  if (val != nullptr) {
+    max_source_block_length = strtoul(val, nullptr, 0);
+  }
+
+  auto encoding_symbol_length = global_fec_oti.encoding_symbol_length;
+  val = file->Attribute("FEC-OTI-Encoding-Symbol-Length");
+  if (val != nullptr) {
+    encoding_symbol_length = strtoul(val, nullptr, 0);
+  }
 
-      LibFlute::FecTransformer *fec_transformer = 0;
+  LibFlute::FecTransformer *fec_transformer = 0;
 
-      switch (encoding_id){
+  switch (encoding_id){
 #ifdef RAPTOR_ENABLED
-        case FecScheme::Raptor:
-          fec_transformer = new RaptorFEC(); // corresponding delete calls in Receiver.cpp and destuctor function
-          fec_transformer->set_max_source_block_length(max_source_block_length);
-          // spdlog::debug("[RECEIVE] Received FDT entry for a raptor encoded file");
-          break;
+    case FecScheme::Raptor:
+      fec_transformer = new RaptorFEC(); // corresponding delete calls in Receiver.cpp and destuctor function
+      fec_transformer->set_max_source_block_length(max_source_block_length);
+      // spdlog::debug("[RECEIVE] Received FDT entry for a raptor encoded file");
+      break;
 #endif
-        default:
-          break;
-      }
+    default:
+      break;
+  }
 
-      if (fec_transformer && !fec_transformer->parse_fdt_info(file, _global_fec_oti)) {
-        throw "Failed to parse fdt info for specific FEC data";
-      }
+  if (fec_transformer && !fec_transformer->parse_fdt_info(file, global_fec_oti)) {
+    throw "Failed to parse fdt info for specific FEC data";
+  }
 
-      uint32_t expires = 0;
-      auto cc = file->FirstChildElement("mbms2007:Cache-Control");
-      if (cc) {
-        auto expires_elem = cc->FirstChildElement("mbms2007:Expires");
-        if (expires_elem) {
-          expires = strtoul(expires_elem->GetText(), nullptr, 0);
-        }
+  uint32_t expires = 0;
+  auto cc = file->FirstChildElement("mbms2007:Cache-Control");
+  if (cc) {
+    auto expires_elem = cc->FirstChildElement("mbms2007:Expires");
+    if (expires_elem) {
+      expires = strtoul(expires_elem->GetText(), nullptr, 0);
+    }
+  }
+  uint64_t deadline = 0;
+  auto r = file->FirstChildElement("mbms2007:Recover");
+  if (r) {
+    auto d = r->FirstChildElement("mbms2007:Deadline");
+    if (d) {
+      deadline = strtoul(d->GetText(), nullptr, 0);
+    }
+  }
+
+  uint32_t stream_id = 0;
+  auto si = file->FirstChildElement("mbms2007:Stream");
+  if (si) {
+    auto si_id = si->FirstChildElement("mbms2007:Id");
+    if (si_id) {
+      stream_id = strtoul(si_id->GetText(), nullptr, 0);
+    }
+  }
+
+  FecOti fec_oti{
+    .encoding_id = (FecScheme)encoding_id,
+    .transfer_length =  transfer_length,
+    .encoding_symbol_length = encoding_symbol_length,
+    .max_source_block_length = max_source_block_length
+  };
+
+  FileEntry fe{
+    .toi = toi,
+    .stream_id = stream_id,
+    .content_location = std::string(content_location),
+    .content_length = content_length,
+    .content_md5 = std::string(content_md5),
+    .content_type = std::string(content_type),
+    .expires = expires,
+    .should_be_complete_at = deadline,
+    .fec_oti = fec_oti,
+    .fec_transformer = fec_transformer,
+    .content_encoding = content_encoding
+  };
+  return fe;
+}
+
+auto LibFlute::FileDeliveryTable::provisional_entry(uint32_t toi, const FecOti& fec_oti, ContentEncoding content_encoding) -> FileEntry
+{
+  if (fec_oti.transfer_length == 0 || fec_oti.encoding_symbol_length == 0 || fec_oti.max_source_block_length == 0) {
+    throw "Incomplete FEC OTI";
+  }
+
+  LibFlute::FecTransformer *fec_transformer = 0;
+  switch (fec_oti.encoding_id) {
+    case FecScheme::CompactNoCode:
+      break;
+#ifdef RAPTOR_ENABLED
+    case FecScheme::Raptor: {
+      // EXT_FTI only carries the number of source blocks, the block length follows from it for a single block
+      if (fec_oti.nof_source_blocks != 1) {
+        throw "Raptor encoded files of several source blocks need their FDT entry";
       }
-      uint64_t deadline = 0;
-      auto r = file->FirstChildElement("mbms2007:Recover");
-      if (r) {
-        auto d = r->FirstChildElement("mbms2007:Deadline");
-        if (d) {
-          deadline = strtoul(d->GetText(), nullptr, 0);
-        }
+      auto raptor = new RaptorFEC();
+      try {
+        raptor->parse_fti(fec_oti);
+      } catch (...) {
+        delete raptor;
+        throw;
       }
+      fec_transformer = raptor;
+      break;
+    }
+#endif
+    default:
+      throw "FEC scheme not supported or not yet implemented";
+  }
 
-      uint32_t stream_id = 0;
-      auto si = file->FirstChildElement("mbms2007:Stream");
-      if (si) {
-        auto si_id = si->FirstChildElement("mbms2007:Id");
-        if (si_id) {
-          stream_id = strtoul(si_id->GetText(), nullptr, 0);
-        }
-      }
+  return FileEntry{
+    .toi = toi,
+    .stream_id = 0,
+    .content_location = "",
+    .content_length = static_cast<uint32_t>(fec_oti.transfer_length),
+    .content_md5 = "",
+    .content_type = "",
+    .expires = 0,
+    .should_be_complete_at = 0,
+    .fec_oti = fec_oti,
+    .fec_transformer = fec_transformer,
+    .content_encoding = content_encoding
+  };
+}
 
-      FecOti fec_oti{
-        .encoding_id = (FecScheme)encoding_id,
-        .transfer_length =  transfer_length,
-        .encoding_symbol_length = encoding_symbol_length,
-        .max_source_block_length = max_source_block_length
-      };
-
-      FileEntry fe{
-        .toi = toi,
-        .stream_id = stream_id,
-        .content_location = std::string(content_location),
-        .content_length = content_length,
-        .content_md5 = std::string(content_md5),
-        .content_type = std::string(content_type),
-        .expires = expires,
-        .should_be_complete_at = deadline,
-        .fec_oti = fec_oti,
-        .fec_transformer = fec_transformer
-      };
-      _file_entries.push_back(fe);
-    } catch (std::exception &ex) {
-      spdlog::warn("[RECEIVE] Failed to parse FDT file entry: {}", ex.what());
-    } catch (const char *errorMessage) {
-      spdlog::warn("[RECEIVE] Failed to parse FDT file entry: {}", errorMessage);
-    } catch (...)
-    {
-      spdlog::warn("[RECEIVE] Failed to parse FDT file entry: unknown error");
-    }
+auto LibFlute::FileDeliveryTable::file_entries() const -> std::vector<FileEntry>
+{
+  const std::lock_guard<LockableBase(std::mutex)> lock(_fdt_mutex);
+  std::vector<FileEntry> entries;
+  entries.reserve(_file_entries.size());
+  for (const auto& entry : _file_entries) {
+    entries.push_back(entry.second);
   }
+  std::sort(entries.begin(), entries.end(), [](const auto& a, const auto& b) { return a.toi < b.toi; });
+  return entries;
 }
 
 auto LibFlute::FileDeliveryTable::add(FileEntry& fe) -> void
@@ -202,30 +438,38 @@ auto LibFlute::FileDeliveryTable::add(FileEntry& fe) -> void
   const std::lock_guard<LockableBase(std::mutex)> lock(_fdt_mutex);
   // Increment id and wrap around when greater than 0xFFFFF
   _instance_id = (_instance_id + 1) & ((1 << 20) - 1);
-  _file_entries.push_back(fe);
+  _file_entries.insert_or_assign(fe.toi, fe);
+  _serialized = nullptr;
 }
 
 auto LibFlute::FileDeliveryTable::remove(uint32_t toi) -> void
 {
   const std::lock_guard<LockableBase(std::mutex)> lock(_fdt_mutex);
 
-  for (auto it = _file_entries.begin(); it != _file_entries.end();) {
-    if (it->toi == toi) {
-      it = _file_entries.erase(it);
-    } else {
-      ++it;
-    }
-  }
+  _file_entries.erase(toi);
+  _serialized = nullptr;
   // Increment id and wrap around when greater than 0xFFFFF
   _instance_id = (_instance_id + 1) & ((1 << 20) - 1);
 }
 
-auto LibFlute::FileDeliveryTable::to_string() const -> std::string {
+auto LibFlute::FileDeliveryTable::serialized() const -> std::shared_ptr<const std::string> {
+  ZoneScopedN("FileDeliveryTable::serialized");
   const std::lock_guard<LockableBase(std::mutex)> lock(_fdt_mutex);
+  if (_serialized) {
+    return _serialized;
+  }
 
   // Create a local copy of the global fec oti
   // If there is only one file entry, use its fec_oti as the global one
-  auto current_global_fec_oti = _file_entries.size() != 1 ? _global_fec_oti : _file_entries[0].fec_oti;
+  auto current_global_fec_oti = _file_entries.size() != 1 ? _global_fec_oti : _file_entries.begin()->second.fec_oti;
+
+  // Entries are listed in TOI order
+  std::vector<const FileEntry*> entries;
+  entries.reserve(_file_entries.size());
+  for (const auto& entry : _file_entries) {
+    entries.push_back(&entry.second);
+  }
+  std::sort(entries.begin(), entries.end(), [](const auto* a, const auto* b) { return a->toi < b->toi; });
 
   tinyxml2::XMLDocument doc;
   doc.InsertFirstChild( doc.NewDeclaration() );
@@ -237,7 +481,8 @@ auto LibFlute::FileDeliveryTable::to_string() const -> std::string {
   root->SetAttribute("xmlns:mbms2007", "urn:3GPP:metadata:2007:MBMS:FLUTE:FDT");
   doc.InsertEndChild(root);
 
-  for (const auto& file : _file_entries) {
+  for (const auto* entry : entries) {
+    const auto& file = *entry;
     auto f = doc.NewElement("File");
     f->SetAttribute("TOI", file.toi);
     f->SetAttribute("Content-Location", file.content_location.c_str());
@@ -251,6 +496,9 @@ auto LibFlute::FileDeliveryTable::to_string() const -> std::string {
     if (file.content_type.length() > 0) {
         f->SetAttribute("Content-Type", file.content_type.c_str());
     }
+    if (file.content_encoding != ContentEncoding::NONE) {
+      f->SetAttribute("Content-Encoding", Compression::encoding_name(file.content_encoding).c_str());
+    }
     if(file.fec_transformer) {
       file.fec_transformer->add_fdt_info(f, current_global_fec_oti);
     } else {
@@ -292,5 +540,6 @@ auto LibFlute::FileDeliveryTable::to_string() const -> std::string {
 
   tinyxml2::XMLPrinter printer;
   doc.Print(&printer);
-  return std::string(printer.CStr());
+  _serialized = std::make_shared<const std::string>(printer.CStr(), printer.CStrSize() - 1);
+  return _serialized;
 }
@@ -27,6 +27,7 @@
 #include "Utils/base64.h"
 #include "spdlog/spdlog.h"
 #include "Metric/Metrics.h"
+#include "Metric/LifecycleTracer.h"
 
 #include "public/tracy/Tracy.hpp"
 
@@ -212,6 +213,7 @@ auto LibFlute::FileStream::put_symbol( const LibFlute::EncodingSymbol& symbol )
 
     symbol.decode_to(target_symbol.data, target_symbol.length);
     target_symbol.complete = true;
+    _symbols_received.fetch_add(1, std::memory_order_relaxed);
     target_symbol.has_content = true; // The buffer of this symbol has content now
     if (_meta.fec_transformer) {
       auto error_occured = false;
@@ -235,7 +237,14 @@ auto LibFlute::FileStream::put_symbol( const LibFlute::EncodingSymbol& symbol )
     }
 
     if (target_symbol.complete) {
+      auto block_was_complete = source_block.complete;
       check_source_block_completion(source_block);
+      if (!block_was_complete && source_block.complete) {
+        LibFlute::Metric::LifecycleTracer::getInstance().record(LibFlute::Metric::LifecycleTracer::Event::BlockDecoded, _tsi, _meta.toi, symbol.source_block_number());
+        if (_block_cb) {
+          _block_cb(*this, symbol.source_block_number());
+        }
+      }
       check_file_completion();
 
       // Print the content of this symbol as a chars, replace non alphanumeric characters with dots
@@ -43,45 +43,19 @@ LibFlute::AlcPacket::AlcPacket(char* data, size_t len)
   if (_lct_header.half_word_flag == 0 && _lct_header.tsi_flag == 0) {
     throw "TSI field not present";
   }
-  auto tsi_shift = 0;
-  if(_lct_header.half_word_flag == 1) {
-    _tsi = ntohs(*(uint16_t*)hdr_ptr);
-    tsi_shift = 16;
-    hdr_ptr += 2;
-  } 
-  if(_lct_header.tsi_flag == 1) {
-    _tsi |= ntohl(*(uint32_t*)hdr_ptr) << tsi_shift;
-    hdr_ptr += 4;
-  } 
-
   if ( _lct_header.close_session_flag == 0 && _lct_header.half_word_flag == 0 && _lct_header.toi_flag == 0) {
     throw "TOI field not present";
   }
-  auto toi_shift = 0;
-  if(_lct_header.half_word_flag == 1) {
-    _toi = ntohs(*(uint16_t*)hdr_ptr);
-    toi_shift = 16;
-    hdr_ptr += 2;
-  } 
-  switch(_lct_header.toi_flag) {
-      case 0: break;
-      case 1: 
-        _toi |= ntohl(*(uint32_t*)hdr_ptr) << toi_shift;
-        hdr_ptr += 4;
-        break;
-      case 2:
-        if (toi_shift > 0) {
-          throw "TOI fields over 64 bits in length are not supported";
-        } else {
-          _toi = ntohl(*(uint32_t*)hdr_ptr);
-          hdr_ptr += 4;
-          _toi |= (uint64_t)(ntohl(*(uint32_t*)hdr_ptr)) << 32;
-          hdr_ptr += 4;
-        }
-        break;
-      default:
-        throw "TOI fields over 64 bits in length are not supported";
-  } 
+  // RFC 5651 5.1: the TSI is 32*S+16*H bits and the TOI 32*O+16*H bits long
+  auto tsi_length = tsi_field_length(_lct_header.tsi_flag, _lct_header.half_word_flag);
+  auto toi_length = toi_field_length(_lct_header.toi_flag, _lct_header.half_word_flag);
+  if (len < 8 + tsi_length + toi_length) {
+    throw "Packet too short";
+  }
+  _tsi = read_id_field(hdr_ptr, tsi_length);
+  hdr_ptr += tsi_length;
+  _toi = read_id_field(hdr_ptr, toi_length);
+  hdr_ptr += toi_length;
 
   switch (_lct_header.codepoint) {
     case 0:
@@ -104,27 +78,53 @@ LibFlute::AlcPacket::AlcPacket(char* data, size_t len)
   auto ext_header_len = (_lct_header.lct_header_len - expected_header_len) * 4;
 
   while (ext_header_len > 0) {
+    char* ext_ptr = hdr_ptr;
     uint8_t het = *hdr_ptr;
     hdr_ptr += 1;
     uint8_t hel = 0;
     if (het < 128) {
       hel = *hdr_ptr;
       hdr_ptr += 1;
+      if (hel * 4 > ext_header_len) {
+        throw "Header extension longer than the LCT header";
+      }
     }
 
     switch ((AlcPacket::HeaderExtension)het) {
       case EXT_NOP: 
-      case EXT_AUTH: 
-      case EXT_TIME:  {
-                        hdr_ptr += 3;
-                        break; // ignored
-                      }
+      case EXT_AUTH: {
+                       break; // ignored
+                     }
+      case EXT_TIME: {
+                       // RFC 5651 5.2.2: the Use field flags the time values that follow, in this order
+                       uint16_t use = ntohs(*(uint16_t*)hdr_ptr);
+                       hdr_ptr += 2;
+                       auto nof_values = __builtin_popcount(use & (TIME_SCT_HIGH | TIME_SCT_LOW | TIME_ERT | TIME_SLC));
+                       if (hel < 1 + nof_values) {
+                         throw "Invalid length for EXT_TIME header extension";
+                       }
+                       if (use & TIME_SCT_HIGH) {
+                         _sender_time.ntp_timestamp = (uint64_t)(ntohl(*(uint32_t*)hdr_ptr)) << 32;
+                         hdr_ptr += 4;
+                         _has_sender_time = true;
+                       }
+                       if (use & TIME_SCT_LOW) {
+                         _sender_time.ntp_timestamp |= ntohl(*(uint32_t*)hdr_ptr);
+                         hdr_ptr += 4;
+                       }
+                       if (use & TIME_ERT) {
+                         _sender_time.expected_residual_time = ntohl(*(uint32_t*)hdr_ptr);
+                         _sender_time.has_expected_residual_time = true;
+                         hdr_ptr += 4;
+                       }
+                       break; // SLC is ignored
+                     }
       case EXT_FTI: {
+                      if (hel != 4) {
+                        throw "Invalid length for EXT_FTI header extension";
+                      }
                       switch (_fec_oti.encoding_id) {
                         case FecScheme::CompactNoCode:
-                          if (hel != 4) {
-                            throw "Invalid length for EXT_FTI header extension";
-                          }
                           _fec_oti.transfer_length = (uint64_t)(ntohs(*(uint16_t*)hdr_ptr)) << 32;
                           hdr_ptr += 2;
                           _fec_oti.transfer_length |= (uint64_t)(ntohl(*(uint32_t*)hdr_ptr));
@@ -135,16 +135,33 @@ LibFlute::AlcPacket::AlcPacket(char* data, size_t len)
                           _fec_oti.max_source_block_length = ntohl(*(uint32_t*)hdr_ptr);
                           hdr_ptr += 4;
                           break;
-                        case FecScheme::Raptor:
-                            // Our transmitter currently only supports encoding id in FDT.
-                            // No need to parse this header extension as long as the transmitter does not support it anyway.
-                            spdlog::warn("Raptor FEC support in EXT_FTI header extension is still in progress");
-                            throw "Raptor FEC support in EXT_FTI header extension is still in progress";
-                            break;
-                          default:
-                            throw "Unsupported FEC scheme";
-                            break;
+                        case FecScheme::Raptor: {
+                          // RFC 5053 3.2.3: F (40 bits), reserved (8 bits), T (16 bits), Z (16 bits), N (8 bits), Al (8 bits)
+                          _fec_oti.transfer_length = (uint64_t)(ntohl(*(uint32_t*)hdr_ptr)) << 8;
+                          hdr_ptr += 4;
+                          _fec_oti.transfer_length |= (uint8_t)*hdr_ptr;
+                          hdr_ptr += 2; // and reserved
+                          _fec_oti.encoding_symbol_length = ntohs(*(uint16_t*)hdr_ptr);
+                          hdr_ptr += 2;
+                          _fec_oti.nof_source_blocks = ntohs(*(uint16_t*)hdr_ptr);
+                          hdr_ptr += 2;
+                          _fec_oti.nof_sub_blocks = *hdr_ptr;
+                          hdr_ptr += 1;
+                          _fec_oti.symbol_alignment = *hdr_ptr;
+                          hdr_ptr += 1;
+                          if (_fec_oti.encoding_symbol_length == 0 || _fec_oti.nof_source_blocks == 0) {
+                            throw "Invalid FEC OTI in EXT_FTI header extension";
+                          }
+                          // The source blocks hold the same number of symbols, except for the last one
+                          auto nof_symbols = (_fec_oti.transfer_length + _fec_oti.encoding_symbol_length - 1) / _fec_oti.encoding_symbol_length;
+                          _fec_oti.max_source_block_length = (nof_symbols + _fec_oti.nof_source_blocks - 1) / _fec_oti.nof_source_blocks;
+                          break;
+                        }
+                        default:
+                          throw "Unsupported FEC scheme";
+                          break;
                       }
+                      _has_fti = true;
                       break; 
                     }
       case EXT_FDT: {
@@ -171,8 +188,13 @@ LibFlute::AlcPacket::AlcPacket(char* data, size_t len)
                      }
     }
 
-    ext_header_len -= 4;
-    ext_header_len -= hel * 4;
+    // Extensions below 128 carry their length in words (HEL), the others are one word long
+    size_t ext_len = het < 128 ? hel * 4 : 4;
+    if (ext_len == 0) {
+      throw "Invalid header extension length";
+    }
+    hdr_ptr = ext_ptr + ext_len;
+    ext_header_len -= ext_len;
   }
 
   // spdlog::debug("AlcPacket::AlcPacket() {}", _toi);
@@ -192,48 +214,123 @@ LibFlute::AlcPacket::AlcPacket(char* data, size_t len)
   }
 }
 
-LibFlute::AlcPacket::AlcPacket(uint16_t tsi, uint16_t toi, LibFlute::FecOti fec_oti, const std::vector<LibFlute::EncodingSymbol>& symbols, size_t max_size, uint32_t fdt_instance_id)
-  : _fec_oti(fec_oti)
+LibFlute::AlcPacket::AlcPacket(uint64_t tsi, uint64_t toi, LibFlute::FecOti fec_oti, const std::vector<LibFlute::EncodingSymbol>& symbols, size_t max_size, uint32_t fdt_instance_id,
+    ContentEncoding content_encoding, bool with_fti, const SenderTime& sender_time)
+  : _content_encoding(content_encoding)
+  , _fec_oti(fec_oti)
+  , _has_fti(with_fti || toi == 0)
+  , _sender_time(sender_time)
+  , _has_sender_time(sender_time.ntp_timestamp != 0)
 {
   ZoneScopedN("AlcPacket::AlcPacket");
-  auto lct_header_len = 3;
+  auto max_packet_length = max_length(tsi, toi, max_size);
+
+  _buffer = (char*)calloc(max_packet_length, sizeof(char));
+  //TracyAlloc(_buffer, max_packet_length);
+
+  _len = serialize(_buffer, tsi, toi, fec_oti, symbols, max_size, fdt_instance_id, content_encoding, with_fti, sender_time);
+}
+
+auto LibFlute::AlcPacket::max_length(uint64_t tsi, uint64_t toi, size_t max_size) -> size_t
+{
+  auto lct_header_len = 2 + id_fields_length(tsi, toi) / 4;
   if (toi == 0) { // Add extensions for FDT
     lct_header_len += 5;
+  } else {
+    lct_header_len += 4; // EXT_FTI if it is sent in-band, or EXT_TIME
   }
+  lct_header_len += 1; // EXT_CENC, if the object has a content encoding
 
-  auto max_packet_length = max_size +
+  return max_size +
     static_cast<long>(lct_header_len) * 4
     + 4 ;
+}
 
-  _buffer = (char*)calloc(max_packet_length, sizeof(char));
-  //TracyAlloc(_buffer, max_packet_length);
+auto LibFlute::AlcPacket::peek(const char* data, size_t len, uint64_t& toi, uint16_t& source_block_number) -> bool
+{
+  lct_header_t lct_header;
+  if (len < 8) {
+    return false;
+  }
+  std::memcpy(&lct_header, data, 4);
+  size_t header_len = lct_header.lct_header_len * 4;
+  // The FEC payload ID of both supported schemes starts with a 16 bit source block number
+  if (lct_header.version != 1 || lct_header.congestion_control_flag != 0 || len < header_len + 2) {
+    return false;
+  }
+
+  // Same layout as in the constructor
+  auto tsi_length = tsi_field_length(lct_header.tsi_flag, lct_header.half_word_flag);
+  auto toi_length = toi_field_length(lct_header.toi_flag, lct_header.half_word_flag);
+  if (8 + tsi_length + toi_length > header_len) {
+    return false;
+  }
+  try {
+    toi = read_id_field(data + 8 + tsi_length, toi_length);
+  } catch (const char*) {
+    return false;
+  }
+  source_block_number = ntohs(*(uint16_t*)(data + header_len));
+  return true;
+}
+
+auto LibFlute::AlcPacket::serialize(char* buffer, uint64_t tsi, uint64_t toi, const LibFlute::FecOti& fec_oti, const std::vector<LibFlute::EncodingSymbol>& symbols, size_t max_size, uint32_t fdt_instance_id,
+    ContentEncoding content_encoding, bool with_fti, const SenderTime& sender_time) -> size_t
+{
+  ZoneScopedN("AlcPacket::serialize");
+  auto with_time = sender_time.ntp_timestamp != 0;
+  if (with_time && (toi == 0 || with_fti)) {
+    throw "EXT_TIME does not fit in a packet with EXT_FTI";
+  }
+  uint8_t tsi_flag = 0;
+  uint8_t toi_flag = 0;
+  uint8_t half_word_flag = 0;
+  id_field_flags(tsi, toi, tsi_flag, toi_flag, half_word_flag);
+  auto tsi_length = tsi_field_length(tsi_flag, half_word_flag);
+  auto toi_length = toi_field_length(toi_flag, half_word_flag);
+
+  auto lct_header_len = 2 + (tsi_length + toi_length) / 4;
+  if (toi == 0) { // Add extensions for FDT
+    lct_header_len += 5;
+  } else if (with_fti) {
+    lct_header_len += 4;
+  } else if (with_time) {
+    lct_header_len += sender_time.has_expected_residual_time ? 4 : 3;
+  }
+  if (content_encoding != ContentEncoding::NONE) {
+    lct_header_len += 1;
+  }
 
-  auto lct_header = (lct_header_t*)_buffer;
+  // The header is built from bit fields, start from zero
+  memset(buffer, 0, 4UL * lct_header_len);
+
+  auto lct_header = (lct_header_t*)buffer;
 
   lct_header->version = 1;
-  lct_header->half_word_flag = 1;
+  lct_header->tsi_flag = tsi_flag;
+  lct_header->toi_flag = toi_flag;
+  lct_header->half_word_flag = half_word_flag;
   lct_header->lct_header_len = lct_header_len;
   lct_header->codepoint = (uint8_t) fec_oti.encoding_id;
-  if (_fec_oti.encoding_id == LibFlute::FecScheme::CompactNoCode) {
+  if (fec_oti.encoding_id == LibFlute::FecScheme::CompactNoCode) {
     lct_header->codepoint = 0;
-  } else if (_fec_oti.encoding_id == LibFlute::FecScheme::Raptor) {
+  } else if (fec_oti.encoding_id == LibFlute::FecScheme::Raptor) {
     lct_header->codepoint = 1;
   } else {
     throw "Unsupported FEC scheme";
   }
-  auto hdr_ptr = _buffer + 4;
-  auto payload_ptr = _buffer + 4UL * lct_header_len;
+  auto hdr_ptr = buffer + 4;
+  auto payload_ptr = buffer + 4UL * lct_header_len;
 
-  auto payload_size = EncodingSymbol::to_payload(symbols, payload_ptr, max_size, _fec_oti, ContentEncoding::NONE);
-  _len = 4L * lct_header_len + payload_size;
+  auto payload_size = EncodingSymbol::to_payload(symbols, payload_ptr, max_size, fec_oti);
   
   hdr_ptr += 4; // CCI = 0 (no congestion control) [32 bits of 0]
   
-  *((uint16_t*)hdr_ptr) = htons(tsi);
-  hdr_ptr += 2;
-  
-  *((uint16_t*)hdr_ptr) = htons(toi);
-  hdr_ptr += 2;
+  write_id_field(hdr_ptr, tsi, tsi_length);
+  hdr_ptr += tsi_length;
+
+  write_id_field(hdr_ptr, toi, toi_length);
+  hdr_ptr += toi_length;
 
   if (toi == 0) { // Add extensions for FDT
     *((uint8_t*)hdr_ptr) = EXT_FDT;
@@ -243,20 +340,137 @@ LibFlute::AlcPacket::AlcPacket(uint16_t tsi, uint16_t toi, LibFlute::FecOti fec_
     hdr_ptr += 1;
     *((uint16_t*)hdr_ptr) = htons(fdt_instance_id & 0x0000FFFF);
     hdr_ptr += 2;
+  }
+  if (toi == 0 || with_fti) {
+    write_fti(hdr_ptr, fec_oti);
+    hdr_ptr += 16;
+  } else if (with_time) {
+    write_time(hdr_ptr, sender_time);
+    hdr_ptr += sender_time.has_expected_residual_time ? 16 : 12;
+  }
 
-    *((uint8_t*)hdr_ptr) = EXT_FTI;
-    hdr_ptr += 1;
-    *((uint8_t*)hdr_ptr) = 4; // HEL
+  if (content_encoding != ContentEncoding::NONE) {
+    *((uint8_t*)hdr_ptr) = EXT_CENC;
     hdr_ptr += 1;
-    *((uint16_t*)hdr_ptr) = htons((_fec_oti.transfer_length & 0x00FF0000) >> 32);
-    hdr_ptr += 2;
-    *((uint32_t*)hdr_ptr) = htonl(_fec_oti.transfer_length & 0x0000FFFF);
-    hdr_ptr += 4;
-    hdr_ptr += 2; // reserved
-    *((uint16_t*)hdr_ptr) = htons(_fec_oti.encoding_symbol_length);
-    hdr_ptr += 2;
-    *((uint32_t*)hdr_ptr) = htonl(_fec_oti.max_source_block_length);
-    hdr_ptr += 4;
+    switch (content_encoding) {
+      case ContentEncoding::ZLIB: *((uint8_t*)hdr_ptr) = 1; break;
+      case ContentEncoding::DEFLATE: *((uint8_t*)hdr_ptr) = 2; break;
+      case ContentEncoding::GZIP: *((uint8_t*)hdr_ptr) = 3; break;
+      default: break;
+    }
+    hdr_ptr += 3; // CENC and 16 reserved bits
+  }
+
+  return 4UL * lct_header_len + payload_size;
+}
+
+auto LibFlute::AlcPacket::id_field_flags(uint64_t tsi, uint64_t toi, uint8_t& tsi_flag, uint8_t& toi_flag, uint8_t& half_word_flag) -> void
+{
+  auto fits = [](uint64_t value, size_t length) { return length >= 8 || value < (1ULL << (8 * length)); };
+  // The half word flag applies to both fields. Pick the shortest header, 16 bit fields when both are equally long.
+  size_t best_length = SIZE_MAX;
+  for (uint8_t h : {1, 0}) {
+    uint8_t s = h == 1 && fits(tsi, 2) ? 0 : 1;
+    uint8_t o = h == 1 && fits(toi, 2) ? 0 : (fits(toi, toi_field_length(1, h)) ? 1 : 2);
+    if (!fits(tsi, tsi_field_length(s, h))) {
+      continue;
+    }
+    auto length = tsi_field_length(s, h) + toi_field_length(o, h);
+    if (length < best_length) {
+      best_length = length;
+      tsi_flag = s;
+      toi_flag = o;
+      half_word_flag = h;
+    }
+  }
+  if (best_length == SIZE_MAX) {
+    throw "TSI values over 48 bits are not supported";
+  }
+}
+
+auto LibFlute::AlcPacket::id_fields_length(uint64_t tsi, uint64_t toi) -> size_t
+{
+  uint8_t tsi_flag = 0;
+  uint8_t toi_flag = 0;
+  uint8_t half_word_flag = 0;
+  id_field_flags(tsi, toi, tsi_flag, toi_flag, half_word_flag);
+  return tsi_field_length(tsi_flag, half_word_flag) + toi_field_length(toi_flag, half_word_flag);
+}
+
+auto LibFlute::AlcPacket::read_id_field(const char* ptr, size_t length) -> uint64_t
+{
+  uint64_t value = 0;
+  for (size_t i = 0; i < length; i++) {
+    if (value >> 56) {
+      throw "TSI and TOI values over 64 bits are not supported";
+    }
+    value = value << 8 | static_cast<uint8_t>(ptr[i]);
+  }
+  return value;
+}
+
+auto LibFlute::AlcPacket::write_id_field(char* ptr, uint64_t value, size_t length) -> void
+{
+  // Big endian, fields longer than 64 bits start with zeros
+  for (size_t i = length; i > 0; i--) {
+    ptr[i - 1] = length - i < 8 ? static_cast<char>(value >> (8 * (length - i))) : 0;
+  }
+}
+
+auto LibFlute::AlcPacket::write_fti(char* hdr_ptr, const LibFlute::FecOti& fec_oti) -> void
+{
+  // The buffer was zeroed, reserved fields are left as they are
+  *((uint8_t*)hdr_ptr) = EXT_FTI;
+  hdr_ptr += 1;
+  *((uint8_t*)hdr_ptr) = 4; // HEL
+  hdr_ptr += 1;
+  switch (fec_oti.encoding_id) {
+    case FecScheme::CompactNoCode:
+      // RFC 5445 3.4.1: transfer length (48 bits), reserved (16 bits), E (16 bits), maximum source block length (32 bits)
+      *((uint16_t*)hdr_ptr) = htons((fec_oti.transfer_length >> 32) & 0xFFFF);
+      hdr_ptr += 2;
+      *((uint32_t*)hdr_ptr) = htonl(fec_oti.transfer_length & 0xFFFFFFFF);
+      hdr_ptr += 4;
+      hdr_ptr += 2; // reserved
+      *((uint16_t*)hdr_ptr) = htons(fec_oti.encoding_symbol_length);
+      hdr_ptr += 2;
+      *((uint32_t*)hdr_ptr) = htonl(fec_oti.max_source_block_length);
+      break;
+    case FecScheme::Raptor:
+      // RFC 5053 3.2.3: F (40 bits), reserved (8 bits), T (16 bits), Z (16 bits), N (8 bits), Al (8 bits), padded to 4 words
+      *((uint32_t*)hdr_ptr) = htonl((fec_oti.transfer_length >> 8) & 0xFFFFFFFF);
+      hdr_ptr += 4;
+      *((uint8_t*)hdr_ptr) = fec_oti.transfer_length & 0xFF;
+      hdr_ptr += 2; // and reserved
+      *((uint16_t*)hdr_ptr) = htons(fec_oti.encoding_symbol_length);
+      hdr_ptr += 2;
+      *((uint16_t*)hdr_ptr) = htons(fec_oti.nof_source_blocks);
+      hdr_ptr += 2;
+      *((uint8_t*)hdr_ptr) = fec_oti.nof_sub_blocks;
+      hdr_ptr += 1;
+      *((uint8_t*)hdr_ptr) = fec_oti.symbol_alignment;
+      break;
+    default:
+      throw "Unsupported FEC scheme";
+  }
+}
+
+auto LibFlute::AlcPacket::write_time(char* hdr_ptr, const SenderTime& sender_time) -> void
+{
+  // RFC 5651 5.2.2: SCT-High and SCT-Low, followed by ERT if it is known
+  uint16_t use = TIME_SCT_HIGH | TIME_SCT_LOW | (sender_time.has_expected_residual_time ? TIME_ERT : 0);
+  *((uint8_t*)hdr_ptr) = EXT_TIME;
+  hdr_ptr += 1;
+  *((uint8_t*)hdr_ptr) = sender_time.has_expected_residual_time ? 4 : 3; // HEL
+  hdr_ptr += 1;
+  *((uint16_t*)hdr_ptr) = htons(use);
+  hdr_ptr += 2;
+  *((uint32_t*)hdr_ptr) = htonl(sender_time.ntp_timestamp >> 32);
+  hdr_ptr += 4;
+  *((uint32_t*)hdr_ptr) = htonl(sender_time.ntp_timestamp & 0xFFFFFFFF);
+  hdr_ptr += 4;
+  if (sender_time.has_expected_residual_time) {
+    *((uint32_t*)hdr_ptr) = htonl(sender_time.expected_residual_time);
   }
 }
 
@@ -0,0 +1,150 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#include "Packet/AlcParkingBuffer.h"
+
+#include "spdlog/spdlog.h"
+#include "Metric/Metrics.h"
+
+#include "public/tracy/Tracy.hpp"
+
+namespace {
+  const char* drop_metric_names[] = {
+    "alcs_parked_dropped_toi_limit",
+    "alcs_parked_dropped_budget",
+    "alcs_parked_dropped_toi_count",
+    "alcs_parked_dropped_expired",
+    "alcs_parked_dropped_discarded",
+  };
+}
+
+LibFlute::AlcParkingBuffer::AlcParkingBuffer(const Limits& limits)
+    : _limits(limits)
+{
+}
+
+LibFlute::AlcParkingBuffer::AlcParkingBuffer()
+    : AlcParkingBuffer(Limits())
+{
+}
+
+auto LibFlute::AlcParkingBuffer::park(std::shared_ptr<AlcPacket> alc_ptr) -> bool
+{
+  ZoneScopedN("AlcParkingBuffer::park");
+  auto toi = alc_ptr->toi();
+  auto bytes = alc_ptr->size();
+
+  auto backlog = _backlogs.find(toi);
+  auto backlog_bytes = backlog == _backlogs.end() ? 0 : backlog->second.bytes;
+  if (backlog_bytes + bytes > _limits.max_bytes_per_toi || bytes > _limits.max_bytes) {
+    _dropped[static_cast<size_t>(DropReason::ToiLimit)]++;
+    LibFlute::Metric::Metrics::getInstance().getOrCreateCounter(drop_metric_names[static_cast<size_t>(DropReason::ToiLimit)])->Increment();
+    spdlog::trace("[RECEIVE] Not parking packet for TOI {}, its backlog is full", toi);
+    return false;
+  }
+
+  // Make room by evicting the backlogs of other TOIs, oldest first
+  while (_bytes + bytes > _limits.max_bytes || (backlog == _backlogs.end() && _backlogs.size() >= _limits.max_tois)) {
+    auto reason = _bytes + bytes > _limits.max_bytes ? DropReason::Budget : DropReason::ToiCount;
+    auto oldest = _order.empty() ? _backlogs.end() : _backlogs.find(_order.front());
+    if (oldest == _backlogs.end() || oldest == backlog) {
+      // Nothing else left to evict, the limits leave no room for this packet
+      _dropped[static_cast<size_t>(reason)]++;
+      LibFlute::Metric::Metrics::getInstance().getOrCreateCounter(drop_metric_names[static_cast<size_t>(reason)])->Increment();
+      return false;
+    }
+    drop(oldest, reason);
+  }
+
+  if (backlog == _backlogs.end()) {
+    backlog = _backlogs.emplace(toi, Backlog()).first;
+    backlog->second.parked_at = std::chrono::steady_clock::now();
+    backlog->second.order = _order.insert(_order.end(), toi);
+  }
+  backlog->second.packets.push_back(std::move(alc_ptr));
+  backlog->second.bytes += bytes;
+  _packets++;
+  _bytes += bytes;
+
+  LibFlute::Metric::Metrics::getInstance().getOrCreateGauge("alcs_buffered")->Increment();
+  update_metrics();
+  return true;
+}
+
+auto LibFlute::AlcParkingBuffer::claim(uint64_t toi) -> std::vector<std::shared_ptr<AlcPacket>>
+{
+  ZoneScopedN("AlcParkingBuffer::claim");
+  auto backlog = _backlogs.find(toi);
+  if (backlog == _backlogs.end()) {
+    return {};
+  }
+  auto packets = std::move(backlog->second.packets);
+  _packets -= packets.size();
+  _bytes -= backlog->second.bytes;
+  _order.erase(backlog->second.order);
+  _backlogs.erase(backlog);
+  update_metrics();
+  return packets;
+}
+
+auto LibFlute::AlcParkingBuffer::discard(uint64_t toi) -> size_t
+{
+  auto backlog = _backlogs.find(toi);
+  if (backlog == _backlogs.end()) {
+    return 0;
+  }
+  auto dropped = drop(backlog, DropReason::Discarded);
+  update_metrics();
+  return dropped;
+}
+
+auto LibFlute::AlcParkingBuffer::evict_expired() -> size_t
+{
+  ZoneScopedN("AlcParkingBuffer::evict_expired");
+  auto now = std::chrono::steady_clock::now();
+  size_t dropped = 0;
+  // The order is by parking time, so only the front has to be looked at
+  while (!_order.empty()) {
+    auto oldest = _backlogs.find(_order.front());
+    if (now - oldest->second.parked_at <= _limits.max_age) {
+      break;
+    }
+    spdlog::debug("[RECEIVE] Dropping {} parked packets for TOI {}, no FDT entry arrived in time", oldest->second.packets.size(), oldest->first);
+    dropped += drop(oldest, DropReason::Expired);
+  }
+  if (dropped > 0) {
+    update_metrics();
+  }
+  return dropped;
+}
+
+auto LibFlute::AlcParkingBuffer::drop(std::unordered_map<uint64_t, Backlog>::iterator backlog, DropReason reason) -> size_t
+{
+  auto dropped = backlog->second.packets.size();
+  _dropped[static_cast<size_t>(reason)] += dropped;
+  LibFlute::Metric::Metrics::getInstance().getOrCreateCounter(drop_metric_names[static_cast<size_t>(reason)])->Increment(dropped);
+  _packets -= dropped;
+  _bytes -= backlog->second.bytes;
+  _order.erase(backlog->second.order);
+  _backlogs.erase(backlog);
+  return dropped;
+}
+
+auto LibFlute::AlcParkingBuffer::update_metrics() -> void
+{
+  LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
+  metricsInstance.getOrCreateGauge("alcs_buffer_size")->Set(_packets);
+  metricsInstance.getOrCreateGauge("alcs_parked_bytes")->Set(_bytes);
+}
@@ -23,7 +23,7 @@
 
 #include "public/tracy/Tracy.hpp"
 
-auto LibFlute::EncodingSymbol::from_payload(char* encoded_data, size_t data_len, const FecOti& fec_oti, ContentEncoding encoding) -> std::vector<EncodingSymbol> 
+auto LibFlute::EncodingSymbol::from_payload(char* encoded_data, size_t data_len, const FecOti& fec_oti) -> std::vector<EncodingSymbol> 
 {
   ZoneScopedN("EncodingSymbol::from_payload()");
   auto source_block_number = 0;
@@ -35,10 +35,6 @@ auto LibFlute::EncodingSymbol::from_payload(char* encoded_data, size_t data_len,
     return symbols;
   }
 
-  if (encoding != ContentEncoding::NONE) {
-    throw "Only unencoded content is supported";
-  }
-  
   switch (fec_oti.encoding_id) {
     case FecScheme::CompactNoCode:
     case FecScheme::Raptor:
@@ -69,7 +65,7 @@ auto LibFlute::EncodingSymbol::from_payload(char* encoded_data, size_t data_len,
   return symbols;
 }
 
-auto LibFlute::EncodingSymbol::to_payload(const std::vector<EncodingSymbol>& symbols, char* encoded_data, size_t data_len, const FecOti& fec_oti, ContentEncoding encoding) -> size_t
+auto LibFlute::EncodingSymbol::to_payload(const std::vector<EncodingSymbol>& symbols, char* encoded_data, size_t data_len, const FecOti& fec_oti) -> size_t
 {
   ZoneScopedN("EncodingSymbol::to_payload()");
   size_t len = 0;
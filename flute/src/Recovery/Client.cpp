@@ -87,33 +87,7 @@ auto LibFlute::Client::start() -> void {
           spdlog::trace("[FETCHER] Retrieved {} bytes from fake network socket", result.size());
 
           io_service_.post([&, result]() {
-            const char* delimiter = "\r\n\r\n";
-            size_t pos = 0;
-            size_t start = 0;
-
-            while ((pos = result.find(delimiter, start)) != std::string::npos) {
-                size_t length = pos - start;
-                char* buffer = new char[length + 1];
-                std::memcpy(buffer, result.c_str() + start, length);
-                buffer[length] = '\0';
-
-                _content_callback(buffer, length + 4);
-
-                delete[] buffer;
-
-                start = pos + strlen(delimiter);
-            }
-
-            if (start < result.size()) {
-                size_t length = result.size() - start;
-                char* buffer = new char[length + 1];
-                std::memcpy(buffer, result.c_str() + start, length);
-                buffer[length] = '\0';
-
-                _content_callback(buffer, length + 4);
-
-                delete[] buffer;
-            }
+            _content_callback(result.data(), result.size());
             _completion_callback(result.size(), _latency_us);
           });
 
@@ -256,9 +230,9 @@ auto LibFlute::Client::handle_read_headers(const boost::system::error_code& err,
         // Intentionally empty loop, we ignore the headers
       }
 
-      // Start reading remaining data until EOF.
-      boost::asio::async_read_until(socket_, response_,
-        "\r\n\r\n",
+      // The server closes the connection after the response, so the content is everything up to EOF.
+      boost::asio::async_read(socket_, response_,
+        boost::asio::transfer_all(),
         boost::bind(&LibFlute::Client::handle_read_content, shared_from_this(),
           boost::asio::placeholders::error,
           boost::asio::placeholders::bytes_transferred));
@@ -272,34 +246,19 @@ auto LibFlute::Client::handle_read_headers(const boost::system::error_code& err,
 
 auto LibFlute::Client::handle_read_content(const boost::system::error_code& err, size_t bytes_recvd) -> void
   {
-    if (!err)
+    _bytes_recvd_total += bytes_recvd;
+    if (!err || err == boost::asio::error::eof)
     {
-      _bytes_recvd_total += bytes_recvd;
       try {
-        // Write all of the data that has been read so far.
-        char buffer[bytes_recvd];
-        boost::asio::buffer_copy(boost::asio::buffer(buffer, bytes_recvd), response_.data(), bytes_recvd);
-        response_.consume(bytes_recvd);
-
-        _content_callback(buffer, bytes_recvd);
-
-        // Continue reading remaining data until EOF.
-        boost::asio::async_read_until(socket_, response_,
-          "\r\n\r\n",
-          boost::bind(&LibFlute::Client::handle_read_content, shared_from_this(),
-            boost::asio::placeholders::error,
-            boost::asio::placeholders::bytes_transferred));
+        // The streambuf is contiguous, hand out the whole body at once
+        _content_callback(boost::asio::buffer_cast<const char*>(response_.data()), response_.size());
+        response_.consume(response_.size());
       } catch (const std::exception &ex) {
-        std::cout << "Caught exception \"" << ex.what() << "\"\n";
         spdlog::error("[FETCHER] Unhandled exception: {}", ex.what());
-        _completion_callback(_bytes_recvd_total, _latency_us);
-      } 
-    }
-    else if (err == boost::asio::error::eof)
-    {
+      }
       _completion_callback(_bytes_recvd_total, _latency_us);
     } else {
       spdlog::warn("[FETCHER] Failed to read content while fetching: {}", err.message());
       _completion_callback(_bytes_recvd_total, _latency_us);
     }
-  }
\ No newline at end of file
+  }
@@ -0,0 +1,500 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#include "Recovery/ConnectionPool.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <sstream>
+
+#include "spdlog/spdlog.h"
+#include "Metric/Metrics.h"
+
+#include "public/tracy/Tracy.hpp"
+
+using boost::asio::ip::tcp;
+
+namespace {
+    // A request is given up after it was assigned to this many connections that were lost
+    constexpr unsigned max_attempts = 2;
+
+    // Largest read of a response body, the deadline is pushed back after each one
+    constexpr size_t max_read_size = 65536;
+
+    auto to_lower(std::string value) -> std::string {
+        std::transform(value.begin(), value.end(), value.begin(), [](unsigned char c) { return std::tolower(c); });
+        return value;
+    }
+
+    auto trim(const std::string& value) -> std::string {
+        auto start = value.find_first_not_of(" \t\r\n");
+        if (start == std::string::npos) {
+            return "";
+        }
+        auto end = value.find_last_not_of(" \t\r\n");
+        return value.substr(start, end - start + 1);
+    }
+}
+
+LibFlute::ConnectionPool::ConnectionPool(boost::asio::io_service& io_service, const std::string& host,
+                                         const std::string& port, const Options& options)
+    : _io_service(io_service)
+    , _host(host)
+    , _port(port)
+    , _options(options)
+    , _resolver(io_service)
+    , _reaper(io_service)
+{
+}
+
+LibFlute::ConnectionPool::ConnectionPool(boost::asio::io_service& io_service, const std::string& host,
+                                         const std::string& port)
+    : ConnectionPool(io_service, host, port, Options())
+{
+}
+
+auto LibFlute::ConnectionPool::serialize(const std::string& path, const std::string& body, const std::string& headers) const -> std::string
+{
+    std::ostringstream request_stream;
+    request_stream << (body.empty() ? "GET " : "POST ") << path << " HTTP/1.1\r\n";
+    request_stream << "Host: " << _host << ":" << _port << "\r\n";
+    request_stream << "Accept: */*\r\n";
+    request_stream << "Connection: keep-alive\r\n";
+    request_stream << headers;
+    if (!body.empty()) {
+        request_stream << "Content-Length: " << body.size() << "\r\n";
+    }
+    request_stream << "\r\n";
+    request_stream << body;
+    return request_stream.str();
+}
+
+auto LibFlute::ConnectionPool::submit(const std::string& path, const std::string& body,
+                                      content_callback_t content_cb, completion_callback_t completion_cb,
+                                      const std::string& headers) -> void
+{
+    auto request = std::make_shared<Request>();
+    request->data = serialize(path, body, headers);
+    request->content_cb = std::move(content_cb);
+    request->completion_cb = std::move(completion_cb);
+    request->submitted_at = std::chrono::steady_clock::now();
+
+    boost::asio::post(_io_service, [self = shared_from_this(), request]() {
+        self->_pending.push_back(request);
+        self->dispatch();
+    });
+}
+
+auto LibFlute::ConnectionPool::set_options(const Options& options) -> void
+{
+    boost::asio::post(_io_service, [self = shared_from_this(), options]() {
+        self->_options = options;
+        self->dispatch();
+    });
+}
+
+auto LibFlute::ConnectionPool::shutdown() -> void
+{
+    boost::system::error_code ignored;
+    _resolver.cancel();
+    _reaper.cancel();
+    for (auto& connection : _connections) {
+        connection->closed = true;
+        connection->in_flight.clear();
+        connection->deadline.cancel();
+        connection->socket.close(ignored);
+    }
+    _connections.clear();
+    _pending.clear();
+}
+
+auto LibFlute::ConnectionPool::dispatch() -> void
+{
+    ZoneScopedN("ConnectionPool::dispatch");
+    while (!_pending.empty()) {
+        auto connection = pick_connection();
+        if (!connection) {
+            // Every connection is at its pipeline depth, the request waits for a response to come in
+            break;
+        }
+        if (connection->in_flight.empty()) {
+            connection->last_progress = std::chrono::steady_clock::now();
+        }
+        connection->in_flight.push_back(_pending.front());
+        _pending.pop_front();
+        schedule_deadline(connection);
+        write_next(connection);
+    }
+}
+
+auto LibFlute::ConnectionPool::pick_connection() -> std::shared_ptr<Connection>
+{
+    // An idle connection is always the cheapest option
+    for (const auto& connection : _connections) {
+        if (!connection->closed && connection->in_flight.empty()) {
+            return connection;
+        }
+    }
+
+    if (_connections.size() < std::max<size_t>(_options.max_connections, 1)) {
+        return open_connection();
+    }
+
+    // Pipeline on the least loaded connection that is known to stay open
+    std::shared_ptr<Connection> least_loaded;
+    for (const auto& connection : _connections) {
+        if (connection->closed || !connection->keep_alive_confirmed
+            || connection->in_flight.size() >= std::max<size_t>(_options.pipeline_depth, 1)) {
+            continue;
+        }
+        if (!least_loaded || connection->in_flight.size() < least_loaded->in_flight.size()) {
+            least_loaded = connection;
+        }
+    }
+    return least_loaded;
+}
+
+auto LibFlute::ConnectionPool::open_connection() -> std::shared_ptr<Connection>
+{
+    auto connection = std::make_shared<Connection>(_io_service);
+    connection->last_used = std::chrono::steady_clock::now();
+    _connections.push_back(connection);
+    schedule_reaper();
+
+    auto resolved = !_endpoints.empty()
+        && std::chrono::steady_clock::now() - _resolved_at < _options.resolve_ttl;
+    if (resolved) {
+        connect(connection);
+    } else {
+        resolve();
+    }
+    return connection;
+}
+
+auto LibFlute::ConnectionPool::resolve() -> void
+{
+    if (_resolving) {
+        return;
+    }
+    _resolving = true;
+    _resolver.async_resolve(_host, _port, tcp::resolver::numeric_service,
+        [self = shared_from_this()](const boost::system::error_code& err, tcp::resolver::results_type results) {
+            self->_resolving = false;
+            auto waiting = self->_connections;
+            if (err || results.empty()) {
+                for (auto& connection : waiting) {
+                    if (!connection->connected && !connection->connecting) {
+                        self->fail_connection(connection, "resolve failed: " + err.message());
+                    }
+                }
+                return;
+            }
+
+            self->_endpoints.assign(results.begin(), results.end());
+            self->_resolved_at = std::chrono::steady_clock::now();
+            for (auto& connection : waiting) {
+                if (!connection->closed && !connection->connected && !connection->connecting) {
+                    self->connect(connection);
+                }
+            }
+        });
+}
+
+auto LibFlute::ConnectionPool::connect(const std::shared_ptr<Connection>& connection) -> void
+{
+    connection->connecting = true;
+    boost::asio::async_connect(connection->socket, _endpoints,
+        [self = shared_from_this(), connection](const boost::system::error_code& err, const tcp::endpoint&) {
+            connection->connecting = false;
+            if (connection->closed) {
+                return;
+            }
+            if (err) {
+                // The cached endpoints might be stale, resolve again for the next connection
+                self->_endpoints.clear();
+                self->fail_connection(connection, "connect failed: " + err.message());
+                return;
+            }
+
+            boost::system::error_code ignored;
+            connection->socket.set_option(tcp::no_delay(true), ignored);
+            connection->connected = true;
+            connection->last_used = std::chrono::steady_clock::now();
+            self->write_next(connection);
+            self->read_headers(connection);
+        });
+}
+
+auto LibFlute::ConnectionPool::write_next(const std::shared_ptr<Connection>& connection) -> void
+{
+    if (connection->closed || !connection->connected || connection->writing
+        || connection->nof_written >= connection->in_flight.size()) {
+        return;
+    }
+
+    auto request = connection->in_flight[connection->nof_written];
+    connection->nof_written++;
+    connection->writing = true;
+    request->written = true;
+    boost::asio::async_write(connection->socket, boost::asio::buffer(request->data),
+        [self = shared_from_this(), connection, request](const boost::system::error_code& err, size_t) {
+            connection->writing = false;
+            if (connection->closed) {
+                return;
+            }
+            if (err) {
+                self->fail_connection(connection, "write failed: " + err.message());
+                return;
+            }
+            // Pipeline the next request, if any, without waiting for the response
+            self->write_next(connection);
+        });
+}
+
+auto LibFlute::ConnectionPool::read_headers(const std::shared_ptr<Connection>& connection) -> void
+{
+    // A read is kept outstanding on idle connections too, so a connection closed by the server is noticed right away
+    boost::asio::async_read_until(connection->socket, connection->response, "\r\n\r\n",
+        [self = shared_from_this(), connection](const boost::system::error_code& err, size_t header_length) {
+            if (connection->closed) {
+                return;
+            }
+            if (err) {
+                if (connection->in_flight.empty()) {
+                    // The server closed an idle connection
+                    self->close_connection(connection, false);
+                } else {
+                    self->fail_connection(connection, "read failed: " + err.message());
+                }
+                return;
+            }
+            if (connection->in_flight.empty() || connection->nof_written == 0) {
+                self->fail_connection(connection, "unexpected response");
+                return;
+            }
+            connection->last_progress = std::chrono::steady_clock::now();
+            self->handle_headers(connection, header_length);
+        });
+}
+
+auto LibFlute::ConnectionPool::handle_headers(const std::shared_ptr<Connection>& connection, size_t header_length) -> void
+{
+    ZoneScopedN("ConnectionPool::handle_headers");
+    auto& request = connection->in_flight.front();
+    auto latency_us = static_cast<size_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - request->submitted_at).count());
+
+    std::string headers(boost::asio::buffers_begin(connection->response.data()),
+                        boost::asio::buffers_begin(connection->response.data()) + header_length);
+    connection->response.consume(header_length);
+
+    std::istringstream header_stream(headers);
+    std::string http_version;
+    unsigned int status_code = 0;
+    header_stream >> http_version >> status_code;
+    if (!header_stream || http_version.substr(0, 5) != "HTTP/") {
+        fail_connection(connection, "invalid response");
+        return;
+    }
+
+    std::string line;
+    std::getline(header_stream, line); // Rest of the status line
+    bool has_content_length = false;
+    size_t content_length = 0;
+    std::string connection_header;
+    while (std::getline(header_stream, line) && line != "\r") {
+        auto colon = line.find(':');
+        if (colon == std::string::npos) {
+            continue;
+        }
+        auto name = to_lower(trim(line.substr(0, colon)));
+        auto value = trim(line.substr(colon + 1));
+        if (name == "content-length") {
+            has_content_length = true;
+            content_length = static_cast<size_t>(std::strtoull(value.c_str(), nullptr, 10));
+        } else if (name == "connection") {
+            connection_header = to_lower(value);
+        }
+    }
+
+    // Without a Content-Length the body ends when the server closes the connection
+    bool close_after = !has_content_length || connection_header == "close"
+        || (http_version == "HTTP/1.0" && connection_header != "keep-alive");
+
+    // 206 answers a byte range request
+    auto deliver = status_code == 200 || status_code == 206;
+    if (deliver) {
+        LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
+        metricsInstance.getOrCreateGauge("fetcher_latency")->Set(static_cast<double>(latency_us));
+    } else {
+        spdlog::debug("[FETCHER] Response returned with status code {}", status_code);
+    }
+
+    if (has_content_length && connection->response.size() >= content_length) {
+        finish_request(connection, content_length, header_length + content_length, latency_us, deliver, close_after);
+        return;
+    }
+
+    auto on_body = [self = shared_from_this(), connection, header_length, latency_us, deliver, close_after, has_content_length, content_length]
+        (const boost::system::error_code& err, size_t) {
+            if (connection->closed) {
+                return;
+            }
+            if (err && !(err == boost::asio::error::eof && !has_content_length)) {
+                self->fail_connection(connection, "read failed: " + err.message());
+                return;
+            }
+            auto body_length = has_content_length ? content_length : connection->response.size();
+            self->finish_request(connection, body_length, header_length + body_length, latency_us, deliver, close_after);
+        };
+
+    // Every part of the body that arrives pushes the deadline of the connection back
+    auto remaining = has_content_length ? content_length - connection->response.size() : 0;
+    boost::asio::async_read(connection->socket, connection->response,
+        [connection, has_content_length, remaining](const boost::system::error_code& err, size_t bytes_transferred) -> size_t {
+            connection->last_progress = std::chrono::steady_clock::now();
+            if (err) {
+                return 0;
+            }
+            if (!has_content_length) {
+                return max_read_size;
+            }
+            return std::min<size_t>(remaining - bytes_transferred, max_read_size);
+        }, on_body);
+}
+
+auto LibFlute::ConnectionPool::finish_request(const std::shared_ptr<Connection>& connection, size_t body_length,
+                                              size_t bytes_recvd_total, size_t latency_us, bool deliver, bool close_after) -> void
+{
+    ZoneScopedN("ConnectionPool::finish_request");
+    auto request = connection->in_flight.front();
+    connection->in_flight.pop_front();
+    connection->nof_written--;
+    connection->last_used = std::chrono::steady_clock::now();
+
+    if (deliver && request->content_cb) {
+        // The streambuf is contiguous, so the body is handed out without copying it
+        const char* body = boost::asio::buffer_cast<const char*>(connection->response.data());
+        try {
+            request->content_cb(body, body_length);
+        } catch (const std::exception &ex) {
+            spdlog::error("[FETCHER] Unhandled exception: {}", ex.what());
+        }
+    }
+    connection->response.consume(body_length);
+
+    if (request->completion_cb) {
+        request->completion_cb(Completion{bytes_recvd_total, latency_us});
+    }
+
+    if (close_after) {
+        close_connection(connection, false);
+    } else {
+        connection->keep_alive_confirmed = true;
+        read_headers(connection);
+    }
+    dispatch();
+}
+
+auto LibFlute::ConnectionPool::fail_connection(const std::shared_ptr<Connection>& connection, const std::string& reason) -> void
+{
+    spdlog::warn("[FETCHER] Repair connection to {}:{} lost: {}", _host, _port, reason);
+    close_connection(connection, true);
+    dispatch();
+}
+
+auto LibFlute::ConnectionPool::close_connection(const std::shared_ptr<Connection>& connection, bool failed) -> void
+{
+    if (connection->closed) {
+        return;
+    }
+    connection->closed = true;
+    connection->deadline.cancel();
+    boost::system::error_code ignored;
+    connection->socket.close(ignored);
+    _connections.erase(std::remove(_connections.begin(), _connections.end(), connection), _connections.end());
+
+    // Requests that did not get a response are retried on another connection, in their original order
+    for (auto it = connection->in_flight.rbegin(); it != connection->in_flight.rend(); ++it) {
+        auto request = *it;
+        if (failed || request->written) {
+            request->attempts++;
+        }
+        if (request->attempts >= max_attempts) {
+            if (request->completion_cb) {
+                request->completion_cb(std::nullopt);
+            }
+            continue;
+        }
+        request->written = false;
+        _pending.push_front(request);
+    }
+    connection->in_flight.clear();
+    connection->nof_written = 0;
+}
+
+auto LibFlute::ConnectionPool::schedule_deadline(const std::shared_ptr<Connection>& connection) -> void
+{
+    if (connection->deadline_running) {
+        return;
+    }
+    connection->deadline_running = true;
+    connection->deadline.expires_at(connection->last_progress + _options.response_timeout);
+    connection->deadline.async_wait([self = shared_from_this(), connection](const boost::system::error_code& err) {
+        connection->deadline_running = false;
+        if (err || connection->closed || connection->in_flight.empty()) {
+            return;
+        }
+        if (std::chrono::steady_clock::now() < connection->last_progress + self->_options.response_timeout) {
+            // Bytes arrived in the meantime
+            self->schedule_deadline(connection);
+            return;
+        }
+        self->fail_connection(connection, "no response within " + std::to_string(self->_options.response_timeout.count()) + " ms");
+    });
+}
+
+auto LibFlute::ConnectionPool::schedule_reaper() -> void
+{
+    if (_reaper_running) {
+        return;
+    }
+    _reaper_running = true;
+    auto interval = std::max<std::chrono::milliseconds>(_options.idle_timeout / 2, std::chrono::milliseconds(100));
+    _reaper.expires_after(interval);
+    _reaper.async_wait([self = shared_from_this()](const boost::system::error_code& err) {
+        self->_reaper_running = false;
+        if (err) {
+            return;
+        }
+        self->reap_idle_connections();
+        if (!self->_connections.empty()) {
+            self->schedule_reaper();
+        }
+    });
+}
+
+auto LibFlute::ConnectionPool::reap_idle_connections() -> void
+{
+    auto now = std::chrono::steady_clock::now();
+    auto connections = _connections;
+    for (auto& connection : connections) {
+        if (connection->in_flight.empty() && now - connection->last_used >= _options.idle_timeout) {
+            spdlog::trace("[FETCHER] Closing idle repair connection to {}:{}", _host, _port);
+            close_connection(connection, false);
+        }
+    }
+}
@@ -0,0 +1,166 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#include "Recovery/EncodedObjectCache.h"
+
+#include <algorithm>
+
+#include "spdlog/spdlog.h"
+#include "Metric/Metrics.h"
+
+LibFlute::EncodedObjectCache::EncodedObjectCache(size_t max_bytes, size_t nof_shards)
+    : _max_bytes(max_bytes)
+{
+    nof_shards = std::max<size_t>(nof_shards, 1);
+    _shard_max_bytes = max_bytes / nof_shards;
+    for (size_t i = 0; i < nof_shards; i++) {
+        _shards.push_back(std::make_unique<Shard>());
+    }
+}
+
+auto LibFlute::EncodedObjectCache::KeyHash::operator()(const Key& key) const -> size_t
+{
+    size_t hash = std::hash<std::string>{}(key.location);
+    auto combine = [&hash](uint64_t value) {
+        hash ^= std::hash<uint64_t>{}(value) + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+    };
+    combine(static_cast<uint64_t>(key.fec));
+    combine(key.symbol_length);
+    combine(key.size);
+    combine(static_cast<uint64_t>(key.mtime));
+    return hash;
+}
+
+auto LibFlute::EncodedObjectCache::cost(FileBase& file) -> size_t
+{
+    size_t bytes = file.length();
+    if (file.meta().fec_transformer) {
+        // The symbols live in their own buffers, next to the content
+        auto content_lock = file.get_content_buffer_lock();
+        for (const auto& block : file.source_blocks()) {
+            bytes += block.second.length;
+        }
+    }
+    return bytes;
+}
+
+auto LibFlute::EncodedObjectCache::shard_for(const Key& key) -> Shard&
+{
+    return *_shards[KeyHash{}(key) % _shards.size()];
+}
+
+auto LibFlute::EncodedObjectCache::get_or_load(const Key& key, const loader_t& loader) -> std::shared_ptr<FileBase>
+{
+    ZoneScopedN("EncodedObjectCache::get_or_load");
+    LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
+    Shard& shard = shard_for(key);
+
+    std::unique_lock<LockableBase(std::mutex)> lock(shard.mutex);
+    auto cached = shard.index.find(key);
+    if (cached != shard.index.end()) {
+        // Move the entry to the front of the LRU list
+        shard.lru.splice(shard.lru.begin(), shard.lru, cached->second);
+        auto file = cached->second->file;
+        lock.unlock();
+        metricsInstance.getOrCreateCounter("object_cache_hits")->Increment();
+        return file;
+    }
+
+    auto in_flight = shard.loading.find(key);
+    if (in_flight != shard.loading.end()) {
+        // Another request is already loading this object, wait for it
+        auto result = in_flight->second;
+        lock.unlock();
+        metricsInstance.getOrCreateCounter("object_cache_hits")->Increment();
+        return result.get();
+    }
+
+    std::promise<std::shared_ptr<FileBase>> promise;
+    shard.loading.emplace(key, promise.get_future().share());
+    lock.unlock();
+    metricsInstance.getOrCreateCounter("object_cache_misses")->Increment();
+
+    std::shared_ptr<FileBase> file;
+    try {
+        file = loader();
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+        lock.lock();
+        shard.loading.erase(key);
+        throw;
+    }
+
+    promise.set_value(file);
+    size_t bytes = file ? cost(*file) : 0;
+    lock.lock();
+    shard.loading.erase(key);
+    if (file) {
+        insert(shard, key, file, bytes);
+    }
+    lock.unlock();
+    update_size_metric();
+    return file;
+}
+
+auto LibFlute::EncodedObjectCache::insert(Shard& shard, const Key& key, const std::shared_ptr<FileBase>& file, size_t bytes) -> void
+{
+    // NOTE: the shard lock should be locked in the parent function.
+    if (bytes > _shard_max_bytes) {
+        spdlog::debug("[RETRIEVE] Not caching {}, {} bytes exceeds the cache budget", key.location, bytes);
+        return;
+    }
+
+    shard.lru.push_front(Entry{key, file, bytes});
+    shard.index[key] = shard.lru.begin();
+    shard.bytes += bytes;
+
+    size_t evicted = 0;
+    while (shard.bytes > _shard_max_bytes && !shard.lru.empty()) {
+        auto& victim = shard.lru.back();
+        shard.bytes -= victim.bytes;
+        shard.index.erase(victim.key);
+        shard.lru.pop_back();
+        evicted++;
+    }
+    if (evicted > 0) {
+        LibFlute::Metric::Metrics::getInstance().getOrCreateCounter("object_cache_evictions")->Increment(static_cast<double>(evicted));
+    }
+}
+
+auto LibFlute::EncodedObjectCache::clear() -> void
+{
+    for (auto& shard : _shards) {
+        const std::lock_guard<LockableBase(std::mutex)> lock(shard->mutex);
+        shard->lru.clear();
+        shard->index.clear();
+        shard->bytes = 0;
+    }
+    update_size_metric();
+}
+
+auto LibFlute::EncodedObjectCache::size_bytes() const -> size_t
+{
+    size_t bytes = 0;
+    for (const auto& shard : _shards) {
+        const std::lock_guard<LockableBase(std::mutex)> lock(shard->mutex);
+        bytes += shard->bytes;
+    }
+    return bytes;
+}
+
+auto LibFlute::EncodedObjectCache::update_size_metric() -> void
+{
+    LibFlute::Metric::Metrics::getInstance().getOrCreateGauge("object_cache_bytes")->Set(static_cast<double>(size_bytes()));
+}
@@ -21,23 +21,45 @@
 #include <string>
 #include <map>
 #include <chrono>
+#include <cstring>
+#include <algorithm>
 
 #include <boost/asio.hpp>
-#include <boost/property_tree/ptree.hpp>
-#include <boost/property_tree/json_parser.hpp>
 #include <boost/bind/bind.hpp>
 #include <boost/lexical_cast.hpp>
 #include "spdlog/spdlog.h"
 #include "Metric/Metrics.h"
+#include "Metric/LifecycleTracer.h"
+#include "Packet/AlcPacket.h"
 #include <Recovery/Client.h>
+#include "Recovery/RepairRequest.h"
+#include "Recovery/RepairResponse.h"
 
 #include "public/tracy/Tracy.hpp"
 
 using boost::asio::ip::tcp;
 
+namespace {
+    // 1 ms up to ~16 s
+    const LibFlute::Metric::Histogram::BucketBoundaries fetcher_latency_buckets =
+        LibFlute::Metric::Histogram::ExponentialBuckets(0.001, 2.0, 15);
+
+    auto now_ms() -> uint64_t {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::system_clock::now().time_since_epoch()).count();
+    }
+
+    // Client reports a failed request with -1 for both values
+    auto client_completion(size_t bytes_recvd_total, size_t latency_us) -> std::optional<LibFlute::ConnectionPool::Completion> {
+        if (bytes_recvd_total == static_cast<size_t>(-1)) {
+            return std::nullopt;
+        }
+        return LibFlute::ConnectionPool::Completion{bytes_recvd_total, latency_us};
+    }
+}
+
 LibFlute::Fetcher::Fetcher( const std::string& url)
     : _url(url)
-    , _url_regex(R"(^(https?)://([^:/]+)(?::(\d+))?(/.*)?$)")
     ,  metricsInstance(LibFlute::Metric::Metrics::getInstance())
 {
     if (_url.length() == 0) {
@@ -45,6 +67,21 @@ LibFlute::Fetcher::Fetcher( const std::string& url)
         return;
     }
 
+    if (_url.compare("fake_network_socket") != 0) {
+        std::smatch url_match;
+        if (std::regex_match(_url, url_match, std::regex(R"(^(https?)://([^:/]+)(?::(\d+))?(/.*)?$)"))) {
+            _host = url_match[2].str();
+            _port = url_match[3].str().empty() ? "80" : url_match[3].str();
+            if (url_match[1].str() == "https") {
+                _port = "443";
+            }
+            _path = url_match[4].str();
+            _pool = std::make_shared<LibFlute::ConnectionPool>(_io_service, _host, _port);
+        } else {
+            spdlog::warn("[FETCHER] Invalid URL: {}", _url);
+        }
+    }
+
     _io_service.reset();
 
     // Start the io_service in a new thread
@@ -79,6 +116,52 @@ LibFlute::Fetcher::~Fetcher() {
         _io_service_thread.join();
         // spdlog::debug("[FETCHER] Joined IO thread.");
     }
+    // The io_service thread is gone, so the pool can be torn down from here
+    if (_pool) {
+        _pool->shutdown();
+    }
+}
+
+auto LibFlute::Fetcher::set_pool_options(const LibFlute::ConnectionPool::Options& options) -> void
+{
+    if (_pool) {
+        _pool->set_options(options);
+    }
+    // Requests beyond what the pool has room for wait here, where they can still be reordered and trimmed
+    std::lock_guard<LockableBase(std::mutex)> lock(_repairs_mutex);
+    _max_requests_in_flight = std::max<size_t>(1, options.max_connections * options.pipeline_depth);
+}
+
+auto LibFlute::Fetcher::handle_fetch_completion(const std::vector<uint32_t>& tois, std::optional<LibFlute::ConnectionPool::Completion> completion) -> void
+{
+    // This is the callback function that will be called when a request is done
+    LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
+    auto fetcher_bandwidth = metricsInstance.getOrCreateGauge("fetcher_bandwidth");
+    if (!completion) {
+        // The request has failed, so there is no bandwidth.
+        fetcher_bandwidth->Set(0);
+        return;
+    }
+    auto bytes_recvd_total = completion->bytes_recvd_total;
+    auto latency_us = completion->latency_us;
+
+    for (auto toi : tois) {
+        LibFlute::Metric::LifecycleTracer::getInstance().record(LibFlute::Metric::LifecycleTracer::Event::RepairReceived, _tsi, toi, bytes_recvd_total);
+    }
+
+    // Calculate the bandwidth used by this request. A request that takes longer than 60 seconds is probably not valid.
+    if (bytes_recvd_total > 0 && latency_us > 0 && latency_us < 60000000) {
+        double latencySeconds = static_cast<double>(latency_us) / 1000000.0; // us to s
+        double bandwidth = static_cast<double>(bytes_recvd_total) / latencySeconds; // bytes per second
+        double bandwidthkbps = bandwidth * 8.0 / 1000.0; // kbits instead of bytes
+        double roundedBandwidth = std::round(bandwidthkbps * 1000.0) / 1000.0;
+        fetcher_bandwidth->Set(roundedBandwidth);
+        metricsInstance.getOrCreateCounter("fetcher_repair_bytes")->Increment(static_cast<double>(bytes_recvd_total));
+        metricsInstance.getOrCreateHistogram("fetcher_latency_seconds", fetcher_latency_buckets)->Observe(latencySeconds);
+        spdlog::debug("[FETCHER] Fetcher finished for {} TOI(s). Received {} bytes in {} us. Bandwidth: {} kbps", tois.size(), bytes_recvd_total, latency_us, fetcher_bandwidth->Value());
+    } else {
+        fetcher_bandwidth->Set(0);
+    }
 }
 
 auto LibFlute::Fetcher::fetch_fdt() -> void
@@ -93,68 +176,36 @@ auto LibFlute::Fetcher::fetch_fdt() -> void
     }
 
     bool use_fake_network_socket = _fake_network_socket != nullptr && _url.compare("fake_network_socket") == 0;
+    if (!use_fake_network_socket && !_pool) {
+        spdlog::warn("[FETCHER] Invalid URL: {}", _url);
+        return;
+    }
 
-    try {
-        // _socket.set_option(boost::asio::socket_base::receive_buffer_size(16*1024*1024));
+    auto content_cb = [this](const char * buffer, size_t bytes_recvd) {
+        this->handle_FDT(buffer, bytes_recvd);
+    };
 
-        std::smatch url_match;
-        std::string scheme;
-        std::string host;
-        std::string port;
-        std::string path = "/fdt";
-        std::string objectJson;
+    try {
         if (!use_fake_network_socket) {
-            if (!std::regex_match(_url, url_match, _url_regex)) {
-                spdlog::warn("[FETCHER] Invalid URL: {}", _url);
-                return;
-            }
-            scheme = url_match[1].str();
-            host = url_match[2].str();
-            port = url_match[3].str().empty() ? "80" : url_match[3].str();
-            bool isSecure = scheme == "https";
-            if (isSecure) {
-                port = "443";
-            }
-        } else {
-            objectJson = "{\"toi\":0}";
+            _pool->submit("/fdt", "", content_cb,
+                [this](std::optional<LibFlute::ConnectionPool::Completion> completion) {
+                    handle_fetch_completion({}, completion);
+                });
+            return;
         }
-    
 
+        std::string objectJson = "{\"toi\":0}";
         boost::shared_ptr<LibFlute::Client> client(new LibFlute::Client(
-            _io_service, host, port, path, objectJson,
-            [this](char * buffer, size_t bytes_recvd) {
-                size_t end_offset = 4; // length of "\r\n\r\n";
-                this->handle_FDT(buffer, bytes_recvd - end_offset);                
-            },
+            _io_service, "", "", "/fdt", objectJson, content_cb,
             [&](size_t bytes_recvd_total, size_t latency_us) {
-                // This is the callback function that will be called when the client is done
-
-                // Calculate the bandwidth used by this client.
-                LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
-                auto fetcher_bandwidth = metricsInstance.getOrCreateGauge("fetcher_bandwidth");
-
-                // A request that takes longer than 60 seconds is probably not a valid FDT.
-                if (bytes_recvd_total > 0 && latency_us > 0 && latency_us < 60000000) {
-                    double latencySeconds = static_cast<double>(latency_us) / 1000000.0; // us to s
-                    double bandwidth = static_cast<double>(bytes_recvd_total) / latencySeconds; // bytes per second
-                    double bandwidthkbps = bandwidth * 8.0 / 1000.0; // kbits instead of bytes
-                    double roundedBandwidth = std::round(bandwidthkbps * 1000.0) / 1000.0;
-                    fetcher_bandwidth->Set(roundedBandwidth);
-                    spdlog::debug("[FETCHER] Fetcher finished for TOI 0. Received {} bytes in {} us. Bandwidth: {} kbps", bytes_recvd_total, latency_us, fetcher_bandwidth->Value());
-                } else {
-                    // The request has failed, so there is no bandwidth.
-                    fetcher_bandwidth->Set(0);
-                }
+                handle_fetch_completion({}, client_completion(bytes_recvd_total, latency_us));
 
                 // Perform any cleanup or handling of completion here
                 // Remove the client from the vector
                 _activeClients.erase(std::remove(_activeClients.begin(), _activeClients.end(), client), _activeClients.end());
             }));
         _activeClients.push_back(client);
-
-        if (use_fake_network_socket) {
-            client->set_fake_network_socket(_fake_network_socket);
-        }
+        client->set_fake_network_socket(_fake_network_socket);
 
         // Start the actual fetch request.
         client->start();
@@ -168,12 +219,15 @@ auto LibFlute::Fetcher::fetch_fdt() -> void
     } 
 }
 
-
 auto LibFlute::Fetcher::fetch_alcs(
     const uint32_t toi,
     LibFlute::FecScheme fec,
     const std::string &content_location,
-    std::shared_ptr<std::map<uint16_t, std::vector<uint16_t>>> missing_symbols) -> void
+    std::shared_ptr<std::map<uint16_t, std::vector<uint16_t>>> missing_symbols,
+    std::shared_ptr<std::map<uint16_t, LibFlute::RepairRequest::Needed>> needed_symbols,
+    uint64_t deadline,
+    std::shared_ptr<const ObjectLayout> layout,
+    ContentEncoding content_encoding) -> void
 {
     ZoneScopedN("Fetcher::fetch_alcs");
     if (
@@ -186,101 +240,133 @@ auto LibFlute::Fetcher::fetch_alcs(
     }
 
     bool use_fake_network_socket = _fake_network_socket != nullptr && _url.compare("fake_network_socket") == 0;
+    if (!use_fake_network_socket && !_pool) {
+        spdlog::warn("[FETCHER] Invalid URL: {}", _url);
+        return;
+    }
+
+    // Files that are too late to be of use are not worth the unicast bytes
+    if (deadline == 0) {
+        deadline = UINT64_MAX;
+    }
+    uint64_t now = now_ms();
+    if (_deadline_grace.count() > 0 && deadline != UINT64_MAX && now > deadline + _deadline_grace.count()) {
+        spdlog::debug("[FETCHER] Not fetching the missing symbols of TOI {}, it is {} ms past its deadline", toi, now - deadline);
+        metricsInstance.getOrCreateCounter("fetcher_repairs_late")->Increment();
+        return;
+    }
+
+    // The symbols of an encoded file are cut from the encoded object, a server that does not know about
+    // content encodings would cut them from the content it has stored
+    if (content_encoding != ContentEncoding::NONE && !_content_encodings) {
+        spdlog::debug("[FETCHER] Not fetching the missing symbols of TOI {}, the server does not handle content encodings", toi);
+        metricsInstance.getOrCreateCounter("fetcher_repairs_encoded_skipped")->Increment();
+        return;
+    }
 
     spdlog::trace("[FETCHER] Fetching missing symbols for TOI {}", toi);
 
     try {
-        // _socket.set_option(boost::asio::socket_base::receive_buffer_size(16*1024*1024));
-
-        std::smatch url_match;
-        std::string scheme;
-        std::string host;
-        std::string port;
-        std::string path = "/alc";
-        if (!use_fake_network_socket) {
-            if (!std::regex_match(_url, url_match, _url_regex)) {
-                spdlog::warn("[FETCHER] Invalid URL: {}", _url);
-                return;
-            }
-            scheme = url_match[1].str();
-            host = url_match[2].str();
-            port = url_match[3].str().empty() ? "80" : url_match[3].str();
-            bool isSecure = scheme == "https";
-            if (isSecure) {
-                port = "443";
-            }
-            path = url_match[4].str();
-        }
-        
-        // Convert the map to a property tree
-        boost::property_tree::ptree symbol_tree;
+        LibFlute::RepairRequest request(toi, static_cast<unsigned>(fec), content_location);
+        request.set_content_encoding(content_encoding);
         for (const auto& entry : *missing_symbols) {
             // Skip empty entries
             if (entry.second.size() == 0) {
                 continue;
             }
-            std::string key = std::to_string(entry.first);
-            boost::property_tree::ptree values;
-            for (const auto& value : entry.second) {
-                values.push_back(std::make_pair("", boost::property_tree::ptree(std::to_string(value))));
+            if (_symbol_counts && needed_symbols) {
+                auto needed = needed_symbols->find(entry.first);
+                if (needed != needed_symbols->end()) {
+                    // Any fresh symbols will do, but never ask for more than the missing ones
+                    request.add_needed(entry.first, std::min<uint32_t>(needed->second.count, entry.second.size()), needed->second.first_esi);
+                    continue;
+                }
             }
-            symbol_tree.add_child(key, values);
+            request.add_missing(entry.first, std::vector<uint32_t>(entry.second.begin(), entry.second.end()));
         }
 
-        // Check the size of the tree
-        if (symbol_tree.size() == 0) {
+        // Check the number of missing symbols
+        if (request.symbol_count() == 0) {
             spdlog::debug("[FETCHER] Not fetching the missing symbols. No symbols to fetch for TOI {}.", toi);
             return;
         }
 
-        boost::property_tree::ptree tree;
-        tree.put("toi",std::to_string(toi));
-        tree.put("file",content_location);
-        tree.put("fec",std::to_string(static_cast<int>(fec)));
-        tree.add_child("missing",symbol_tree);
+        // Ask for the binary framing, servers that do not support it ignore these fields.
+        // Only servers that announced it in an earlier response get the compact encoding.
+        request.set_encoding(LibFlute::RepairResponse::Encoding::BinaryZlib);
+
+        if (!use_fake_network_socket) {
+            // Blocks that lost most of their symbols, or the whole object, may be cheaper to fetch as they are
+            std::vector<Range> ranges;
+            if (layout && _object_cb && _cost_model.enabled) {
+                ranges = plan(request, *layout);
+            }
+            if (ranges.empty()) {
+                metricsInstance.getOrCreateCounter("fetcher_repairs_by_symbols")->Increment();
+            } else if (ranges.size() == 1 && ranges.front().length == layout->length) {
+                spdlog::debug("[FETCHER] Fetching TOI {} as a whole", toi);
+                metricsInstance.getOrCreateCounter("fetcher_repairs_by_object")->Increment();
+            } else {
+                spdlog::debug("[FETCHER] Fetching {} byte ranges of TOI {}, {} symbols by repair", ranges.size(), toi, request.symbol_count());
+                metricsInstance.getOrCreateCounter("fetcher_repairs_by_blocks")->Increment();
+            }
+
+            // Servers that accept batches get the requests of all files that are fetched within the window at once
+            bool open_window = false;
+            {
+                std::lock_guard<LockableBase(std::mutex)> lock(_repairs_mutex);
+                if (!ranges.empty()) {
+                    _waiting_ranges.insert_or_assign(toi, RangeRepair{object_path(content_location), layout->length, std::move(ranges), deadline});
+                } else {
+                    _waiting_ranges.erase(toi);
+                }
+                if (request.symbol_count() > 0) {
+                    _waiting.insert_or_assign(toi, Repair{std::move(request), deadline});
+                } else {
+                    _waiting.erase(toi);
+                }
+                if (_batch_requests && _batch_window.count() > 0 && !_window_open) {
+                    _window_open = true;
+                    open_window = true;
+                }
+            }
+            boost::asio::post(_io_service, [this, open_window]() {
+                if (open_window) {
+                    _batch_timer.expires_after(_batch_window);
+                    _batch_timer.async_wait([this](const boost::system::error_code& error) {
+                        if (!error) {
+                            {
+                                std::lock_guard<LockableBase(std::mutex)> lock(_repairs_mutex);
+                                _window_open = false;
+                            }
+                            dispatch();
+                        }
+                    });
+                }
+                dispatch();
+            });
+            return;
+        }
 
-        // Convert the property tree to a JSON string
-        std::ostringstream body_stream;
-        boost::property_tree::json_parser::write_json(body_stream, tree, false);
-        std::string objectJson = body_stream.str();
+        std::string objectJson = _compact_requests ? request.to_compact() : request.to_json();
 
         // spdlog::debug("[FETCHER] Fetching missing symbols for TOI {} with JSON: {}", toi, objectJson);
 
+        auto content_cb = [this](const char * buffer, size_t bytes_recvd) {
+            this->handle_ALC(buffer, bytes_recvd);
+        };
+
         boost::shared_ptr<LibFlute::Client> client(new LibFlute::Client(
-            _io_service, host, port, path, objectJson,
-            [this](char * buffer, size_t bytes_recvd) {
-                size_t end_offset = 4; // length of "\r\n\r\n";
-                this->handle_ALC(buffer, bytes_recvd - end_offset);
-            },
+            _io_service, "", "", "/alc", objectJson, content_cb,
             [&, toi](size_t bytes_recvd_total, size_t latency_us) {
-                // This is the callback function that will be called when the client is done
-
-                // Calculate the bandwidth used by this client.
-                LibFlute::Metric::Metrics& metricsInstance = LibFlute::Metric::Metrics::getInstance();
-                auto fetcher_bandwidth = metricsInstance.getOrCreateGauge("fetcher_bandwidth");
-
-                // A request that takes longer than 60 seconds is probably not a valid ALC.
-                if (bytes_recvd_total > 0 && latency_us > 0 && latency_us < 60000000) {
-                    double latencySeconds = static_cast<double>(latency_us) / 1000000.0; // us to s
-                    double bandwidth = static_cast<double>(bytes_recvd_total) / latencySeconds; // bytes per second
-                    double bandwidthkbps = bandwidth * 8.0 / 1000.0; // kbits instead of bytes
-                    double roundedBandwidth = std::round(bandwidthkbps * 1000.0) / 1000.0;
-                    fetcher_bandwidth->Set(roundedBandwidth);
-                    spdlog::debug("[FETCHER] Fetcher finished for TOI {}. Received {} bytes in {} us. Bandwidth: {} kbps", toi, bytes_recvd_total, latency_us, fetcher_bandwidth->Value());
-                } else {
-                    // The request has failed, so there is no bandwidth.
-                    fetcher_bandwidth->Set(0);
-                }
+                handle_fetch_completion({toi}, client_completion(bytes_recvd_total, latency_us));
 
                 // Perform any cleanup or handling of completion here
                 // Remove the client from the vector
                 _activeClients.erase(std::remove(_activeClients.begin(), _activeClients.end(), client), _activeClients.end());
             }));
         _activeClients.push_back(client);
-
-        if (use_fake_network_socket) {
-            client->set_fake_network_socket(_fake_network_socket);
-        }
+        client->set_fake_network_socket(_fake_network_socket);
 
         // Start the actual fetch request.
         client->start();
@@ -294,74 +380,388 @@ auto LibFlute::Fetcher::fetch_alcs(
     }  
 }
 
-auto LibFlute::Fetcher::handle_ALC(char * buffer, size_t bytes_recvd) -> void
+auto LibFlute::Fetcher::block_completed(uint32_t toi, uint16_t sbn) -> void
 {
-    ZoneScopedN("Fetcher::handle_ALC");   
-    if (bytes_recvd == 0){
-        return;
+    bool cancelled = false;
+    {
+        std::lock_guard<LockableBase(std::mutex)> lock(_repairs_mutex);
+        auto waiting = _waiting.find(toi);
+        if (waiting != _waiting.end()) {
+            waiting->second.request.remove_block(sbn);
+            if (waiting->second.request.symbol_count() == 0) {
+                _waiting.erase(waiting);
+                cancelled = true;
+            }
+        }
+        if (_in_flight.find(toi) != _in_flight.end()) {
+            _completed_blocks[toi].insert(sbn);
+            _drop_completed = true;
+        }
+    }
+    if (cancelled) {
+        spdlog::debug("[FETCHER] Cancelled the repair of TOI {}, its last missing block completed", toi);
+        metricsInstance.getOrCreateCounter("fetcher_repairs_cancelled")->Increment();
+    }
+}
+
+auto LibFlute::Fetcher::file_completed(uint32_t toi) -> void
+{
+    bool cancelled = false;
+    {
+        std::lock_guard<LockableBase(std::mutex)> lock(_repairs_mutex);
+        cancelled = _waiting.erase(toi) + _waiting_ranges.erase(toi) > 0;
+        if (_in_flight.find(toi) != _in_flight.end()) {
+            _completed_files.insert(toi);
+            _drop_completed = true;
+        }
+    }
+    if (cancelled) {
+        spdlog::debug("[FETCHER] Cancelled the repair of TOI {}, it completed", toi);
+        metricsInstance.getOrCreateCounter("fetcher_repairs_cancelled")->Increment();
+    }
+}
+
+auto LibFlute::Fetcher::plan(LibFlute::RepairRequest& request, const ObjectLayout& layout) const -> std::vector<Range>
+{
+    if (layout.length == 0 || layout.symbol_length == 0) {
+        return {};
+    }
+    const auto& model = _cost_model;
+    double symbol_cost = layout.symbol_length + model.packet_overhead + model.packet_cost + model.symbol_request_cost;
+
+    // Symbols asked for per block
+    std::map<uint32_t, size_t> symbols;
+    for (const auto& [sbn, esis] : request.missing()) {
+        symbols[sbn] = esis.size();
+    }
+    for (const auto& [sbn, needed] : request.needed()) {
+        symbols[sbn] = needed.count;
+    }
+
+    double by_symbols = model.request_overhead + request.symbol_count() * symbol_cost;
+    double by_object = model.request_overhead + layout.length;
+
+    // Blocks that are cheaper to fetch as a byte range, neighbouring blocks share a range
+    struct BlockRange {
+        Range range;
+        uint32_t first_sbn;
+        uint32_t last_sbn;
+        double saving;
+    };
+    std::vector<BlockRange> block_ranges;
+    for (const auto& [sbn, count] : symbols) {
+        if (sbn >= layout.block_offsets.size()) {
+            continue;
+        }
+        uint64_t end = sbn + 1 < layout.block_offsets.size() ? layout.block_offsets[sbn + 1] : layout.length;
+        uint64_t bytes = end - layout.block_offsets[sbn];
+        double saving = count * symbol_cost - bytes;
+        if (saving <= 0) {
+            continue;
+        }
+        if (!block_ranges.empty() && block_ranges.back().last_sbn + 1 == sbn) {
+            block_ranges.back().range.length += bytes;
+            block_ranges.back().last_sbn = sbn;
+            block_ranges.back().saving += saving;
+        } else {
+            block_ranges.push_back(BlockRange{{layout.block_offsets[sbn], bytes}, sbn, sbn, saving});
+        }
+    }
+    // A range has to make up for its request
+    block_ranges.erase(std::remove_if(block_ranges.begin(), block_ranges.end(),
+        [&model](const BlockRange& block_range) { return block_range.saving <= model.request_overhead; }), block_ranges.end());
+
+    double by_blocks = by_symbols;
+    size_t symbols_left = request.symbol_count();
+    for (const auto& block_range : block_ranges) {
+        by_blocks += model.request_overhead - block_range.saving;
+        for (auto sbn = block_range.first_sbn; sbn <= block_range.last_sbn; sbn++) {
+            symbols_left -= symbols[sbn];
+        }
+    }
+    if (symbols_left == 0) {
+        by_blocks -= model.request_overhead;
+    }
+
+    if (by_object < by_blocks && by_object < by_symbols) {
+        for (const auto& block : symbols) {
+            request.remove_block(block.first);
+        }
+        return {Range{0, layout.length}};
     }
+    std::vector<Range> ranges;
+    if (by_blocks < by_symbols) {
+        for (const auto& block_range : block_ranges) {
+            for (auto sbn = block_range.first_sbn; sbn <= block_range.last_sbn; sbn++) {
+                request.remove_block(sbn);
+            }
+            ranges.push_back(block_range.range);
+        }
+    }
+    return ranges;
+}
+
+auto LibFlute::Fetcher::object_path(const std::string& content_location) const -> std::string
+{
+    // Absolute locations keep their path, relative ones are taken from the directory of the repair URL
+    auto scheme = content_location.find("://");
+    if (scheme != std::string::npos) {
+        auto slash = content_location.find('/', scheme + 3);
+        return slash == std::string::npos ? "/" : content_location.substr(slash);
+    }
+    auto directory = _path.rfind('/');
+    return (directory == std::string::npos ? "/" : _path.substr(0, directory + 1)) + content_location;
+}
+
+auto LibFlute::Fetcher::dispatch() -> void
+{
+    ZoneScopedN("Fetcher::dispatch");
+    // Only called from the IO thread
+    std::vector<std::vector<LibFlute::RepairRequest>> batches;
+    std::vector<std::tuple<uint32_t, std::string, uint64_t, Range>> range_fetches;
+    size_t late = 0;
+    {
+        std::lock_guard<LockableBase(std::mutex)> lock(_repairs_mutex);
+        size_t max_files = _batch_requests && _batch_window.count() > 0 ? LibFlute::RepairRequest::max_batch_size : 1;
+        // A full batch does not wait for the window to close
+        if (_window_open && _waiting.size() < max_files) {
+            return;
+        }
 
+        uint64_t now = now_ms();
+        auto is_late = [this, now](uint64_t deadline) {
+            return _deadline_grace.count() > 0 && deadline != UINT64_MAX && now > deadline + _deadline_grace.count();
+        };
+        std::vector<std::map<uint32_t, Repair>::iterator> order;
+        order.reserve(_waiting.size());
+        for (auto it = _waiting.begin(); it != _waiting.end();) {
+            if (is_late(it->second.deadline)) {
+                it = _waiting.erase(it);
+                late++;
+            } else {
+                order.push_back(it++);
+            }
+        }
+        // Earliest deadline first, files without a deadline go last
+        std::stable_sort(order.begin(), order.end(), [](const auto& a, const auto& b) {
+            return a->second.deadline < b->second.deadline;
+        });
+        std::vector<std::map<uint32_t, RangeRepair>::iterator> range_order;
+        for (auto it = _waiting_ranges.begin(); it != _waiting_ranges.end();) {
+            if (is_late(it->second.deadline)) {
+                it = _waiting_ranges.erase(it);
+                late++;
+            } else {
+                range_order.push_back(it++);
+            }
+        }
+        std::stable_sort(range_order.begin(), range_order.end(), [](const auto& a, const auto& b) {
+            return a->second.deadline < b->second.deadline;
+        });
+
+        // Both queues share the requests in flight, whichever has the earlier deadline goes first
+        auto next = order.begin();
+        auto next_range = range_order.begin();
+        while (_requests_in_flight < _max_requests_in_flight && (next != order.end() || next_range != range_order.end())) {
+            if (next_range != range_order.end() && (next == order.end() || (*next_range)->second.deadline < (*next)->second.deadline)) {
+                auto& range_repair = (*next_range)->second;
+                range_fetches.emplace_back((*next_range)->first, range_repair.path, range_repair.object_length, range_repair.ranges.back());
+                range_repair.ranges.pop_back();
+                _in_flight[(*next_range)->first]++;
+                _requests_in_flight++;
+                if (range_repair.ranges.empty()) {
+                    _waiting_ranges.erase(*next_range);
+                    ++next_range;
+                }
+                continue;
+            }
 
-    // We are only interested in lines that start with "ALC ".
-    size_t start_offset = 4; // length of "ALC "
-    size_t alc_length =  bytes_recvd - start_offset;
-    spdlog::trace("[FETCHER] Received {} ALC bytes from Fetcher", alc_length);
-    if (strncmp(buffer, "ALC ", start_offset) == 0) {
-        try{
-            if (_alc_cb){
-                // Calculate the starting point for the buffer
-                const char *alc_data = buffer + start_offset;
-
-                /*
-                auto len_to_display = alc_length < 50 ? alc_length : 50;
-                std::stringstream hex_stream;
-                std::stringstream ascii_stream;
-                std::stringstream binary_stream;
-                hex_stream << std::hex << std::setfill('0');
-                for (int i = 0; i < len_to_display; ++i) {
-                    auto c = alc_data[i];
-                    hex_stream << std::setw(2) << static_cast<int>(static_cast<unsigned char>(c));
-                    if (i < len_to_display / 4) {
-                        binary_stream << std::bitset<8>(static_cast<unsigned char>(c)); // Add binary stream
-                    }
-                    if (c >= 32 && c <= 126) {
-                        ascii_stream << c;
-                    } else {
-                        ascii_stream << '?';
-                    }
-                    if (i % 2 == 1) {
-                        hex_stream << ' ';  // Add a space every two characters
-                        ascii_stream << ' ' << ' ' << ' ';
-                        binary_stream << ' ';
-                    } else if (i < len_to_display / 4) {
-                        binary_stream << '.';
-                    }
+            std::vector<LibFlute::RepairRequest> batch;
+            size_t symbols = 0;
+            while (next != order.end() && batch.size() < max_files) {
+                auto& request = (*next)->second.request;
+                if (!batch.empty() && symbols + request.symbol_count() > LibFlute::RepairRequest::max_symbols) {
+                    break;
                 }
+                symbols += request.symbol_count();
+                _in_flight[(*next)->first]++;
+                batch.push_back(std::move(request));
+                _waiting.erase(*next);
+                ++next;
+            }
+            _requests_in_flight++;
+            batches.push_back(std::move(batch));
+        }
+    }
 
-                spdlog::trace("[FETCHER] First {} / {} bytes in hex:   {}", len_to_display, alc_length, hex_stream.str());
-                spdlog::trace("[FETCHER] First {} / {} bytes in ascii: {}", len_to_display, alc_length, ascii_stream.str());
-                spdlog::trace("[FETCHER] First {}  / {} bytes in bin:   {}", len_to_display / 8, alc_length, binary_stream.str());
-                */
+    if (late > 0) {
+        spdlog::debug("[FETCHER] Dropped the repair of {} files that are past their deadline", late);
+        metricsInstance.getOrCreateCounter("fetcher_repairs_late")->Increment(static_cast<double>(late));
+    }
+    for (auto& batch : batches) {
+        send(std::move(batch));
+    }
+    for (auto& [toi, path, object_length, range] : range_fetches) {
+        send_range(toi, path, object_length, range);
+    }
+}
+
+auto LibFlute::Fetcher::send(std::vector<LibFlute::RepairRequest> batch) -> void
+{
+    std::vector<uint32_t> tois;
+    tois.reserve(batch.size());
+    for (const auto& request : batch) {
+        tois.push_back(static_cast<uint32_t>(request.toi()));
+    }
+
+    std::string body;
+    if (batch.size() == 1) {
+        body = _compact_requests ? batch.front().to_compact() : batch.front().to_json();
+    } else {
+        spdlog::debug("[FETCHER] Fetching missing symbols for {} files in one request", batch.size());
+        metricsInstance.getOrCreateCounter("fetcher_batched_files")->Increment(static_cast<double>(batch.size()));
+        body = LibFlute::RepairRequest::to_batch(batch);
+    }
+
+    // The ALC packets of all files come back in one response, the ALC callback sorts them by TOI
+    _pool->submit(_path, body,
+        [this](const char * buffer, size_t bytes_recvd) {
+            this->handle_ALC(buffer, bytes_recvd);
+        },
+        [this, tois = std::move(tois)](std::optional<LibFlute::ConnectionPool::Completion> completion) {
+            sent(tois);
+            handle_fetch_completion(tois, completion);
+            dispatch();
+        });
+}
+
+auto LibFlute::Fetcher::send_range(uint32_t toi, const std::string& path, uint64_t object_length, Range range) -> void
+{
+    std::string headers;
+    if (range.offset != 0 || range.length != object_length) {
+        headers = "Range: bytes=" + std::to_string(range.offset) + "-" + std::to_string(range.offset + range.length - 1) + "\r\n";
+    }
+    _pool->submit(path, "",
+        [this, toi, object_length, range](const char * buffer, size_t bytes_recvd) {
+            // Servers that do not support ranges send the whole object
+            if (bytes_recvd == object_length && range.length != object_length) {
+                buffer += range.offset;
+            } else if (bytes_recvd != range.length) {
+                spdlog::warn("[FETCHER] Received {} bytes of TOI {} instead of {}", bytes_recvd, toi, range.length);
+                return;
+            }
+            metricsInstance.getOrCreateCounter("fetcher_object_bytes")->Increment(static_cast<double>(range.length));
+            try {
+                _object_cb(toi, range.offset, buffer, range.length);
+            } catch (std::exception &ex) {
+                spdlog::warn("[FETCHER] Failed to handle fetched object: {}", ex.what());
+            } catch (const char* errorMessage) {
+                spdlog::warn("[FETCHER] Failed to handle fetched object: {}", errorMessage);
+            } catch (...) {
+                spdlog::warn("[FETCHER] Failed to handle fetched object: unknown error");
+            }
+        },
+        [this, toi](std::optional<LibFlute::ConnectionPool::Completion> completion) {
+            sent({toi});
+            handle_fetch_completion({toi}, completion);
+            dispatch();
+        },
+        headers);
+}
+
+auto LibFlute::Fetcher::sent(const std::vector<uint32_t>& tois) -> void
+{
+    std::lock_guard<LockableBase(std::mutex)> lock(_repairs_mutex);
+    _requests_in_flight--;
+    for (auto toi : tois) {
+        auto in_flight = _in_flight.find(toi);
+        if (in_flight != _in_flight.end() && --in_flight->second == 0) {
+            _in_flight.erase(in_flight);
+            _completed_blocks.erase(toi);
+            _completed_files.erase(toi);
+        }
+    }
+    _drop_completed = !_completed_blocks.empty() || !_completed_files.empty();
+}
+
+auto LibFlute::Fetcher::is_completed(const char * alc_data, size_t alc_length) -> bool
+{
+    uint64_t toi = 0;
+    uint16_t sbn = 0;
+    if (!LibFlute::AlcPacket::peek(alc_data, alc_length, toi, sbn)) {
+        return false;
+    }
+    std::lock_guard<LockableBase(std::mutex)> lock(_repairs_mutex);
+    if (_completed_files.find(toi) != _completed_files.end()) {
+        return true;
+    }
+    auto blocks = _completed_blocks.find(toi);
+    return blocks != _completed_blocks.end() && blocks->second.find(sbn) != blocks->second.end();
+}
+
+auto LibFlute::Fetcher::handle_ALC(const char * buffer, size_t bytes_recvd) -> void
+{
+    ZoneScopedN("Fetcher::handle_ALC");   
+    if (bytes_recvd == 0 || !_alc_cb){
+        return;
+    }
 
+    spdlog::trace("[FETCHER] Received {} ALC bytes from Fetcher ({} framing)", bytes_recvd,
+        LibFlute::RepairResponse::is_binary(buffer, bytes_recvd) ? "binary" : "legacy");
+
+    if (!_compact_requests && LibFlute::RepairResponse::accepts_compact_requests(buffer, bytes_recvd)) {
+        spdlog::debug("[FETCHER] Server accepts compact repair requests");
+        _compact_requests = true;
+    }
+    if (!_symbol_counts && LibFlute::RepairResponse::accepts_symbol_counts(buffer, bytes_recvd)) {
+        spdlog::debug("[FETCHER] Server creates fresh repair symbols");
+        _symbol_counts = true;
+    }
+    if (!_batch_requests && LibFlute::RepairResponse::accepts_batch_requests(buffer, bytes_recvd)) {
+        spdlog::debug("[FETCHER] Server accepts batches of repair requests");
+        _batch_requests = true;
+    }
+    if (!_content_encodings && LibFlute::RepairResponse::accepts_content_encodings(buffer, bytes_recvd)) {
+        spdlog::debug("[FETCHER] Server handles the content encoding of repair requests");
+        _content_encodings = true;
+    }
+
+    // Only called from the IO thread, so the inflate buffer can be reused between responses
+    size_t dropped = 0;
+    bool valid = LibFlute::RepairResponse::for_each_packet(buffer, bytes_recvd, _inflate_buffer,
+        [this, &dropped](const char * alc_data, size_t alc_length) {
+            // A request on the wire can not be taken back, but the symbols of blocks that completed in the
+            // meantime need not be handled
+            if (_drop_completed && is_completed(alc_data, alc_length)) {
+                dropped++;
+                return;
+            }
+            try{
                 // Call the callback responsible for handling the received ALC.
                 _alc_cb(alc_data, alc_length);
-                 
+            } catch (std::exception &ex) {
+                spdlog::warn("[FETCHER] Failed to handle fetched ALC: {}", ex.what());
+            } catch (const char* errorMessage) {
+                spdlog::warn("[FETCHER] Failed to handle fetched ALC: {}", errorMessage);
+            } catch (...) {
+                spdlog::warn("[FETCHER] Failed to handle fetched ALC: unknown error");
             }
-        } catch (std::exception &ex) {
-            spdlog::warn("[FETCHER] Failed to handle fetched ALC: {}", ex.what());
-        } catch (const char* errorMessage) {
-            spdlog::warn("[FETCHER] Failed to handle fetched ALC: {}", errorMessage);
-        } catch (...) {
-            spdlog::warn("[FETCHER] Failed to handle fetched ALC: unknown error");
-        }
-    } else if (bytes_recvd > 0) {
-        spdlog::warn("[FETCHER] Received ALC data that does not start with 'ALC '.");
+        });
+    if (dropped > 0) {
+        metricsInstance.getOrCreateCounter("fetcher_alcs_dropped")->Increment(static_cast<double>(dropped));
+    }
+    if (!valid) {
+        spdlog::warn("[FETCHER] Received a malformed repair response of {} bytes", bytes_recvd);
     }
 }
 
-auto LibFlute::Fetcher::handle_FDT(char * buffer, size_t bytes_recvd) -> void
+auto LibFlute::Fetcher::handle_FDT(const char * buffer, size_t bytes_recvd) -> void
 {
     ZoneScopedN("Fetcher::handle_FDT");    
+    // The FDT may be followed by a "\r\n\r\n" delimiter
+    if (bytes_recvd >= 4 && memcmp(buffer + bytes_recvd - 4, "\r\n\r\n", 4) == 0) {
+        bytes_recvd -= 4;
+    }
     if (bytes_recvd == 0){
         return;
     }
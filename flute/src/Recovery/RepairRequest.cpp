@@ -0,0 +1,502 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#include "Recovery/RepairRequest.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <sstream>
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include "Utils/Compression.h"
+#include "Utils/base64.h"
+
+#include "public/tracy/Tracy.hpp"
+
+namespace {
+    constexpr char magic[4] = {'F', 'L', 'R', 'Q'};
+    constexpr uint8_t flag_binary_framing = 0x01;
+    constexpr uint8_t flag_zlib = 0x02;
+    constexpr uint8_t flag_content_encoding = 0x04;
+    constexpr uint8_t mode_runs = 0;
+    constexpr uint8_t mode_bitmap = 1;
+    constexpr uint8_t mode_count = 2;
+
+    auto append_varint(std::string& out, uint64_t value) -> void {
+        while (value >= 0x80) {
+            out.push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out.push_back(static_cast<char>(value));
+    }
+
+    class Reader {
+      public:
+        Reader(const std::string& data) : _data(data) {}
+
+        auto byte() -> uint8_t {
+            if (_offset >= _data.size()) {
+                throw "Truncated repair request";
+            }
+            return static_cast<uint8_t>(_data[_offset++]);
+        }
+
+        auto varint() -> uint64_t {
+            uint64_t value = 0;
+            for (unsigned shift = 0; shift < 64; shift += 7) {
+                auto b = byte();
+                value |= static_cast<uint64_t>(b & 0x7f) << shift;
+                if (!(b & 0x80)) {
+                    return value;
+                }
+            }
+            throw "Invalid varint in repair request";
+        }
+
+        auto bytes(size_t length) -> const char* {
+            if (_data.size() - _offset < length) {
+                throw "Truncated repair request";
+            }
+            const char* start = _data.data() + _offset;
+            _offset += length;
+            return start;
+        }
+
+      private:
+        const std::string& _data;
+        size_t _offset = 0;
+    };
+
+    // Missing symbols as runs of consecutive ESIs
+    auto encode_runs(const std::vector<uint32_t>& esis) -> std::string {
+        std::string out;
+        std::vector<std::pair<uint32_t, uint32_t>> runs;
+        for (auto esi : esis) {
+            if (!runs.empty() && runs.back().first + runs.back().second == esi) {
+                runs.back().second++;
+            } else {
+                runs.emplace_back(esi, 1);
+            }
+        }
+        append_varint(out, runs.size());
+        uint64_t end = 0;
+        for (const auto& [start, length] : runs) {
+            append_varint(out, start - end);
+            append_varint(out, length - 1);
+            end = static_cast<uint64_t>(start) + length;
+        }
+        return out;
+    }
+
+    auto encode_bitmap(const std::vector<uint32_t>& esis) -> std::string {
+        std::string out;
+        uint32_t first = esis.front();
+        std::string bitmap((esis.back() - first) / 8 + 1, '\0');
+        for (auto esi : esis) {
+            bitmap[(esi - first) / 8] |= static_cast<char>(1 << ((esi - first) % 8));
+        }
+        append_varint(out, first);
+        append_varint(out, bitmap.size());
+        out += bitmap;
+        return out;
+    }
+}
+
+LibFlute::RepairRequest::RepairRequest(uint64_t toi, unsigned fec, const std::string& content_location)
+    : _toi(toi)
+    , _fec(fec)
+    , _content_location(content_location)
+{
+}
+
+auto LibFlute::RepairRequest::add_missing(uint32_t sbn, std::vector<uint32_t> esis) -> void
+{
+    std::sort(esis.begin(), esis.end());
+    esis.erase(std::unique(esis.begin(), esis.end()), esis.end());
+    if (esis.empty()) {
+        return;
+    }
+    auto existing = _missing.find(sbn);
+    auto needed = _needed.find(sbn);
+    size_t replaced = (existing != _missing.end() ? existing->second.size() : 0)
+                    + (needed != _needed.end() ? needed->second.count : 0);
+    if (esis.size() > max_symbols_per_block || _symbol_count - replaced + esis.size() > max_symbols) {
+        throw "Too many missing symbols in repair request";
+    }
+    _symbol_count = _symbol_count - replaced + esis.size();
+    if (needed != _needed.end()) {
+        _needed.erase(needed);
+    }
+    _missing[sbn] = std::move(esis);
+}
+
+auto LibFlute::RepairRequest::add_needed(uint32_t sbn, uint32_t count, uint32_t first_esi) -> void
+{
+    if (count == 0) {
+        return;
+    }
+    auto existing = _missing.find(sbn);
+    auto needed = _needed.find(sbn);
+    size_t replaced = (existing != _missing.end() ? existing->second.size() : 0)
+                    + (needed != _needed.end() ? needed->second.count : 0);
+    if (count > max_symbols_per_block || _symbol_count - replaced + count > max_symbols) {
+        throw "Too many missing symbols in repair request";
+    }
+    if (static_cast<uint64_t>(first_esi) + count > static_cast<uint64_t>(UINT32_MAX) + 1) {
+        throw "Invalid encoding symbol id in repair request";
+    }
+    _symbol_count = _symbol_count - replaced + count;
+    if (existing != _missing.end()) {
+        _missing.erase(existing);
+    }
+    _needed[sbn] = Needed{count, first_esi};
+}
+
+auto LibFlute::RepairRequest::remove_block(uint32_t sbn) -> void
+{
+    auto existing = _missing.find(sbn);
+    if (existing != _missing.end()) {
+        _symbol_count -= existing->second.size();
+        _missing.erase(existing);
+    }
+    auto needed = _needed.find(sbn);
+    if (needed != _needed.end()) {
+        _symbol_count -= needed->second.count;
+        _needed.erase(needed);
+    }
+}
+
+auto LibFlute::RepairRequest::parse(const char* data, size_t length) -> RepairRequest
+{
+    ZoneScopedN("RepairRequest::parse");
+    // Skip leading white space, JSON requests start with '{', which is not in the base64 alphabet
+    while (length > 0 && std::isspace(static_cast<unsigned char>(*data))) {
+        data++;
+        length--;
+    }
+    if (length == 0) {
+        throw "Empty repair request";
+    }
+    if (*data == '{') {
+        return parse_json(data, length);
+    }
+    return parse_compact(data, length);
+}
+
+auto LibFlute::RepairRequest::parse_json(const char* data, size_t length) -> RepairRequest
+{
+    std::stringstream ss;
+    ss.write(data, length);
+
+    boost::property_tree::ptree pt;
+    boost::property_tree::read_json(ss, pt);
+    return from_tree(pt);
+}
+
+auto LibFlute::RepairRequest::from_tree(const boost::property_tree::ptree& pt) -> RepairRequest
+{
+    RepairRequest request(
+        std::stoull(pt.get<std::string>("toi", "0")),
+        static_cast<unsigned>(std::stoul(pt.get<std::string>("fec", "0"))),
+        pt.get<std::string>("file", ""));
+    request._encoding = RepairResponse::requested_encoding(
+        static_cast<unsigned>(std::stoul(pt.get<std::string>("framing", "0"))), pt.get<std::string>("compression", ""));
+    auto content_encoding = pt.get<std::string>("content-encoding", "");
+    request._content_encoding = Compression::parse_encoding(content_encoding);
+    if (!content_encoding.empty() && request._content_encoding == ContentEncoding::NONE) {
+        throw "Unknown content encoding in repair request";
+    }
+
+    auto missing_pt = pt.get_child_optional("missing");
+    if (missing_pt) {
+        for (const auto& block : *missing_pt) {
+            std::vector<uint32_t> symbols;
+            for (const auto& symbol : block.second) {
+                symbols.push_back(static_cast<uint32_t>(std::stoul(symbol.second.data())));
+            }
+            request.add_missing(static_cast<uint32_t>(std::stoul(block.first)), std::move(symbols));
+        }
+    }
+
+    auto needed_pt = pt.get_child_optional("needed");
+    if (needed_pt) {
+        for (const auto& block : *needed_pt) {
+            request.add_needed(
+                static_cast<uint32_t>(std::stoul(block.first)),
+                static_cast<uint32_t>(std::stoul(block.second.get<std::string>("count", "0"))),
+                static_cast<uint32_t>(std::stoul(block.second.get<std::string>("from", "0"))));
+        }
+    }
+    return request;
+}
+
+auto LibFlute::RepairRequest::parse_batch(const char* data, size_t length) -> std::vector<RepairRequest>
+{
+    ZoneScopedN("RepairRequest::parse_batch");
+    while (length > 0 && std::isspace(static_cast<unsigned char>(*data))) {
+        data++;
+        length--;
+    }
+    if (length == 0) {
+        throw "Empty repair request";
+    }
+
+    std::vector<RepairRequest> batch;
+    size_t symbol_count = 0;
+    auto add = [&](RepairRequest request) {
+        symbol_count += request.symbol_count();
+        if (batch.size() >= max_batch_size || symbol_count > max_symbols) {
+            throw "Too many requests in repair batch";
+        }
+        batch.push_back(std::move(request));
+    };
+
+    if (*data == '[') {
+        std::stringstream ss;
+        ss.write(data, length);
+        boost::property_tree::ptree pt;
+        boost::property_tree::read_json(ss, pt);
+        for (const auto& request : pt) {
+            add(from_tree(request.second));
+        }
+    } else if (*data == '{') {
+        add(parse_json(data, length));
+    } else {
+        // Compact requests are base64, so they can not contain a line break
+        const char* end = data + length;
+        while (data < end) {
+            const char* line_end = static_cast<const char*>(std::memchr(data, '\n', end - data));
+            if (line_end == nullptr) {
+                line_end = end;
+            }
+            const char* next = line_end + (line_end < end ? 1 : 0);
+            while (line_end > data && std::isspace(static_cast<unsigned char>(line_end[-1]))) {
+                line_end--;
+            }
+            if (line_end > data) {
+                add(parse_compact(data, line_end - data));
+            }
+            data = next;
+        }
+    }
+    if (batch.empty()) {
+        throw "Empty repair request";
+    }
+    return batch;
+}
+
+auto LibFlute::RepairRequest::to_batch(const std::vector<RepairRequest>& requests) -> std::string
+{
+    std::string out;
+    for (const auto& request : requests) {
+        if (!out.empty()) {
+            out.push_back('\n');
+        }
+        out += request.to_compact();
+    }
+    return out;
+}
+
+auto LibFlute::RepairRequest::parse_compact(const char* data, size_t length) -> RepairRequest
+{
+    auto decoded = base64_decode(std::string_view(data, length));
+    Reader reader(decoded);
+
+    if (std::memcmp(reader.bytes(sizeof(magic)), magic, sizeof(magic)) != 0) {
+        throw "Invalid repair request";
+    }
+    if (reader.byte() != version) {
+        throw "Unsupported repair request version";
+    }
+    auto flags = reader.byte();
+
+    uint64_t toi = reader.varint();
+    auto fec = static_cast<unsigned>(reader.varint());
+    auto location_length = reader.varint();
+    if (location_length > max_content_location_length) {
+        throw "Content location in repair request is too long";
+    }
+    const char* location = reader.bytes(location_length);
+    RepairRequest request(toi, fec, std::string(location, location_length));
+    if (flags & flag_binary_framing) {
+        request._encoding = (flags & flag_zlib) ? RepairResponse::Encoding::BinaryZlib : RepairResponse::Encoding::Binary;
+    }
+    if (flags & flag_content_encoding) {
+        auto content_encoding = reader.byte();
+        if (content_encoding == static_cast<uint8_t>(ContentEncoding::NONE) || content_encoding > static_cast<uint8_t>(ContentEncoding::GZIP)) {
+            throw "Unknown content encoding in repair request";
+        }
+        request._content_encoding = static_cast<ContentEncoding>(content_encoding);
+    }
+
+    auto nof_blocks = reader.varint();
+    uint64_t sbn = 0;
+    for (uint64_t i = 0; i < nof_blocks; i++) {
+        auto delta = reader.varint();
+        if (delta > UINT32_MAX || (sbn += delta) > UINT32_MAX) {
+            throw "Invalid source block number in repair request";
+        }
+        std::vector<uint32_t> esis;
+        auto mode = reader.byte();
+        if (mode == mode_count) {
+            uint64_t count = reader.varint();
+            uint64_t first = reader.varint();
+            if (count > max_symbols_per_block || first > UINT32_MAX) {
+                throw "Too many missing symbols in repair request";
+            }
+            request.add_needed(static_cast<uint32_t>(sbn), static_cast<uint32_t>(count), static_cast<uint32_t>(first));
+            continue;
+        } else if (mode == mode_runs) {
+            auto nof_runs = reader.varint();
+            uint64_t end = 0;
+            for (uint64_t run = 0; run < nof_runs; run++) {
+                uint64_t gap = reader.varint();
+                uint64_t length_minus_one = reader.varint();
+                if (gap > UINT32_MAX || length_minus_one >= max_symbols_per_block - esis.size()) {
+                    throw "Too many missing symbols in repair request";
+                }
+                uint64_t start = end + gap;
+                uint64_t run_length = length_minus_one + 1;
+                if (start + run_length > static_cast<uint64_t>(UINT32_MAX) + 1) {
+                    throw "Invalid encoding symbol id in repair request";
+                }
+                for (uint64_t esi = start; esi < start + run_length; esi++) {
+                    esis.push_back(static_cast<uint32_t>(esi));
+                }
+                end = start + run_length;
+            }
+        } else if (mode == mode_bitmap) {
+            uint64_t first = reader.varint();
+            auto nof_bytes = reader.varint();
+            if (first > UINT32_MAX || nof_bytes > max_symbols_per_block / 8 || first + nof_bytes * 8 > static_cast<uint64_t>(UINT32_MAX) + 1) {
+                throw "Repair request bitmap is too large";
+            }
+            const char* bitmap = reader.bytes(nof_bytes);
+            for (uint64_t byte = 0; byte < nof_bytes; byte++) {
+                for (unsigned bit = 0; bit < 8; bit++) {
+                    if (bitmap[byte] & (1 << bit)) {
+                        esis.push_back(static_cast<uint32_t>(first + byte * 8 + bit));
+                    }
+                }
+            }
+        } else {
+            throw "Unknown block encoding in repair request";
+        }
+        request.add_missing(static_cast<uint32_t>(sbn), std::move(esis));
+    }
+    return request;
+}
+
+auto LibFlute::RepairRequest::to_json() const -> std::string
+{
+    boost::property_tree::ptree symbol_tree;
+    for (const auto& [sbn, esis] : _missing) {
+        boost::property_tree::ptree values;
+        for (const auto& esi : esis) {
+            values.push_back(std::make_pair("", boost::property_tree::ptree(std::to_string(esi))));
+        }
+        symbol_tree.add_child(std::to_string(sbn), values);
+    }
+
+    boost::property_tree::ptree tree;
+    tree.put("toi", std::to_string(_toi));
+    tree.put("file", _content_location);
+    tree.put("fec", std::to_string(_fec));
+    if (_encoding != RepairResponse::Encoding::Legacy) {
+        tree.put("framing", std::to_string(RepairResponse::version));
+        if (_encoding == RepairResponse::Encoding::BinaryZlib) {
+            tree.put("compression", "zlib");
+        }
+    }
+    if (_content_encoding != ContentEncoding::NONE) {
+        tree.put("content-encoding", Compression::encoding_name(_content_encoding));
+    }
+    tree.add_child("missing", symbol_tree);
+    if (!_needed.empty()) {
+        boost::property_tree::ptree needed_tree;
+        for (const auto& [sbn, needed] : _needed) {
+            boost::property_tree::ptree values;
+            values.put("count", std::to_string(needed.count));
+            values.put("from", std::to_string(needed.first_esi));
+            needed_tree.add_child(std::to_string(sbn), values);
+        }
+        tree.add_child("needed", needed_tree);
+    }
+
+    std::ostringstream body_stream;
+    boost::property_tree::json_parser::write_json(body_stream, tree, false);
+    return body_stream.str();
+}
+
+auto LibFlute::RepairRequest::to_compact() const -> std::string
+{
+    ZoneScopedN("RepairRequest::to_compact");
+    std::string out(magic, sizeof(magic));
+    out.push_back(static_cast<char>(version));
+    uint8_t flags = 0;
+    if (_encoding != RepairResponse::Encoding::Legacy) {
+        flags |= flag_binary_framing;
+        if (_encoding == RepairResponse::Encoding::BinaryZlib) {
+            flags |= flag_zlib;
+        }
+    }
+    if (_content_encoding != ContentEncoding::NONE) {
+        flags |= flag_content_encoding;
+    }
+    out.push_back(static_cast<char>(flags));
+
+    append_varint(out, _toi);
+    append_varint(out, _fec);
+    append_varint(out, _content_location.size());
+    out += _content_location;
+    if (_content_encoding != ContentEncoding::NONE) {
+        out.push_back(static_cast<char>(_content_encoding));
+    }
+
+    // Blocks are sent in order, a block either lists its missing symbols or says how many it needs
+    append_varint(out, _missing.size() + _needed.size());
+    uint32_t previous_sbn = 0;
+    auto needed = _needed.begin();
+    auto append_needed = [&](uint64_t until_sbn) {
+        for (; needed != _needed.end() && needed->first < until_sbn; ++needed) {
+            append_varint(out, needed->first - previous_sbn);
+            previous_sbn = needed->first;
+            out.push_back(static_cast<char>(mode_count));
+            append_varint(out, needed->second.count);
+            append_varint(out, needed->second.first_esi);
+        }
+    };
+    for (const auto& [sbn, esis] : _missing) {
+        append_needed(sbn);
+        append_varint(out, sbn - previous_sbn);
+        previous_sbn = sbn;
+
+        auto runs = encode_runs(esis);
+        // A bitmap wider than the limit would be rejected, runs are always accepted
+        bool bitmap_allowed = (esis.back() - esis.front()) / 8 + 1 <= max_symbols_per_block / 8;
+        auto bitmap = bitmap_allowed ? encode_bitmap(esis) : std::string();
+        if (bitmap_allowed && bitmap.size() < runs.size()) {
+            out.push_back(static_cast<char>(mode_bitmap));
+            out += bitmap;
+        } else {
+            out.push_back(static_cast<char>(mode_runs));
+            out += runs;
+        }
+    }
+    append_needed(static_cast<uint64_t>(UINT32_MAX) + 1);
+    return base64_encode(out);
+}
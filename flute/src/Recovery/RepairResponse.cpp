@@ -0,0 +1,254 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#include "Recovery/RepairResponse.h"
+
+#include <cstring>
+#include <arpa/inet.h>
+#include <zlib.h>
+
+#include "spdlog/spdlog.h"
+
+#include "public/tracy/Tracy.hpp"
+
+namespace {
+    constexpr char magic[4] = {'F', 'L', 'R', 'B'};
+    constexpr uint8_t flag_zlib = 0x01;
+    constexpr uint8_t flag_capabilities = LibFlute::RepairResponse::CompactRequests
+        | LibFlute::RepairResponse::SymbolCounts | LibFlute::RepairResponse::BatchRequests
+        | LibFlute::RepairResponse::ContentEncodings;
+    // Upper bound for the inflated frames, protects the receiver against corrupt or hostile headers
+    constexpr uint32_t max_frames_length = 64 * 1024 * 1024;
+
+    const char legacy_prefix[] = "ALC ";
+    const char legacy_delimiter[] = "\r\n\r\n";
+    constexpr size_t legacy_prefix_length = sizeof(legacy_prefix) - 1;
+    constexpr size_t legacy_delimiter_length = sizeof(legacy_delimiter) - 1;
+
+    auto append_u32(std::string& out, uint32_t value) -> void {
+        value = htonl(value);
+        out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    auto read_u32(const char* data) -> uint32_t {
+        uint32_t value;
+        std::memcpy(&value, data, sizeof(value));
+        return ntohl(value);
+    }
+
+    auto for_each_frame(const char* frames, size_t length, uint32_t count,
+                        const std::function<void(const char*, size_t)>& packet_cb) -> bool {
+        size_t offset = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (length - offset < LibFlute::RepairResponse::frame_header_length) {
+                return false;
+            }
+            uint32_t packet_length = read_u32(frames + offset);
+            offset += LibFlute::RepairResponse::frame_header_length;
+            if (length - offset < packet_length) {
+                return false;
+            }
+            packet_cb(frames + offset, packet_length);
+            offset += packet_length;
+        }
+        return true;
+    }
+}
+
+auto LibFlute::RepairResponse::requested_encoding(unsigned framing, const std::string& compression) -> Encoding
+{
+    if (framing < version) {
+        return Encoding::Legacy;
+    }
+    return compression == "zlib" ? Encoding::BinaryZlib : Encoding::Binary;
+}
+
+LibFlute::RepairResponse::Writer::Writer(Encoding encoding, size_t expected_bytes)
+    : _encoding(encoding)
+{
+    if (_encoding == Encoding::Legacy) {
+        _out.reserve(expected_bytes);
+        return;
+    }
+    _out.reserve(header_length + expected_bytes);
+    // The header is filled in by finish()
+    _out.resize(header_length);
+}
+
+auto LibFlute::RepairResponse::Writer::reserve(size_t max_length) -> char*
+{
+    _frame_start = _out.size();
+    size_t prefix = _encoding == Encoding::Legacy ? legacy_prefix_length : frame_header_length;
+    _out.resize(_frame_start + prefix + max_length);
+    if (_encoding == Encoding::Legacy) {
+        std::memcpy(_out.data() + _frame_start, legacy_prefix, legacy_prefix_length);
+    }
+    return _out.data() + _frame_start + prefix;
+}
+
+auto LibFlute::RepairResponse::Writer::commit(size_t length) -> void
+{
+    size_t prefix = _encoding == Encoding::Legacy ? legacy_prefix_length : frame_header_length;
+    _out.resize(_frame_start + prefix + length);
+    if (_encoding == Encoding::Legacy) {
+        _out.append(legacy_delimiter, legacy_delimiter_length);
+    } else {
+        uint32_t frame_length = htonl(static_cast<uint32_t>(length));
+        std::memcpy(_out.data() + _frame_start, &frame_length, sizeof(frame_length));
+    }
+    _count++;
+}
+
+auto LibFlute::RepairResponse::Writer::append(const char* data, size_t length) -> void
+{
+    std::memcpy(reserve(length), data, length);
+    commit(length);
+}
+
+auto LibFlute::RepairResponse::Writer::finish() -> std::string
+{
+    ZoneScopedN("RepairResponse::Writer::finish");
+    if (_encoding == Encoding::Legacy) {
+        return std::move(_out);
+    }
+
+    const char* frames = _out.data() + header_length;
+    size_t frames_length = _out.size() - header_length;
+
+    uint8_t flags = 0; // Capabilities are added by the server with announce()
+    std::string compressed;
+    if (_encoding == Encoding::BinaryZlib && frames_length > 0) {
+        uLongf compressed_length = compressBound(frames_length);
+        compressed.resize(header_length + compressed_length);
+        if (compress2(reinterpret_cast<Bytef*>(compressed.data() + header_length), &compressed_length,
+                reinterpret_cast<const Bytef*>(frames), frames_length, Z_BEST_SPEED) == Z_OK
+            && compressed_length < frames_length) {
+            compressed.resize(header_length + compressed_length);
+            flags |= flag_zlib;
+        }
+    }
+
+    std::string& out = (flags & flag_zlib) ? compressed : _out;
+    std::string header(magic, sizeof(magic));
+    header.push_back(static_cast<char>(version));
+    header.push_back(static_cast<char>(flags));
+    header.append(2, '\0');
+    append_u32(header, static_cast<uint32_t>(_count));
+    append_u32(header, static_cast<uint32_t>(frames_length));
+    std::memcpy(out.data(), header.data(), header_length);
+    return std::move(out);
+}
+
+auto LibFlute::RepairResponse::encode(const std::vector<std::shared_ptr<AlcPacket>>& packets, Encoding encoding) -> std::string
+{
+    ZoneScopedN("RepairResponse::encode");
+    size_t expected_bytes = 0;
+    for (const auto& packet : packets) {
+        expected_bytes += packet->size() + legacy_prefix_length + legacy_delimiter_length;
+    }
+
+    Writer writer(encoding, expected_bytes);
+    for (const auto& packet : packets) {
+        writer.append(packet->data(), packet->size());
+    }
+    return writer.finish();
+}
+
+auto LibFlute::RepairResponse::is_binary(const char* data, size_t length) -> bool
+{
+    return length >= header_length && std::memcmp(data, magic, sizeof(magic)) == 0;
+}
+
+auto LibFlute::RepairResponse::accepts_compact_requests(const char* data, size_t length) -> bool
+{
+    return is_binary(data, length) && (static_cast<uint8_t>(data[5]) & CompactRequests);
+}
+
+auto LibFlute::RepairResponse::accepts_symbol_counts(const char* data, size_t length) -> bool
+{
+    return is_binary(data, length) && (static_cast<uint8_t>(data[5]) & SymbolCounts);
+}
+
+auto LibFlute::RepairResponse::accepts_batch_requests(const char* data, size_t length) -> bool
+{
+    return is_binary(data, length) && (static_cast<uint8_t>(data[5]) & BatchRequests);
+}
+
+auto LibFlute::RepairResponse::accepts_content_encodings(const char* data, size_t length) -> bool
+{
+    return is_binary(data, length) && (static_cast<uint8_t>(data[5]) & ContentEncodings);
+}
+
+auto LibFlute::RepairResponse::announce(std::string& body, uint8_t capabilities) -> void
+{
+    if (is_binary(body.data(), body.size())) {
+        body[5] = static_cast<char>(static_cast<uint8_t>(body[5]) | (capabilities & flag_capabilities));
+    }
+}
+
+auto LibFlute::RepairResponse::for_each_packet(const char* data, size_t length, std::vector<char>& scratch,
+                                               const std::function<void(const char*, size_t)>& packet_cb) -> bool
+{
+    ZoneScopedN("RepairResponse::for_each_packet");
+    if (!is_binary(data, length)) {
+        // Legacy framing, split on the delimiter
+        size_t start = 0;
+        while (start < length) {
+            const char* begin = data + start;
+            const char* end = static_cast<const char*>(memmem(begin, length - start, legacy_delimiter, legacy_delimiter_length));
+            size_t part_length = end ? static_cast<size_t>(end - begin) : length - start;
+            if (part_length >= legacy_prefix_length && std::memcmp(begin, legacy_prefix, legacy_prefix_length) == 0) {
+                packet_cb(begin + legacy_prefix_length, part_length - legacy_prefix_length);
+            } else if (part_length > 0) {
+                spdlog::warn("[FETCHER] Received ALC data that does not start with 'ALC '.");
+            }
+            start += part_length + legacy_delimiter_length;
+        }
+        return true;
+    }
+
+    auto response_version = static_cast<uint8_t>(data[4]);
+    auto flags = static_cast<uint8_t>(data[5]);
+    if (response_version != version) {
+        spdlog::warn("[FETCHER] Unsupported repair response version {}", response_version);
+        return false;
+    }
+    uint32_t count = read_u32(data + 8);
+    uint32_t frames_length = read_u32(data + 12);
+    const char* frames = data + header_length;
+    size_t available = length - header_length;
+
+    if (flags & flag_zlib) {
+        if (frames_length > max_frames_length) {
+            spdlog::warn("[FETCHER] Repair response of {} bytes is too large", frames_length);
+            return false;
+        }
+        scratch.resize(frames_length);
+        uLongf inflated_length = frames_length;
+        if (uncompress(reinterpret_cast<Bytef*>(scratch.data()), &inflated_length,
+                reinterpret_cast<const Bytef*>(frames), available) != Z_OK || inflated_length != frames_length) {
+            spdlog::warn("[FETCHER] Failed to inflate repair response");
+            return false;
+        }
+        frames = scratch.data();
+        available = frames_length;
+    } else if (available < frames_length) {
+        return false;
+    } else {
+        available = frames_length;
+    }
+
+    return for_each_frame(frames, available, count, packet_cb);
+}
@@ -0,0 +1,81 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#include "Utils/AsyncFileWriter.h"
+
+#include <cstdio>
+
+#include "spdlog/spdlog.h"
+#include "Metric/Metrics.h"
+
+LibFlute::AsyncFileWriter::AsyncFileWriter(const std::string& path)
+    : _path(path)
+{
+    _thread = std::jthread([this](std::stop_token stop) { run(stop); });
+}
+
+LibFlute::AsyncFileWriter::~AsyncFileWriter()
+{
+    // The wait in run() is woken by the stop request itself, without a wakeup that could be lost
+    _thread.request_stop();
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+auto LibFlute::AsyncFileWriter::write(std::shared_ptr<const std::string> content) -> void
+{
+    {
+        std::lock_guard<LockableBase(std::mutex)> lock(_mutex);
+        if (_pending) {
+            LibFlute::Metric::Metrics::getInstance().getOrCreateCounter("file_writes_coalesced")->Increment();
+        }
+        _pending = std::move(content);
+    }
+    _cv.notify_one();
+}
+
+auto LibFlute::AsyncFileWriter::run(std::stop_token stop) -> void
+{
+    while (true) {
+        std::shared_ptr<const std::string> content;
+        {
+            std::unique_lock<LockableBase(std::mutex)> lock(_mutex);
+            _cv.wait(lock, stop, [this] { return _pending != nullptr; });
+            if (!_pending) {
+                return;
+            }
+            content = std::move(_pending);
+        }
+        write_now(*content);
+    }
+}
+
+auto LibFlute::AsyncFileWriter::write_now(const std::string& content) -> void
+{
+    ZoneScopedN("AsyncFileWriter::write_now");
+    auto temporary = _path + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (!file) {
+        spdlog::error("Failed to open {} for writing", temporary);
+        return;
+    }
+    bool written = fwrite(content.data(), 1, content.size(), file) == content.size();
+    written = fclose(file) == 0 && written;
+    if (!written || rename(temporary.c_str(), _path.c_str()) != 0) {
+        spdlog::error("Failed to write {}", _path);
+        remove(temporary.c_str());
+    }
+}
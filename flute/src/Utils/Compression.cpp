@@ -0,0 +1,167 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#include "Utils/Compression.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <zlib.h>
+
+#include "public/tracy/Tracy.hpp"
+
+namespace {
+  // Window bits that select the zlib, raw deflate or gzip format
+  auto window_bits(LibFlute::ContentEncoding encoding) -> int
+  {
+    switch (encoding) {
+      case LibFlute::ContentEncoding::ZLIB: return MAX_WBITS;
+      case LibFlute::ContentEncoding::DEFLATE: return -MAX_WBITS;
+      case LibFlute::ContentEncoding::GZIP: return MAX_WBITS + 16;
+      default: throw "Unsupported content encoding";
+    }
+  }
+
+  // Deflate all data at once, into a buffer of deflateBound bytes that is asked from allocate
+  template <typename Allocate>
+  auto deflate_all(const char* data, size_t length, LibFlute::ContentEncoding encoding, int level, Allocate allocate) -> size_t
+  {
+    z_stream stream{};
+    if (deflateInit2(&stream, level, Z_DEFLATED, window_bits(encoding), 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      throw "Failed to initialize the compressor";
+    }
+    auto bound = deflateBound(&stream, length);
+    char* out = nullptr;
+    try {
+      out = allocate(bound);
+    } catch (...) {
+      deflateEnd(&stream);
+      throw;
+    }
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+    stream.avail_in = length;
+    stream.next_out = reinterpret_cast<Bytef*>(out);
+    stream.avail_out = bound;
+    auto result = deflate(&stream, Z_FINISH);
+    size_t compressed_length = stream.total_out;
+    deflateEnd(&stream);
+    if (result != Z_STREAM_END) {
+      throw "Failed to compress";
+    }
+    return compressed_length;
+  }
+};
+
+auto LibFlute::Compression::compress(const char* data, size_t length, ContentEncoding encoding, int level) -> std::string
+{
+  ZoneScopedN("Compression::compress");
+  std::string out;
+  out.resize(deflate_all(data, length, encoding, level, [&out](size_t size) {
+    out.resize(size);
+    return out.data();
+  }));
+  return out;
+}
+
+auto LibFlute::Compression::compress_to_buffer(const char* data, size_t length, ContentEncoding encoding, int level, size_t& compressed_length) -> char*
+{
+  ZoneScopedN("Compression::compress_to_buffer");
+  char* out = nullptr;
+  try {
+    compressed_length = deflate_all(data, length, encoding, level, [&out](size_t size) {
+      out = static_cast<char*>(malloc(size));
+      if (out == nullptr) {
+        throw "Failed to allocate the compression buffer";
+      }
+      return out;
+    });
+  } catch (...) {
+    free(out);
+    throw;
+  }
+  // Give back what the bound reserved too much, this shrinks the buffer in place
+  auto shrunk = static_cast<char*>(realloc(out, std::max<size_t>(compressed_length, 1)));
+  return shrunk != nullptr ? shrunk : out;
+}
+
+auto LibFlute::Compression::decompress(const char* data, size_t length, ContentEncoding encoding, size_t max_length) -> std::string
+{
+  ZoneScopedN("Compression::decompress");
+  z_stream stream{};
+  if (inflateInit2(&stream, window_bits(encoding)) != Z_OK) {
+    throw "Failed to initialize the decompressor";
+  }
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  stream.avail_in = length;
+  std::string out;
+  auto result = Z_OK;
+  while (result == Z_OK) {
+    if (out.size() == max_length) {
+      break;
+    }
+    // Grow the output buffer as needed, most content inflates to a few times its size
+    auto offset = out.size();
+    out.resize(std::min(max_length, std::max<size_t>({offset * 2, length * 4, 1024})));
+    stream.next_out = reinterpret_cast<Bytef*>(out.data() + offset);
+    stream.avail_out = out.size() - offset;
+    result = inflate(&stream, Z_NO_FLUSH);
+    out.resize(stream.total_out);
+  }
+  inflateEnd(&stream);
+  if (result != Z_STREAM_END) {
+    throw "Failed to decompress";
+  }
+  return out;
+}
+
+auto LibFlute::Compression::decompress_to(const char* data, size_t length, ContentEncoding encoding, char* buffer, size_t buffer_length) -> void
+{
+  ZoneScopedN("Compression::decompress_to");
+  z_stream stream{};
+  if (inflateInit2(&stream, window_bits(encoding)) != Z_OK) {
+    throw "Failed to initialize the decompressor";
+  }
+  stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+  stream.avail_in = length;
+  stream.next_out = reinterpret_cast<Bytef*>(buffer);
+  stream.avail_out = buffer_length;
+  auto result = inflate(&stream, Z_FINISH);
+  size_t inflated_length = stream.total_out;
+  inflateEnd(&stream);
+  if (result != Z_STREAM_END || inflated_length != buffer_length) {
+    throw "Content does not inflate to its length";
+  }
+}
+
+auto LibFlute::Compression::encoding_name(ContentEncoding encoding) -> std::string
+{
+  switch (encoding) {
+    case ContentEncoding::ZLIB: return "zlib";
+    case ContentEncoding::DEFLATE: return "deflate";
+    case ContentEncoding::GZIP: return "gzip";
+    default: return "";
+  }
+}
+
+auto LibFlute::Compression::parse_encoding(const std::string& name) -> ContentEncoding
+{
+  if (name == "zlib") {
+    return ContentEncoding::ZLIB;
+  } else if (name == "deflate") {
+    return ContentEncoding::DEFLATE;
+  } else if (name == "gzip") {
+    return ContentEncoding::GZIP;
+  }
+  return ContentEncoding::NONE;
+}
@@ -10,7 +10,7 @@
 
 LibFlute::FakeNetworkSocket::FakeNetworkSocket(size_t sender_capacity, size_t network_capacity, size_t receiver_capacity, boost::asio::io_service& sender_io_service, boost::asio::io_service& receiver_io_service)
     : sender_to_network_buffer(sender_capacity),
-      network_buffer(network_capacity),
+      network_capacity(network_capacity),
       network_to_receiver_buffer(receiver_capacity),
       sender_io_service(sender_io_service),
       receiver_io_service(receiver_io_service),
@@ -131,26 +131,38 @@ void LibFlute::FakeNetworkSocket::move_item_from_sender_to_network() {
         }
     }
 
+    auto release_at = std::chrono::steady_clock::now();
+    std::unique_lock<LockableBase(std::mutex)> impairments_lock(impairments_mutex);
+    for (const auto& impairment : impairments) {
+        if (!impairment->process(data.size(), release_at)) {
+            spdlog::trace("[NETWORK] Dropped packet in {}", impairment->name());
+            metricsInstance.getOrCreateCounter(std::string("network_dropped_") + impairment->name())->Increment();
+            return;
+        }
+    }
+    impairments_lock.unlock();
+
     std::unique_lock<LockableBase(std::mutex)> network_lock(network_mutex);
-    if (network_buffer.full()) {
+    if (network_buffer.size() >= network_capacity) {
         spdlog::warn("[NETWORK] Network buffer is full, dropping oldest packet");
+        network_buffer.erase(network_buffer.begin());
     }
-    network_buffer.push_back(data);
+    network_buffer.emplace(release_at, std::move(data));
     network_lock.unlock();
 }
 
 void LibFlute::FakeNetworkSocket::move_item_from_network_to_receiver() {
     // Move data from network buffer to receiver buffer
     std::unique_lock<LockableBase(std::mutex)> network_lock(network_mutex);
-    if (network_buffer.empty()) {
+    if (network_buffer.empty() || network_buffer.begin()->first > std::chrono::steady_clock::now()) {
         network_lock.unlock();
         return;
     }
 
     ZoneScopedN("FakeNetworkSocket::move_item_from_network_to_receiver");
 
-    std::string data = network_buffer.front();
-    network_buffer.pop_front();
+    std::string data = std::move(network_buffer.begin()->second);
+    network_buffer.erase(network_buffer.begin());
     network_lock.unlock();
 
     std::unique_lock<LockableBase(std::mutex)> receiver_lock(network_to_receiver_mutex);
@@ -166,6 +178,16 @@ void LibFlute::FakeNetworkSocket::set_loss_rate(double loss_rate) {
     this->loss_rate.store(loss_rate);
 }
 
+void LibFlute::FakeNetworkSocket::add_impairment(std::shared_ptr<NetworkImpairment> impairment) {
+    std::lock_guard<LockableBase(std::mutex)> lock(impairments_mutex);
+    impairments.push_back(std::move(impairment));
+}
+
+void LibFlute::FakeNetworkSocket::clear_impairments() {
+    std::lock_guard<LockableBase(std::mutex)> lock(impairments_mutex);
+    impairments.clear();
+}
+
 void LibFlute::FakeNetworkSocket::start_threads() {
     ZoneScopedN("FakeNetworkSocket::start_threads");
     // Start background threads for processing
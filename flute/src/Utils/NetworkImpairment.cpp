@@ -0,0 +1,99 @@
+// libflute - FLUTE/ALC library
+//
+// Copyright (C) 2023 Casper Haems (IDLab, Ghent University, in collaboration with imec)
+//
+// Licensed under the License terms and conditions for use, reproduction, and
+// distribution of 5G-MAG software (the “License”).  You may not use this file
+// except in compliance with the License.  You may obtain a copy of the License at
+// https://www.5g-mag.com/reference-tools.  Unless required by applicable law or
+// agreed to in writing, software distributed under the License is distributed on
+// an “AS IS” BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express
+// or implied.
+//
+// See the License for the specific language governing permissions and limitations
+// under the License.
+//
+#include "Utils/NetworkImpairment.h"
+
+#include <algorithm>
+
+LibFlute::GilbertElliottLoss::GilbertElliottLoss(const Options& options)
+    : _options(options)
+    , _random(options.seed)
+{
+}
+
+auto LibFlute::GilbertElliottLoss::process(size_t /*size*/, time_point_t& /*release_at*/) -> bool
+{
+  if (_uniform(_random) < (_bad ? _options.r : _options.p)) {
+    _bad = !_bad;
+  }
+  return _uniform(_random) >= (_bad ? _options.loss_bad : _options.loss_good);
+}
+
+LibFlute::DelayImpairment::DelayImpairment(const Options& options)
+    : _options(options)
+    , _random(options.seed)
+{
+}
+
+auto LibFlute::DelayImpairment::process(size_t /*size*/, time_point_t& release_at) -> bool
+{
+  auto delay = _options.delay;
+  if (_options.jitter.count() > 0) {
+    std::uniform_int_distribution<int64_t> variation(-_options.jitter.count(), _options.jitter.count());
+    delay = std::max(std::chrono::microseconds(0), delay + std::chrono::microseconds(variation(_random)));
+  }
+  release_at += delay;
+  if (!_options.reorder) {
+    release_at = std::max(release_at, _last_release);
+  }
+  _last_release = std::max(release_at, _last_release);
+  return true;
+}
+
+LibFlute::TokenBucket::TokenBucket(const Options& options)
+    : _options(options)
+    , _tokens(options.burst)
+{
+}
+
+auto LibFlute::TokenBucket::process(size_t size, time_point_t& release_at) -> bool
+{
+  if (_options.rate == 0) {
+    return true;
+  }
+
+  // The packets that left the queue by the time this one arrives
+  while (!_departures.empty() && _departures.front() <= release_at) {
+    _departures.pop_front();
+  }
+  if (_options.queue_limit > 0 && _departures.size() >= _options.queue_limit) {
+    return false;
+  }
+
+  // Packets leave in order, a packet waits for the one before it and then for its tokens
+  double bytes_per_second = _options.rate * 1000.0 / 8.0;
+  auto start = std::max({release_at, _last_departure, _updated});
+  if (_updated != time_point_t()) {
+    auto refill = std::chrono::duration<double>(start - _updated).count() * bytes_per_second;
+    _tokens = std::min<double>(_options.burst, _tokens + refill);
+  }
+  _updated = start;
+
+  auto departure = start;
+  if (_tokens < size) {
+    departure += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+        std::chrono::duration<double>((size - _tokens) / bytes_per_second));
+    _tokens = 0;
+    _updated = departure;
+  } else {
+    _tokens -= size;
+  }
+  _last_departure = departure;
+  if (departure > release_at) {
+    _departures.push_back(departure);
+  }
+  release_at = departure;
+  return true;
+}
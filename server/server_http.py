@@ -45,6 +45,13 @@ flute_length = libflute_retriever.length # Obtain the library function
 flute_length.restype = ctypes.c_uint64 # Set the return type
 flute_length.argtypes = [ctypes.c_char_p] # Set the argument types
 
+flute_retrieve_request = libflute_retriever.retrieve_request # Obtain the library function
+flute_retrieve_request.restype = ctypes.c_size_t # Set the return type
+flute_retrieve_request.argtypes = [ctypes.c_char_p, ctypes.c_uint16, ctypes.POINTER(ctypes.POINTER(ctypes.c_char)), ctypes.POINTER(ctypes.c_uint64)] # Set the argument types
+
+flute_free_result = libflute_retriever.free_result # Obtain the library function
+flute_free_result.argtypes = [ctypes.POINTER(ctypes.c_char)] # Set the argument types
+
 # Create metrics
 requests_counter = Gauge('http_requests', 'Total number of HTTP requests', METRIC_LOG_FILE)
 files_counter = Gauge('files_sent', 'Total number of files sent', METRIC_LOG_FILE)
@@ -125,19 +132,20 @@ def fetch(filename: str):
         return None
     
 def get_missing_packages(json_string: str) -> bytes:
+    # The request (JSON or compact) is parsed once, the library allocates the result.
+    result = ctypes.POINTER(ctypes.c_char)()
+    symbol_count = ctypes.c_uint64(0)
+    length = flute_retrieve_request(ctypes.c_char_p(json_string.encode('utf-8')), ctypes.c_uint16(1500), ctypes.byref(result), ctypes.byref(symbol_count))
     # Keep track of the amount of symbols that have been fetched.
-    symbol_count = flute_symbol_count(ctypes.c_char_p(json_string.encode('utf-8')))
-    symbols_counter.inc(symbol_count)
-
-    # First we calculate a size prediction. The output is an approximation that is at least the final size.
-    buffer_size = flute_length(ctypes.c_char_p(json_string.encode('utf-8')))
-    # Create a buffer to store the result to.
-    result = ctypes.create_string_buffer(buffer_size)
-    # Fill the buffer with the requested data.
-    length = flute_retriever(ctypes.c_char_p(json_string.encode('utf-8')), ctypes.c_uint16(1500), result)
+    symbols_counter.inc(symbol_count.value)
     total_partial_bytes_uc.inc(length)
-    # Return only the part that has been filled.
-    return ctypes.string_at(result, length)
+    if not result:
+        return b''
+    try:
+        # Return only the part that has been filled.
+        return ctypes.string_at(result, length)
+    finally:
+        flute_free_result(result)
 
     
 def handle_request(headers: dict, body: str) -> bytearray: